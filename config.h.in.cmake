@@ -73,6 +73,8 @@
 
 #cmakedefine HAVE_FSYNC
 
+#cmakedefine HAVE_SYNCFS
+
 #cmakedefine HAVE_GETRLIMIT
 
 #cmakedefine HAVE_MKOSTEMPS
@@ -85,6 +87,10 @@
 
 #cmakedefine HAVE_LTTNG_UST
 
+#cmakedefine HAVE_MADVISE
+
+#cmakedefine HAVE_MEMFD_CREATE
+
 #cmakedefine HAVE_OCL_ICD
 #cmakedefine HAVE_OCL_ICD_30_COMPATIBLE
 
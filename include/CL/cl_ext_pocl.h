@@ -46,11 +46,55 @@ clSetContentSizeBufferPoCL(
     cl_mem    buffer,
     cl_mem    content_size_buffer) CL_API_SUFFIX__VERSION_1_2;
 
+/*********************************************
+* cl_pocl_profiling_counters extension       *
+**********************************************/
+
+/* Additional cl_profiling_info values for clGetEventProfilingInfo.
+ * They return the hardware counter totals (cl_ulong) of a kernel command
+ * executed with POCL_PERF_COUNTERS=1 on a CPU device, or on a profiling
+ * queue of a Vortex device. CL_PROFILING_INFO_NOT_AVAILABLE is returned
+ * if the device did not collect the counter. */
+#define CL_PROFILING_COMMAND_CYCLES_POCL               0x4F50
+#define CL_PROFILING_COMMAND_INSTRUCTIONS_POCL         0x4F51
+#define CL_PROFILING_COMMAND_CACHE_MISSES_POCL         0x4F52
+#define CL_PROFILING_COMMAND_BRANCH_MISSES_POCL        0x4F53
+#define CL_PROFILING_COMMAND_STALLS_POCL               0x4F54
+#define CL_PROFILING_COMMAND_MEM_REQUESTS_POCL         0x4F55
+
 typedef CL_API_ENTRY cl_int
 (CL_API_CALL *clSetContentSizeBufferPoCL_fn)(
     cl_mem    buffer,
     cl_mem    content_size_buffer) CL_API_SUFFIX__VERSION_1_2;
 
+/*********************************************
+* cl_pocl_memory_stats extension             *
+**********************************************/
+
+/* Additional cl_context_info values for clGetContextInfo. Each returns an
+ * array of CL_MEM_CATEGORY_COUNT_POCL cl_ulongs, indexed by the
+ * CL_MEM_CATEGORY_*_POCL values below: the bytes currently allocated, their
+ * high-water mark, and the number of allocations. The statistics are
+ * collected only when POCL_MEM_STATS or POCL_MEM_STATS_TRACE is set,
+ * otherwise they are zero. The command node, kernel module, printf and
+ * local scratch categories are shared by all contexts. */
+#define CL_CONTEXT_MEM_CURRENT_POCL                    0x4F60
+#define CL_CONTEXT_MEM_PEAK_POCL                       0x4F61
+#define CL_CONTEXT_MEM_ALLOCS_POCL                     0x4F62
+
+#define CL_MEM_CATEGORY_BUFFER_POCL                    0
+#define CL_MEM_CATEGORY_IMAGE_POCL                     1
+#define CL_MEM_CATEGORY_SVM_POCL                       2
+#define CL_MEM_CATEGORY_USM_POCL                       3
+#define CL_MEM_CATEGORY_KERNEL_ARGS_POCL               4
+#define CL_MEM_CATEGORY_EVENTS_POCL                    5
+#define CL_MEM_CATEGORY_COMMANDS_POCL                  6
+#define CL_MEM_CATEGORY_KERNEL_MODULES_POCL            7
+#define CL_MEM_CATEGORY_PRINTF_POCL                    8
+#define CL_MEM_CATEGORY_LOCAL_SCRATCH_POCL             9
+#define CL_MEM_CATEGORY_TOTAL_POCL                     10
+#define CL_MEM_CATEGORY_COUNT_POCL                     11
+
 
 #ifdef __cplusplus
 }
@@ -158,6 +158,23 @@ typedef struct
   int force_generic_wg_func;
   /* If set to 1, disallow "small grid" WG function specialization. */
   int force_large_grid_wg_func;
+  /* Hash of the values of the arguments selected with
+     -pocl-specialize-args, which the specialized WG function has folded
+     in. Zero if the values are not specialized for this launch. */
+  uint64_t spec_args_hash;
+  /* The folded values themselves, concatenated in the argument order, and
+     their total size. Owned by the kernel metadata. The caches compare
+     them on hash matches. */
+  const unsigned char *spec_args;
+  size_t spec_args_size;
+  /* If set to 1, the buffer arguments do not overlap each other and are
+     aligned to the mem_base_addr_align of the device, which allows a
+     specialized WG function with noalias and alignment facts. */
+  int noalias_args;
+  /* The WG function cache item the launch holds a reference of, from
+     pocl_check_kernel_dlhandle_cache () to pocl_release_dlhandle_cache ().
+     Device specific. */
+  void *dlhandle_cache_item;
 } _cl_command_run;
 
 // clEnqueueCommandBufferKHR
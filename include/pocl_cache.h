@@ -68,6 +68,15 @@ int pocl_cache_write_generic_objfile (char *objfile_path,
                                       const char *objfile_content,
                                       uint64_t objfile_size);
 
+/* Takes the cross-process build lease of the cache artifact at path.
+   Returns 1 if the caller should build the artifact, and then release the
+   lease with pocl_cache_release_build_lease(), or 0 if another process
+   built it meanwhile. Returns 1 without a lease (-1 in lease_fd) when the
+   lease is disabled, unsupported, or the wait times out. */
+int pocl_cache_acquire_build_lease (const char *path, int *lease_fd);
+
+void pocl_cache_release_build_lease (const char *path, int lease_fd);
+
 int pocl_cache_update_program_last_access(cl_program program,
                                           unsigned device_i);
 
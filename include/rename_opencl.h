@@ -152,4 +152,8 @@
 #define clCommandFillBufferKHR POclCommandFillBufferKHR
 #define clCommandFillImageKHR POclCommandFillImageKHR
 
+/* cl_khr_command_buffer_mutable_dispatch */
+#define clUpdateMutableCommandsKHR POclUpdateMutableCommandsKHR
+#define clGetMutableCommandInfoKHR POclGetMutableCommandInfoKHR
+
 #endif
@@ -25,6 +25,7 @@
 #include "pocl_cache.h"
 #include "pocl_cl.h"
 #include "pocl_file_util.h"
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
 
 extern unsigned long kernel_c;
@@ -140,6 +141,15 @@ POname (clCloneKernel) (cl_kernel source_kernel,
   POCL_UNLOCK_OBJ (program);
 
   POCL_ATOMIC_INC (kernel_c);
+  if (kernel->dyn_argument_storage != NULL)
+    POCL_MEM_STATS_ALLOC (kernel->context, POCL_MEM_KERNEL_ARGS,
+                          kernel->meta->num_args
+                                  * sizeof (struct pocl_argument)
+                              + kernel->meta->total_argument_storage_size);
+  else
+    POCL_MEM_STATS_ALLOC (kernel->context, POCL_MEM_KERNEL_ARGS,
+                          pocl_mem_stats_args_size (kernel->meta->num_args,
+                                                    kernel->dyn_arguments));
 
   errcode = CL_SUCCESS;
   goto SUCCESS;
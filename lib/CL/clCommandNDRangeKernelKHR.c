@@ -25,6 +25,67 @@
 #include "pocl_mem_management.h"
 #include "pocl_shared.h"
 #include "pocl_util.h"
+#include "utlist.h"
+
+/* Creates the handle returned for a command recorded with a
+   mutable_handle, after checking the properties of the command. */
+static cl_int
+create_mutable_handle (
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_ndrange_kernel_command_properties_khr *properties,
+    const size_t *local_work_size, cl_mutable_command_khr *mutable_handle)
+{
+  cl_mutable_dispatch_fields_khr fields = POCL_MUTABLE_DISPATCH_FIELDS;
+  cl_uint num_properties = 0;
+
+  POCL_RETURN_ERROR_ON (
+      (strstr (command_queue->device->extensions,
+               "cl_khr_command_buffer_mutable_dispatch")
+       == NULL),
+      CL_INVALID_VALUE,
+      "The device does not support cl_khr_command_buffer_mutable_dispatch\n");
+
+  if (properties != NULL)
+    {
+      const cl_ndrange_kernel_command_properties_khr *key;
+      for (key = properties; *key != 0; key += 2, ++num_properties)
+        {
+          POCL_RETURN_ERROR_ON (
+              (*key != CL_MUTABLE_DISPATCH_UPDATABLE_FIELDS_KHR),
+              CL_INVALID_VALUE, "Unknown NDRange command property %#lx\n",
+              (unsigned long)*key);
+          POCL_RETURN_ERROR_ON ((key[1] & ~POCL_MUTABLE_DISPATCH_FIELDS),
+                                CL_INVALID_VALUE,
+                                "Unsupported mutable dispatch fields\n");
+          fields = key[1];
+        }
+    }
+
+  cl_mutable_command_khr handle
+      = (cl_mutable_command_khr)calloc (1, sizeof (*handle));
+  POCL_RETURN_ERROR_COND ((handle == NULL), CL_OUT_OF_HOST_MEMORY);
+  if (num_properties > 0)
+    {
+      size_t size = (2 * num_properties + 1)
+                    * sizeof (cl_ndrange_kernel_command_properties_khr);
+      handle->properties
+          = (cl_ndrange_kernel_command_properties_khr *)malloc (size);
+      if (handle->properties == NULL)
+        {
+          POCL_MEM_FREE (handle);
+          return CL_OUT_OF_HOST_MEMORY;
+        }
+      memcpy (handle->properties, properties, size);
+    }
+  handle->num_properties = num_properties;
+  handle->command_buffer = command_buffer;
+  handle->command_queue = command_queue;
+  handle->updatable_fields = fields;
+  handle->auto_local_size = (local_work_size == NULL);
+
+  *mutable_handle = handle;
+  return CL_SUCCESS;
+}
 
 CL_API_ENTRY cl_int
 POname (clCommandNDRangeKernelKHR) (
@@ -39,14 +100,28 @@ POname (clCommandNDRangeKernelKHR) (
 {
   cl_int errcode = CL_SUCCESS;
   _cl_command_node *cmd = NULL;
+  cl_mutable_command_khr handle = NULL;
+
+  CMDBUF_VALIDATE_HANDLES;
 
-  CMDBUF_VALIDATE_COMMON_HANDLES;
+  if (mutable_handle != NULL)
+    {
+      errcode = create_mutable_handle (command_buffer, command_queue,
+                                       properties, local_work_size, &handle);
+      if (errcode != CL_SUCCESS)
+        return errcode;
+    }
 
   errcode = pocl_ndrange_kernel_common (
       command_buffer, command_queue, properties, kernel, work_dim,
       global_work_offset, global_work_size, local_work_size,
       num_sync_points_in_wait_list, NULL, NULL, sync_point_wait_list,
       sync_point, &cmd);
+  if (errcode != CL_SUCCESS)
+    {
+      cmd = NULL;
+      goto ERROR;
+    }
 
   for (unsigned i = 0; i < kernel->meta->num_args; ++i)
     {
@@ -61,9 +136,23 @@ POname (clCommandNDRangeKernelKHR) (
   if (errcode != CL_SUCCESS)
     goto ERROR;
 
+  if (handle != NULL)
+    {
+      handle->node = cmd;
+      POCL_LOCK (command_buffer->mutex);
+      LL_APPEND (command_buffer->mutable_cmds, handle);
+      POCL_UNLOCK (command_buffer->mutex);
+      *mutable_handle = handle;
+    }
+
   return CL_SUCCESS;
 
 ERROR:
+  if (handle != NULL)
+    {
+      POCL_MEM_FREE (handle->properties);
+      POCL_MEM_FREE (handle);
+    }
   pocl_mem_manager_free_command (cmd);
   return errcode;
 }
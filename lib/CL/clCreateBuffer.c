@@ -25,6 +25,7 @@
 #include "common.h"
 #include "devices.h"
 #include "pocl_cl.h"
+#include "pocl_mem_stats.h"
 #include "pocl_shared.h"
 #include "pocl_util.h"
 
@@ -189,6 +190,9 @@ pocl_create_memobject (cl_context context, cl_mem_flags flags, size_t size,
       mem->latest_version = 1;
     }
 
+  POCL_MEM_STATS_ALLOC (context,
+                        mem->is_image ? POCL_MEM_IMAGE : POCL_MEM_BUFFER,
+                        mem->size);
   goto SUCCESS;
 
 ERROR:
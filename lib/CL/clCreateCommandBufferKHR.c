@@ -82,14 +82,25 @@ POname (clCreateCommandBufferKHR) (
           switch (*key)
             {
             case CL_COMMAND_BUFFER_FLAGS_KHR:
-              /* For now only CL_COMMAND_BUFFER_SIMULTANEOUS_USE_KHR is a known
-               * allowed value */
               POCL_GOTO_ERROR_COND (
-                  ((*val & ~(CL_COMMAND_BUFFER_SIMULTANEOUS_USE_KHR)) != 0),
+                  ((*val
+                    & ~(CL_COMMAND_BUFFER_SIMULTANEOUS_USE_KHR
+                        | CL_COMMAND_BUFFER_MUTABLE_KHR))
+                   != 0),
                   CL_INVALID_VALUE);
               /* If any of the devices associated with 'queues' does not
                * support a requested capability, error out with
                * CL_INVALID_PROPERTY */
+              if (*val & CL_COMMAND_BUFFER_MUTABLE_KHR)
+                for (unsigned j = 0; j < num_queues; ++j)
+                  POCL_GOTO_ERROR_ON (
+                      (strstr (queues[j]->device->extensions,
+                               "cl_khr_command_buffer_mutable_dispatch")
+                       == NULL),
+                      CL_INVALID_PROPERTY,
+                      "Device %s does not support mutable command "
+                      "buffers\n",
+                      queues[j]->device->long_name);
               break;
             default:
               errcode = CL_INVALID_VALUE;
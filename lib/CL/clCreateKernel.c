@@ -34,6 +34,8 @@
 #include "pocl_file_util.h"
 #include "pocl_cache.h"
 #include "pocl_binary.h"
+#include "pocl_mem_stats.h"
+#include "pocl_shared.h"
 #include "pocl_util.h"
 
 extern unsigned long kernel_c;
@@ -51,6 +53,8 @@ POname(clCreateKernel)(cl_program program,
 
   POCL_GOTO_ERROR_COND ((!IS_CL_OBJECT_VALID (program)), CL_INVALID_PROGRAM);
 
+  pocl_wait_for_program_build (program);
+
   POCL_GOTO_ERROR_ON((program->build_status == CL_BUILD_NONE),
     CL_INVALID_PROGRAM_EXECUTABLE, "You must call clBuildProgram first!"
       " (even for programs created with binaries)\n");
@@ -110,6 +114,12 @@ POname(clCreateKernel)(cl_program program,
   for (i = 0; i < program->num_devices; ++i)
     {
       cl_device_id device = program->devices[i];
+      errcode = pocl_binary_deserialize_kernel (
+          program, i, (unsigned)(kernel->meta - program->kernel_meta));
+      POCL_GOTO_ERROR_ON ((errcode != CL_SUCCESS), CL_INVALID_PROGRAM,
+                          "could not unpack kernel %s from the pocl "
+                          "binary\n",
+                          kernel->name);
       if (device->ops->create_kernel)
         {
           int r = device->ops->create_kernel (device, program, kernel, i);
@@ -128,6 +138,9 @@ POname(clCreateKernel)(cl_program program,
   POCL_UNLOCK_OBJ (program);
 
   POCL_ATOMIC_INC (kernel_c);
+  POCL_MEM_STATS_ALLOC (kernel->context, POCL_MEM_KERNEL_ARGS,
+                        kernel->meta->num_args * sizeof (struct pocl_argument)
+                            + kernel->meta->total_argument_storage_size);
 
   errcode = CL_SUCCESS;
 
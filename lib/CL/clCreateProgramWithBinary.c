@@ -103,7 +103,7 @@ create_program_skeleton (cl_context context, cl_uint num_devices,
       goto ERROR;
     }
   
-  POCL_INIT_OBJECT(program);
+  pocl_init_program_object (program);
 
   if ((program->binary_sizes = (size_t *)calloc (num_devices, sizeof (size_t)))
           == NULL
@@ -142,8 +142,6 @@ create_program_skeleton (cl_context context, cl_uint num_devices,
   program->associated_devices = unique_devlist;
   program->num_devices = num_devices;
   program->devices = unique_devlist;
-  program->build_status = CL_BUILD_NONE;
-  program->binary_type = CL_PROGRAM_BINARY_TYPE_NONE;
 
   TP_CREATE_PROGRAM (context->id, program->id);
 
@@ -23,6 +23,7 @@
 */
 
 #include "pocl_cl.h"
+#include "pocl_shared.h"
 #include "pocl_util.h"
 #include <string.h>
 
@@ -52,7 +53,7 @@ POname(clCreateProgramWithSource)(cl_context context,
     goto ERROR;
   }
 
-  POCL_INIT_OBJECT(program);
+  pocl_init_program_object (program);
 
   for (i = 0; i < count; ++i)
     {
@@ -103,8 +104,6 @@ POname(clCreateProgramWithSource)(cl_context context,
   program->num_devices = 0;
   program->devices = 0;
 
-  program->build_status = CL_BUILD_NONE;
-  program->binary_type = CL_PROGRAM_BINARY_TYPE_NONE;
 
   if ((program->binary_sizes
        = (size_t *)calloc (program->associated_num_devices, sizeof (size_t)))
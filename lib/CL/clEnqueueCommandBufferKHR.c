@@ -41,18 +41,6 @@ buffer_finished_callback (cl_event event, cl_int event_command_status,
   POname (clReleaseCommandBufferKHR) (command_buffer);
 }
 
-static cl_command_buffer_properties_khr
-get_cmdbuf_property (cl_command_buffer_khr command_buffer,
-              cl_command_buffer_properties_khr name)
-{
-  for (unsigned i = 0; i < command_buffer->num_properties; ++i)
-    {
-      if (command_buffer->properties[2 * i] == name)
-        return command_buffer->properties[2 * i + 1];
-    }
-  return 0;
-}
-
 CL_API_ENTRY cl_int
 POname (clEnqueueCommandBufferKHR) (cl_uint num_queues,
                                     cl_command_queue *queues,
@@ -128,7 +116,7 @@ POname (clEnqueueCommandBufferKHR) (cl_uint num_queues,
     return errcode;
 
   cl_command_buffer_flags_khr flags
-      = (cl_command_buffer_flags_khr)get_cmdbuf_property (
+      = (cl_command_buffer_flags_khr)pocl_cmdbuf_get_property (
           command_buffer, CL_COMMAND_BUFFER_FLAGS_KHR);
   POCL_LOCK (command_buffer->mutex);
   int is_ready
@@ -158,7 +146,23 @@ POname (clEnqueueCommandBufferKHR) (cl_uint num_queues,
       cl_event syncpoints[command_buffer->num_syncpoints];
       cl_event *deps = (cl_event *)alloca (
           sizeof (event)
-          * (command_buffer->num_syncpoints + num_events_in_wait_list));
+          * (command_buffer->num_syncpoints + num_events_in_wait_list + 1));
+
+      /* The commands are not chained after each other, so the ones that
+       * wait for no other command wait for the previous command of the
+       * queue instead. */
+      int unchained = command_buffer->explicit_order
+                      && !(q->properties
+                           & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+      cl_event prev_event = NULL;
+      if (unchained)
+        {
+          POCL_LOCK_OBJ (q);
+          prev_event = q->last_event.event;
+          if (prev_event != NULL)
+            POname (clRetainEvent) (prev_event);
+          POCL_UNLOCK_OBJ (q);
+        }
 
       unsigned sync_id = 0;
       LL_FOREACH (command_buffer->cmds, cmd)
@@ -178,40 +182,81 @@ POname (clEnqueueCommandBufferKHR) (cl_uint num_queues,
           {
             deps[j] = event_wait_list[k];
           }
+        if (prev_event != NULL
+            && cmd->sync.syncpoint.num_sync_points_in_wait_list == 0)
+          deps[j++] = prev_event;
 
         _cl_command_node *node = NULL;
-        char readonly_flag_list[cmd->memobj_count];
-        memcpy(readonly_flag_list, cmd->readonly_flag_list, cmd->memobj_count);
-        cl_mem memobj_list[cmd->memobj_count];
-        memcpy(memobj_list, cmd->memobj_list, sizeof(cl_mem) * cmd->memobj_count);
-        errcode = pocl_create_command (
-            &node, q, cmd->type, &syncpoints[sync_id], j, deps,
-            cmd->memobj_count, memobj_list, readonly_flag_list);
+        _cl_command_t command;
+        /* clUpdateMutableCommandsKHR can change the launch state of an
+           NDRange command concurrently, so take a snapshot of it. The
+           buffers of the snapshot are retained before the unlock, as the
+           update releases the ones it replaces. */
+        POCL_LOCK (command_buffer->mutex);
+        cl_uint memobj_count = cmd->memobj_count;
+        /* a kernel without buffer arguments has no memobjs */
+        char readonly_flag_list[memobj_count > 0 ? memobj_count : 1];
+        cl_mem memobj_list[memobj_count > 0 ? memobj_count : 1];
+        /* pocl_create_command () sorts memobj_list in place */
+        cl_mem retained_list[memobj_count > 0 ? memobj_count : 1];
+        if (memobj_count > 0)
+          {
+            memcpy (readonly_flag_list, cmd->readonly_flag_list,
+                    memobj_count);
+            memcpy (memobj_list, cmd->memobj_list,
+                    sizeof (cl_mem) * memobj_count);
+            memcpy (retained_list, cmd->memobj_list,
+                    sizeof (cl_mem) * memobj_count);
+          }
+        for (k = 0; k < memobj_count; ++k)
+          POname (clRetainMemObject) (retained_list[k]);
+        memcpy (&command, &cmd->command, sizeof (_cl_command_t));
+        int args_copied = 0;
+        if (cmd->type == CL_COMMAND_NDRANGE_KERNEL)
+          {
+            /* the recorded arguments, not the ones currently set to the
+               kernel */
+            errcode = pocl_kernel_copy_args_from (command.run.kernel,
+                                                  cmd->command.run.arguments,
+                                                  &command.run);
+            if (errcode == CL_SUCCESS)
+              {
+                POname (clRetainKernel) (command.run.kernel);
+                args_copied = 1;
+              }
+          }
+        POCL_UNLOCK (command_buffer->mutex);
+
+        if (errcode == CL_SUCCESS)
+          errcode = pocl_create_command (
+              &node, q, cmd->type, &syncpoints[sync_id], j, deps,
+              memobj_count, memobj_list, readonly_flag_list);
         ++sync_id;
+        /* the event of the command holds its own references */
+        for (k = 0; k < memobj_count; ++k)
+          POname (clReleaseMemObject) (retained_list[k]);
 
         if (errcode != CL_SUCCESS)
           {
             POCL_MSG_ERR ("Failed to instantiate recorded command: %i\n",
                           errcode);
+            if (args_copied)
+              {
+                _cl_command_node copy;
+                copy.command.run = command.run;
+                pocl_ndrange_node_cleanup (&copy);
+              }
             pocl_mem_manager_free_command (node);
+            if (prev_event != NULL)
+              POname (clReleaseEvent) (prev_event);
             return errcode;
           }
 
-        memcpy (&node->command, &cmd->command, sizeof (_cl_command_t));
+        memcpy (&node->command, &command, sizeof (_cl_command_t));
 
         // Copy variables that are freed when the command finishes
         switch (cmd->type)
           {
-          case CL_COMMAND_NDRANGE_KERNEL:
-            POname (clRetainKernel) (node->command.run.kernel);
-            errcode = pocl_kernel_copy_args (node->command.run.kernel,
-                                             &node->command.run);
-            if (errcode != CL_SUCCESS)
-              {
-                errcode = CL_OUT_OF_HOST_MEMORY;
-                break;
-              }
-            break;
           case CL_COMMAND_FILL_BUFFER:
             node->command.memfill.pattern
                 = pocl_aligned_malloc (cmd->command.memfill.pattern_size,
@@ -234,11 +279,18 @@ POname (clEnqueueCommandBufferKHR) (cl_uint num_queues,
           {
             POCL_MSG_ERR ("Failed to allocate temporary command parameters\n");
             pocl_mem_manager_free_command (node);
+            if (prev_event != NULL)
+              POname (clReleaseEvent) (prev_event);
             return errcode;
           }
 
-        pocl_command_enqueue (q, node);
+        if (unchained)
+          pocl_command_enqueue_unchained (q, node);
+        else
+          pocl_command_enqueue (q, node);
       }
+      if (prev_event != NULL)
+        POname (clReleaseEvent) (prev_event);
 
       /* We need an event for the completion of the command buffer as a whole.
        * TODO: grab start timestamp before submitting any of the constituent
@@ -24,6 +24,7 @@
 #include <CL/cl_ext.h>
 
 #include "pocl_cl.h"
+#include "pocl_util.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname (clFinalizeCommandBufferKHR) (cl_command_buffer_khr command_buffer)
@@ -42,7 +43,9 @@ POname (clFinalizeCommandBufferKHR) (cl_command_buffer_khr command_buffer)
   if (command_buffer->state == CL_COMMAND_BUFFER_STATE_EXECUTABLE_KHR)
     return CL_SUCCESS;
 
-  /* TODO: perform task graph optimizations here */
+  errcode_ret = pocl_cmdbuf_optimize_graph (command_buffer);
+  if (errcode_ret != CL_SUCCESS)
+    return errcode_ret;
 
   /* Command buffers API is per queue but internal handling is per device */
   cl_device_id *finalized_devs
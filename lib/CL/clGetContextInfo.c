@@ -22,6 +22,8 @@
 */
 
 #include <assert.h>
+#include <CL/cl_ext_pocl.h>
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
 
 
@@ -59,6 +61,17 @@ POname(clGetContextInfo)(cl_context context,
         *param_value_size_ret = 0;
         return CL_SUCCESS;
       }
+  case CL_CONTEXT_MEM_CURRENT_POCL:
+  case CL_CONTEXT_MEM_PEAK_POCL:
+  case CL_CONTEXT_MEM_ALLOCS_POCL:
+    {
+      cl_ulong stats[POCL_MEM_CATEGORY_COUNT];
+      pocl_mem_stats_get (
+          context, (param_name == CL_CONTEXT_MEM_CURRENT_POCL) ? stats : NULL,
+          (param_name == CL_CONTEXT_MEM_PEAK_POCL) ? stats : NULL,
+          (param_name == CL_CONTEXT_MEM_ALLOCS_POCL) ? stats : NULL);
+      POCL_RETURN_GETINFO_ARRAY (cl_ulong, POCL_MEM_CATEGORY_COUNT, stats);
+    }
   default:
     return CL_INVALID_VALUE;
   }
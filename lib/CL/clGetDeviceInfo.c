@@ -383,6 +383,14 @@ POname(clGetDeviceInfo)(cl_device_id   device,
 
   case CL_DEVICE_COMMAND_BUFFER_REQUIRED_QUEUE_PROPERTIES_KHR:
     POCL_RETURN_GETINFO (cl_command_queue_properties, 0);
+
+  /** cl_khr_command_buffer_mutable_dispatch queries **/
+  case CL_DEVICE_MUTABLE_DISPATCH_CAPABILITIES_KHR:
+    if (strstr (device->extensions, "cl_khr_command_buffer_mutable_dispatch")
+        == NULL)
+      return CL_INVALID_VALUE;
+    POCL_RETURN_GETINFO (cl_mutable_dispatch_fields_khr,
+                         POCL_MUTABLE_DISPATCH_FIELDS);
   }
 
   if(device->ops->get_device_info_ext != NULL) {
@@ -22,6 +22,7 @@
 */
 
 #include "pocl_cl.h"
+#include <CL/cl_ext_pocl.h>
 #include <string.h>
 
 CL_API_ENTRY cl_int CL_API_CALL
@@ -66,6 +67,21 @@ POname(clGetEventProfilingInfo)(cl_event event,
       /* Child commands not supported */
       *(cl_ulong *)param_value = event->time_end;
       break;
+    case CL_PROFILING_COMMAND_CYCLES_POCL:
+    case CL_PROFILING_COMMAND_INSTRUCTIONS_POCL:
+    case CL_PROFILING_COMMAND_CACHE_MISSES_POCL:
+    case CL_PROFILING_COMMAND_BRANCH_MISSES_POCL:
+    case CL_PROFILING_COMMAND_STALLS_POCL:
+    case CL_PROFILING_COMMAND_MEM_REQUESTS_POCL:
+      {
+        unsigned i = param_name - CL_PROFILING_COMMAND_CYCLES_POCL;
+        POCL_RETURN_ERROR_ON (((event->hw_counter_mask & (1U << i)) == 0),
+                              CL_PROFILING_INFO_NOT_AVAILABLE,
+                              "The hardware counter was not collected for "
+                              "this command\n");
+        *(cl_ulong *)param_value = event->hw_counters[i];
+        break;
+      }
     default:
       return CL_INVALID_VALUE;
     }
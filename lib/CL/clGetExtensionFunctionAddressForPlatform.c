@@ -113,6 +113,13 @@ CL_API_SUFFIX__VERSION_1_2
     return (void *)&POname (clGetCommandBufferInfoKHR);
   /* end of cl_khr_command_buffer */
 
+  /* cl_khr_command_buffer_mutable_dispatch */
+  if (strcmp (func_name, "clUpdateMutableCommandsKHR") == 0)
+    return (void *)&POname (clUpdateMutableCommandsKHR);
+
+  if (strcmp (func_name, "clGetMutableCommandInfoKHR") == 0)
+    return (void *)&POname (clGetMutableCommandInfoKHR);
+
   /* cl_intel_unified_shared_memory */
   if (strcmp (func_name, "clHostMemAllocINTEL") == 0)
     return (void *)&POname (clHostMemAllocINTEL);
@@ -64,7 +64,8 @@ CL_API_ENTRY cl_int CL_API_ENTRY POname (clGetKernelSubGroupInfo) (
   POCL_RETURN_ERROR_ON ((dev_i == CL_UINT_MAX), CL_INVALID_KERNEL,
                         "the kernel was not built for this device\n");
 
-  if (param_name == CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE)
+  if (param_name == CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE
+      || param_name == CL_KERNEL_SUB_GROUP_COUNT_FOR_NDRANGE)
     {
       POCL_RETURN_ERROR_ON ((input_value == NULL
                              || input_value_size < sizeof (size_t)
@@ -84,48 +85,63 @@ CL_API_ENTRY cl_int CL_API_ENTRY POname (clGetKernelSubGroupInfo) (
     /* TODO: this should be a device ops callback */
     case CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE:
       {
-        /* For now assume SG == WG_x. */
-        POCL_RETURN_GETINFO (size_t, ((size_t *)input_value)[0]);
+        POCL_RETURN_GETINFO (
+            size_t, pocl_kernel_sub_group_size (device, kernel->meta,
+                                                ((size_t *)input_value)[0]));
       }
     case CL_KERNEL_SUB_GROUP_COUNT_FOR_NDRANGE:
       {
-        /* For now assume SG == WG_x and thus we have WG_size_y*WG_size_z of
-           them per WG. */
-        POCL_RETURN_GETINFO (size_t,
-                             min (device->max_num_sub_groups,
-                                  (input_value_size > sizeof (size_t)
-                                       ? ((size_t *)input_value)[1]
-                                       : 1)
-                                      * (input_value_size > sizeof (size_t) * 2
-                                             ? ((size_t *)input_value)[2]
-                                             : 1)));
+        size_t local[3] = { 1, 1, 1 };
+        for (unsigned i = 0; i < input_value_size / sizeof (size_t) && i < 3;
+             ++i)
+          local[i] = ((size_t *)input_value)[i];
+        size_t sg_size
+            = pocl_kernel_sub_group_size (device, kernel->meta, local[0]);
+        if (sg_size == 0)
+          POCL_RETURN_GETINFO (size_t, 0);
+        /* The sub-groups tile the x dimension, the last one of a row can be
+           partial. */
+        POCL_RETURN_GETINFO (size_t, (local[0] + sg_size - 1) / sg_size
+                                         * local[1] * local[2]);
       }
     case CL_KERNEL_LOCAL_SIZE_FOR_SUB_GROUP_COUNT:
       {
         POCL_RETURN_ERROR_ON ((input_value == NULL), CL_INVALID_VALUE,
                               "SG size wish not given.");
         size_t n_wish = *(size_t *)input_value;
-        /* For now assume SG == WG_x and the simplest way of looping only at
-           y dimension. Use magic number 32 as the preferred SG size for now.
-         */
-        size_t nd[3];
-        if (n_wish > device->max_num_sub_groups ||
-            (n_wish > 1 && param_value_size / sizeof(size_t) == 1))
+        size_t dims = min (param_value_size / sizeof (size_t), 3);
+        size_t sg_size = pocl_kernel_sub_group_size (device, kernel->meta, 0);
+        size_t nd[3] = { 0, 0, 0 };
+        if (n_wish == 0 || n_wish > device->max_num_sub_groups)
+          POCL_RETURN_GETINFO_ARRAY (size_t, dims, nd);
+
+        if (sg_size == 0)
           {
-            nd[0] = nd[1] = nd[2] = 0;
-            POCL_RETURN_GETINFO_ARRAY (size_t,
-                                       param_value_size / sizeof(size_t),
-                                       nd);
+            /* SG == WG_x, loop the sub-groups in the y dimension. */
+            if (n_wish == 1 || dims > 1)
+              {
+                nd[0] = device->max_work_group_size / n_wish;
+                nd[1] = n_wish;
+                nd[2] = 1;
+              }
           }
-        else
+        else if (sg_size * n_wish <= device->max_work_group_size)
           {
-            nd[0] = device->max_work_group_size / n_wish;
-            nd[1] = n_wish;
-            nd[2] = 1;
-            POCL_RETURN_GETINFO_ARRAY (size_t,
-                                       param_value_size / sizeof(size_t),
-                                       nd);
+            /* Fixed size sub-groups, in a row if they fit the x dimension,
+               else one per row. */
+            if (sg_size * n_wish <= device->max_work_item_sizes[0])
+              {
+                nd[0] = sg_size * n_wish;
+                nd[1] = nd[2] = 1;
+              }
+            else if (dims > 1 && n_wish <= device->max_work_item_sizes[1])
+              {
+                nd[0] = sg_size;
+                nd[1] = n_wish;
+                nd[2] = 1;
+              }
           }
+        POCL_RETURN_GETINFO_ARRAY (size_t, dims, nd);
       }
 
     /************ these are NOT dependent on NDRANGE ***********************/
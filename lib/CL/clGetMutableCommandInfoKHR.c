@@ -0,0 +1,83 @@
+/* OpenCL runtime library: clGetMutableCommandInfoKHR()
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#include <CL/cl_ext.h>
+
+#include "pocl_cl.h"
+#include "pocl_util.h"
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname (clGetMutableCommandInfoKHR) (cl_mutable_command_khr command,
+                                     cl_mutable_command_info_khr param_name,
+                                     size_t param_value_size,
+                                     void *param_value,
+                                     size_t *param_value_size_ret)
+    CL_API_SUFFIX__VERSION_1_2
+{
+  POCL_RETURN_ERROR_COND ((command == NULL), CL_INVALID_MUTABLE_COMMAND_KHR);
+
+  cl_command_buffer_khr command_buffer = command->command_buffer;
+  _cl_command_run *run = &command->node->command.run;
+  size_t global_work_offset[3], global_work_size[3], local_work_size[3];
+  cl_uint work_dim;
+  unsigned i;
+
+  /* the launch state can be updated concurrently */
+  POCL_LOCK (command_buffer->mutex);
+  work_dim = run->pc.work_dim;
+  for (i = 0; i < 3; ++i)
+    {
+      global_work_offset[i] = run->pc.global_offset[i];
+      local_work_size[i] = run->pc.local_size[i];
+      global_work_size[i] = run->pc.num_groups[i] * run->pc.local_size[i];
+    }
+  POCL_UNLOCK (command_buffer->mutex);
+
+  switch (param_name)
+    {
+    case CL_MUTABLE_COMMAND_COMMAND_QUEUE_KHR:
+      POCL_RETURN_GETINFO (cl_command_queue, command->command_queue);
+    case CL_MUTABLE_COMMAND_COMMAND_BUFFER_KHR:
+      POCL_RETURN_GETINFO (cl_command_buffer_khr, command_buffer);
+    case CL_MUTABLE_COMMAND_COMMAND_TYPE_KHR:
+      POCL_RETURN_GETINFO (cl_command_type, CL_COMMAND_NDRANGE_KERNEL);
+    case CL_MUTABLE_DISPATCH_PROPERTIES_ARRAY_KHR:
+      POCL_RETURN_GETINFO_ARRAY (
+          cl_ndrange_kernel_command_properties_khr,
+          command->num_properties ? 2 * command->num_properties + 1 : 0,
+          command->properties);
+    case CL_MUTABLE_DISPATCH_KERNEL_KHR:
+      POCL_RETURN_GETINFO (cl_kernel, run->kernel);
+    case CL_MUTABLE_DISPATCH_DIMENSIONS_KHR:
+      POCL_RETURN_GETINFO (cl_uint, work_dim);
+    case CL_MUTABLE_DISPATCH_GLOBAL_WORK_OFFSET_KHR:
+      POCL_RETURN_GETINFO_ARRAY (size_t, work_dim, global_work_offset);
+    case CL_MUTABLE_DISPATCH_GLOBAL_WORK_SIZE_KHR:
+      POCL_RETURN_GETINFO_ARRAY (size_t, work_dim, global_work_size);
+    case CL_MUTABLE_DISPATCH_LOCAL_WORK_SIZE_KHR:
+      POCL_RETURN_GETINFO_ARRAY (size_t, work_dim, local_work_size);
+    default:
+      return CL_INVALID_VALUE;
+    }
+}
+POsym (clGetMutableCommandInfoKHR)
@@ -61,6 +61,7 @@ POname(clGetProgramBuildInfo)(cl_program            program,
                       size_t *              param_value_size_ret) CL_API_SUFFIX__VERSION_1_0
 {
   const char *str;
+  cl_build_status build_status;
 
   POCL_RETURN_ERROR_COND ((!IS_CL_OBJECT_VALID (program)), CL_INVALID_PROGRAM);
 
@@ -73,10 +74,15 @@ POname(clGetProgramBuildInfo)(cl_program            program,
                         "Device is not in the list of devices"
                         " associated with the program\n");
 
+  /* A background build publishes its status under the program lock. */
+  POCL_LOCK_OBJ (program);
+  build_status = program->build_status;
+  POCL_UNLOCK_OBJ (program);
+
   switch (param_name) {
   case CL_PROGRAM_BUILD_STATUS:
     {
-      POCL_RETURN_GETINFO(cl_build_status, program->build_status);
+      POCL_RETURN_GETINFO (cl_build_status, build_status);
     }
     
   case CL_PROGRAM_BUILD_OPTIONS:
@@ -87,9 +93,14 @@ POname(clGetProgramBuildInfo)(cl_program            program,
     
   case CL_PROGRAM_BUILD_LOG:
     {
-      POCL_RETURN_ERROR_ON((program->build_status == CL_BUILD_NONE),
+      POCL_RETURN_ERROR_ON((build_status == CL_BUILD_NONE),
                            CL_INVALID_PROGRAM,
                            "Program was not built");
+      /* The background build writes and reallocates the logs without the
+         program lock; they are complete once it has published the final
+         status. */
+      if (build_status == CL_BUILD_IN_PROGRESS)
+        POCL_RETURN_GETINFO_STR ("");
       if (program->builtin_kernel_names != NULL)
         {
           POCL_RETURN_GETINFO_STR ("");
@@ -117,6 +117,7 @@ POname(clGetProgramInfo)(cl_program program,
 
   case CL_PROGRAM_BINARY_SIZES:
     {
+      pocl_wait_for_program_build (program);
       POCL_RETURN_ERROR_COND(program->build_status != CL_BUILD_SUCCESS,
                              CL_INVALID_PROGRAM);
       size_t const value_size = sizeof(size_t) * program->num_devices;
@@ -126,6 +127,7 @@ POname(clGetProgramInfo)(cl_program program,
 
   case CL_PROGRAM_BINARIES:
     {
+      pocl_wait_for_program_build (program);
       POCL_RETURN_ERROR_COND(program->build_status != CL_BUILD_SUCCESS,
                              CL_INVALID_PROGRAM);
       size_t const value_size = sizeof(unsigned char *) * program->num_devices;
@@ -152,6 +154,7 @@ POname(clGetProgramInfo)(cl_program program,
 
   case CL_PROGRAM_NUM_KERNELS:
     {
+      pocl_wait_for_program_build (program);
       POCL_RETURN_ERROR_ON((program->build_status != CL_BUILD_SUCCESS),
                            CL_INVALID_PROGRAM_EXECUTABLE,
                            "This information is only available after a "
@@ -171,6 +174,7 @@ POname(clGetProgramInfo)(cl_program program,
 
   case CL_PROGRAM_KERNEL_NAMES:
     {
+      pocl_wait_for_program_build (program);
       POCL_RETURN_ERROR_ON((program->build_status != CL_BUILD_SUCCESS),
                            CL_INVALID_PROGRAM_EXECUTABLE,
                            "This information is only available after a "
@@ -59,6 +59,8 @@ CL_API_SUFFIX__VERSION_1_2
   for (i = 0; i < num_input_programs; i++)
     {
       cl_program p = input_programs[i];
+      /* may have been compiled with a callback */
+      pocl_wait_for_program_build (p);
       POCL_GOTO_LABEL_ON (
           PFN_NOTIFY,
           ((p->binary_type != CL_PROGRAM_BINARY_TYPE_LIBRARY)
@@ -22,6 +22,7 @@
 */
 
 #include "devices.h"
+#include "pocl_mem_stats.h"
 #include "pocl_shared.h"
 #include "pocl_util.h"
 
@@ -125,6 +126,7 @@ pocl_usm_alloc (unsigned alloc_type, cl_context context, cl_device_id device,
   POCL_LOCK_OBJ (context);
   item->svm_ptr = ptr;
   item->size = size;
+  item->is_usm = 1;
   DL_APPEND (context->svm_ptrs, item);
   POCL_UNLOCK_OBJ (context);
   POname (clRetainContext) (context);
@@ -134,6 +136,7 @@ pocl_usm_alloc (unsigned alloc_type, cl_context context, cl_device_id device,
                          ptr, size, flags);
 
   POCL_ATOMIC_INC (usm_buffer_c);
+  POCL_MEM_STATS_ALLOC (context, POCL_MEM_USM, size);
 
   return ptr;
 
@@ -22,6 +22,7 @@
 */
 
 #include "pocl_debug.h"
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
 
 extern unsigned long usm_buffer_c;
@@ -137,6 +138,8 @@ pocl_mem_free_intel (cl_context context, void *usm_pointer, cl_bool blocking)
         }
     }
 
+  POCL_MEM_STATS_FREE (context, item->is_usm ? POCL_MEM_USM : POCL_MEM_SVM,
+                       item->size);
   POCL_MEM_FREE (item);
   POname (clReleaseContext) (context);
 
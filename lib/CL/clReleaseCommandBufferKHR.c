@@ -23,7 +23,9 @@
 
 #include "pocl_cl.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
+#include "utlist.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname (clReleaseCommandBufferKHR) (cl_command_buffer_khr command_buffer)
@@ -78,6 +80,11 @@ POname (clReleaseCommandBufferKHR) (cl_command_buffer_khr command_buffer)
           switch (cmd->type)
             {
             case CL_COMMAND_NDRANGE_KERNEL:
+              POCL_MEM_STATS_FREE (
+                  cmd->command.run.kernel->context, POCL_MEM_KERNEL_ARGS,
+                  pocl_mem_stats_args_size (
+                      cmd->command.run.kernel->meta->num_args,
+                      cmd->command.run.arguments));
               for (unsigned i = 0; i < cmd->command.run.kernel->meta->num_args;
                    ++i)
                 {
@@ -120,6 +127,13 @@ POname (clReleaseCommandBufferKHR) (cl_command_buffer_khr command_buffer)
           cmd = next;
         }
 
+      cl_mutable_command_khr handle, tmp;
+      LL_FOREACH_SAFE (command_buffer->mutable_cmds, handle, tmp)
+      {
+        POCL_MEM_FREE (handle->properties);
+        POCL_MEM_FREE (handle);
+      }
+
       POCL_DESTROY_OBJECT (command_buffer);
       POCL_MEM_FREE (command_buffer->queues);
       POCL_MEM_FREE (command_buffer->properties);
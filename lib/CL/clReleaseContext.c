@@ -23,6 +23,7 @@
 */
 
 #include "devices/devices.h"
+#include "pocl_mem_stats.h"
 #include "pocl_runtime_config.h"
 
 #ifdef ENABLE_LLVM
@@ -59,6 +60,9 @@ POname(clReleaseContext)(cl_context context) CL_API_SUFFIX__VERSION_1_0
       POCL_MSG_PRINT_REFCOUNTS ("Free Context %" PRId64 " (%p)\n", context->id,
                                 context);
 
+      if (pocl_mem_stats_enabled)
+        pocl_mem_stats_dump (context);
+
       /* The context holds references to all its devices,
          memory objects, command-queues etc. Release the
          references and let the objects to get freed. */
@@ -23,6 +23,7 @@
 
 #include "pocl_cl.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
 
 extern unsigned long uevent_c;
 extern unsigned long event_c;
@@ -68,6 +69,10 @@ POname(clReleaseEvent)(cl_event event) CL_API_SUFFIX__VERSION_1_0
           event->queue->device->ops->free_event_data)
         event->queue->device->ops->free_event_data(event);
 
+      POCL_MEM_STATS_FREE (event->context, POCL_MEM_EVENTS,
+                           sizeof (struct _cl_event)
+                               + event->num_buffers * sizeof (cl_mem));
+
       if (event->queue)
         POname(clReleaseCommandQueue) (event->queue);
       else
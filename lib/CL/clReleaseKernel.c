@@ -22,6 +22,7 @@
 */
 
 #include "pocl_cl.h"
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
 
 extern unsigned long kernel_c;
@@ -70,9 +71,16 @@ POname(clReleaseKernel)(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
         {
           for (i = 0; i < (kernel->meta->num_args); i++)
             {
+              if (kernel->dyn_arguments[i].value != NULL)
+                POCL_MEM_STATS_FREE (kernel->context, POCL_MEM_KERNEL_ARGS,
+                                     kernel->dyn_arguments[i].size);
               pocl_aligned_free (kernel->dyn_arguments[i].value);
             }
         }
+      POCL_MEM_STATS_FREE (kernel->context, POCL_MEM_KERNEL_ARGS,
+                           kernel->meta->num_args
+                                   * sizeof (struct pocl_argument)
+                               + kernel->meta->total_argument_storage_size);
       kernel->name = NULL;
       kernel->meta = NULL;
       POCL_MEM_FREE (kernel->data);
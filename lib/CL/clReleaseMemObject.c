@@ -23,6 +23,7 @@
 
 #include "devices.h"
 #include "pocl_cl.h"
+#include "pocl_mem_stats.h"
 #include "utlist.h"
 
 extern unsigned long buffer_c;
@@ -114,6 +115,10 @@ POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
             }
 
           POCL_MEM_FREE (memobj->device_ptrs);
+
+          POCL_MEM_STATS_FREE (
+              context, memobj->is_image ? POCL_MEM_IMAGE : POCL_MEM_BUFFER,
+              memobj->size);
         }
 
       assert (memobj->mem_host_ptr == NULL);
@@ -111,6 +111,7 @@ POname(clReleaseProgram)(cl_program program) CL_API_SUFFIX__VERSION_1_0
 
       POCL_MEM_FREE (program->build_hash);
       POCL_MEM_FREE (program->compiler_options);
+      POCL_MEM_FREE (program->specialize_args);
       POCL_MEM_FREE (program->data);
       POCL_MEM_FREE (program->global_var_total_size);
       POCL_MEM_FREE (program->llvm_irs);
@@ -121,6 +122,7 @@ POname(clReleaseProgram)(cl_program program) CL_API_SUFFIX__VERSION_1_0
       POCL_MEM_FREE (program->builtin_kernel_names);
       POCL_MEM_FREE (program->concated_builtin_names);
 
+      POCL_DESTROY_COND (program->build_cond);
       POCL_DESTROY_OBJECT (program);
       POCL_MEM_FREE (program);
 
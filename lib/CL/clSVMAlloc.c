@@ -22,6 +22,7 @@
 */
 
 #include "devices.h"
+#include "pocl_mem_stats.h"
 #include "pocl_shared.h"
 #include "pocl_util.h"
 
@@ -117,6 +118,7 @@ POname(clSVMAlloc)(cl_context context,
                          ptr, size, flags);
 
   POCL_ATOMIC_INC (svm_buffer_c);
+  POCL_MEM_STATS_ALLOC (context, POCL_MEM_SVM, size);
 
   return ptr;
 }
@@ -23,6 +23,7 @@
 
 #include "pocl_util.h"
 #include "pocl_debug.h"
+#include "pocl_mem_stats.h"
 
 extern unsigned long svm_buffer_c;
 
@@ -66,6 +67,8 @@ POname(clSVMFree)(cl_context context,
       return;
     }
 
+  POCL_MEM_STATS_FREE (context, item->is_usm ? POCL_MEM_USM : POCL_MEM_SVM,
+                       item->size);
   POCL_MEM_FREE (item);
 
   POname (clReleaseContext) (context);
@@ -25,6 +25,7 @@
 #include "config.h"
 #include "pocl_cl.h"
 #include "pocl_debug.h"
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
 #include <assert.h>
 #include <stdbool.h>
@@ -49,18 +50,17 @@ dump_hex (const char *data, size_t size, char *buffer)
   buffer[j] = 0;
 }
 
-CL_API_ENTRY cl_int CL_API_CALL
-POname(clSetKernelArg)(cl_kernel kernel,
-               cl_uint arg_index,
-               size_t arg_size,
-               const void *arg_value) CL_API_SUFFIX__VERSION_1_0
+/* Sets the argument in the given argument array of the kernel, which is
+   either its dyn_arguments or the copy of them in a recorded command. The
+   array is left untouched if the value is invalid. */
+cl_int
+pocl_set_kernel_arg (cl_kernel kernel, struct pocl_argument *arguments,
+                     cl_uint arg_index, size_t arg_size, const void *arg_value)
 {
   size_t arg_alignment, arg_alloc_size;
   struct pocl_argument *p;
   struct pocl_argument_info *pi;
 
-  POCL_RETURN_ERROR_COND ((!IS_CL_OBJECT_VALID (kernel)), CL_INVALID_KERNEL);
-
   POCL_RETURN_ERROR_ON ((arg_index >= kernel->meta->num_args),
                         CL_INVALID_ARG_INDEX,
                         "This kernel has %u args, cannot set arg %u\n",
@@ -165,9 +165,14 @@ POname(clSetKernelArg)(cl_kernel kernel,
           arg_index, pi->type_name, arg_size, pi->type_size);
     }
 
-  p = &(kernel->dyn_arguments[arg_index]);
-  if (kernel->dyn_argument_storage == NULL)
-    pocl_aligned_free (p->value);
+  p = &(arguments[arg_index]);
+  int in_storage = (arguments == kernel->dyn_arguments
+                    && kernel->dyn_argument_storage != NULL);
+  if (!in_storage && p->value != NULL)
+    {
+      POCL_MEM_STATS_FREE (kernel->context, POCL_MEM_KERNEL_ARGS, p->size);
+      pocl_aligned_free (p->value);
+    }
   p->value = NULL;
   p->is_set = 0;
   p->is_readonly = 0;
@@ -196,7 +201,7 @@ POname(clSetKernelArg)(cl_kernel kernel,
            && *(const intptr_t *)arg_value == 0))
     {
       void *value;
-      if (kernel->dyn_argument_storage != NULL)
+      if (in_storage)
         value = kernel->dyn_argument_offsets[arg_index];
       else
         {
@@ -216,6 +221,8 @@ POname(clSetKernelArg)(cl_kernel kernel,
             {
               return CL_OUT_OF_HOST_MEMORY;
             }
+          POCL_MEM_STATS_ALLOC (kernel->context, POCL_MEM_KERNEL_ARGS,
+                                arg_size);
         }
 
       if ((pi->type == POCL_ARG_TYPE_POINTER) && (arg_value != NULL))
@@ -248,4 +255,16 @@ POname(clSetKernelArg)(cl_kernel kernel,
 
   return CL_SUCCESS;
 }
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname(clSetKernelArg)(cl_kernel kernel,
+               cl_uint arg_index,
+               size_t arg_size,
+               const void *arg_value) CL_API_SUFFIX__VERSION_1_0
+{
+  POCL_RETURN_ERROR_COND ((!IS_CL_OBJECT_VALID (kernel)), CL_INVALID_KERNEL);
+
+  return pocl_set_kernel_arg (kernel, kernel->dyn_arguments, arg_index,
+                              arg_size, arg_value);
+}
 POsym(clSetKernelArg)
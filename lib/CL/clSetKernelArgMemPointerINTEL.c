@@ -37,6 +37,7 @@ POname (clSetKernelArgMemPointerINTEL) (cl_kernel kernel, cl_uint arg_index,
       (!kernel->context->usm_allocdev), CL_INVALID_OPERATION,
       "None of the devices in this context is USM-capable\n");
 
-  return pocl_set_kernel_arg_pointer (kernel, arg_index, arg_value);
+  return pocl_set_kernel_arg_pointer (kernel, kernel->dyn_arguments,
+                                      arg_index, arg_value);
 }
 POsym (clSetKernelArgMemPointerINTEL)
@@ -23,12 +23,13 @@
 
 #include "config.h"
 #include "pocl_cl.h"
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
 #include "devices.h"
 
 int
-pocl_set_kernel_arg_pointer (cl_kernel kernel, cl_uint arg_index,
-                             const void *arg_value)
+pocl_set_kernel_arg_pointer (cl_kernel kernel, struct pocl_argument *arguments,
+                             cl_uint arg_index, const void *arg_value)
 {
   POCL_RETURN_ERROR_ON ((kernel->dyn_arguments == NULL), CL_INVALID_KERNEL,
                         "This kernel has no arguments that could be set\n");
@@ -43,7 +44,7 @@ pocl_set_kernel_arg_pointer (cl_kernel kernel, cl_uint arg_index,
                         "This kernel has %u args, cannot set arg %u\n",
                         (unsigned)kernel->meta->num_args, (unsigned)arg_index);
 
-  p = &(kernel->dyn_arguments[arg_index]);
+  p = &(arguments[arg_index]);
   pi = &(kernel->meta->arg_info[arg_index]);
   POCL_RETURN_ERROR_ON ((ARGP_IS_LOCAL (pi)), CL_INVALID_ARG_VALUE,
                         "arg %u is in local address space\n", arg_index);
@@ -52,12 +53,15 @@ pocl_set_kernel_arg_pointer (cl_kernel kernel, cl_uint arg_index,
                         CL_INVALID_ARG_VALUE, "arg %u is not a pointer\n",
                         arg_index);
 
-  if (kernel->dyn_argument_storage != NULL)
+  if (arguments == kernel->dyn_arguments
+      && kernel->dyn_argument_storage != NULL)
     p->value = kernel->dyn_argument_offsets[arg_index];
   else if (p->value == NULL)
     {
       p->value = pocl_aligned_malloc (sizeof (void *), sizeof (void *));
       POCL_RETURN_ERROR_COND ((p->value == NULL), CL_OUT_OF_HOST_MEMORY);
+      POCL_MEM_STATS_ALLOC (kernel->context, POCL_MEM_KERNEL_ARGS,
+                            sizeof (void *));
     }
   memcpy (p->value, &arg_value, sizeof (void *));
 
@@ -81,6 +85,7 @@ POname (clSetKernelArgSVMPointer) (cl_kernel kernel, cl_uint arg_index,
       (!kernel->context->svm_allocdev), CL_INVALID_OPERATION,
       "None of the devices in this context is SVM-capable\n");
 
-  return pocl_set_kernel_arg_pointer (kernel, arg_index, arg_value);
+  return pocl_set_kernel_arg_pointer (kernel, kernel->dyn_arguments,
+                                      arg_index, arg_value);
 }
 POsym(clSetKernelArgSVMPointer)
@@ -0,0 +1,358 @@
+/* OpenCL runtime library: clUpdateMutableCommandsKHR()
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* The updates are first applied to copies of the launch state of the
+   commands, which validates them, and only if all of them are valid the
+   copies replace the launch state in the recorded nodes. The replays
+   instantiate the nodes with the launch state they have at the time of
+   clEnqueueCommandBufferKHR, so the instances already enqueued are not
+   affected. */
+
+#include <CL/cl_ext.h>
+
+#include "pocl_cl.h"
+#include "pocl_mem_stats.h"
+#include "pocl_shared.h"
+#include "pocl_util.h"
+
+typedef struct
+{
+  cl_mutable_command_khr handle;
+
+  /* NULL if the arguments are not updated */
+  struct pocl_argument *arguments;
+  uint64_t spec_args_hash;
+  const unsigned char *spec_args;
+  size_t spec_args_size;
+  cl_uint memobj_count;
+  cl_mem *memobj_list;
+  char *readonly_flag_list;
+
+  int ndrange_updated;
+  int auto_local_size;
+  size_t global_offset[3];
+  size_t local_size[3];
+  size_t num_groups[3];
+} staged_update;
+
+static void
+free_arguments (cl_kernel kernel, struct pocl_argument *arguments)
+{
+  unsigned i;
+  POCL_MEM_STATS_FREE (
+      kernel->context, POCL_MEM_KERNEL_ARGS,
+      pocl_mem_stats_args_size (kernel->meta->num_args, arguments));
+  for (i = 0; i < kernel->meta->num_args; ++i)
+    pocl_aligned_free (arguments[i].value);
+  POCL_MEM_FREE (arguments);
+}
+
+static void
+free_staged (staged_update *u)
+{
+  if (u->arguments != NULL)
+    free_arguments (u->handle->node->command.run.kernel, u->arguments);
+  POCL_MEM_FREE (u->memobj_list);
+  POCL_MEM_FREE (u->readonly_flag_list);
+}
+
+/* Applies the argument updates to the copy of the arguments in U. */
+static cl_int
+stage_arguments (staged_update *u, const cl_mutable_dispatch_config_khr *config)
+{
+  cl_mutable_command_khr handle = u->handle;
+  cl_kernel kernel = handle->node->command.run.kernel;
+  _cl_command_run run;
+  cl_int errcode;
+  unsigned i;
+
+  POCL_RETURN_ERROR_ON (
+      (config->num_svm_args > 0 && !kernel->context->svm_allocdev),
+      CL_INVALID_OPERATION,
+      "None of the devices in this context is SVM-capable\n");
+
+  for (i = 0; i < config->num_args; ++i)
+    {
+      const cl_mutable_dispatch_arg_khr *arg = &config->arg_list[i];
+      errcode = pocl_set_kernel_arg (kernel, u->arguments, arg->arg_index,
+                                     arg->arg_size, arg->arg_value);
+      if (errcode != CL_SUCCESS)
+        return errcode;
+    }
+  for (i = 0; i < config->num_svm_args; ++i)
+    {
+      const cl_mutable_dispatch_arg_khr *arg = &config->arg_svm_list[i];
+      errcode = pocl_set_kernel_arg_pointer (kernel, u->arguments,
+                                             arg->arg_index, arg->arg_value);
+      if (errcode != CL_SUCCESS)
+        return errcode;
+    }
+
+  u->memobj_list = (cl_mem *)malloc (kernel->meta->num_args * sizeof (cl_mem));
+  u->readonly_flag_list = (char *)malloc (kernel->meta->num_args);
+  if (kernel->meta->num_args > 0
+      && (u->memobj_list == NULL || u->readonly_flag_list == NULL))
+    return CL_OUT_OF_HOST_MEMORY;
+  errcode = pocl_kernel_collect_mem_objs (
+      handle->command_queue, kernel, u->arguments, &u->memobj_count,
+      u->memobj_list, u->readonly_flag_list);
+  if (errcode != CL_SUCCESS)
+    return errcode;
+
+  memset (&run, 0, sizeof (run));
+  run.arguments = u->arguments;
+  pocl_kernel_set_spec_args_hash (kernel, &run);
+  u->spec_args_hash = run.spec_args_hash;
+  u->spec_args = run.spec_args;
+  u->spec_args_size = run.spec_args_size;
+  return CL_SUCCESS;
+}
+
+static cl_int
+stage_ndrange (staged_update *u, const cl_mutable_dispatch_config_khr *config,
+               const struct pocl_context *current)
+{
+  _cl_command_node *node = u->handle->node;
+  cl_uint work_dim = current->work_dim;
+  size_t offset[3], global[3], local[3];
+  unsigned i;
+
+  for (i = 0; i < work_dim; ++i)
+    {
+      offset[i] = config->global_work_offset ? config->global_work_offset[i]
+                                             : current->global_offset[i];
+      global[i] = config->global_work_size
+                      ? config->global_work_size[i]
+                      : current->num_groups[i] * current->local_size[i];
+      local[i] = config->local_work_size ? config->local_work_size[i]
+                                         : current->local_size[i];
+    }
+
+  /* a local size chosen by the runtime is chosen again for the new global
+     size */
+  u->auto_local_size
+      = config->local_work_size == NULL && u->handle->auto_local_size;
+  u->ndrange_updated = 1;
+  return pocl_kernel_calc_wg_size (
+      u->handle->command_queue, node->command.run.kernel,
+      node->program_device_i, work_dim, offset, global,
+      u->auto_local_size ? NULL : local, u->global_offset, u->local_size,
+      u->num_groups);
+}
+
+static cl_int
+stage_update (staged_update *u, cl_command_buffer_khr command_buffer,
+              const cl_mutable_dispatch_config_khr *config)
+{
+  cl_mutable_command_khr handle = config->command;
+  cl_int errcode = CL_SUCCESS;
+
+  POCL_RETURN_ERROR_COND (
+      (config->type != CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR),
+      CL_INVALID_VALUE);
+  POCL_RETURN_ERROR_COND ((config->next != NULL), CL_INVALID_VALUE);
+  POCL_RETURN_ERROR_COND (
+      (handle == NULL || handle->command_buffer != command_buffer),
+      CL_INVALID_MUTABLE_COMMAND_KHR);
+  u->handle = handle;
+
+  cl_mutable_dispatch_fields_khr fields = handle->updatable_fields;
+  int update_args = config->num_args > 0 || config->num_svm_args > 0;
+  int update_ndrange = config->global_work_offset != NULL
+                       || config->global_work_size != NULL
+                       || config->local_work_size != NULL;
+
+  POCL_RETURN_ERROR_COND ((config->num_args > 0 && config->arg_list == NULL),
+                          CL_INVALID_VALUE);
+  POCL_RETURN_ERROR_COND (
+      (config->num_svm_args > 0 && config->arg_svm_list == NULL),
+      CL_INVALID_VALUE);
+  POCL_RETURN_ERROR_ON ((config->num_exec_infos > 0), CL_INVALID_OPERATION,
+                        "The exec info of a command cannot be updated\n");
+  POCL_RETURN_ERROR_ON (
+      (update_args && !(fields & CL_MUTABLE_DISPATCH_ARGUMENTS_KHR)),
+      CL_INVALID_OPERATION, "The arguments of the command are not mutable\n");
+  POCL_RETURN_ERROR_ON (
+      (config->global_work_offset != NULL
+       && !(fields & CL_MUTABLE_DISPATCH_GLOBAL_OFFSET_KHR)),
+      CL_INVALID_OPERATION,
+      "The global offset of the command is not mutable\n");
+  POCL_RETURN_ERROR_ON (
+      (config->global_work_size != NULL
+       && !(fields & CL_MUTABLE_DISPATCH_GLOBAL_SIZE_KHR)),
+      CL_INVALID_OPERATION, "The global size of the command is not mutable\n");
+  POCL_RETURN_ERROR_ON (
+      (config->local_work_size != NULL
+       && !(fields & CL_MUTABLE_DISPATCH_LOCAL_SIZE_KHR)),
+      CL_INVALID_OPERATION, "The local size of the command is not mutable\n");
+
+  _cl_command_run *run = &handle->node->command.run;
+  POCL_RETURN_ERROR_ON (
+      (config->work_dim != 0 && config->work_dim != run->pc.work_dim),
+      CL_INVALID_VALUE,
+      "The work dimensions of a command cannot be changed\n");
+
+  /* stage the updates on a snapshot of the current launch state, which
+     an earlier clUpdateMutableCommandsKHR might be replacing */
+  struct pocl_context pc;
+  POCL_LOCK (command_buffer->mutex);
+  pc = run->pc;
+  if (update_args)
+    {
+      _cl_command_run copy;
+      errcode = pocl_kernel_copy_args_from (run->kernel, run->arguments,
+                                            &copy);
+      if (errcode == CL_SUCCESS)
+        u->arguments = copy.arguments;
+    }
+  POCL_UNLOCK (command_buffer->mutex);
+  if (errcode != CL_SUCCESS)
+    return errcode;
+
+  if (update_args)
+    {
+      errcode = stage_arguments (u, config);
+      if (errcode != CL_SUCCESS)
+        return errcode;
+    }
+  if (update_ndrange)
+    errcode = stage_ndrange (u, config, &pc);
+  return errcode;
+}
+
+/* Replaces the launch state of the command with the staged one, call with
+   the command buffer locked. */
+static void
+commit_update (staged_update *u)
+{
+  cl_mutable_command_khr handle = u->handle;
+  _cl_command_node *node = handle->node;
+  _cl_command_run *run = &node->command.run;
+  unsigned i;
+
+  if (u->arguments != NULL)
+    {
+      for (i = 0; i < u->memobj_count; ++i)
+        POname (clRetainMemObject) (u->memobj_list[i]);
+      for (i = 0; i < node->memobj_count; ++i)
+        POname (clReleaseMemObject) (node->memobj_list[i]);
+      POCL_MEM_FREE (node->memobj_list);
+      POCL_MEM_FREE (node->readonly_flag_list);
+      node->memobj_count = u->memobj_count;
+      node->memobj_list = u->memobj_list;
+      node->readonly_flag_list = u->readonly_flag_list;
+      u->memobj_list = NULL;
+      u->readonly_flag_list = NULL;
+
+      free_arguments (run->kernel, run->arguments);
+      run->arguments = u->arguments;
+      run->spec_args_hash = u->spec_args_hash;
+      run->spec_args = u->spec_args;
+      run->spec_args_size = u->spec_args_size;
+      u->arguments = NULL;
+    }
+
+  if (u->ndrange_updated)
+    {
+      for (i = 0; i < 3; ++i)
+        {
+          run->pc.global_offset[i] = u->global_offset[i];
+          run->pc.local_size[i] = u->local_size[i];
+          run->pc.num_groups[i] = u->num_groups[i];
+        }
+      handle->auto_local_size = u->auto_local_size;
+    }
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname (clUpdateMutableCommandsKHR) (
+    cl_command_buffer_khr command_buffer,
+    const cl_mutable_base_config_khr *mutable_config)
+    CL_API_SUFFIX__VERSION_1_2
+{
+  cl_int errcode = CL_SUCCESS;
+  unsigned i, j;
+
+  POCL_RETURN_ERROR_COND ((!IS_CL_OBJECT_VALID (command_buffer)),
+                          CL_INVALID_COMMAND_BUFFER_KHR);
+
+  cl_command_buffer_flags_khr flags
+      = (cl_command_buffer_flags_khr)pocl_cmdbuf_get_property (
+          command_buffer, CL_COMMAND_BUFFER_FLAGS_KHR);
+  POCL_RETURN_ERROR_ON (
+      (!(flags & CL_COMMAND_BUFFER_MUTABLE_KHR)), CL_INVALID_OPERATION,
+      "The command buffer was not created with CL_COMMAND_BUFFER_MUTABLE_KHR\n");
+
+  /* the instances of a pending command buffer keep the launch state they
+     were enqueued with */
+  POCL_RETURN_ERROR_ON (
+      (command_buffer->state != CL_COMMAND_BUFFER_STATE_EXECUTABLE_KHR
+       && command_buffer->state != CL_COMMAND_BUFFER_STATE_PENDING_KHR),
+      CL_INVALID_OPERATION, "The command buffer is not finalized\n");
+
+  POCL_RETURN_ERROR_COND ((mutable_config == NULL), CL_INVALID_VALUE);
+  POCL_RETURN_ERROR_COND (
+      (mutable_config->type != CL_STRUCTURE_TYPE_MUTABLE_BASE_CONFIG_KHR),
+      CL_INVALID_VALUE);
+  POCL_RETURN_ERROR_COND ((mutable_config->next != NULL), CL_INVALID_VALUE);
+  POCL_RETURN_ERROR_COND ((mutable_config->num_mutable_dispatch == 0
+                           || mutable_config->mutable_dispatch_list == NULL),
+                          CL_INVALID_VALUE);
+
+  cl_uint num_updates = mutable_config->num_mutable_dispatch;
+  staged_update *updates
+      = (staged_update *)calloc (num_updates, sizeof (staged_update));
+  POCL_RETURN_ERROR_COND ((updates == NULL), CL_OUT_OF_HOST_MEMORY);
+
+  for (i = 0; i < num_updates && errcode == CL_SUCCESS; ++i)
+    {
+      const cl_mutable_dispatch_config_khr *config
+          = &mutable_config->mutable_dispatch_list[i];
+      /* each config is staged on the launch state of the node, so the
+         changes of an earlier config of the same command would be lost */
+      for (j = 0; j < i; ++j)
+        if (updates[j].handle == config->command)
+          {
+            POCL_MSG_ERR ("The same command is updated twice in one call\n");
+            errcode = CL_INVALID_VALUE;
+            break;
+          }
+      if (errcode == CL_SUCCESS)
+        errcode = stage_update (&updates[i], command_buffer, config);
+    }
+
+  if (errcode == CL_SUCCESS)
+    {
+      POCL_LOCK (command_buffer->mutex);
+      for (i = 0; i < num_updates; ++i)
+        commit_update (&updates[i]);
+      POCL_UNLOCK (command_buffer->mutex);
+    }
+
+  for (i = 0; i < num_updates; ++i)
+    if (updates[i].handle != NULL)
+      free_staged (&updates[i]);
+  POCL_MEM_FREE (updates);
+  return errcode;
+}
+POsym (clUpdateMutableCommandsKHR)
@@ -43,6 +43,7 @@ opyright (c) 2011-2013 Universidad Rey Juan Carlos and
 #include "pocl_cache.h"
 #include "pocl_file_util.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
 #include "pocl_timing.h"
 #include "pocl_workgroup_func.h"
 
@@ -52,6 +53,10 @@ opyright (c) 2011-2013 Universidad Rey Juan Carlos and
 #include "pocl_llvm.h"
 #endif
 
+#ifdef __linux__
+#include "perf_counters.h"
+#endif
+
 struct data {
   /* List of commands ready to be executed */
   _cl_command_node *ready_list;
@@ -205,17 +210,7 @@ pocl_basic_init (unsigned j, cl_device_id device, const char* parameters)
 
   pocl_init_default_device_infos (device);
 
-  if (strstr (HOST_DEVICE_EXTENSIONS, "cl_khr_subgroup") != NULL)
-    {
-      /* In reality there is no independent SG progress implemented in this
-         version because we can only have one SG in flight at a time, but it's
-         a corner case which allows us to advertise it for full CTS compliance.
-       */
-      device->sub_group_independent_forward_progress = CL_TRUE;
-
-      /* Just an arbitrary number here based on assumption of SG size 32. */
-      device->max_num_sub_groups = device->max_work_group_size / 32;
-    }
+  pocl_init_cpu_sub_groups (device);
 
   /* 0 is the host memory shared with all drivers that use it */
   device->global_mem_id = 0;
@@ -299,6 +294,7 @@ pocl_basic_init (unsigned j, cl_device_id device, const char* parameters)
   d->printf_buffer = pocl_aligned_malloc (MAX_EXTENDED_ALIGNMENT,
                                           device->printf_buffer_size);
   assert (d->printf_buffer != NULL);
+  POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_PRINTF, device->printf_buffer_size);
 
   pocl_cpuinfo_detect_device_info(device);
   pocl_set_buffer_image_limits(device);
@@ -369,6 +365,7 @@ pocl_basic_run (void *data, _cl_command_node *cmd)
               arguments[i] = malloc (sizeof (void *));
               *(void **)(arguments[i]) =
                 pocl_aligned_malloc(MAX_EXTENDED_ALIGNMENT, al->size);
+              POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_LOCAL_SCRATCH, al->size);
             }
         }
       else if (meta->arg_info[i].type == POCL_ARG_TYPE_POINTER)
@@ -443,6 +440,7 @@ pocl_basic_run (void *data, _cl_command_node *cmd)
           arguments[j] = malloc (sizeof (void *));
           void *pp = pocl_aligned_malloc (MAX_EXTENDED_ALIGNMENT, s);
           *(void **)(arguments[j]) = pp;
+          POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_LOCAL_SCRATCH, s);
         }
     }
 
@@ -459,12 +457,22 @@ pocl_basic_run (void *data, _cl_command_node *cmd)
   unsigned ftz = pocl_save_ftz ();
   pocl_set_ftz (kernel->program->flush_denorms);
 
+#ifdef __linux__
+  if (pocl_perf_counters_enabled)
+    pocl_perf_counters_start ();
+#endif
+
   for (z = 0; z < pc->num_groups[2]; ++z)
     for (y = 0; y < pc->num_groups[1]; ++y)
       for (x = 0; x < pc->num_groups[0]; ++x)
         ((pocl_workgroup_func) cmd->command.run.wg)
     ((uint8_t *)arguments, (uint8_t *)pc, x, y, z);
 
+#ifdef __linux__
+  if (pocl_perf_counters_enabled)
+    pocl_perf_counters_stop (cmd->sync.event.event);
+#endif
+
   pocl_restore_rm (rm);
   pocl_restore_ftz (ftz);
 
@@ -480,6 +488,8 @@ pocl_basic_run (void *data, _cl_command_node *cmd)
         {
           if (!cmd->device->device_alloca_locals)
             {
+              POCL_MEM_STATS_FREE (NULL, POCL_MEM_LOCAL_SCRATCH,
+                                   cmd->command.run.arguments[i].size);
               POCL_MEM_FREE(*(void **)(arguments[i]));
               POCL_MEM_FREE(arguments[i]);
             }
@@ -505,6 +515,8 @@ pocl_basic_run (void *data, _cl_command_node *cmd)
   if (!cmd->device->device_alloca_locals)
     for (i = 0; i < meta->num_locals; ++i)
       {
+        POCL_MEM_STATS_FREE (NULL, POCL_MEM_LOCAL_SCRATCH,
+                             meta->local_sizes[i]);
         POCL_MEM_FREE (*(void **)(arguments[meta->num_args + i]));
         POCL_MEM_FREE (arguments[meta->num_args + i]);
       }
@@ -539,6 +551,7 @@ pocl_basic_uninit (unsigned j, cl_device_id device)
 {
   struct data *d = (struct data*)device->data;
   POCL_DESTROY_LOCK (d->cq_lock);
+  POCL_MEM_STATS_FREE (NULL, POCL_MEM_PRINTF, device->printf_buffer_size);
   pocl_aligned_free (d->printf_buffer);
   POCL_MEM_FREE(d);
   device->data = NULL;
@@ -558,6 +571,7 @@ pocl_basic_reinit (unsigned j, cl_device_id device)
   d->printf_buffer = pocl_aligned_malloc (MAX_EXTENDED_ALIGNMENT,
                                           device->printf_buffer_size);
   assert (d->printf_buffer != NULL);
+  POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_PRINTF, device->printf_buffer_size);
 
   POCL_INIT_LOCK (d->cq_lock);
   device->data = d;
@@ -589,7 +603,10 @@ pocl_basic_submit (_cl_command_node *node, cl_command_queue cq)
   struct data *d = node->device->data;
 
   if (node != NULL && node->type == CL_COMMAND_NDRANGE_KERNEL)
-    pocl_check_kernel_dlhandle_cache (node, CL_TRUE, CL_TRUE);
+    {
+      pocl_cmd_set_noalias_args (node);
+      pocl_check_kernel_dlhandle_cache (node, CL_TRUE, CL_TRUE);
+    }
 
   node->ready = 1;
   POCL_LOCK (d->cq_lock);
@@ -54,6 +54,7 @@
 #include "pocl_file_util.h"
 #include "pocl_image_util.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
 #include "pocl_runtime_config.h"
 #include "pocl_timing.h"
 #include "pocl_util.h"
@@ -70,12 +71,17 @@
 #define _DARWIN_C_SOURCE
 #endif
 #include <dlfcn.h>
+#include <sys/stat.h>
 #endif
 
 #ifdef ENABLE_LLVM
 #include "pocl_llvm.h"
 #endif
 
+#ifdef __linux__
+#include "perf_jitdump.h"
+#endif
+
 /*
 #ifdef __cplusplus
 extern "C" {
@@ -394,8 +400,48 @@ pocl_init_cpu_device_infos (cl_device_id dev)
 #endif
 
 
+}
+
+/* Sets up the sub-groups of the CPU devices, if the host device
+   extensions include them. */
+void
+pocl_init_cpu_sub_groups (cl_device_id dev)
+{
+  if (strstr (HOST_DEVICE_EXTENSIONS, "cl_khr_subgroup") == NULL)
+    return;
+
+  /* In reality there is no independent SG progress implemented in this
+     version because we can only have one SG in flight at a time, but it's
+     a corner case which allows us to advertise it for full CTS compliance.
+   */
+  dev->sub_group_independent_forward_progress = CL_TRUE;
+
+  /* One sub-group per SIMD register of floats, so that the vectorized
+     work-item loop runs a sub-group per iteration. */
+  int sg_size = pocl_get_int_option ("POCL_CPU_SUB_GROUP_SIZE",
+                                     dev->native_vector_width_float);
+  if (sg_size < 0)
+    sg_size = 0;
+  dev->native_sub_group_size = min ((size_t)sg_size, dev->max_work_group_size);
+
+  if (dev->native_sub_group_size > 0)
+    /* The sub-groups tile each row of the local x dimension. A local x
+       size the native size does not divide gets one sub-group per row,
+       and with intel_reqd_sub_group_size the last sub-group of a row is
+       partial when the local x size is not a multiple of the required
+       size, so a work-group can have as many sub-groups as work-items. */
+    dev->max_num_sub_groups = dev->max_work_group_size;
+  else
+    /* Just an arbitrary number here based on assumption of SG size 32. */
+    dev->max_num_sub_groups = dev->max_work_group_size / 32;
 }
 #define WORKGROUP_STRING_LENGTH 1024
+/* appended to the final binary path for the first tier of the tiered
+   compilation */
+#define POCL_QUICK_BINARY_SUFFIX ".quick"
+/* the generic WG functions of all the kernels of a program, in the
+   program's cache directory */
+#define POCL_PROGRAM_BUNDLE_FILENAME "/bundle.so"
 
 uint64_t last_object_id = 0;
 
@@ -415,17 +461,21 @@ unsigned long event_c;
  * Generate code from the final bitcode using the LLVM
  * tools.
  *
- * Uses an existing (cached) one, if available.
+ * Uses an existing (cached) one, if available. With quick set, builds the
+ * lightly optimized first tier version of the tiered compilation, which is
+ * stored next to the final binary with POCL_QUICK_BINARY_SUFFIX.
  */
 
 #ifdef ENABLE_LLVM
 static int
 llvm_codegen (char *output, unsigned device_i, cl_kernel kernel,
-              cl_device_id device, _cl_command_node *command, int specialize)
+              cl_device_id device, _cl_command_node *command, int specialize,
+              int quick)
 {
   POCL_MEASURE_START (llvm_codegen);
   int error = 0;
   void *llvm_module = NULL;
+  int lease_fd = -1;
 
   char tmp_module[POCL_MAX_PATHNAME_LENGTH];
   char tmp_objfile[POCL_MAX_PATHNAME_LENGTH];
@@ -446,14 +496,20 @@ llvm_codegen (char *output, unsigned device_i, cl_kernel kernel,
   char final_binary_path[POCL_MAX_PATHNAME_LENGTH];
   pocl_cache_final_binary_path (final_binary_path, program, device_i, kernel,
                                 command, specialize);
+  if (quick)
+    strcat (final_binary_path, POCL_QUICK_BINARY_SUFFIX);
 
   if (pocl_exists (final_binary_path))
     goto FINISH;
 
+  /* Processes sharing the cache directory build each binary only once. */
+  if (!pocl_cache_acquire_build_lease (final_binary_path, &lease_fd))
+    goto FINISH;
+
   assert (strlen (final_binary_path) < (POCL_MAX_PATHNAME_LENGTH - 3));
 
   error = pocl_llvm_generate_workgroup_function_nowrite (
-      device_i, device, kernel, command, &llvm_module, specialize);
+      device_i, device, kernel, command, &llvm_module, specialize, quick);
   if (error)
     {
       POCL_MSG_PRINT_LLVM ("pocl_llvm_generate_workgroup_function() failed"
@@ -465,7 +521,8 @@ llvm_codegen (char *output, unsigned device_i, cl_kernel kernel,
 
 #ifndef BUILD_VORTEX
   // shin TODO : change if
-  if (true)
+  /* the parallel.bc of the quick tier is not worth keeping */
+  if (!quick)
   //if (pocl_get_bool_option ("POCL_LEAVE_KERNEL_COMPILER_TEMP_FILES", 0))
     {
   POCL_MSG_PRINT_GENERAL("check !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
@@ -496,7 +553,7 @@ llvm_codegen (char *output, unsigned device_i, cl_kernel kernel,
 
 #ifndef BUILD_VORTEX
   error = pocl_llvm_codegen (device, program, llvm_module, &objfile,
-                             &objfile_size);
+                             &objfile_size, quick);
   if (error)
     {
       POCL_MSG_PRINT_LLVM ("pocl_llvm_codegen() failed for kernel %s\n",
@@ -580,6 +637,24 @@ llvm_codegen (char *output, unsigned device_i, cl_kernel kernel,
       goto FINISH;
     }
 
+#ifdef __linux__
+  /* The line table for the perf jitdump records can only be extracted
+     from the unlinked object, so store it next to the kernel.so. */
+  if (pocl_perf_jitdump_enabled)
+    {
+      char lines_path[POCL_MAX_PATHNAME_LENGTH];
+      char workgroup_string[WORKGROUP_STRING_LENGTH];
+      snprintf (lines_path, POCL_MAX_PATHNAME_LENGTH, "%s%s",
+                final_binary_path, POCL_PERF_LINES_SUFFIX);
+      snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+                "_pocl_kernel_%s_workgroup", kernel_name);
+      if (pocl_llvm_write_line_table (objfile, objfile_size,
+                                      workgroup_string, lines_path))
+        POCL_MSG_PRINT_LLVM ("Could not extract the line table of %s\n",
+                             kernel_name);
+    }
+#endif
+
    /* rename temporary kernel.so */
   error = pocl_rename (tmp_module, final_binary_path);
   if (error)
@@ -611,6 +686,7 @@ llvm_codegen (char *output, unsigned device_i, cl_kernel kernel,
     }
 
 FINISH:
+  pocl_cache_release_build_lease (final_binary_path, lease_fd);
   pocl_destroy_llvm_module (llvm_module, kernel->context);
   POCL_MEM_FREE (objfile);
   POCL_MEASURE_FINISH (llvm_codegen);
@@ -1003,6 +1079,9 @@ pocl_exec_command (_cl_command_node *node)
             }
             POCL_UNLOCK_OBJ (event->context);
             assert (item);
+            POCL_MEM_STATS_FREE (event->context,
+                                 item->is_usm ? POCL_MEM_USM : POCL_MEM_SVM,
+                                 item->size);
             POCL_MEM_FREE (item);
             POname (clReleaseContext) (event->context);
             dev->ops->svm_free (dev, ptr);
@@ -1177,6 +1256,57 @@ pocl_cmd_max_grid_dim_width (_cl_command_run *cmd)
               cmd->pc.local_size[2] * cmd->pc.local_size[2]);
 }
 
+static int noalias_specialization = -1;
+
+/* Checks at launch time if the buffer arguments of the kernel command can
+   be assumed to not alias each other and to be aligned, and sets
+   noalias_args of the command accordingly. SVM pointers have no known
+   extent, so a command with them gets the generic version. */
+void
+pocl_cmd_set_noalias_args (_cl_command_node *cmd)
+{
+  _cl_command_run *run_cmd = &cmd->command.run;
+  pocl_kernel_metadata_t *meta = run_cmd->kernel->meta;
+  cl_device_id dev = cmd->device;
+  size_t align = dev->mem_base_addr_align;
+  uintptr_t starts[meta->num_args];
+  uintptr_t ends[meta->num_args];
+  unsigned i, j, num_ranges = 0;
+
+  run_cmd->noalias_args = 0;
+  if (noalias_specialization < 0)
+    noalias_specialization
+        = pocl_get_bool_option ("POCL_NOALIAS_SPECIALIZATION", 1);
+  if (!noalias_specialization)
+    return;
+
+  for (i = 0; i < meta->num_args; ++i)
+    {
+      struct pocl_argument *al = &run_cmd->arguments[i];
+      if (meta->arg_info[i].type != POCL_ARG_TYPE_POINTER
+          || ARG_IS_LOCAL (meta->arg_info[i]) || al->value == NULL)
+        continue;
+      if (al->is_svm)
+        return;
+
+      cl_mem m = *(cl_mem *)al->value;
+      uintptr_t start
+          = (uintptr_t)m->device_ptrs[dev->global_mem_id].mem_ptr
+            + al->offset;
+      uintptr_t end = start + (m->size - al->offset);
+      if (align > 1 && (start % align) != 0)
+        return;
+      for (j = 0; j < num_ranges; ++j)
+        if (start < ends[j] && starts[j] < end)
+          return;
+      starts[num_ranges] = start;
+      ends[num_ranges] = end;
+      ++num_ranges;
+    }
+
+  run_cmd->noalias_args = (num_ranges > 0);
+}
+
 
 /* CPU driver stuff */
 
@@ -1195,9 +1325,31 @@ struct pocl_dlhandle_cache_item
   int specialize;
   /* Maximum grid dimension this WG function works with. */
   size_t max_grid_dim_width;
+  /* Hash of the folded argument values, or 0 (see spec_args_hash in
+     _cl_command_run), and a copy of the values. */
+  uint64_t spec_args_hash;
+  unsigned char *spec_args;
+  size_t spec_args_size;
+  /* If the buffer arguments are assumed to not alias. */
+  int noalias_args;
 
   void *wg;
   void *dlhandle;
+  /* size of the loaded module file (for memory accounting) */
+  size_t module_size;
+  /* Set while wg is the quickly compiled first tier version and the
+     optimized one is being built in the background. */
+  int quick;
+  /* Set while wg comes from the program bundle, which does not put the
+     kernel's own binary to the disk cache. */
+  int bundled;
+  /* The replaced first tier module, if commands were still using it at the
+     time of the swap. Closed when the last of them is released. */
+  void *stale_dlhandle;
+  size_t stale_module_size;
+  /* Set while the launch that added the item builds and loads its WG
+     function. The other launches that need it wait for pocl_dlhandle_cond. */
+  int building;
   pocl_dlhandle_cache_item *next;
   pocl_dlhandle_cache_item *prev;
   unsigned ref_count;
@@ -1206,7 +1358,51 @@ struct pocl_dlhandle_cache_item
 static pocl_dlhandle_cache_item *pocl_dlhandle_cache = NULL;
 static pocl_lock_t pocl_llvm_codegen_lock;
 static pocl_lock_t pocl_dlhandle_lock;
+static pocl_cond_t pocl_dlhandle_cond;
 static int pocl_dlhandle_cache_initialized = 0;
+static unsigned handle_count = 0;
+/* POCL_MAX_WORK_GROUP_FUNCTIONS: the number of loaded WG functions above
+   which the least recently used unreferenced one is unloaded */
+static unsigned max_cache_items = 128;
+
+#if defined(ENABLE_LLVM) && !defined(BUILD_VORTEX)
+/* Tiered compilation (POCL_TIERED_COMPILATION): the first launch of a
+   kernel uses a quickly compiled WG function, while the optimized one is
+   built by a background thread and swapped into the dlhandle cache for the
+   later launches. */
+static int pocl_tiered_compilation = 0;
+
+/* Program bundles (POCL_CPU_PROGRAM_BUNDLE): the first launch of a kernel of
+   the program links the generic WG functions of all its kernels into one
+   shared object, which the launches of the other kernels then reuse. The
+   specialized WG functions are built in the background as add-on objects,
+   like the optimized tier of the tiered compilation. */
+static int pocl_program_bundle = 0;
+
+typedef struct pocl_tier_up_job pocl_tier_up_job;
+struct pocl_tier_up_job
+{
+  /* The fields of the launching command the WG function is built for. */
+  _cl_command_node command;
+  int specialize;
+  pocl_tier_up_job *next;
+};
+
+static pocl_tier_up_job *tier_up_queue = NULL;
+static pocl_lock_t tier_up_lock;
+static pocl_cond_t tier_up_cond;
+static pocl_thread_t tier_up_thread;
+static int tier_up_thread_started = 0;
+static int tier_up_shutdown = 0;
+/* The number of first tier builds in progress. The background thread does
+   not start the next optimized build before they are done, as they compete
+   for the same LLVM context. */
+static unsigned quick_builds_pending = 0;
+/* Serializes the first tier builds. Their target machines and pass
+   managers are kept per device (not per context) in pocl_llvm_wg.cc, so
+   the builds of different contexts would share them. */
+static pocl_lock_t quick_codegen_lock;
+#endif
 
 /* only to be called in basic/pthread/<other cpu driver> init */
 void
@@ -1216,12 +1412,24 @@ pocl_init_dlhandle_cache ()
     {
       POCL_INIT_LOCK (pocl_llvm_codegen_lock);
       POCL_INIT_LOCK (pocl_dlhandle_lock);
+      POCL_INIT_COND (pocl_dlhandle_cond);
+      int max_items = pocl_get_int_option ("POCL_MAX_WORK_GROUP_FUNCTIONS",
+                                           max_cache_items);
+      if (max_items > 0)
+        max_cache_items = (unsigned)max_items;
+#if defined(ENABLE_LLVM) && !defined(BUILD_VORTEX)
+      pocl_tiered_compilation
+          = pocl_get_bool_option ("POCL_TIERED_COMPILATION", 0);
+      pocl_program_bundle
+          = pocl_get_bool_option ("POCL_CPU_PROGRAM_BUNDLE", 0);
+      POCL_INIT_LOCK (tier_up_lock);
+      POCL_INIT_COND (tier_up_cond);
+      POCL_INIT_LOCK (quick_codegen_lock);
+#endif
       pocl_dlhandle_cache_initialized = 1;
    }
 }
 
-static unsigned handle_count = 0;
-#define MAX_CACHE_ITEMS 128
 
 /* must be called with pocl_dlhandle_lock LOCKED */
 static pocl_dlhandle_cache_item *
@@ -1237,13 +1445,16 @@ get_new_dlhandle_cache_item ()
         ci = ci->prev;
     }
 
-  if ((handle_count >= MAX_CACHE_ITEMS) && ci && (ci != pocl_dlhandle_cache))
+  if ((handle_count >= max_cache_items) && ci && (ci != pocl_dlhandle_cache))
     {
       DL_DELETE (pocl_dlhandle_cache, ci);
       dlclose (ci->dlhandle);
       dl_error = dlerror ();
       if (dl_error != NULL)
         POCL_ABORT ("dlclose() failed with error: %s\n", dl_error);
+      POCL_MEM_STATS_FREE (NULL, POCL_MEM_KERNEL_MODULES, ci->module_size);
+      assert (ci->stale_dlhandle == NULL);
+      free (ci->spec_args);
       memset (ci, 0, sizeof (pocl_dlhandle_cache_item));
     }
   else
@@ -1256,28 +1467,41 @@ get_new_dlhandle_cache_item ()
   return ci;
 }
 
+/* Returns nonzero if the WG function of the cache item has the argument
+   values of the command folded in, or none if spec_args_hash is zero. */
+static int
+same_spec_args (pocl_dlhandle_cache_item *ci, uint64_t spec_args_hash,
+                const _cl_command_run *run_cmd)
+{
+  if (ci->spec_args_hash != spec_args_hash)
+    return 0;
+  if (spec_args_hash == 0)
+    return 1;
+  return ci->spec_args_size == run_cmd->spec_args_size
+         && memcmp (ci->spec_args, run_cmd->spec_args, ci->spec_args_size)
+                == 0;
+}
+
+/* Drops the reference of the WG function cache item that
+   pocl_check_kernel_dlhandle_cache () retained for the launch. */
 void
 pocl_release_dlhandle_cache (_cl_command_node *cmd)
 {
-  pocl_dlhandle_cache_item *ci = NULL, *found = NULL;
+  pocl_dlhandle_cache_item *found
+      = (pocl_dlhandle_cache_item *)cmd->command.run.dlhandle_cache_item;
 
   POCL_LOCK (pocl_dlhandle_lock);
-  DL_FOREACH (pocl_dlhandle_cache, ci)
-  {
-    if ((memcmp (ci->hash, cmd->command.run.hash, sizeof (pocl_kernel_hash_t))
-         == 0)
-        && (ci->local_wgs[0] == cmd->command.run.pc.local_size[0])
-        && (ci->local_wgs[1] == cmd->command.run.pc.local_size[1])
-        && (ci->local_wgs[2] == cmd->command.run.pc.local_size[2]))
-      {
-        found = ci;
-        break;
-      }
-  }
-
   assert (found != NULL);
   assert (found->ref_count > 0);
+  cmd->command.run.dlhandle_cache_item = NULL;
   --found->ref_count;
+  if (found->ref_count == 0 && found->stale_dlhandle != NULL)
+    {
+      dlclose (found->stale_dlhandle);
+      POCL_MEM_STATS_FREE (NULL, POCL_MEM_KERNEL_MODULES,
+                           found->stale_module_size);
+      found->stale_dlhandle = NULL;
+    }
   POCL_UNLOCK (pocl_dlhandle_lock);
 }
 
@@ -1319,7 +1543,7 @@ pocl_check_kernel_disk_cache (_cl_command_node *command, int specialized)
 #ifdef ENABLE_LLVM
       POCL_LOCK (pocl_llvm_codegen_lock);
       int error = llvm_codegen (module_fn, dev_i, k, command->device, command,
-                                specialized);
+                                specialized, 0);
       POCL_UNLOCK (pocl_llvm_codegen_lock);
       if (error)
         POCL_ABORT ("Final linking of kernel %s failed.\n", k->name);
@@ -1376,6 +1600,9 @@ fetch_dlhandle_cache_item (_cl_command_run *run_cmd, int specialize)
         && (ci->local_wgs[2] == run_cmd->pc.local_size[2])
         && (max_grid_width <= ci->max_grid_dim_width)
         && (ci->specialize == specialize)
+        && same_spec_args (ci, specialize ? run_cmd->spec_args_hash : 0,
+                           run_cmd)
+        && (ci->noalias_args == (specialize && run_cmd->noalias_args))
         && (ci->goffs_zero == (run_cmd->pc.global_offset[0] == 0
                 && run_cmd->pc.global_offset[1] == 0
                 && run_cmd->pc.global_offset[2] == 0)))
@@ -1390,6 +1617,477 @@ fetch_dlhandle_cache_item (_cl_command_run *run_cmd, int specialize)
   return NULL;
 }
 
+#if !(defined(BUILD_VORTEX) && !defined(OCS_AVAILABLE))                     \
+    && !(defined(CROSS_COMPILATION) && defined(OCS_AVAILABLE))
+/* Loads the module and returns its work-group function. The caller should
+   hold pocl_dlhandle_lock. */
+static void *
+load_work_group_function (const char *module_fn, const char *kernel_name,
+                          void **dlhandle, size_t *module_size)
+{
+  char workgroup_string[WORKGROUP_STRING_LENGTH];
+  const char *dl_error = NULL;
+  void *wg = NULL;
+
+  // reset possibly existing error from calls from an ICD loader
+  (void)dlerror();
+  *dlhandle = dlopen (module_fn, RTLD_NOW | RTLD_LOCAL);
+  dl_error = dlerror ();
+
+  if (*dlhandle == NULL || dl_error != NULL)
+    POCL_ABORT ("dlopen(\"%s\") failed with '%s'.\n"
+                "note: missing symbols in the kernel binary might be"
+                " reported as 'file not found' errors.\n",
+                module_fn, dl_error);
+
+  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+            "_pocl_kernel_%s_workgroup", kernel_name);
+
+  wg = dlsym (*dlhandle, workgroup_string);
+  dl_error = dlerror ();
+
+  if (wg == NULL || dl_error != NULL)
+    {
+      // Older OSX dyld APIs need the name without the underscore.
+      snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+                "pocl_kernel_%s_workgroup", kernel_name);
+
+      wg = dlsym (*dlhandle, workgroup_string);
+      dl_error = dlerror ();
+
+      if (wg == NULL || dl_error != NULL)
+        POCL_ABORT ("dlsym(\"%s\", \"%s\") failed with '%s'.\n"
+                    "note: missing symbols in the kernel binary might be"
+                    " reported as 'file not found' errors.\n",
+                    module_fn, workgroup_string, dl_error);
+    }
+
+#ifdef __linux__
+  if (pocl_perf_jitdump_enabled)
+    pocl_perf_jitdump_register (kernel_name, wg, module_fn);
+#endif
+
+  *module_size = 0;
+  if (pocl_mem_stats_enabled)
+    {
+      struct stat st;
+      if (stat (module_fn, &st) == 0)
+        *module_size = st.st_size;
+      pocl_mem_stats_alloc (NULL, POCL_MEM_KERNEL_MODULES, *module_size);
+    }
+
+  return wg;
+}
+#endif
+
+#if defined(ENABLE_LLVM) && !defined(BUILD_VORTEX)
+
+/* Copies the argument values the WG function folds in, for building it
+   after the launching command has been freed. */
+static struct pocl_argument *
+copy_specialized_args (cl_kernel k, struct pocl_argument *args)
+{
+  struct pocl_argument *copy = (struct pocl_argument *)calloc (
+      k->meta->num_args, sizeof (struct pocl_argument));
+  unsigned i;
+
+  for (i = 0; i < k->meta->num_args; ++i)
+    {
+      if (!(k->meta->specialized_args & ((uint64_t)1 << i)))
+        continue;
+      copy[i].size = args[i].size;
+      copy[i].value = malloc (args[i].size);
+      memcpy (copy[i].value, args[i].value, args[i].size);
+    }
+  return copy;
+}
+
+static void
+free_specialized_args (cl_kernel k, struct pocl_argument *args)
+{
+  unsigned i;
+
+  if (args == NULL)
+    return;
+  for (i = 0; i < k->meta->num_args; ++i)
+    POCL_MEM_FREE (args[i].value);
+  free (args);
+}
+
+/* Builds the optimized WG function of a job and swaps it into the dlhandle
+   cache item that has the first tier version. */
+static void
+tier_up (pocl_tier_up_job *job)
+{
+  _cl_command_node *command = &job->command;
+  _cl_command_run *run_cmd = &command->command.run;
+  cl_kernel k = run_cmd->kernel;
+  pocl_dlhandle_cache_item *ci = NULL, *found = NULL;
+  char module_fn[POCL_MAX_PATHNAME_LENGTH];
+  void *dlhandle = NULL, *wg = NULL;
+  size_t module_size = 0;
+  int goffs_zero = run_cmd->pc.global_offset[0] == 0
+                   && run_cmd->pc.global_offset[1] == 0
+                   && run_cmd->pc.global_offset[2] == 0;
+
+  uint64_t start = pocl_gettimemono_ns ();
+  POCL_LOCK (pocl_llvm_codegen_lock);
+  int error = llvm_codegen (module_fn, command->program_device_i, k,
+                            command->device, command, job->specialize, 0);
+  POCL_UNLOCK (pocl_llvm_codegen_lock);
+  if (error)
+    {
+      POCL_MSG_WARN ("Building the optimized WG function of kernel %s "
+                     "failed, keeping the quickly compiled one.\n",
+                     k->name);
+      goto FINISH;
+    }
+  POCL_MSG_PRINT_INFO ("Built an optimized WG function in the background "
+                       "in %" PRIu64 " ms: %s\n",
+                       (pocl_gettimemono_ns () - start) / 1000000, module_fn);
+
+  POCL_LOCK (pocl_dlhandle_lock);
+  DL_FOREACH (pocl_dlhandle_cache, ci)
+  {
+    if (ci->quick
+        && (memcmp (ci->hash, run_cmd->hash, sizeof (pocl_kernel_hash_t)) == 0)
+        && (ci->local_wgs[0] == run_cmd->pc.local_size[0])
+        && (ci->local_wgs[1] == run_cmd->pc.local_size[1])
+        && (ci->local_wgs[2] == run_cmd->pc.local_size[2])
+        && (ci->max_grid_dim_width == pocl_cmd_max_grid_dim_width (run_cmd))
+        && (ci->specialize == job->specialize)
+        && same_spec_args (ci, job->specialize ? run_cmd->spec_args_hash : 0,
+                           run_cmd)
+        && (ci->noalias_args == (job->specialize && run_cmd->noalias_args))
+        && (ci->goffs_zero == goffs_zero))
+      {
+        found = ci;
+        break;
+      }
+  }
+
+  /* Evicted from the cache in the meantime; the next launch loads the
+     optimized one from the disk. */
+  if (found != NULL)
+    {
+      wg = load_work_group_function (module_fn, k->name, &dlhandle,
+                                     &module_size);
+      /* The commands that already got the first tier version keep using
+         it, so it cannot be closed before they are released. */
+      if (found->ref_count > 0)
+        {
+          assert (found->stale_dlhandle == NULL);
+          found->stale_dlhandle = found->dlhandle;
+          found->stale_module_size = found->module_size;
+        }
+      else
+        {
+          dlclose (found->dlhandle);
+          POCL_MEM_STATS_FREE (NULL, POCL_MEM_KERNEL_MODULES,
+                               found->module_size);
+        }
+      found->dlhandle = dlhandle;
+      found->wg = wg;
+      found->module_size = module_size;
+      found->quick = 0;
+      found->bundled = 0;
+    }
+  POCL_UNLOCK (pocl_dlhandle_lock);
+
+  /* Not needed anymore, the next process uses the optimized one. */
+  strcat (module_fn, POCL_QUICK_BINARY_SUFFIX);
+  pocl_remove (module_fn);
+
+FINISH:
+  free_specialized_args (k, run_cmd->arguments);
+  POname (clReleaseKernel) (k);
+  free (job);
+}
+
+static void *
+tier_up_thread_func (void *arg)
+{
+  pocl_tier_up_job *job;
+
+  POCL_LOCK (tier_up_lock);
+  while (1)
+    {
+      while ((tier_up_queue == NULL || quick_builds_pending > 0)
+             && !tier_up_shutdown)
+        POCL_WAIT_COND (tier_up_cond, tier_up_lock);
+      if (tier_up_shutdown)
+        break;
+      job = tier_up_queue;
+      LL_DELETE (tier_up_queue, job);
+      POCL_UNLOCK (tier_up_lock);
+      tier_up (job);
+      POCL_LOCK (tier_up_lock);
+    }
+  POCL_UNLOCK (tier_up_lock);
+  return NULL;
+}
+
+/* Lets the build in progress finish at exit, so the thread is not running
+   in LLVM while its static objects are destroyed. The queued jobs are
+   dropped. */
+static void
+stop_tier_up_thread ()
+{
+  POCL_LOCK (tier_up_lock);
+  tier_up_shutdown = 1;
+  POCL_SIGNAL_COND (tier_up_cond);
+  POCL_UNLOCK (tier_up_lock);
+  POCL_JOIN_THREAD (tier_up_thread);
+}
+
+static void
+queue_tier_up (_cl_command_node *command, int specialize)
+{
+  pocl_tier_up_job *job
+      = (pocl_tier_up_job *)calloc (1, sizeof (pocl_tier_up_job));
+  job->command.type = command->type;
+  job->command.device = command->device;
+  job->command.program_device_i = command->program_device_i;
+  job->command.command.run = command->command.run;
+  /* freed with the launching command */
+  job->command.command.run.arguments = NULL;
+  job->specialize = specialize;
+  if (specialize && command->command.run.spec_args_hash != 0)
+    job->command.command.run.arguments
+        = copy_specialized_args (command->command.run.kernel,
+                                 command->command.run.arguments);
+  POname (clRetainKernel) (job->command.command.run.kernel);
+
+  POCL_LOCK (tier_up_lock);
+  if (!tier_up_thread_started)
+    {
+      POCL_CREATE_THREAD (tier_up_thread, tier_up_thread_func, NULL);
+      atexit (stop_tier_up_thread);
+      tier_up_thread_started = 1;
+    }
+  LL_APPEND (tier_up_queue, job);
+  POCL_SIGNAL_COND (tier_up_cond);
+  POCL_UNLOCK (tier_up_lock);
+}
+
+/* Builds the first tier WG function for the command. Returns the file name
+   of the first tier binary, or NULL if the optimized one should be used
+   right away (it is in the disk cache already, or there is no LLVM IR to
+   build it from). The caller queues the build of the optimized one once it
+   has loaded the first tier binary.
+
+   This does not take pocl_llvm_codegen_lock, which the background thread
+   holds for a whole optimized build, but quick_codegen_lock: the first tier
+   has its own target machines and pass managers, which are shared by all
+   the contexts, so the LLVM context lock taken by each compilation step is
+   not enough. The background thread waits for the pending first tier
+   builds before it starts the next one. */
+static char *
+build_quick_tier (_cl_command_node *command, int specialize)
+{
+  _cl_command_run *run_cmd = &command->command.run;
+  cl_kernel k = run_cmd->kernel;
+  cl_program p = k->program;
+  unsigned dev_i = command->program_device_i;
+  char *module_fn;
+
+  if (p->binaries[dev_i] == NULL)
+    return NULL;
+
+  module_fn = malloc (POCL_MAX_PATHNAME_LENGTH);
+  pocl_cache_final_binary_path (module_fn, p, dev_i, k, command, specialize);
+  if (pocl_exists (module_fn))
+    {
+      POCL_MEM_FREE (module_fn);
+      return NULL;
+    }
+
+  POCL_LOCK (tier_up_lock);
+  ++quick_builds_pending;
+  POCL_UNLOCK (tier_up_lock);
+
+  uint64_t start = pocl_gettimemono_ns ();
+  POCL_LOCK (quick_codegen_lock);
+  int error = llvm_codegen (module_fn, dev_i, k, command->device, command,
+                            specialize, 1);
+  POCL_UNLOCK (quick_codegen_lock);
+
+  POCL_LOCK (tier_up_lock);
+  --quick_builds_pending;
+  POCL_SIGNAL_COND (tier_up_cond);
+  POCL_UNLOCK (tier_up_lock);
+
+  if (error)
+    {
+      POCL_MSG_WARN ("Building the quick WG function of kernel %s failed, "
+                     "building the optimized one instead.\n",
+                     k->name);
+      POCL_MEM_FREE (module_fn);
+      return NULL;
+    }
+  POCL_MSG_PRINT_INFO ("Built a quick %sWG function in %" PRIu64 " ms: %s\n",
+                       specialize ? "specialized " : "generic ",
+                       (pocl_gettimemono_ns () - start) / 1000000, module_fn);
+  return module_fn;
+}
+
+/* Builds the generic WG functions of all the kernels of the program into
+   one shared object, unless it is in the disk cache already. Returns the
+   file name of the bundle, or NULL if it could not be built.
+
+   pocl_llvm_codegen_lock is held only while each kernel is generated and
+   compiled, so the wait for another process' build lease and the final link
+   do not hold up the other builds. */
+static char *
+build_program_bundle (cl_program program, unsigned dev_i, cl_device_id device)
+{
+  char *bundle_fn = malloc (POCL_MAX_PATHNAME_LENGTH);
+  char tmp_module[POCL_MAX_PATHNAME_LENGTH];
+  char **objfiles = NULL;
+  const char **cmd_line = NULL;
+  unsigned num_objfiles = 0, i;
+  int lease_fd = -1;
+  int error = 0;
+
+  pocl_cache_program_path (bundle_fn, program, dev_i);
+  strcat (bundle_fn, POCL_PROGRAM_BUNDLE_FILENAME);
+  if (pocl_exists (bundle_fn))
+    return bundle_fn;
+  if (!pocl_cache_acquire_build_lease (bundle_fn, &lease_fd))
+    return bundle_fn;
+
+  uint64_t start = pocl_gettimemono_ns ();
+  objfiles = (char **)calloc (program->num_kernels, sizeof (char *));
+
+  _cl_command_node cmd;
+  struct _cl_kernel fake_k;
+  memset (&cmd, 0, sizeof (cmd));
+  memset (&fake_k, 0, sizeof (fake_k));
+  cmd.type = CL_COMMAND_NDRANGE_KERNEL;
+  cmd.device = device;
+  cmd.program_device_i = dev_i;
+  cmd.command.run.kernel = &fake_k;
+  fake_k.context = program->context;
+  fake_k.program = program;
+
+  for (i = 0; i < program->num_kernels; ++i)
+    {
+      void *llvm_module = NULL;
+      char *objfile = NULL;
+      uint64_t objfile_size = 0;
+      unsigned d;
+
+      fake_k.meta = &program->kernel_meta[i];
+      fake_k.name = fake_k.meta->name;
+      cmd.command.run.hash = fake_k.meta->build_hash[dev_i];
+      /* as in pocl_driver_build_poclbinary () */
+      for (d = 0; d < OPENCL_MAX_DIMENSION; ++d)
+        cmd.command.run.pc.local_size[d] = fake_k.meta->reqd_wg_size[d];
+
+      POCL_LOCK (pocl_llvm_codegen_lock);
+      error = pocl_llvm_generate_workgroup_function_nowrite (
+          dev_i, device, &fake_k, &cmd, &llvm_module, 0, 0);
+      if (error == 0)
+        error = pocl_llvm_codegen (device, program, llvm_module, &objfile,
+                                   &objfile_size, 0);
+      POCL_UNLOCK (pocl_llvm_codegen_lock);
+      if (error == 0)
+        {
+          objfiles[num_objfiles] = malloc (POCL_MAX_PATHNAME_LENGTH);
+          error = pocl_cache_write_kernel_objfile (objfiles[num_objfiles++],
+                                                   objfile, objfile_size);
+        }
+      pocl_destroy_llvm_module (llvm_module, program->context);
+      POCL_MEM_FREE (objfile);
+      if (error)
+        {
+          POCL_MSG_PRINT_LLVM ("Building kernel %s for the program bundle "
+                               "failed\n",
+                               fake_k.name);
+          goto FINISH;
+        }
+    }
+
+  error = pocl_cache_tempname (tmp_module, ".so", NULL);
+  if (error)
+    goto FINISH;
+
+  unsigned num_ld_flags = 0;
+  while (device->final_linkage_flags[num_ld_flags] != NULL)
+    ++num_ld_flags;
+  cmd_line = (const char **)calloc (num_objfiles + num_ld_flags + 8,
+                                    sizeof (const char *));
+  const char **pos = cmd_line;
+  *pos++ = CLANG;
+#ifdef GCC_TOOLCHAIN
+  *pos++ = "--gcc-toolchain=" GCC_TOOLCHAIN;
+#endif
+  *pos++ = "-o";
+  *pos++ = tmp_module;
+  for (i = 0; i < num_objfiles; ++i)
+    *pos++ = objfiles[i];
+  for (i = 0; i < num_ld_flags; ++i)
+    *pos++ = device->final_linkage_flags[i];
+
+  error = pocl_invoke_clang (device, cmd_line);
+  if (error)
+    {
+      POCL_MSG_PRINT_LLVM ("Linking the program bundle has failed\n");
+      pocl_remove (tmp_module);
+      goto FINISH;
+    }
+
+  error = pocl_rename (tmp_module, bundle_fn);
+  if (error == 0)
+    POCL_MSG_PRINT_INFO ("Built a bundle of %u kernels in %" PRIu64
+                         " ms: %s\n",
+                         num_objfiles,
+                         (pocl_gettimemono_ns () - start) / 1000000,
+                         bundle_fn);
+
+FINISH:
+  for (i = 0; i < num_objfiles; ++i)
+    {
+      pocl_remove (objfiles[i]);
+      free (objfiles[i]);
+    }
+  free (objfiles);
+  free (cmd_line);
+  pocl_cache_release_build_lease (bundle_fn, lease_fd);
+  if (error)
+    {
+      POCL_MSG_WARN ("Could not build the program bundle, building the "
+                     "kernels separately.\n");
+      POCL_MEM_FREE (bundle_fn);
+    }
+  return bundle_fn;
+}
+
+/* Returns the program bundle for a launch whose own WG function is not in
+   the disk cache yet. Returns NULL if the launch should use its own WG
+   function right away. For a specialized launch, the caller queues the
+   build of the specialized WG function once it has loaded the bundle. */
+static char *
+use_program_bundle (_cl_command_node *command, int specialize)
+{
+  _cl_command_run *run_cmd = &command->command.run;
+  cl_kernel k = run_cmd->kernel;
+  cl_program p = k->program;
+  unsigned dev_i = command->program_device_i;
+  char module_fn[POCL_MAX_PATHNAME_LENGTH];
+
+  /* nothing to share */
+  if (p->binaries[dev_i] == NULL || p->num_kernels < 2)
+    return NULL;
+
+  pocl_cache_final_binary_path (module_fn, p, dev_i, k, command, specialize);
+  if (pocl_exists (module_fn))
+    return NULL;
+
+  return build_program_bundle (p, dev_i, command->device);
+}
+#endif
+
 /**
  * Checks if the kernel command has been built and has been loaded with
  * dlopen, and reuses its handle. If not, checks if a built binary is found
@@ -1409,9 +2107,7 @@ void
 pocl_check_kernel_dlhandle_cache (_cl_command_node *command,
                                   int retain, int specialize)
 {
-  char workgroup_string[WORKGROUP_STRING_LENGTH];
   pocl_dlhandle_cache_item *ci = NULL;
-  const char *dl_error = NULL;
   _cl_command_run *run_cmd = &command->command.run;
 
   /* Brute force mechanism to test relying on generic work-group functions
@@ -1420,28 +2116,63 @@ pocl_check_kernel_dlhandle_cache (_cl_command_node *command,
     specialize = 0;
 
   POCL_LOCK (pocl_dlhandle_lock);
-  ci = fetch_dlhandle_cache_item (run_cmd, specialize);
+  while ((ci = fetch_dlhandle_cache_item (run_cmd, specialize)) != NULL
+         && ci->building)
+    POCL_WAIT_COND (pocl_dlhandle_cond, pocl_dlhandle_lock);
   if (ci != NULL)
     {
-      if (retain) ++ci->ref_count;
+      if (retain)
+        {
+          ++ci->ref_count;
+          run_cmd->dlhandle_cache_item = ci;
+        }
+#if defined(ENABLE_LLVM) && !defined(BUILD_VORTEX)
+      int bundled = ci->bundled;
+#endif
       POCL_UNLOCK (pocl_dlhandle_lock);
+#if defined(ENABLE_LLVM) && !defined(BUILD_VORTEX)
+      /* pre-compilation for binaries needs the kernel's own binary */
+      if (!retain && bundled)
+        {
+          char *module_fn = pocl_check_kernel_disk_cache (command, specialize);
+          POCL_MEM_FREE (module_fn);
+        }
+#endif
       return;
     }
 
-  /* Not found, build a new kernel and cache its dlhandle. */
+  /* Not found. Add a placeholder for the other launches of the kernel to
+     wait for, and build the kernel and load its dlhandle without holding
+     the lock, so the launches of the other kernels are not held up. The
+     reference of the placeholder keeps it from being evicted meanwhile. */
   ci = get_new_dlhandle_cache_item ();
   memcpy (ci->hash, run_cmd->hash, sizeof (pocl_kernel_hash_t));
   ci->local_wgs[0] = run_cmd->pc.local_size[0];
   ci->local_wgs[1] = run_cmd->pc.local_size[1];
   ci->local_wgs[2] = run_cmd->pc.local_size[2];
-  ci->ref_count = retain ? 1 : 0;
+  ci->ref_count = 1;
+  ci->building = 1;
   ci->specialize = specialize;
+  ci->spec_args_hash = specialize ? run_cmd->spec_args_hash : 0;
+  if (ci->spec_args_hash != 0)
+    {
+      ci->spec_args = (unsigned char *)malloc (run_cmd->spec_args_size);
+      memcpy (ci->spec_args, run_cmd->spec_args, run_cmd->spec_args_size);
+      ci->spec_args_size = run_cmd->spec_args_size;
+    }
+  ci->noalias_args = specialize && run_cmd->noalias_args;
   ci->goffs_zero = run_cmd->pc.global_offset[0] == 0
                 && run_cmd->pc.global_offset[1] == 0
                 && run_cmd->pc.global_offset[2] == 0;
 
   size_t max_grid_width = pocl_cmd_max_grid_dim_width (run_cmd);
   ci->max_grid_dim_width = max_grid_width;
+  DL_PREPEND (pocl_dlhandle_cache, ci);
+  POCL_UNLOCK (pocl_dlhandle_lock);
+
+  void *wg = NULL, *dlhandle = NULL;
+  size_t module_size = 0;
+  int quick = 0, bundled = 0;
 
 #if defined(BUILD_VORTEX) && !defined(OCS_AVAILABLE)
   {
@@ -1454,48 +2185,46 @@ pocl_check_kernel_dlhandle_cache (_cl_command_node *command,
   }
 #else
 
-  char *module_fn = pocl_check_kernel_disk_cache (command, specialize); 
-  // reset possibly existing error from calls from an ICD loader
-  (void)dlerror();
-  ci->dlhandle = dlopen (module_fn, RTLD_NOW | RTLD_LOCAL);
-  dl_error = dlerror ();
-
-  if (ci->dlhandle == NULL || dl_error != NULL)
-    POCL_ABORT ("dlopen(\"%s\") failed with '%s'.\n"
-                "note: missing symbols in the kernel binary might be"
-                " reported as 'file not found' errors.\n",
-                module_fn, dl_error);
-
-  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
-            "_pocl_kernel_%s_workgroup", run_cmd->kernel->name);
-
-  ci->wg = dlsym (ci->dlhandle, workgroup_string);
-  dl_error = dlerror ();
-
-  if (ci->wg == NULL || dl_error != NULL)
+  char *module_fn = NULL;
+#if defined(ENABLE_LLVM) && !defined(BUILD_VORTEX)
+  /* Only actual launches are tiered or bundled, not the pre-compilation
+     for binaries. */
+  if (pocl_program_bundle && retain)
     {
-      // Older OSX dyld APIs need the name without the underscore.
-      snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
-                "pocl_kernel_%s_workgroup", run_cmd->kernel->name);
-
-      ci->wg = dlsym (ci->dlhandle, workgroup_string);
-      dl_error = dlerror ();
-
-      if (ci->wg == NULL || dl_error != NULL)
-        POCL_ABORT ("dlsym(\"%s\", \"%s\") failed with '%s'.\n"
-                    "note: missing symbols in the kernel binary might be"
-                    " reported as 'file not found' errors.\n",
-                    module_fn, workgroup_string, dl_error);
+      module_fn = use_program_bundle (command, specialize);
+      bundled = (module_fn != NULL);
     }
+  if (module_fn == NULL && pocl_tiered_compilation && retain)
+    module_fn = build_quick_tier (command, specialize);
+  quick = (module_fn != NULL && (!bundled || specialize));
+#endif
+  if (module_fn == NULL)
+    module_fn = pocl_check_kernel_disk_cache (command, specialize);
 
+  wg = load_work_group_function (module_fn, run_cmd->kernel->name, &dlhandle,
+                                 &module_size);
   POCL_MEM_FREE (module_fn);  
 #endif
 
+  POCL_LOCK (pocl_dlhandle_lock);
+  ci->wg = wg;
+  ci->dlhandle = dlhandle;
+  ci->module_size = module_size;
+  ci->quick = quick;
+  ci->bundled = bundled;
+  ci->ref_count = retain ? 1 : 0;
+  ci->building = 0;
   run_cmd->wg = ci->wg;
-  DL_PREPEND (pocl_dlhandle_cache, ci);
-
+  if (retain)
+    run_cmd->dlhandle_cache_item = ci;
+  POCL_BROADCAST_COND (pocl_dlhandle_cond);
   POCL_UNLOCK (pocl_dlhandle_lock);
-  //POCL_MEM_FREE (module_fn);
+
+#if defined(ENABLE_LLVM) && !defined(BUILD_VORTEX)
+  /* Queued only now, so the swap finds the loaded first tier version. */
+  if (quick)
+    queue_tier_up (command, specialize);
+#endif
 }
 
 #endif
@@ -1724,6 +2453,9 @@ pocl_print_system_memory_stats()
  * this should be reasonable for CPU */
 #define DEFAULT_WG_SIZE 4096
 
+/* roughly the DRAM latency of a desktop CPU, in cycles */
+#define DEFAULT_PREFETCH_LATENCY 200
+
 void
 pocl_init_default_device_infos (cl_device_id dev)
 {
@@ -1931,6 +2663,13 @@ pocl_init_default_device_infos (cl_device_id dev)
   dev->on_host_queue_props = CL_QUEUE_PROFILING_ENABLE;
   dev->has_64bit_long = 1;
   dev->autolocals_to_args = POCL_AUTOLOCALS_TO_ARGS_ALWAYS;
+  dev->prefetch_latency
+      = pocl_get_int_option ("POCL_PREFETCH_LATENCY", DEFAULT_PREFETCH_LATENCY);
+  dev->prefetch_min_stride
+      = pocl_get_int_option ("POCL_PREFETCH_MIN_STRIDE", 0);
+  dev->staging_copy_elimination
+      = pocl_get_bool_option ("POCL_STAGING_COPY_ELIMINATION", 0);
+  dev->barrier_elision = pocl_get_bool_option ("POCL_BARRIER_ELISION", 1);
   dev->device_alloca_locals = 0;
   dev->global_var_max_size = 0;
   dev->global_var_pref_size = 0;
@@ -2091,7 +2830,9 @@ static const cl_name_version OPENCL_EXTENSIONS[]
         { CL_MAKE_VERSION (1, 0, 0), "cl_khr_image2d_from_buffer" },
         { CL_MAKE_VERSION (2, 1, 0), "cl_khr_spir" },
         { CL_MAKE_VERSION (2, 1, 0), "cl_khr_il_program" },
-        { CL_MAKE_VERSION (0, 9, 0), "cl_khr_command_buffer" } };
+        { CL_MAKE_VERSION (0, 9, 0), "cl_khr_command_buffer" },
+        { CL_MAKE_VERSION (0, 9, 0),
+          "cl_khr_command_buffer_mutable_dispatch" } };
 
 const size_t OPENCL_EXTENSIONS_NUM
     = sizeof (OPENCL_EXTENSIONS) / sizeof (OPENCL_EXTENSIONS[0]);
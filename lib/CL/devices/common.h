@@ -86,6 +86,9 @@ char *pocl_check_kernel_disk_cache (_cl_command_node *cmd, int specialized);
 POCL_EXPORT
 size_t pocl_cmd_max_grid_dim_width (_cl_command_run *cmd);
 
+POCL_EXPORT
+void pocl_cmd_set_noalias_args (_cl_command_node *cmd);
+
 POCL_EXPORT
 void pocl_check_kernel_dlhandle_cache (_cl_command_node *command,
                                        int retain,
@@ -114,6 +117,9 @@ void pocl_print_system_memory_stats();
 POCL_EXPORT
 void pocl_init_default_device_infos (cl_device_id dev);
 
+POCL_EXPORT
+void pocl_init_cpu_sub_groups (cl_device_id dev);
+
 POCL_EXPORT
 void pocl_setup_opencl_c_with_version (cl_device_id dev, int supports_30);
 
@@ -36,6 +36,9 @@
 #include "pocl_util.h"
 #include "pocl_file_util.h"
 
+// for copy-on-write buffer copies
+#include "pocl_cow.h"
+
 // for SPIR-V handling
 #include "pocl_cache.h"
 #include "pocl_file_util.h"
@@ -106,6 +109,16 @@ pocl_driver_copy (void *data, pocl_mem_identifier *dst_mem_id, cl_mem dst_buf,
   if ((src_ptr + src_offset) == (dst_ptr + dst_offset))
     return;
 
+  /* share the pages until either buffer writes them */
+  if (src_buf->mem_host_ptr_cow && dst_buf->mem_host_ptr_cow
+      && src_ptr == src_buf->mem_host_ptr && dst_ptr == dst_buf->mem_host_ptr
+      && pocl_cow_copy ((pocl_cow_buffer *)dst_buf->mem_host_ptr_cow,
+                        dst_offset,
+                        (pocl_cow_buffer *)src_buf->mem_host_ptr_cow,
+                        src_offset, size)
+             == 0)
+    return;
+
   memcpy (dst_ptr + dst_offset, src_ptr + src_offset, size);
 }
 
@@ -310,12 +323,53 @@ pocl_driver_read_rect (void *data, void *__restrict__ const host_ptr,
     }
 }
 
+/* Smaller zero fills are written, it is cheaper than faulting the pages
+ * back in. */
+#define LAZY_ZERO_FILL_MIN_SIZE (2 * 1024 * 1024)
+
+/* Whether a fill can drop the pages of the buffer instead of writing
+ * zeros to them. */
+static int
+can_zero_fill_lazily (void *ptr, cl_mem buf, size_t size,
+                      const void *__restrict__ pattern, size_t pattern_size)
+{
+  static int enabled = -1;
+  size_t i;
+
+  if (enabled < 0)
+    enabled = pocl_get_bool_option ("POCL_LAZY_ZERO_FILL", 1);
+  if (!enabled || buf == NULL || size < LAZY_ZERO_FILL_MIN_SIZE)
+    return 0;
+
+  /* only the memory pocl allocated itself is known to be anonymous, and
+   * the pages must not be registered to another device */
+  if (ptr != buf->mem_host_ptr || !buf->mem_host_ptr_is_malloced)
+    return 0;
+  cl_device_id svm_dev = buf->context->svm_allocdev;
+  if (svm_dev && svm_dev->ops->svm_register)
+    return 0;
+
+  for (i = 0; i < pattern_size; ++i)
+    if (((const char *)pattern)[i] != 0)
+      return 0;
+  return 1;
+}
+
 void
 pocl_driver_memfill (void *data, pocl_mem_identifier *dst_mem_id,
                      cl_mem dst_buf, size_t size, size_t offset,
                      const void *__restrict__ pattern, size_t pattern_size)
 {
   void *__restrict__ ptr = dst_mem_id->mem_ptr;
+
+  /* A cleared buffer then takes memory bandwidth only for the pages that
+   * are used again, and a new buffer cleared before its first use none. */
+  if (can_zero_fill_lazily (ptr, dst_buf, size, pattern, pattern_size))
+    {
+      pocl_zero_fill_pages ((char *)ptr + offset, size);
+      return;
+    }
+
   pocl_fill_aligned_buf_with_pattern (ptr, offset, size, pattern,
                                       pattern_size);
 }
@@ -46,6 +46,7 @@
 #include "pocl_cache.h"
 #include "pocl_debug.h"
 #include "pocl_export.h"
+#include "pocl_mem_stats.h"
 #include "pocl_runtime_config.h"
 #include "pocl_shared.h"
 #include "pocl_tracing.h"
@@ -57,6 +58,11 @@
 #include "pocl_llvm.h"
 #endif
 
+#ifdef __linux__
+#include "perf_counters.h"
+#include "perf_jitdump.h"
+#endif
+
 #ifdef BUILD_BASIC
 #include "basic/basic.h"
 #endif
@@ -517,6 +523,8 @@ pocl_init_devices ()
 
   pocl_event_tracing_init ();
 
+  pocl_mem_stats_init ();
+
 #ifdef HAVE_SLEEP
   int delay = pocl_get_int_option ("POCL_STARTUP_DELAY", 0);
   if (delay > 0)
@@ -537,6 +545,18 @@ pocl_init_devices ()
     {
       pocl_install_sigusr2_handler ();
     }
+
+#ifdef ENABLE_HOST_CPU_DEVICES
+  if (pocl_get_bool_option ("POCL_PERF_COUNTERS", 0))
+    {
+      pocl_perf_counters_init ();
+    }
+
+  if (pocl_get_bool_option ("POCL_PERF_JITDUMP", 0))
+    {
+      pocl_perf_jitdump_init ();
+    }
+#endif
 #endif
 
   pocl_offline_compile = pocl_get_bool_option ("POCL_OFFLINE_COMPILE", 0);
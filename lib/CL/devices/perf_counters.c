@@ -0,0 +1,201 @@
+/* perf_counters.c - per-command hardware performance counters for the CPU
+   drivers
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+
+#ifndef __linux__
+#error This only compiles under Linux
+#endif
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf_counters.h"
+#include "pocl_debug.h"
+
+int pocl_perf_counters_enabled = 0;
+
+static const struct
+{
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+} counter_desc[]
+    = { { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+          "branch-misses" } };
+
+/* The CPU counters are the first POCL_HW_COUNTER_* indices. */
+#define NUM_CPU_COUNTERS (sizeof (counter_desc) / sizeof (counter_desc[0]))
+
+/* The counters opened by one thread. Reading the counter also returns the
+   time it was enabled and actually counting; the previous values are kept
+   to scale the deltas in case the kernel multiplexed the counters. */
+struct thread_counters
+{
+  int fd[NUM_CPU_COUNTERS];
+  uint64_t time_enabled[NUM_CPU_COUNTERS];
+  uint64_t time_running[NUM_CPU_COUNTERS];
+};
+
+static pthread_key_t counters_key;
+
+static int
+open_counter (unsigned i)
+{
+  struct perf_event_attr attr;
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = counter_desc[i].type;
+  attr.config = counter_desc[i].config;
+  attr.disabled = 1;
+  /* user space only, so that the default perf_event_paranoid (2)
+     allows it */
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format
+      = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  /* calling thread, any CPU */
+  return (int)syscall (SYS_perf_event_open, &attr, 0, -1, -1,
+                       PERF_FLAG_FD_CLOEXEC);
+}
+
+static void
+close_thread_counters (void *p)
+{
+  struct thread_counters *tc = (struct thread_counters *)p;
+  for (unsigned i = 0; i < NUM_CPU_COUNTERS; ++i)
+    if (tc->fd[i] >= 0)
+      close (tc->fd[i]);
+  free (tc);
+}
+
+static struct thread_counters *
+get_thread_counters ()
+{
+  struct thread_counters *tc
+      = (struct thread_counters *)pthread_getspecific (counters_key);
+  if (tc != NULL)
+    return tc;
+
+  tc = (struct thread_counters *)calloc (1, sizeof (struct thread_counters));
+  if (tc == NULL)
+    return NULL;
+
+  for (unsigned i = 0; i < NUM_CPU_COUNTERS; ++i)
+    {
+      tc->fd[i] = open_counter (i);
+      if (tc->fd[i] < 0)
+        POCL_MSG_PRINT_INFO ("POCL_PERF_COUNTERS: cannot count %s\n",
+                             counter_desc[i].name);
+    }
+  pthread_setspecific (counters_key, tc);
+  return tc;
+}
+
+void
+pocl_perf_counters_init ()
+{
+  int fd = open_counter (POCL_HW_COUNTER_CYCLES);
+  if (fd < 0)
+    {
+      POCL_MSG_WARN ("POCL_PERF_COUNTERS: perf_event_open() failed, "
+                     "hardware counters will not be collected. Check "
+                     "/proc/sys/kernel/perf_event_paranoid.\n");
+      return;
+    }
+  close (fd);
+
+  if (pthread_key_create (&counters_key, close_thread_counters) != 0)
+    return;
+
+  pocl_perf_counters_enabled = 1;
+}
+
+void
+pocl_perf_counters_start ()
+{
+  struct thread_counters *tc = get_thread_counters ();
+  if (tc == NULL)
+    return;
+
+  for (unsigned i = 0; i < NUM_CPU_COUNTERS; ++i)
+    {
+      if (tc->fd[i] < 0)
+        continue;
+      ioctl (tc->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl (tc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void
+pocl_perf_counters_stop (cl_event event)
+{
+  struct thread_counters *tc
+      = (struct thread_counters *)pthread_getspecific (counters_key);
+  if (tc == NULL)
+    return;
+
+  for (unsigned i = 0; i < NUM_CPU_COUNTERS; ++i)
+    if (tc->fd[i] >= 0)
+      ioctl (tc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+  cl_uint mask = 0;
+  for (unsigned i = 0; i < NUM_CPU_COUNTERS; ++i)
+    {
+      /* value, time_enabled, time_running */
+      uint64_t buf[3];
+      if (tc->fd[i] < 0 || read (tc->fd[i], buf, sizeof (buf)) != sizeof (buf))
+        continue;
+
+      /* The times are not reset by PERF_EVENT_IOC_RESET. */
+      uint64_t enabled = buf[1] - tc->time_enabled[i];
+      uint64_t running = buf[2] - tc->time_running[i];
+      tc->time_enabled[i] = buf[1];
+      tc->time_running[i] = buf[2];
+
+      /* The counter did not get a hardware slot at all. */
+      if (running == 0)
+        continue;
+
+      uint64_t value = buf[0];
+      if (running < enabled)
+        value = (uint64_t)((double)value * enabled / running);
+
+      __atomic_add_fetch (&event->hw_counters[i], value, __ATOMIC_RELAXED);
+      mask |= (1U << i);
+    }
+
+  if (mask)
+    __atomic_or_fetch (&event->hw_counter_mask, mask, __ATOMIC_RELAXED);
+}
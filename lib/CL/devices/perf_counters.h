@@ -0,0 +1,64 @@
+/* perf_counters.h - per-command hardware performance counters for the CPU
+   drivers
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* When POCL_PERF_COUNTERS is enabled, every thread that executes work-groups
+   lazily opens a set of perf_event counters for itself (cycles,
+   instructions, cache misses and branch misses). The counters are enabled
+   only around the work-group loop of a command, and their deltas are added
+   to the command's event, from where they can be queried with
+   clGetEventProfilingInfo (cl_pocl_profiling_counters) and are printed by
+   the cq profiler. Counters the kernel refuses to open are simply left out. */
+
+#ifndef POCL_PERF_COUNTERS_H
+#define POCL_PERF_COUNTERS_H
+
+#include "pocl_cl.h"
+#include "pocl_export.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* This is set to 1 in case the counters are collected (POCL_PERF_COUNTERS)
+   and at least the cycle counter could be opened. */
+POCL_EXPORT
+extern int pocl_perf_counters_enabled;
+
+void pocl_perf_counters_init ();
+
+/* Starts counting on the calling thread. */
+POCL_EXPORT
+void pocl_perf_counters_start ();
+
+/* Stops counting on the calling thread and adds the counts to the event.
+   Safe to call concurrently from several threads for the same event. */
+POCL_EXPORT
+void pocl_perf_counters_stop (cl_event event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,362 @@
+/* perf_jitdump.c - Linux perf jitdump records for dlopened work-group
+   functions
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+
+#ifndef __linux__
+#error This only compiles under Linux
+#endif
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf_jitdump.h"
+#include "pocl_cl.h"
+#include "pocl_debug.h"
+#include "pocl_runtime_config.h"
+
+/* See tools/perf/Documentation/jitdump-specification.txt in the Linux
+   kernel sources for the format. */
+#define JITHEADER_MAGIC 0x4A695444
+#define JITHEADER_VERSION 1
+
+enum jit_record_type
+{
+  JIT_CODE_LOAD = 0,
+  JIT_CODE_MOVE = 1,
+  JIT_CODE_DEBUG_INFO = 2,
+  JIT_CODE_CLOSE = 3,
+};
+
+struct jitheader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct jit_record_header
+{
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+struct jit_record_code_load
+{
+  struct jit_record_header p;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+  /* followed by the NUL-terminated name and the code bytes */
+};
+
+struct jit_record_debug_info
+{
+  struct jit_record_header p;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+  /* followed by nr_entry debug_entry records */
+};
+
+struct debug_entry
+{
+  uint64_t addr;
+  uint32_t lineno;
+  uint32_t discrim;
+  /* followed by the NUL-terminated file name */
+};
+
+/* The largest line table accepted from a .lines file. */
+#define MAX_LINE_ENTRIES 65536
+#define MAX_LINE_LENGTH 4096
+
+int pocl_perf_jitdump_enabled = 0;
+
+static FILE *jitdump_file = NULL;
+static void *jitdump_marker = NULL;
+static size_t jitdump_marker_size = 0;
+static uint64_t jitdump_code_index = 0;
+static pocl_lock_t jitdump_lock;
+
+/* perf correlates the records with the samples using the timestamps, which
+   must come from the same clock as 'perf record -k mono' uses. */
+static uint64_t
+jitdump_timestamp ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static uint32_t
+host_elf_machine ()
+{
+  ElfW (Ehdr) ehdr;
+  uint32_t mach = EM_NONE;
+  int fd = open ("/proc/self/exe", O_RDONLY);
+  if (fd < 0)
+    return mach;
+  if (read (fd, &ehdr, sizeof (ehdr)) == sizeof (ehdr)
+      && memcmp (ehdr.e_ident, ELFMAG, SELFMAG) == 0)
+    mach = ehdr.e_machine;
+  close (fd);
+  return mach;
+}
+
+static void
+pocl_perf_jitdump_close ()
+{
+  POCL_LOCK (jitdump_lock);
+  if (jitdump_file != NULL)
+    {
+      struct jit_record_header rec;
+      rec.id = JIT_CODE_CLOSE;
+      rec.total_size = sizeof (rec);
+      rec.timestamp = jitdump_timestamp ();
+      fwrite (&rec, sizeof (rec), 1, jitdump_file);
+      fclose (jitdump_file);
+      jitdump_file = NULL;
+    }
+  if (jitdump_marker != NULL)
+    munmap (jitdump_marker, jitdump_marker_size);
+  jitdump_marker = NULL;
+  pocl_perf_jitdump_enabled = 0;
+  POCL_UNLOCK (jitdump_lock);
+}
+
+void
+pocl_perf_jitdump_init ()
+{
+  char path[POCL_MAX_PATHNAME_LENGTH];
+  const char *dir = pocl_get_string_option ("POCL_PERF_JITDUMP_DIR", "/tmp");
+
+  snprintf (path, POCL_MAX_PATHNAME_LENGTH, "%s/jit-%i.dump", dir,
+            (int)getpid ());
+
+  int fd = open (path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+  if (fd < 0)
+    {
+      POCL_MSG_WARN ("Could not create the perf jitdump file %s\n", path);
+      return;
+    }
+
+  /* perf finds the jitdump file from the executable mmap() of it recorded
+     in the profile, so the mapping must stay alive during the run. */
+  jitdump_marker_size = sysconf (_SC_PAGESIZE);
+  jitdump_marker = mmap (NULL, jitdump_marker_size, PROT_READ | PROT_EXEC,
+                         MAP_PRIVATE, fd, 0);
+  if (jitdump_marker == MAP_FAILED)
+    {
+      POCL_MSG_WARN ("Could not mmap the perf jitdump file %s\n", path);
+      jitdump_marker = NULL;
+      close (fd);
+      return;
+    }
+
+  jitdump_file = fdopen (fd, "wb");
+  if (jitdump_file == NULL)
+    {
+      munmap (jitdump_marker, jitdump_marker_size);
+      jitdump_marker = NULL;
+      close (fd);
+      return;
+    }
+
+  struct jitheader header;
+  memset (&header, 0, sizeof (header));
+  header.magic = JITHEADER_MAGIC;
+  header.version = JITHEADER_VERSION;
+  header.total_size = sizeof (header);
+  header.elf_mach = host_elf_machine ();
+  header.pid = getpid ();
+  header.timestamp = jitdump_timestamp ();
+  fwrite (&header, sizeof (header), 1, jitdump_file);
+  fflush (jitdump_file);
+
+  POCL_INIT_LOCK (jitdump_lock);
+  pocl_perf_jitdump_enabled = 1;
+  atexit (pocl_perf_jitdump_close);
+
+  POCL_MSG_PRINT_GENERAL ("Writing perf jitdump records to %s\n", path);
+}
+
+/* Reads the line table written by llvm_codegen next to the kernel.so and
+   emits it as a JIT_CODE_DEBUG_INFO record. The offsets in the file are
+   relative to the start of the work-group function. Must be called with
+   jitdump_lock held. */
+static void
+write_debug_info (const char *module_fn, uint64_t code_addr,
+                  uint64_t code_size)
+{
+  char lines_path[POCL_MAX_PATHNAME_LENGTH];
+  char line[MAX_LINE_LENGTH];
+  snprintf (lines_path, POCL_MAX_PATHNAME_LENGTH, "%s%s", module_fn,
+            POCL_PERF_LINES_SUFFIX);
+
+  FILE *f = fopen (lines_path, "r");
+  if (f == NULL)
+    return;
+
+  /* First pass counts the entries and the record size. */
+  uint64_t nr_entry = 0;
+  size_t total_size = sizeof (struct jit_record_debug_info);
+  unsigned long long offset;
+  unsigned lineno;
+  int name_pos;
+  while (fgets (line, MAX_LINE_LENGTH, f) != NULL
+         && nr_entry < MAX_LINE_ENTRIES)
+    {
+      if (sscanf (line, "%llx %u %n", &offset, &lineno, &name_pos) < 2
+          || offset >= code_size)
+        continue;
+      line[strcspn (line, "\n")] = 0;
+      total_size += sizeof (struct debug_entry) + strlen (line + name_pos) + 1;
+      ++nr_entry;
+    }
+
+  if (nr_entry == 0)
+    {
+      fclose (f);
+      return;
+    }
+
+  struct jit_record_debug_info rec;
+  rec.p.id = JIT_CODE_DEBUG_INFO;
+  rec.p.total_size = total_size;
+  rec.p.timestamp = jitdump_timestamp ();
+  rec.code_addr = code_addr;
+  rec.nr_entry = nr_entry;
+  fwrite (&rec, sizeof (rec), 1, jitdump_file);
+
+  rewind (f);
+  uint64_t written = 0;
+  while (fgets (line, MAX_LINE_LENGTH, f) != NULL && written < nr_entry)
+    {
+      if (sscanf (line, "%llx %u %n", &offset, &lineno, &name_pos) < 2
+          || offset >= code_size)
+        continue;
+      line[strcspn (line, "\n")] = 0;
+      struct debug_entry entry;
+      entry.addr = code_addr + offset;
+      entry.lineno = lineno;
+      entry.discrim = 0;
+      fwrite (&entry, sizeof (entry), 1, jitdump_file);
+      fwrite (line + name_pos, strlen (line + name_pos) + 1, 1, jitdump_file);
+      ++written;
+    }
+  fclose (f);
+}
+
+void
+pocl_perf_jitdump_register (const char *kernel_name, void *wg_func,
+                            const char *module_fn)
+{
+  Dl_info info;
+  const ElfW (Sym) *sym = NULL;
+  char name[POCL_MAX_PATHNAME_LENGTH];
+  char variant[POCL_MAX_DIRNAME_LENGTH + 1] = "generic";
+
+  if (!pocl_perf_jitdump_enabled || wg_func == NULL)
+    return;
+
+  if (dladdr1 (wg_func, &info, (void **)&sym, RTLD_DL_SYMENT) == 0
+      || sym == NULL || sym->st_size == 0)
+    {
+      POCL_MSG_WARN ("perf jitdump: could not find the size of the "
+                     "work-group function of kernel %s\n",
+                     kernel_name);
+      return;
+    }
+  uint64_t code_size = sym->st_size;
+
+  /* The specialization is encoded in the name of the directory holding the
+     kernel.so, e.g. ".../kernel_name/2-1-1-goffs0-smallgrid/kernel_name.so".
+     The generic version lives in "0-0-0". */
+  const char *end = strrchr (module_fn, '/');
+  if (end != NULL)
+    {
+      const char *start = end;
+      while (start > module_fn && *(start - 1) != '/')
+        --start;
+      size_t len = end - start;
+      if (len > 0 && len <= POCL_MAX_DIRNAME_LENGTH
+          && strncmp (start, "0-0-0", len) != 0)
+        {
+          memcpy (variant, start, len);
+          variant[len] = 0;
+        }
+    }
+  snprintf (name, POCL_MAX_PATHNAME_LENGTH, "pocl:%s[%s]", kernel_name,
+            variant);
+
+  POCL_LOCK (jitdump_lock);
+  if (jitdump_file == NULL)
+    {
+      POCL_UNLOCK (jitdump_lock);
+      return;
+    }
+
+  /* The debug info must precede the code load record it refers to. */
+  write_debug_info (module_fn, (uint64_t)(uintptr_t)wg_func, code_size);
+
+  struct jit_record_code_load rec;
+  size_t name_len = strlen (name) + 1;
+  rec.p.id = JIT_CODE_LOAD;
+  rec.p.total_size = sizeof (rec) + name_len + code_size;
+  rec.p.timestamp = jitdump_timestamp ();
+  rec.pid = getpid ();
+  rec.tid = syscall (SYS_gettid);
+  rec.vma = (uint64_t)(uintptr_t)wg_func;
+  rec.code_addr = (uint64_t)(uintptr_t)wg_func;
+  rec.code_size = code_size;
+  rec.code_index = jitdump_code_index++;
+
+  fwrite (&rec, sizeof (rec), 1, jitdump_file);
+  fwrite (name, name_len, 1, jitdump_file);
+  fwrite (wg_func, code_size, 1, jitdump_file);
+  fflush (jitdump_file);
+  POCL_UNLOCK (jitdump_lock);
+
+  POCL_MSG_PRINT_GENERAL ("perf jitdump: %s at %p, %zu bytes\n", name,
+                          wg_func, (size_t)code_size);
+}
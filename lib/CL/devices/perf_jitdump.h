@@ -0,0 +1,63 @@
+/* perf_jitdump.h - Linux perf jitdump records for dlopened work-group
+   functions
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Work-group functions of the CPU drivers are loaded with dlopen() from
+   cache directory files with hashed names, which makes their samples hard
+   to attribute in 'perf report'. When POCL_PERF_JITDUMP is enabled, every
+   loaded work-group function is described in a jitdump file
+   (jit-<pid>.dump) so 'perf inject --jit' can name the samples after the
+   kernel and its specialization, and attach a line table if the kernel
+   was built with debug info. */
+
+#ifndef POCL_PERF_JITDUMP_H
+#define POCL_PERF_JITDUMP_H
+
+#include "pocl_export.h"
+
+/* Suffix of the line table file written next to a kernel.so. */
+#define POCL_PERF_LINES_SUFFIX ".lines"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* This is set to 1 in case jitdump records are written (POCL_PERF_JITDUMP). */
+POCL_EXPORT
+extern int pocl_perf_jitdump_enabled;
+
+void pocl_perf_jitdump_init ();
+
+/* Describes a freshly dlsym'd work-group function to perf. module_fn is the
+   path of the loaded shared object, which is used to find the variant name
+   and the optional line table. */
+POCL_EXPORT
+void pocl_perf_jitdump_register (const char *kernel_name, void *wg_func,
+                                 const char *module_fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -43,6 +43,14 @@ void pthread_scheduler_uninit ();
 /* Gives ready-to-execute command for scheduler */
 void pthread_scheduler_push_command (_cl_command_node *cmd);
 
+/* Runs a small ready command on the calling thread, if possible. */
+int pthread_scheduler_try_run_inline (_cl_command_node *cmd);
+
+/* Lets a host thread waiting for the queue, or for the event if it is not
+   NULL, execute work-groups of the kernels it waits for. Returns 0 if
+   there was nothing to do. */
+int pthread_scheduler_help (cl_command_queue cq, cl_event event);
+
 #ifdef __GNUC__
 #pragma GCC visibility pop
 #endif
@@ -146,17 +146,7 @@ pocl_pthread_init (unsigned j, cl_device_id device, const char* parameters)
 
   pocl_init_default_device_infos (device);
 
-  if (strstr (HOST_DEVICE_EXTENSIONS, "cl_khr_subgroup") != NULL)
-    {
-      /* In reality there is no independent SG progress implemented in this
-         version because we can only have one SG in flight at a time, but it's
-         a corner case which allows us to advertise it for full CTS compliance.
-       */
-      device->sub_group_independent_forward_progress = CL_TRUE;
-
-      /* Just an arbitrary number here based on assumption of SG size 32. */
-      device->max_num_sub_groups = device->max_work_group_size / 32;
-    }
+  pocl_init_cpu_sub_groups (device);
 
   /* 0 is the host memory shared with all drivers that use it */
   device->global_mem_id = 0;
@@ -345,6 +335,9 @@ pocl_pthread_submit (_cl_command_node *node, cl_command_queue cq)
   if (pocl_command_is_ready (node->sync.event.event))
     {
       pocl_update_event_submitted (node->sync.event.event);
+      /* this unlocks the event if it runs the command */
+      if (pthread_scheduler_try_run_inline (node))
+        return;
       pthread_scheduler_push_command (node);
     }
   POCL_UNLOCK_OBJ (node->sync.event.event);
@@ -371,7 +364,11 @@ pocl_pthread_join(cl_device_id device, cl_command_queue cq)
         }
       else
         {
-          PTHREAD_CHECK (pthread_cond_wait (cq_cond, &cq->pocl_lock));
+          POCL_UNLOCK_OBJ (cq);
+          int helped = pthread_scheduler_help (cq, NULL);
+          POCL_LOCK_OBJ (cq);
+          if (!helped && cq->command_count > 0)
+            PTHREAD_CHECK (pthread_cond_wait (cq_cond, &cq->pocl_lock));
         }
     }
   return;
@@ -444,7 +441,16 @@ void pocl_pthread_wait_event (cl_device_id device, cl_event event)
   POCL_LOCK_OBJ (event);
   while (event->status > CL_COMPLETE)
     {
-      PTHREAD_CHECK (pthread_cond_wait (&e_d->event_cond, &event->pocl_lock));
+      int helped = 0;
+      if (event->queue != NULL)
+        {
+          POCL_UNLOCK_OBJ (event);
+          helped = pthread_scheduler_help (event->queue, event);
+          POCL_LOCK_OBJ (event);
+        }
+      if (!helped && event->status > CL_COMPLETE)
+        PTHREAD_CHECK (
+            pthread_cond_wait (&e_d->event_cond, &event->pocl_lock));
     }
   POCL_UNLOCK_OBJ (event);
 }
@@ -40,6 +40,7 @@
 #include "pocl-pthread_utils.h"
 #include "pocl_cl.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
 #include "pocl_util.h"
 #include "utlist.h"
 
@@ -47,6 +48,10 @@
 #include "pthread_barrier.h"
 #endif
 
+#ifdef __linux__
+#include "perf_counters.h"
+#endif
+
 static void* pocl_pthread_driver_thread (void *p);
 
 struct pool_thread_data
@@ -65,6 +70,9 @@ struct pool_thread_data
   unsigned index;
   /* printf buffer*/
   void *printf_buffer;
+  /* For a host thread helping with the work-groups: the event it waits
+     for. It stops taking new work-groups once the event has completed. */
+  cl_event awaited_event;
 } __attribute__ ((aligned (HOST_CPU_CACHELINE_SIZE)));
 
 typedef struct scheduler_data_
@@ -92,6 +100,21 @@ typedef struct scheduler_data_
 
 static scheduler_data scheduler;
 
+/* Host threads run the commands that are cheaper to run than to hand over
+   to a worker thread (pthread_scheduler_try_run_inline), and execute
+   work-groups of the kernels they are waiting for (pthread_scheduler_help).
+   Each needs its own scratch memory for the kernels; there is a fixed
+   number of these, allocated on the first use. A host thread that finds
+   them all taken leaves the work to the worker threads. */
+#define POCL_PTHREAD_MAX_HOST_THREADS 4
+static struct pool_thread_data host_thread_data[POCL_PTHREAD_MAX_HOST_THREADS];
+static pthread_mutex_t host_thread_locks[POCL_PTHREAD_MAX_HOST_THREADS];
+static int inline_commands = -1;
+static size_t inline_command_size;
+static int host_threads_help = 0;
+
+#define DEFAULT_INLINE_COMMAND_SIZE 65536
+
 cl_int
 pthread_scheduler_init (cl_device_id device)
 {
@@ -125,6 +148,10 @@ pthread_scheduler_init (cl_device_id device)
                                        num_worker_threads + 1));
   scheduler.worker_out_of_memory = 0;
 
+  for (i = 0; i < POCL_PTHREAD_MAX_HOST_THREADS; ++i)
+    PTHREAD_CHECK (pthread_mutex_init (&host_thread_locks[i], NULL));
+  host_threads_help = pocl_get_bool_option ("POCL_HOST_THREADS_HELP", 1);
+
   for (i = 0; i < num_worker_threads; ++i)
     {
       scheduler.thread_pool[i].index = i;
@@ -164,6 +191,21 @@ pthread_scheduler_uninit ()
     }
 
   pocl_aligned_free (scheduler.thread_pool);
+  for (i = 0; i < POCL_PTHREAD_MAX_HOST_THREADS; ++i)
+    {
+      thread_data *td = &host_thread_data[i];
+      if (td->local_mem != NULL)
+        {
+          POCL_MEM_STATS_FREE (NULL, POCL_MEM_PRINTF,
+                               scheduler.printf_buf_size);
+          POCL_MEM_STATS_FREE (NULL, POCL_MEM_LOCAL_SCRATCH,
+                               scheduler.local_mem_size);
+        }
+      pocl_aligned_free (td->printf_buffer);
+      pocl_aligned_free (td->local_mem);
+      memset (td, 0, sizeof (struct pool_thread_data));
+      PTHREAD_CHECK (pthread_mutex_destroy (&host_thread_locks[i]));
+    }
   POCL_FAST_DESTROY (scheduler.wq_lock_fast);
   PTHREAD_CHECK (pthread_cond_destroy (&scheduler.wake_pool));
   PTHREAD_CHECK (pthread_barrier_destroy (&scheduler.init_barrier));
@@ -317,6 +359,11 @@ work_group_scheduler (kernel_run_command *k,
   unsigned slice_size = k->pc.num_groups[0] * k->pc.num_groups[1];
   unsigned row_size = k->pc.num_groups[0];
 
+#ifdef __linux__
+  if (pocl_perf_counters_enabled)
+    pocl_perf_counters_start ();
+#endif
+
   do
     {
       if (last_wgs)
@@ -341,8 +388,15 @@ work_group_scheduler (kernel_run_command *k,
 			gids[0], gids[1], gids[2]);
         }
     }
-  while (get_wg_index_range (k, &start_index, &end_index, &last_wgs,
-                             thread_data->num_threads));
+  while ((thread_data->awaited_event == NULL
+          || thread_data->awaited_event->status > CL_COMPLETE)
+         && get_wg_index_range (k, &start_index, &end_index, &last_wgs,
+                                thread_data->num_threads));
+
+#ifdef __linux__
+  if (pocl_perf_counters_enabled)
+    pocl_perf_counters_stop (k->cmd->sync.event.event);
+#endif
 
   if (position > 0)
     {
@@ -374,8 +428,10 @@ finalize_kernel_command (struct pool_thread_data *thread_data,
   free_kernel_run_command (k);
 }
 
-static void
-pocl_pthread_prepare_kernel (void *data, _cl_command_node *cmd)
+/* Sets up the run command of a kernel launch. Returns NULL if the launch
+   has no work-groups, in which case it is completed already. */
+static kernel_run_command *
+create_kernel_run_command (void *data, _cl_command_node *cmd)
 {
   kernel_run_command *run_cmd;
   cl_kernel kernel = cmd->command.run.kernel;
@@ -396,11 +452,12 @@ pocl_pthread_prepare_kernel (void *data, _cl_command_node *cmd)
       POCL_UPDATE_EVENT_COMPLETE_MSG (cmd->sync.event.event,
                                       "NDRange Kernel        ");
 
-      return;
+      return NULL;
     }
 
   char *saved_name = NULL;
   pocl_sanitize_builtin_kernel_name (kernel, &saved_name);
+  pocl_cmd_set_noalias_args (cmd);
   pocl_check_kernel_dlhandle_cache (cmd, CL_TRUE, CL_TRUE);
   pocl_restore_builtin_kernel_name (kernel, saved_name);
 
@@ -426,7 +483,176 @@ pocl_pthread_prepare_kernel (void *data, _cl_command_node *cmd)
 
   pocl_update_event_running (cmd->sync.event.event);
 
-  pthread_scheduler_push_kernel (run_cmd);
+  return run_cmd;
+}
+
+static void
+pocl_pthread_prepare_kernel (void *data, _cl_command_node *cmd)
+{
+  kernel_run_command *run_cmd = create_kernel_run_command (data, cmd);
+  if (run_cmd != NULL)
+    pthread_scheduler_push_kernel (run_cmd);
+}
+
+/* Runs the single work-group of a kernel launch on the calling host thread.
+   Unlike the worker threads, the host thread gets its rounding mode and
+   denormal handling restored afterwards. */
+static void
+run_kernel_inline (kernel_run_command *k, thread_data *td)
+{
+  pocl_kernel_metadata_t *meta = k->kernel->meta;
+  void *arguments[meta->num_args + meta->num_locals + 1];
+  void *arguments2[meta->num_args + meta->num_locals + 1];
+  struct pocl_context pc;
+  uint32_t position = 0;
+
+  assert (k->remaining_wgs == 1);
+  setup_kernel_arg_array_with_locals ((void **)&arguments,
+                                      (void **)&arguments2, k, td->local_mem,
+                                      scheduler.local_mem_size);
+  memcpy (&pc, &k->pc, sizeof (struct pocl_context));
+  pc.printf_buffer = td->printf_buffer;
+  pc.printf_buffer_position = &position;
+
+  unsigned rm = pocl_save_rm ();
+  unsigned ftz = pocl_save_ftz ();
+  pocl_set_ftz (k->kernel->program->flush_denorms);
+  pocl_set_default_rm ();
+
+#ifdef __linux__
+  if (pocl_perf_counters_enabled)
+    pocl_perf_counters_start ();
+#endif
+
+  k->workgroup ((uint8_t *)arguments, (uint8_t *)&pc, 0, 0, 0);
+
+#ifdef __linux__
+  if (pocl_perf_counters_enabled)
+    pocl_perf_counters_stop (k->cmd->sync.event.event);
+#endif
+
+  pocl_restore_rm (rm);
+  pocl_restore_ftz (ftz);
+
+  if (position > 0)
+    write (STDOUT_FILENO, pc.printf_buffer, position);
+
+  free_kernel_arg_array_with_locals ((void **)&arguments, (void **)&arguments2,
+                                     k);
+}
+
+/* Returns the scratch data of a host thread for the calling thread, or NULL
+   if they are all in use. */
+static thread_data *
+claim_host_thread_data ()
+{
+  unsigned i;
+
+  for (i = 0; i < POCL_PTHREAD_MAX_HOST_THREADS; ++i)
+    if (pthread_mutex_trylock (&host_thread_locks[i]) == 0)
+      break;
+  if (i == POCL_PTHREAD_MAX_HOST_THREADS)
+    return NULL;
+
+  thread_data *td = &host_thread_data[i];
+  if (td->local_mem == NULL)
+    {
+      td->printf_buffer = pocl_aligned_malloc (MAX_EXTENDED_ALIGNMENT,
+                                               scheduler.printf_buf_size);
+      td->local_mem = pocl_aligned_malloc (MAX_EXTENDED_ALIGNMENT,
+                                           scheduler.local_mem_size);
+      if (td->printf_buffer == NULL || td->local_mem == NULL)
+        {
+          pocl_aligned_free (td->printf_buffer);
+          pocl_aligned_free (td->local_mem);
+          td->printf_buffer = td->local_mem = NULL;
+          PTHREAD_CHECK (pthread_mutex_unlock (&host_thread_locks[i]));
+          return NULL;
+        }
+      POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_PRINTF, scheduler.printf_buf_size);
+      POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_LOCAL_SCRATCH,
+                            scheduler.local_mem_size);
+    }
+  /* chunk the work-groups the same way as the workers */
+  td->num_threads = scheduler.num_threads;
+  return td;
+}
+
+static void
+release_host_thread_data (thread_data *td)
+{
+  size_t i = td - host_thread_data;
+  PTHREAD_CHECK (pthread_mutex_unlock (&host_thread_locks[i]));
+}
+
+/* Returns 1 if the command is small enough to be run by the host thread
+   instead of a worker thread. */
+static int
+command_is_inline_eligible (_cl_command_node *cmd)
+{
+  struct pocl_context *pc;
+
+  switch (cmd->type)
+    {
+    case CL_COMMAND_READ_BUFFER:
+      return cmd->command.read.size <= inline_command_size;
+    case CL_COMMAND_WRITE_BUFFER:
+      return cmd->command.write.size <= inline_command_size;
+    case CL_COMMAND_COPY_BUFFER:
+      return cmd->command.copy.size <= inline_command_size;
+    case CL_COMMAND_FILL_BUFFER:
+      return cmd->command.memfill.size <= inline_command_size;
+    case CL_COMMAND_MAP_BUFFER:
+      return cmd->command.map.mapping->size <= inline_command_size;
+    case CL_COMMAND_UNMAP_MEM_OBJECT:
+      return cmd->command.unmap.mapping->size <= inline_command_size;
+    case CL_COMMAND_NDRANGE_KERNEL:
+      pc = &cmd->command.run.pc;
+      return pc->num_groups[0] * pc->num_groups[1] * pc->num_groups[2] == 1;
+    default:
+      return 0;
+    }
+}
+
+/* Called by submit with the event of the ready command locked. If the
+   command is eligible and no other host thread is running a command inline
+   at the moment, unlocks the event, runs the command to completion on the
+   calling thread and returns 1. Otherwise returns 0 and leaves the command
+   to the caller. */
+int
+pthread_scheduler_try_run_inline (_cl_command_node *cmd)
+{
+  if (inline_commands < 0)
+    {
+      inline_command_size = pocl_get_int_option (
+          "POCL_INLINE_COMMAND_SIZE", DEFAULT_INLINE_COMMAND_SIZE);
+      inline_commands = pocl_get_bool_option ("POCL_INLINE_COMMANDS", 1);
+    }
+
+  if (!inline_commands || !command_is_inline_eligible (cmd))
+    return 0;
+
+  thread_data *td = claim_host_thread_data ();
+  if (td == NULL)
+    return 0;
+
+  POCL_UNLOCK_OBJ (cmd->sync.event.event);
+
+  if (cmd->type == CL_COMMAND_NDRANGE_KERNEL)
+    {
+      kernel_run_command *run_cmd
+          = create_kernel_run_command (cmd->device->data, cmd);
+      if (run_cmd != NULL)
+        {
+          run_kernel_inline (run_cmd, td);
+          finalize_kernel_command (td, run_cmd);
+        }
+    }
+  else
+    pocl_exec_command (cmd);
+
+  release_host_thread_data (td);
+  return 1;
 }
 
 /*
@@ -482,6 +708,102 @@ check_kernel_queue_for_device (thread_data *td)
   return NULL;
 }
 
+/* Executes work-group chunks of the kernel until all of them have been
+   dealt, and finalizes the kernel if this was the last thread working on it.
+   Must be called with wq_lock_fast locked, returns with it locked. */
+static void
+run_kernel_chunks (kernel_run_command *run_cmd, thread_data *td)
+{
+  ++run_cmd->ref_count;
+  POCL_FAST_UNLOCK (scheduler.wq_lock_fast);
+
+  work_group_scheduler (run_cmd, td);
+
+  POCL_FAST_LOCK (scheduler.wq_lock_fast);
+  if ((--run_cmd->ref_count) == 0)
+    {
+      POCL_FAST_UNLOCK (scheduler.wq_lock_fast);
+      finalize_kernel_command (td, run_cmd);
+      POCL_FAST_LOCK (scheduler.wq_lock_fast);
+    }
+}
+
+/* Returns 1 if EVENT cannot complete before DEP: DEP is EVENT itself, is
+   in its wait list, or is an earlier command of its in-order queue. Only
+   compares the pointers of the wait list, so the caller must hold the lock
+   of EVENT. */
+static int
+event_waits_for (cl_event event, cl_event dep)
+{
+  event_node *n;
+
+  if (dep == event)
+    return 1;
+  if (event->queue != NULL && dep->queue == event->queue
+      && !(event->queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+      && dep->id < event->id)
+    return 1;
+  LL_FOREACH (event->wait_list, n)
+  {
+    if (n->event == dep)
+      return 1;
+  }
+  return 0;
+}
+
+/* Called by a host thread that waits for commands of the queue CQ, or for
+   EVENT if it is not NULL, to finish. Joins the worker threads in executing
+   the work-groups of a kernel that the wait depends on, if one is running.
+   When waiting for EVENT, the host thread stops taking more work-groups as
+   soon as EVENT has completed. Returns 1 after it has run out of
+   work-groups to take, or 0 if there was nothing to help with. */
+int
+pthread_scheduler_help (cl_command_queue cq, cl_event event)
+{
+  kernel_run_command *run_cmd;
+  thread_data *td;
+
+  if (!host_threads_help || scheduler.kernel_queue == NULL)
+    return 0;
+
+  td = claim_host_thread_data ();
+  if (td == NULL)
+    return 0;
+
+  /* the event is locked first, as in submit */
+  if (event != NULL)
+    POCL_LOCK_OBJ (event);
+  POCL_FAST_LOCK (scheduler.wq_lock_fast);
+  /* subdevices are limited to their own cores */
+  DL_FOREACH (scheduler.kernel_queue, run_cmd)
+  {
+    cl_event run_event = run_cmd->cmd->sync.event.event;
+    if (run_cmd->device->parent_device != NULL)
+      continue;
+    if (event != NULL ? event_waits_for (event, run_event)
+                      : run_event->queue == cq)
+      break;
+  }
+  if (event != NULL)
+    POCL_UNLOCK_OBJ (event);
+  if (run_cmd != NULL)
+    {
+      unsigned rm = pocl_save_rm ();
+      unsigned ftz = pocl_save_ftz ();
+      /* force work_group_scheduler() to set up the denormal handling */
+      td->current_ftz = 213;
+      td->awaited_event = event;
+      run_kernel_chunks (run_cmd, td);
+      td->awaited_event = NULL;
+      pocl_restore_rm (rm);
+      pocl_restore_ftz (ftz);
+    }
+  POCL_FAST_UNLOCK (scheduler.wq_lock_fast);
+
+  release_host_thread_data (td);
+  return run_cmd != NULL;
+}
+
 static int
 pthread_scheduler_get_work (thread_data *td)
 {
@@ -498,20 +820,7 @@ RETRY:
   run_cmd = check_kernel_queue_for_device (td);
   /* execute kernel if available */
   if (run_cmd)
-    {
-      ++run_cmd->ref_count;
-      POCL_FAST_UNLOCK (scheduler.wq_lock_fast);
-
-      work_group_scheduler (run_cmd, td);
-
-      POCL_FAST_LOCK (scheduler.wq_lock_fast);
-      if ((--run_cmd->ref_count) == 0)
-        {
-          POCL_FAST_UNLOCK (scheduler.wq_lock_fast);
-          finalize_kernel_command (td, run_cmd);
-          POCL_FAST_LOCK (scheduler.wq_lock_fast);
-        }
-    }
+    run_kernel_chunks (run_cmd, td);
 
   /* execute a command if available */
   cmd = check_cmd_queue_for_device (td);
@@ -580,6 +889,12 @@ pocl_pthread_driver_thread (void *p)
     {
       POCL_ATOMIC_INC (scheduler.worker_out_of_memory);
     }
+  else
+    {
+      POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_PRINTF, scheduler.printf_buf_size);
+      POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_LOCAL_SCRATCH,
+                            scheduler.local_mem_size);
+    }
 
   PTHREAD_CHECK2 (PTHREAD_BARRIER_SERIAL_THREAD,
                   pthread_barrier_wait (&scheduler.init_barrier));
@@ -589,6 +904,13 @@ pocl_pthread_driver_thread (void *p)
       do_exit = pthread_scheduler_get_work (td);
       if (do_exit)
         {
+          if (td->printf_buffer != NULL && td->local_mem != NULL)
+            {
+              POCL_MEM_STATS_FREE (NULL, POCL_MEM_PRINTF,
+                                   scheduler.printf_buf_size);
+              POCL_MEM_STATS_FREE (NULL, POCL_MEM_LOCAL_SCRATCH,
+                                   scheduler.local_mem_size);
+            }
           pocl_aligned_free (td->printf_buffer);
           pocl_aligned_free (td->local_mem);
           pthread_exit (NULL);
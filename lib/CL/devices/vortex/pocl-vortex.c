@@ -52,6 +52,7 @@
 #include "pocl_cache.h"
 #include "pocl_file_util.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
 #include "pocl_timing.h"
 #include "pocl_workgroup_func.h"
 
@@ -74,6 +75,45 @@
 // allocate 1MB OpenCL print buffer
 #define PRINT_BUFFER_SIZE (1024 * 1024)
 
+/* Machine performance monitoring CSRs read with vx_mpm_query(), as laid out
+   in the VX_config.h of the Vortex runtime. They are per core and count
+   from device reset. */
+#ifndef CSR_MCYCLE
+#define CSR_MCYCLE 0xB00
+#endif
+#ifndef CSR_MINSTRET
+#define CSR_MINSTRET 0xB02
+#endif
+#ifndef CSR_MPM_IBUF_ST
+#define CSR_MPM_IBUF_ST 0xB03
+#endif
+#ifndef CSR_MPM_SCRB_ST
+#define CSR_MPM_SCRB_ST 0xB04
+#endif
+#ifndef CSR_MPM_MEM_READS
+#define CSR_MPM_MEM_READS 0xB17
+#endif
+#ifndef CSR_MPM_MEM_WRITES
+#define CSR_MPM_MEM_WRITES 0xB18
+#endif
+
+/* Used when the runtime does not report the global memory size. */
+#define DEFAULT_GLOBAL_MEM_SIZE (3ULL * 1024 * 1024 * 1024)
+
+/* The work-group scheduling of the kernels, as selected with
+   VORTEX_SCHEDULE_FLAG at kernel compilation: with 0 each hardware thread
+   runs whole work-groups, with 1 and 2 the threads of all the warps of a
+   core share one work-group. */
+#define VORTEX_SCHEDULE_GROUP_PER_THREAD 0
+
+/* What starting a work-group costs, in rounds of work-items. */
+#define VORTEX_GROUP_OVERHEAD 1
+
+/* Device clock reported when POCL_VORTEX_CLOCK_MHZ is not set. The
+   driver does not report the clock, so this is only nominal and is not
+   used to convert cycle counts to time. */
+#define DEFAULT_CLOCK_MHZ 1000
+
 extern char *build_cflags;
 extern char *build_ldflags;
 
@@ -91,9 +131,30 @@ struct vx_device_data_t {
   _cl_command_node *command_list;
   /* Lock for command list related operations */
   pocl_lock_t cq_lock;
+  /* Signaled when ready_list gets a command or the thread should exit */
+  pocl_cond_t wakeup_cond;
+
+  /* Executes the commands of ready_list, so that every Vortex device runs
+     its commands concurrently with the other ones and the host thread. */
+  pocl_thread_t scheduler_thread;
+  int scheduler_exit;
 
   /* Currently loaded kernel. */
   cl_kernel current_kernel;
+
+  /* Number of cores to read the performance CSRs from. */
+  uint32_t num_cores;
+  uint32_t num_warps;
+  /* threads per warp */
+  uint32_t num_threads;
+  /* VORTEX_SCHEDULE_FLAG */
+  int schedule;
+  /* The clock was set with POCL_VORTEX_CLOCK_MHZ, so the kernel cycle
+     counts can be converted to time. */
+  int clock_known;
+
+  /* Index of the device among the Vortex devices. */
+  unsigned dev_index;
 };
 
 /*typedef struct _pocl_vortex_usm_allocation_t
@@ -193,7 +254,11 @@ pocl_vortex_init_device_ops(struct pocl_device_ops *ops)
   ops->broadcast = pocl_broadcast;
   ops->notify = pocl_vortex_notify;
   ops->flush = pocl_vortex_flush;
-  ops->compute_local_size = pocl_default_local_size_optimizer;
+  ops->update_event = pocl_vortex_update_event;
+  ops->notify_cmdq_finished = pocl_vortex_notify_cmdq_finished;
+  ops->init_queue = pocl_vortex_init_queue;
+  ops->free_queue = pocl_vortex_free_queue;
+  ops->compute_local_size = pocl_vortex_compute_local_size;
  
   ops->read = pocl_vortex_read; // pocl_driver_read;
   ops->write = pocl_vortex_write; // pocl_driver_write;
@@ -207,8 +272,8 @@ pocl_vortex_init_device_ops(struct pocl_device_ops *ops)
   ops->unmap_mem = pocl_vortex_unmap_mem;
   ops->get_mapping_ptr = pocl_driver_get_mapping_ptr;
   ops->free_mapping_ptr = pocl_driver_free_mapping_ptr;
-  ops->can_migrate_d2d = NULL;
-  ops->migrate_d2d = NULL;
+  ops->can_migrate_d2d = pocl_vortex_can_migrate_d2d;
+  ops->migrate_d2d = pocl_vortex_migrate_d2d;
 
   ops->get_device_info_ext = NULL;
   ops->get_mem_info_ext = NULL;
@@ -258,11 +323,21 @@ static const char *final_ld_flags[] = {"-nostartfiles", HOST_LD_FLAGS_ARRAY, NUL
 unsigned int
 pocl_vortex_probe(struct pocl_device_ops *ops)
 {
-  if (0 == strcmp(ops->device_name, "vortex"))
+  int env_count = pocl_device_get_env_count(ops->device_name);
+
+  /* one device unless POCL_DEVICES lists vortex several times, which gives
+   * one simx instance per entry; vx_dev_open has no board selector, so
+   * the hardware drivers would open the same board for every entry */
+  if (env_count < 0)
     return 1;
-  return 0;
+
+  return env_count;
 }
 
+#if !defined(OCS_AVAILABLE)
+static void *vortex_scheduler_thread (void *data);
+#endif
+
 cl_int
 pocl_vortex_init (unsigned j, cl_device_id dev, const char* parameters)
 {
@@ -291,10 +366,8 @@ pocl_vortex_init (unsigned j, cl_device_id dev, const char* parameters)
     return CL_OUT_OF_HOST_MEMORY;
   }
 
-  // TODO : change this to vortex mem size
-  dev->global_mem_size = 3*1024*1024*1024; //MIN_MAX_MEM_ALLOC_SIZE;
+  dev->global_mem_size = DEFAULT_GLOBAL_MEM_SIZE;
   dev->max_mem_alloc_size=dev->global_mem_size / 4;
-  POCL_MSG_WARN("GLOBAL_MEM_SIZE  : %ld\n", dev->global_mem_size);
 
   dev->vendor = "Vortex Group";
   dev->vendor_id = 0;
@@ -306,6 +379,9 @@ pocl_vortex_init (unsigned j, cl_device_id dev, const char* parameters)
 
   dev->max_compute_units = 1;
 
+  // the RISC-V backend has no prefetch instruction to lower to
+  dev->prefetch_latency = 0;
+
   dev->long_name = "Vortex Open-Source GPU";
   dev->short_name = "Vortex";
 
@@ -321,6 +397,11 @@ pocl_vortex_init (unsigned j, cl_device_id dev, const char* parameters)
 
   vx_device_h vx_device;
 
+  // each call starts a separate simulator with simx; there is no way to
+  // pick a board, so only simx supports more than one instance
+  if (j > 0)
+    POCL_MSG_WARN ("vortex%u: several Vortex devices are only independent "
+                   "with the simx driver\n", j);
   vx_err = vx_dev_open(&vx_device);
   if (vx_err != 0) {
     free(d);
@@ -349,16 +430,64 @@ pocl_vortex_init (unsigned j, cl_device_id dev, const char* parameters)
   }
 
   d->printf_buffer_ptr = malloc(PRINT_BUFFER_SIZE);
+  POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_PRINTF, PRINT_BUFFER_SIZE);
   d->printf_buffer_devaddr = printf_buffer_devaddr;
   d->printf_buffer_position = printf_buffer_devaddr + PRINT_BUFFER_SIZE;    
   d->vx_device = vx_device;
 
+  uint64_t num_cores = 1;
+  if (vx_dev_caps(vx_device, VX_CAPS_NUM_CORES, &num_cores) != 0 || num_cores == 0)
+    num_cores = 1;
+  d->num_cores = (uint32_t)num_cores;
+
+  uint64_t num_warps = 1;
+  if (vx_dev_caps(vx_device, VX_CAPS_NUM_WARPS, &num_warps) != 0 || num_warps == 0)
+    num_warps = 1;
+  d->num_warps = (uint32_t)num_warps;
+
+  uint64_t num_threads = 1;
+  if (vx_dev_caps(vx_device, VX_CAPS_NUM_THREADS, &num_threads) != 0 || num_threads == 0)
+    num_threads = 1;
+  d->num_threads = (uint32_t)num_threads;
+
+  d->schedule = pocl_get_int_option("VORTEX_SCHEDULE_FLAG",
+                                    VORTEX_SCHEDULE_GROUP_PER_THREAD);
+
+  dev->max_compute_units = d->num_cores;
+  dev->preferred_wg_size_multiple = d->num_threads;
+
+  uint64_t caps_value;
+  if (vx_dev_caps(vx_device, VX_CAPS_GLOBAL_MEM_SIZE, &caps_value) == 0 && caps_value != 0) {
+    dev->global_mem_size = caps_value;
+    dev->max_mem_alloc_size = dev->global_mem_size / 4;
+  }
+  if (vx_dev_caps(vx_device, VX_CAPS_LOCAL_MEM_SIZE, &caps_value) == 0 && caps_value != 0)
+    dev->local_mem_size = caps_value;
+  if (vx_dev_caps(vx_device, VX_CAPS_CACHE_LINE_SIZE, &caps_value) == 0 && caps_value != 0)
+    dev->global_mem_cacheline_size = (cl_uint)caps_value;
+
+  POCL_MSG_PRINT_INFO("vortex%u: %u cores, %u warps, %u threads, "
+                      "%lu MB global memory\n", j, d->num_cores, d->num_warps,
+                      d->num_threads,
+                      (unsigned long)(dev->global_mem_size >> 20));
+
+  dev->max_clock_frequency
+      = pocl_get_int_option ("POCL_VORTEX_CLOCK_MHZ", DEFAULT_CLOCK_MHZ);
+  d->clock_known = pocl_is_option_set ("POCL_VORTEX_CLOCK_MHZ")
+                   && dev->max_clock_frequency > 0;
+
 #endif 
 
   d->current_kernel = NULL;
+  d->dev_index = j;
 
   POCL_INIT_LOCK(d->cq_lock);
-  
+  POCL_INIT_COND(d->wakeup_cond);
+
+#if !defined(OCS_AVAILABLE)
+  POCL_CREATE_THREAD(d->scheduler_thread, vortex_scheduler_thread, d);
+#endif
+
   dev->data = d;  
 
   //SETUP_DEVICE_CL_VERSION(1, 2);
@@ -403,11 +532,19 @@ cl_int pocl_vortex_uninit (unsigned j, cl_device_id device) {
     return CL_SUCCESS;  
 
 #if !defined(OCS_AVAILABLE)
+  POCL_LOCK(d->cq_lock);
+  d->scheduler_exit = 1;
+  POCL_SIGNAL_COND(d->wakeup_cond);
+  POCL_UNLOCK(d->cq_lock);
+  POCL_JOIN_THREAD(d->scheduler_thread);
+
   free(d->printf_buffer_ptr);
+  POCL_MEM_STATS_FREE (NULL, POCL_MEM_PRINTF, PRINT_BUFFER_SIZE);
   vx_mem_free(d->vx_device, d->printf_buffer_devaddr);
   vx_dev_close(d->vx_device);
 #endif
 
+  POCL_DESTROY_COND (d->wakeup_cond);
   POCL_DESTROY_LOCK (d->cq_lock);
   POCL_MEM_FREE(d);
   device->data = NULL;
@@ -539,22 +676,70 @@ cl_int pocl_vortex_unmap_mem (void *data, pocl_mem_identifier *dst_mem_id,
   return CL_SUCCESS;
 }
 
-static void vortex_command_scheduler (struct vx_device_data_t *d) 
+int
+pocl_vortex_can_migrate_d2d (cl_device_id dest, cl_device_id source)
 {
+  /* between two Vortex devices, without going through mem_host_ptr */
+  return dest->ops == source->ops;
+}
+
+int
+pocl_vortex_migrate_d2d (cl_device_id src_dev, cl_device_id dst_dev,
+                         cl_mem mem, pocl_mem_identifier *src_mem_id,
+                         pocl_mem_identifier *dst_mem_id)
+{
+  struct vx_buffer_data_t *src_buf
+      = (struct vx_buffer_data_t *)src_mem_id->mem_ptr;
+  struct vx_buffer_data_t *dst_buf
+      = (struct vx_buffer_data_t *)dst_mem_id->mem_ptr;
+  int vx_err;
+
+  /* the devices do not see each other's memory, bounce through a staging
+   * buffer that is not the (possibly unallocated) mem_host_ptr */
+  void *staging = malloc (mem->size);
+  if (staging == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+
+  vx_err = vx_copy_from_dev (src_buf->vx_device, staging,
+                             src_buf->dev_mem_addr, mem->size);
+  if (vx_err == 0)
+    vx_err = vx_copy_to_dev (dst_buf->vx_device, dst_buf->dev_mem_addr,
+                             staging, mem->size);
+  free (staging);
+  if (vx_err != 0)
+    POCL_ABORT ("POCL_VORTEX_MIGRATE_D2D\n");
+
+  return 0;
+}
+
+static void *
+vortex_scheduler_thread (void *data)
+{
+  struct vx_device_data_t *d = (struct vx_device_data_t *)data;
   _cl_command_node *node;
-  
-  /* execute commands from ready list */
-  while ((node = d->ready_list))
+
+  POCL_LOCK (d->cq_lock);
+  while (1)
     {
-      assert (pocl_command_is_ready (node->sync.event.event));
-      assert (node->sync.event.event->status == CL_SUBMITTED);
-      CDL_DELETE (d->ready_list, node);
-      POCL_UNLOCK (d->cq_lock);
-      pocl_exec_command (node);
-      POCL_LOCK (d->cq_lock);
+      /* execute commands from ready list */
+      if ((node = d->ready_list) != NULL)
+        {
+          assert (pocl_command_is_ready (node->sync.event.event));
+          assert (node->sync.event.event->status == CL_SUBMITTED);
+          CDL_DELETE (d->ready_list, node);
+          POCL_UNLOCK (d->cq_lock);
+          pocl_exec_command (node);
+          POCL_LOCK (d->cq_lock);
+          continue;
+        }
+
+      if (d->scheduler_exit)
+        break;
+      POCL_WAIT_COND (d->wakeup_cond, d->cq_lock);
     }
+  POCL_UNLOCK (d->cq_lock);
 
-  return;
+  return NULL;
 }
 
 void
@@ -570,7 +755,7 @@ pocl_vortex_submit (_cl_command_node *node, cl_command_queue cq)
   pocl_command_push(node, &d->ready_list, &d->command_list);
 
   POCL_UNLOCK_OBJ (node->sync.event.event);
-  vortex_command_scheduler (d);
+  POCL_SIGNAL_COND (d->wakeup_cond);
   POCL_UNLOCK (d->cq_lock);
 
   return;
@@ -578,21 +763,17 @@ pocl_vortex_submit (_cl_command_node *node, cl_command_queue cq)
 
 void pocl_vortex_flush (cl_device_id device, cl_command_queue cq)
 {
-  struct vx_device_data_t *d = (struct vx_device_data_t *)device->data;
-
-  POCL_LOCK (d->cq_lock);
-  vortex_command_scheduler (d);
-  POCL_UNLOCK (d->cq_lock);
+  /* the scheduler thread picks up ready commands as they are submitted */
 }
 
 void
 pocl_vortex_join (cl_device_id device, cl_command_queue cq)
 {
-  struct vx_device_data_t *d = (struct vx_device_data_t *)device->data;
-
-  POCL_LOCK (d->cq_lock);
-  vortex_command_scheduler (d);
-  POCL_UNLOCK (d->cq_lock);
+  POCL_LOCK_OBJ (cq);
+  pocl_cond_t *cq_cond = (pocl_cond_t *)cq->data;
+  while (cq->command_count > 0)
+    POCL_WAIT_COND (*cq_cond, cq->pocl_lock);
+  POCL_UNLOCK_OBJ (cq);
 
   return;
 }
@@ -620,13 +801,185 @@ pocl_vortex_notify (cl_device_id device, cl_event event, cl_event finished)
           POCL_LOCK (d->cq_lock);
           CDL_DELETE (d->command_list, node);
           CDL_PREPEND (d->ready_list, node);
-          vortex_command_scheduler (d);
+          POCL_SIGNAL_COND (d->wakeup_cond);
           POCL_UNLOCK (d->cq_lock);
         }
       return;
     }
 }
 
+void
+pocl_vortex_notify_cmdq_finished (cl_command_queue cq)
+{
+  /* called with CQ locked, broadcast since several user threads can be
+   * waiting for the same queue in pocl_vortex_join() */
+  pocl_cond_t *cq_cond = (pocl_cond_t *)cq->data;
+  POCL_BROADCAST_COND (*cq_cond);
+}
+
+int
+pocl_vortex_init_queue (cl_device_id device, cl_command_queue queue)
+{
+  queue->data = malloc (sizeof (pocl_cond_t));
+  if (queue->data == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  POCL_INIT_COND (*(pocl_cond_t *)queue->data);
+  return CL_SUCCESS;
+}
+
+int
+pocl_vortex_free_queue (cl_device_id device, cl_command_queue queue)
+{
+  POCL_DESTROY_COND (*(pocl_cond_t *)queue->data);
+  POCL_MEM_FREE (queue->data);
+  return CL_SUCCESS;
+}
+
+/* Reads the performance CSRs of all cores into counters (indexed with
+   POCL_HW_COUNTER_*). The kernel takes as many cycles as its slowest core,
+   the other counters are summed up. Returns the mask of the counters that
+   were read. */
+static cl_uint
+vortex_read_perf_counters (struct vx_device_data_t *d, uint64_t *counters)
+{
+  static const uint32_t stall_csrs[] = { CSR_MPM_IBUF_ST, CSR_MPM_SCRB_ST };
+  static const uint32_t mem_csrs[] = { CSR_MPM_MEM_READS, CSR_MPM_MEM_WRITES };
+  cl_uint mask = (1U << POCL_HW_COUNTER_CYCLES)
+                 | (1U << POCL_HW_COUNTER_INSTRUCTIONS)
+                 | (1U << POCL_HW_COUNTER_STALLS)
+                 | (1U << POCL_HW_COUNTER_MEM_REQUESTS);
+  uint64_t value;
+  unsigned i;
+
+  memset (counters, 0, sizeof (uint64_t) * POCL_HW_COUNTER_COUNT);
+  for (uint32_t core = 0; core < d->num_cores; ++core) {
+    if (vx_mpm_query (d->vx_device, CSR_MCYCLE, core, &value) != 0)
+      mask &= ~(1U << POCL_HW_COUNTER_CYCLES);
+    else if (value > counters[POCL_HW_COUNTER_CYCLES])
+      counters[POCL_HW_COUNTER_CYCLES] = value;
+
+    if (vx_mpm_query (d->vx_device, CSR_MINSTRET, core, &value) != 0)
+      mask &= ~(1U << POCL_HW_COUNTER_INSTRUCTIONS);
+    else
+      counters[POCL_HW_COUNTER_INSTRUCTIONS] += value;
+
+    for (i = 0; i < sizeof (stall_csrs) / sizeof (stall_csrs[0]); ++i) {
+      if (vx_mpm_query (d->vx_device, stall_csrs[i], core, &value) != 0)
+        mask &= ~(1U << POCL_HW_COUNTER_STALLS);
+      else
+        counters[POCL_HW_COUNTER_STALLS] += value;
+    }
+
+    for (i = 0; i < sizeof (mem_csrs) / sizeof (mem_csrs[0]); ++i) {
+      if (vx_mpm_query (d->vx_device, mem_csrs[i], core, &value) != 0)
+        mask &= ~(1U << POCL_HW_COUNTER_MEM_REQUESTS);
+      else
+        counters[POCL_HW_COUNTER_MEM_REQUESTS] += value;
+    }
+  }
+  return mask;
+}
+
+void
+pocl_vortex_update_event (cl_device_id device, cl_event event)
+{
+  struct vx_device_data_t *d = (struct vx_device_data_t *)device->data;
+
+  /* With a known clock, let the command end when the device says it did:
+     the start timestamp is the host time the command started, the
+     duration comes from the kernel's cycle count. Otherwise the end stays
+     the host-measured one, and the cycles are only available as the
+     CYCLES counter of the event. */
+  if (event->status == CL_COMPLETE
+      && (event->queue->properties & CL_QUEUE_PROFILING_ENABLE)
+      && (event->hw_counter_mask & (1U << POCL_HW_COUNTER_CYCLES))
+      && d->clock_known) {
+    event->time_end = event->time_start
+                      + event->hw_counters[POCL_HW_COUNTER_CYCLES] * 1000
+                            / device->max_clock_frequency;
+  }
+}
+
+/* Cost of running GROUPS work-groups of GROUP_SIZE work-items each on
+   UNITS schedule units that each run LANES work-items side by side: the
+   rounds of LANES work-items the busiest unit runs. */
+static size_t
+vortex_launch_cost (size_t groups, size_t group_size, size_t lanes,
+                    size_t units)
+{
+  size_t waves = (groups + units - 1) / units;
+  size_t rounds = (group_size + lanes - 1) / lanes;
+  return waves * (rounds + VORTEX_GROUP_OVERHEAD);
+}
+
+void
+pocl_vortex_compute_local_size (cl_device_id dev, cl_kernel kernel,
+                                unsigned device_i, size_t global_x,
+                                size_t global_y, size_t global_z,
+                                size_t *local_x, size_t *local_y,
+                                size_t *local_z)
+{
+  struct vx_device_data_t *d = (struct vx_device_data_t *)dev->data;
+  size_t max_group_size = dev->max_work_group_size;
+  size_t lanes, units;
+
+  if (d->schedule == VORTEX_SCHEDULE_GROUP_PER_THREAD)
+    {
+      /* a thread runs the work-items of its group one after another */
+      lanes = 1;
+      units = (size_t)d->num_cores * d->num_warps * d->num_threads;
+    }
+  else
+    {
+      /* a core runs a group at a time on all of its threads */
+      lanes = (size_t)d->num_warps * d->num_threads;
+      units = d->num_cores;
+    }
+
+  /* Local sizes must divide the global ones. Try all the shapes, for the
+     ones as cheap as the best so far prefer the wider along x, which keeps
+     the accesses of the threads of a warp contiguous, then the larger. */
+  size_t best_cost = SIZE_MAX;
+  *local_x = *local_y = *local_z = 1;
+  for (size_t z = 1; z <= min (global_z, dev->max_work_item_sizes[2])
+                     && z <= max_group_size;
+       ++z)
+    {
+      if (global_z % z != 0)
+        continue;
+      for (size_t y = 1; y <= min (global_y, dev->max_work_item_sizes[1])
+                         && y * z <= max_group_size;
+           ++y)
+        {
+          if (global_y % y != 0)
+            continue;
+          for (size_t x = 1; x <= min (global_x, dev->max_work_item_sizes[0])
+                             && x * y * z <= max_group_size;
+               ++x)
+            {
+              if (global_x % x != 0)
+                continue;
+              size_t groups
+                  = (global_x / x) * (global_y / y) * (global_z / z);
+              size_t cost
+                  = vortex_launch_cost (groups, x * y * z, lanes, units);
+              if (cost < best_cost
+                  || (cost == best_cost
+                      && (x > *local_x
+                          || (x == *local_x
+                              && x * y * z
+                                     > *local_x * *local_y * *local_z))))
+                {
+                  best_cost = cost;
+                  *local_x = x;
+                  *local_y = y;
+                  *local_z = z;
+                }
+            }
+        }
+    }
+}
+
 void
 pocl_vortex_run (void *data, _cl_command_node *cmd)
 {
@@ -687,6 +1040,7 @@ pocl_vortex_run (void *data, _cl_command_node *cmd)
     if (vx_err != 0) {
       POCL_ABORT("POCL_VORTEX_RUN\n"); 
     }
+    POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_LOCAL_SCRATCH, abuf_local_size);
   }
 
   // update kernel arguments buffer
@@ -759,6 +1113,7 @@ pocl_vortex_run (void *data, _cl_command_node *cmd)
       if (vx_err != 0) {
         POCL_ABORT("POCL_VORTEX_RUN\n"); 
       }
+      POCL_MEM_STATS_FREE (NULL, POCL_MEM_LOCAL_SCRATCH, abuf_local_size);
     }
 
     // upload kernel arguments buffer
@@ -769,7 +1124,11 @@ pocl_vortex_run (void *data, _cl_command_node *cmd)
     if (vx_err != 0) {
       POCL_ABORT("POCL_VORTEX_RUN\n");
     }
-    vx_err = pocl_write_file("args.bin", abuf_ptr, abuf_size, 0, 0);
+    // one file per device, they run concurrently in the same directory
+    char args_file[32] = "args.bin";
+    if (d->dev_index > 0)
+      snprintf(args_file, sizeof(args_file), "args%u.bin", d->dev_index);
+    vx_err = pocl_write_file(args_file, abuf_ptr, abuf_size, 0, 0);
     if (vx_err != 0) {
       POCL_ABORT("POCL_VORTEX_RUN_WRITE_FILE\n");
     }
@@ -790,6 +1149,14 @@ pocl_vortex_run (void *data, _cl_command_node *cmd)
     }
   }
     
+  cl_event event = cmd->sync.event.event;
+  int profiling = (event->queue->properties & CL_QUEUE_PROFILING_ENABLE) != 0;
+  uint64_t perf_before[POCL_HW_COUNTER_COUNT];
+  uint64_t perf_after[POCL_HW_COUNTER_COUNT];
+  cl_uint perf_mask = 0;
+  if (profiling)
+    perf_mask = vortex_read_perf_counters(d, perf_before);
+
   // quick off kernel execution
   vx_err = vx_start(d->vx_device);
   if (vx_err != 0) {
@@ -801,6 +1168,19 @@ pocl_vortex_run (void *data, _cl_command_node *cmd)
   if (vx_err != 0) {
     POCL_ABORT("POCL_VORTEX_RUN\n");
   }
+
+  if (profiling) {
+    perf_mask &= vortex_read_perf_counters(d, perf_after);
+    for (i = 0; i < POCL_HW_COUNTER_COUNT; ++i) {
+      if (!(perf_mask & (1U << i)))
+        continue;
+      /* simx restarts the counters on every launch */
+      event->hw_counters[i] = (perf_after[i] >= perf_before[i])
+                                  ? perf_after[i] - perf_before[i]
+                                  : perf_after[i];
+    }
+    event->hw_counter_mask = perf_mask;
+  }
   
   {
     // flush print buffer 
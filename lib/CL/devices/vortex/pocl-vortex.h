@@ -41,4 +41,12 @@
 #include "prototypes.inc"
 GEN_PROTOTYPES (vortex)
 
+/* Picks the local size that keeps the most cores, warps and threads busy
+ * for the work-group scheduling selected with VORTEX_SCHEDULE_FLAG. */
+void pocl_vortex_compute_local_size (cl_device_id dev, cl_kernel kernel,
+                                     unsigned device_i, size_t global_x,
+                                     size_t global_y, size_t global_z,
+                                     size_t *local_x, size_t *local_y,
+                                     size_t *local_z);
+
 #endif /* POCL_VORTEX_H */
@@ -30,8 +30,10 @@
 #include "pocl_cl.h"
 #include "pocl_binary.h"
 #include "pocl_cache.h"
+#include "pocl_compress.h"
 #include "pocl_file_util.h"
 #include "pocl_llvm.h"
+#include "pocl_runtime_config.h"
 
 #include <sys/stat.h>
 #include <dirent.h>
@@ -57,10 +59,12 @@
 /* changes for version 8: compilation parameters are stored in module metadata
  * changes for version 9: support other than "program.bc" files in root dir
  * changes for version 10: support program scope variables
- * changes for version 11: support extra subgroup & workgroup metadata */
+ * changes for version 11: support extra subgroup & workgroup metadata
+ * changes for version 12: optional compression of file contents
+ * changes for version 13: store the required sub-group size */
 
 #define FIRST_SUPPORTED_POCLCC_VERSION 9
-#define POCLCC_VERSION 11
+#define POCLCC_VERSION 13
 
 /* pocl binary structures */
 
@@ -69,10 +73,14 @@
  * 2) pointers in general are not written at all, rather reconstructed from data
  * 3) char* strings are written as: | uint32_t strlen | strlen bytes of content |
  * 4) files are written as two strings: | uint32_t | relative filename | uint32_t | content |
+ *    or, in binaries with POCL_BINARY_FLAG_COMPRESSED, as
+ *    | uint32_t | relative filename | uint32_t stored | uint32_t raw | content |
+ *    where the content is compressed unless stored == raw
  */
 
 #define POCL_KERNEL_HAS_WORKG_META (1 << 1)
 #define POCL_KERNEL_HAS_SUBG_META (1 << 2)
+#define POCL_KERNEL_HAS_REQD_SUBG_SIZE (1 << 3)
 
 typedef struct pocl_binary_kernel_s
 {
@@ -102,6 +110,8 @@ typedef struct pocl_binary_kernel_s
   /* per-device subgroup metadata */
   uint32_t max_subgroups;
   uint32_t compile_subgroups;
+  /* intel_reqd_sub_group_size */
+  uint32_t reqd_sub_group_size;
 
   /* per-device workgroup metadata */
   uint32_t max_wg_size;
@@ -150,6 +160,7 @@ typedef struct pocl_binary_s
 /* pocl_binary flags  */
 #define POCL_BINARY_FLAG_FLUSH_DENORMS (1 << 0)
 #define POCL_BINARY_HAS_PROG_SCOPE_VARS (1 << 1)
+#define POCL_BINARY_FLAG_COMPRESSED (1 << 2)
 
 #define TO_LE(x)                                \
   ((sizeof(x) == 8) ? htole64((uint64_t)x) :    \
@@ -325,31 +336,77 @@ pocl_binary_get_kernel_count (cl_program program, unsigned device_i)
 
 /* serializes a single file. */
 static unsigned char*
-serialize_file(char* path, size_t basedir_offset, unsigned char* buffer)
+serialize_file(char* path, size_t basedir_offset, unsigned char* buffer,
+               int compressed)
 {
   char* content;
   uint64_t fsize;
   char* p = path + basedir_offset;
   BUFFER_STORE_STR(p);
   pocl_read_file(path, &content, &fsize);
-  BUFFER_STORE_STR2(content, fsize);
+  if (compressed)
+    {
+      unsigned char *sizes = buffer;
+      buffer += 2 * sizeof (uint32_t);
+      /* one byte less than the raw size, so that stored == raw is
+       * unambiguous for files that don't compress */
+      uint64_t stored = 0;
+      if (fsize > 0)
+        stored = pocl_compress ((unsigned char *)content, fsize, buffer,
+                                fsize - 1);
+      if (stored == 0)
+        {
+          memcpy (buffer, content, fsize);
+          stored = fsize;
+        }
+      buffer = sizes;
+      BUFFER_STORE (stored, uint32_t);
+      BUFFER_STORE (fsize, uint32_t);
+      buffer += stored;
+    }
+  else
+    BUFFER_STORE_STR2(content, fsize);
   free(content);
   return buffer;
 }
 
+#if defined(CROSS_COMPILATION) || defined(BUILD_VORTEX)
+/* returns the serialized size of a single file, without unpacking it */
+static size_t
+skip_file (const unsigned char *buffer, int compressed)
+{
+  const unsigned char *orig_buffer = buffer;
+  uint32_t len;
+
+  /* relative path */
+  BUFFER_READ (len, uint32_t);
+  assert (len > 0);
+  buffer += len;
+
+  /* content */
+  BUFFER_READ (len, uint32_t);
+  if (compressed)
+    buffer += sizeof (uint32_t);
+  buffer += len;
+
+  return (buffer - orig_buffer);
+}
+#endif
+
 /* recursively serializes files/directories by calling
  * either itself (on directory), or serialize_file (on files) */
 static unsigned char*
 recursively_serialize_path (char* path,
                             size_t basedir_offset,
-                            unsigned char* buffer)
+                            unsigned char* buffer,
+                            int compressed)
 {
   struct stat st;
   if (stat (path, &st) != 0)
     return buffer;
 
   if (S_ISREG (st.st_mode))
-    buffer = serialize_file (path, basedir_offset, buffer);
+    buffer = serialize_file (path, basedir_offset, buffer, compressed);
 
   if (S_ISDIR (st.st_mode))
     {
@@ -366,8 +423,8 @@ recursively_serialize_path (char* path,
           if (strcmp (entry->d_name, ".") == 0) continue;
           if (strcmp (entry->d_name, "..") == 0) continue;
           strcpy (p, entry->d_name);
-          buffer =
-            recursively_serialize_path (subpath, basedir_offset, buffer);
+          buffer = recursively_serialize_path (subpath, basedir_offset,
+                                               buffer, compressed);
         }
       closedir (d);
     }
@@ -379,7 +436,8 @@ static unsigned char*
 serialize_kernel_cachedir (cl_program program,
                            const char* kernel_name,
                            unsigned device_i,
-                           unsigned char* buffer)
+                           unsigned char* buffer,
+                           int compressed)
 {
   char path[POCL_MAX_PATHNAME_LENGTH];
   char basedir[POCL_MAX_PATHNAME_LENGTH];
@@ -391,7 +449,8 @@ serialize_kernel_cachedir (cl_program program,
   POCL_MSG_PRINT_INFO ("Kernel %s: recur serializing cachedir %s\n",
                        kernel_name, path);
   if (pocl_exists (path))
-    buffer = recursively_serialize_path (path, basedir_len, buffer);
+    buffer
+        = recursively_serialize_path (path, basedir_len, buffer, compressed);
 
   return buffer;
 }
@@ -401,7 +460,8 @@ static unsigned char*
 pocl_binary_serialize_kernel_to_buffer(cl_program program,
                                        pocl_kernel_metadata_t *meta,
                                        unsigned device_i,
-                                       unsigned char *buf)
+                                       unsigned char *buf,
+                                       int compressed)
 {
   unsigned char *buffer = buf;
   unsigned i;
@@ -440,6 +500,8 @@ pocl_binary_serialize_kernel_to_buffer(cl_program program,
       || (meta->preferred_wg_multiple
           && meta->preferred_wg_multiple[device_i]))
     flags |= POCL_KERNEL_HAS_WORKG_META;
+  if (meta->reqd_sub_group_size)
+    flags |= POCL_KERNEL_HAS_REQD_SUBG_SIZE;
   BUFFER_STORE (flags, uint32_t);
 
   if (flags & POCL_KERNEL_HAS_SUBG_META)
@@ -479,6 +541,12 @@ pocl_binary_serialize_kernel_to_buffer(cl_program program,
       BUFFER_STORE (tmp, uint32_t);
     }
 
+  if (flags & POCL_KERNEL_HAS_REQD_SUBG_SIZE)
+    {
+      uint32_t tmp = meta->reqd_sub_group_size;
+      BUFFER_STORE (tmp, uint32_t);
+    }
+
   /***********************************************************************/
   unsigned char *start = buffer;
   for (i = 0; i < meta->num_args; i++)
@@ -507,8 +575,8 @@ pocl_binary_serialize_kernel_to_buffer(cl_program program,
 
   uint32_t arginfo_size = buffer - start;
 
-  unsigned char *end
-      = serialize_kernel_cachedir (program, meta->name, device_i, buffer);
+  unsigned char *end = serialize_kernel_cachedir (program, meta->name,
+                                                  device_i, buffer, compressed);
   uint64_t binaries_size = end - buffer;
 
   /* write struct size properly */
@@ -529,17 +597,24 @@ pocl_binary_serialize_kernel_to_buffer(cl_program program,
 static size_t
 deserialize_file (unsigned char* buffer,
                   char* basedir,
-                  size_t offset)
+                  size_t offset,
+                  int compressed)
 {
   unsigned char* orig_buffer = buffer;
-  size_t len;
+  uint32_t len, raw_len;
 
   char* relpath = NULL;
   BUFFER_READ_STR2 (relpath, len);
   assert (len > 0);
 
-  char* content = NULL;
-  BUFFER_READ_STR2 (content, len);
+  BUFFER_READ (len, uint32_t);
+  raw_len = len;
+  if (compressed)
+    {
+      BUFFER_READ (raw_len, uint32_t);
+    }
+  unsigned char *stored = buffer;
+  buffer += len;
 
   char *p = basedir + offset;
   strcpy (p, relpath);
@@ -549,32 +624,49 @@ deserialize_file (unsigned char* buffer,
   if (pocl_exists (fullpath))
     goto RET;
 
+  char *content = (char *)stored;
+  if (raw_len != len)
+    {
+      content = malloc (raw_len);
+      if (content == NULL
+          || pocl_decompress (stored, len, (unsigned char *)content, raw_len))
+        {
+          POCL_MSG_ERR ("Could not decompress %s from the pocl binary\n",
+                        fullpath);
+          free (content);
+          goto RET;
+        }
+    }
+
   char* dir = strdup (basedir);
   char* dirpath = dirname (dir);
   if (!pocl_exists (dirpath))
     pocl_mkdir_p (dirpath);
   free (dir);
 
-  if (len == 0)
+  if (raw_len == 0)
     pocl_touch_file (fullpath);
   else
-    pocl_write_file (fullpath, content, len, 0, 0);
+    pocl_write_file (fullpath, content, raw_len, 0, 0);
+
+  if (content != (char *)stored)
+    free (content);
 
 RET:
-  free (content);
   return (buffer - orig_buffer);
 }
 
 /* Deserializes all files of a single pocl kernel cachedir.  */
 static unsigned char*
-recursively_deserialize_path (char* basedir, unsigned char* buffer, size_t bytes)
+recursively_deserialize_path (char* basedir, unsigned char* buffer, size_t bytes,
+                              int compressed)
 {
   size_t done = 0;
   size_t offset = strlen (basedir);
 
   while (done < bytes)
     {
-      done += deserialize_file (buffer + done, basedir, offset);
+      done += deserialize_file (buffer + done, basedir, offset, compressed);
     }
   basedir[offset] = 0;
   assert(done == bytes);
@@ -593,7 +685,7 @@ recursively_deserialize_path (char* basedir, unsigned char* buffer, size_t bytes
 
    2) if name_len and name_match are NULL, unpacks kernel cachedir on disk, but
    does not set up kernel metadata of pocl_binary_kernel argument - used by
-   pocl_binary_deserialize()
+   pocl_binary_deserialize() and pocl_binary_deserialize_kernel()
  */
 
 static int
@@ -647,6 +739,9 @@ pocl_binary_deserialize_kernel_from_buffer (pocl_binary *b,
           BUFFER_READ (kernel->spill_mem_size, uint32_t);
         }
 
+      if (kernel->flags & POCL_KERNEL_HAS_REQD_SUBG_SIZE)
+        BUFFER_READ (kernel->reqd_sub_group_size, uint32_t);
+
       meta->arg_info = calloc (kernel->num_args, sizeof (struct pocl_argument_info));
       POCL_RETURN_ERROR_COND ((!meta->arg_info), CL_OUT_OF_HOST_MEMORY);
 
@@ -669,7 +764,9 @@ pocl_binary_deserialize_kernel_from_buffer (pocl_binary *b,
       /* skip the arg_info and all kernel metadata */
       buffer = *buf + (kernel->struct_size - kernel->binaries_size);
       if (kernel->binaries_size > 0)
-        recursively_deserialize_path (basedir, buffer, kernel->binaries_size);
+        recursively_deserialize_path (
+            basedir, buffer, kernel->binaries_size,
+            (b->flags & POCL_BINARY_FLAG_COMPRESSED) != 0);
       POCL_MEM_FREE (kernel->kernel_name);
     }
 
@@ -695,6 +792,7 @@ pocl_binary_serialize(cl_program program, unsigned device_i, size_t *size)
   unsigned char *start = buffer;
 
   unsigned num_kernels = program->num_kernels;
+  int compressed = pocl_get_bool_option ("POCL_BINARY_COMPRESSION", 0);
 
   char basedir[POCL_MAX_PATHNAME_LENGTH];
   pocl_cache_program_path (basedir, program, device_i);
@@ -708,6 +806,8 @@ pocl_binary_serialize(cl_program program, unsigned device_i, size_t *size)
   uint64_t flags = POCL_BINARY_HAS_PROG_SCOPE_VARS;
   if (program->flush_denorms)
     flags |= POCL_BINARY_FLAG_FLUSH_DENORMS;
+  if (compressed)
+    flags |= POCL_BINARY_FLAG_COMPRESSED;
   flags |= ((uint64_t)program->binary_type << 32);
   BUFFER_STORE (flags, uint64_t);
   unsigned char *root_entries_save = buffer;
@@ -733,7 +833,8 @@ pocl_binary_serialize(cl_program program, unsigned device_i, size_t *size)
     fake_k.name = fake_k.meta->name;    
     pocl_cache_final_binary_path (program_bin_path, program, device_i, &fake_k, NULL, 0);
     POCL_MSG_PRINT_INFO ("serializing kernel binary: %s\n", program_bin_path);
-    buffer = serialize_file (program_bin_path, basedir_len, buffer);
+    buffer = serialize_file (program_bin_path, basedir_len, buffer,
+                             compressed);
   }
 #else
   unsigned actually_serialized_entries = 0;
@@ -750,7 +851,8 @@ pocl_binary_serialize(cl_program program, unsigned device_i, size_t *size)
     strcpy(temp, basedir);
     strcat(temp, dev->serialize_entries[i]);
     POCL_MSG_PRINT_INFO ("serializing %s\n", temp);
-    unsigned char* new_buffer = recursively_serialize_path (temp, basedir_len, buffer);
+    unsigned char* new_buffer = recursively_serialize_path (temp, basedir_len,
+                                                            buffer, compressed);
     uint64_t size = new_buffer - buffer;
     buffer = saved_b;
     if (size > 0) {
@@ -769,7 +871,8 @@ pocl_binary_serialize(cl_program program, unsigned device_i, size_t *size)
   for (i=0; i < num_kernels; i++)
     {
       buffer = pocl_binary_serialize_kernel_to_buffer
-                 (program, &program->kernel_meta[i], device_i, buffer);
+                 (program, &program->kernel_meta[i], device_i, buffer,
+                  compressed);
       assert(buffer <= end_of_buffer);
     }
 
@@ -808,23 +911,35 @@ pocl_binary_deserialize(cl_program program, unsigned device_i)
   pocl_cache_program_path (basedir, program, device_i);
   size_t basedir_len = strlen (basedir); 
 
+  /* the kernel files of compressed binaries are unpacked only when the
+   * kernel is created, by pocl_binary_deserialize_kernel() */
+  int compressed = (b.flags & POCL_BINARY_FLAG_COMPRESSED) != 0;
+
 #if defined(CROSS_COMPILATION)  
   for (i = 0; i < b.num_kernels; i++) {
-
+    if (compressed)
+      {
+        buffer += skip_file (buffer, compressed);
+        continue;
+      }
     POCL_MSG_PRINT_INFO ("deserializing kernel binary: %s\n", basedir);
-    buffer += deserialize_file (buffer, basedir, basedir_len);
+    buffer += deserialize_file (buffer, basedir, basedir_len, compressed);
   }
 #else
   for (i = 0; i < b.root_entries; ++i)
   {
     uint64_t bytes;
     BUFFER_READ(bytes, uint64_t);
-    unsigned char* retval = recursively_deserialize_path (basedir, buffer, bytes);
+    unsigned char *retval
+        = recursively_deserialize_path (basedir, buffer, bytes, compressed);
     assert (retval == buffer + bytes);
     buffer += bytes;
   }
 #endif
 
+  if (compressed)
+    return CL_SUCCESS;
+
   pocl_binary_kernel k;
 
 
@@ -842,6 +957,59 @@ ERROR:
   return CL_OUT_OF_HOST_MEMORY;
 }
 
+cl_int
+pocl_binary_deserialize_kernel (cl_program program, unsigned device_i,
+                                unsigned kernel_i)
+{
+  unsigned char *buffer = program->pocl_binaries[device_i];
+  unsigned i;
+
+  if (buffer == NULL)
+    return CL_SUCCESS;
+
+  pocl_binary b;
+  buffer = read_header (&b, buffer);
+  if ((b.flags & POCL_BINARY_FLAG_COMPRESSED) == 0)
+    return CL_SUCCESS;
+  assert (kernel_i < b.num_kernels);
+
+  char basedir[POCL_MAX_PATHNAME_LENGTH];
+  pocl_cache_program_path (basedir, program, device_i);
+
+#if defined(CROSS_COMPILATION)
+  size_t basedir_len = strlen (basedir);
+  for (i = 0; i < b.num_kernels; i++)
+    {
+      if (i == kernel_i)
+        {
+          POCL_MSG_PRINT_INFO ("deserializing kernel binary: %s\n", basedir);
+          deserialize_file (buffer, basedir, basedir_len, 1);
+          basedir[basedir_len] = 0;
+        }
+      buffer += skip_file (buffer, 1);
+    }
+#else
+  for (i = 0; i < b.root_entries; ++i)
+    {
+      uint64_t bytes;
+      BUFFER_READ (bytes, uint64_t);
+      buffer += bytes;
+    }
+#endif
+
+  /* skip the records of the preceding kernels */
+  for (i = 0; i < kernel_i; i++)
+    {
+      uint64_t struct_size;
+      memcpy (&struct_size, buffer, sizeof (uint64_t));
+      buffer += FROM_LE (struct_size);
+    }
+
+  pocl_binary_kernel k;
+  return pocl_binary_deserialize_kernel_from_buffer (&b, &buffer, &k, NULL,
+                                                     basedir);
+}
+
 #define MAX_BINARY_SIZE (256 << 20)
 
 size_t
@@ -897,19 +1065,10 @@ pocl_binary_get_kernels_metadata (cl_program program, unsigned device_i)
                         CL_INVALID_PROGRAM,
                         "Deserialized a binary, but it doesn't seem to be "
                         "for this device.\n");
-  size_t len;
-
 #if defined(BUILD_VORTEX)  
   for (j = 0; j < b.num_kernels; j++) {
-    /* skip real path of program.bc */
-    BUFFER_READ(len, uint32_t);
-    assert (len > 0);
-    buffer += len;
-
-    /* skip content of program.bc */
-    BUFFER_READ(len, uint32_t);
-    assert (len > 0);
-    buffer += len;
+    /* skip the kernel binary */
+    buffer += skip_file (buffer, (b.flags & POCL_BINARY_FLAG_COMPRESSED) != 0);
   }
 #else  
   unsigned i;
@@ -942,6 +1101,7 @@ pocl_binary_get_kernels_metadata (cl_program program, unsigned device_i)
       km->num_locals = k.num_locals;
       km->local_sizes = k.local_sizes;
       km->attributes = k.attributes;
+      km->reqd_sub_group_size = k.reqd_sub_group_size;
       km->has_arg_metadata = k.has_arg_metadata;
       km->name = k.kernel_name;
       km->data
@@ -46,6 +46,11 @@ size_t pocl_binary_sizeof_binary(cl_program program, unsigned device_i);
 /* unpacks the content of program->pocl_binaries[device_i] into pocl cache */
 cl_int pocl_binary_deserialize(cl_program program, unsigned device_i);
 
+/* unpacks the files of the kernel_i'th kernel of a compressed binary into
+ * pocl cache; pocl_binary_deserialize() leaves them packed */
+cl_int pocl_binary_deserialize_kernel (cl_program program, unsigned device_i,
+                                       unsigned kernel_i);
+
 /* pocl cache -> program->pocl_binaries[device_i] */
 cl_int pocl_binary_serialize(cl_program program, unsigned device_i, size_t *size);
 
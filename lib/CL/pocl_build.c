@@ -48,6 +48,7 @@
 #include "pocl_runtime_config.h"
 #include "pocl_binary.h"
 #include "pocl_shared.h"
+#include "utlist.h"
 
 #define REQUIRES_CR_SQRT_DIV_ERR                                              \
   "-cl-fp32-correctly-rounded-divide-sqrt build option "                      \
@@ -419,6 +420,23 @@ process_options (const char *options, char *modded_options, char *link_options,
           token = strtok_r (NULL, " ", &saveptr);
           continue;
         }
+      else if (strncmp (token, "-pocl-specialize-args=", 22) == 0)
+        {
+          /* pocl specific, not passed to clang: the values of these
+             scalar arguments are folded into the specialized WG
+             functions at launch time. */
+          if (token[22] == 0)
+            {
+              APPEND_TO_OPTION_BUILD_LOG (
+                  "\"-pocl-specialize-args=\" needs argument names\n");
+              error = ret_error;
+              goto ERROR;
+            }
+          POCL_MEM_FREE (program->specialize_args);
+          program->specialize_args = strdup (token + 22);
+          token = strtok_r (NULL, " ", &saveptr);
+          continue;
+        }
       else if (strncmp (token, "-create-library", 15) == 0)
         {
           if (!linking)
@@ -543,7 +561,10 @@ clean_program_on_rebuild (cl_program program, int from_error)
   free_meta (program);
 
   program->num_kernels = 0;
-  program->build_status = CL_BUILD_NONE;
+  /* On errors the caller sets CL_BUILD_ERROR. A background build publishes
+     it under the program lock, so the status is not touched here. */
+  if (!from_error)
+    program->build_status = CL_BUILD_NONE;
   program->binary_type = CL_PROGRAM_BINARY_TYPE_NONE;
 
   for (i = 0; i < program->num_devices;
@@ -577,6 +598,51 @@ clean_program_on_rebuild (cl_program program, int from_error)
     }
 }
 
+/* Sets the bits of the by-value scalar arguments of the kernel that are
+   listed in the -pocl-specialize-args option. */
+static void
+setup_specialized_args (cl_program program, pocl_kernel_metadata_t *meta)
+{
+  cl_uint j;
+  meta->specialized_args = 0;
+
+  if (!(meta->has_arg_metadata & POCL_HAS_KERNEL_ARG_NAME))
+    {
+      POCL_MSG_WARN ("No argument names for kernel %s, not specializing "
+                     "its arguments\n",
+                     meta->name);
+      return;
+    }
+
+  for (j = 0; j < meta->num_args && j < 64; ++j)
+    {
+      pocl_argument_info *ai = &meta->arg_info[j];
+      size_t len = strlen (ai->name);
+      const char *list = program->specialize_args;
+      int listed = 0;
+
+      while (*list && !listed)
+        {
+          const char *end = strchr (list, ',');
+          size_t n = end ? (size_t)(end - list) : strlen (list);
+          listed = (n == len && strncmp (list, ai->name, n) == 0);
+          list += end ? n + 1 : n;
+        }
+      if (!listed)
+        continue;
+
+      if (ai->type != POCL_ARG_TYPE_NONE || ARGP_IS_LOCAL (ai)
+          || ai->type_size == 0 || ai->type_size > sizeof (uint64_t))
+        {
+          POCL_MSG_WARN ("Argument %s of kernel %s is not a scalar, "
+                         "not specializing it\n",
+                         ai->name, meta->name);
+          continue;
+        }
+      meta->specialized_args |= (uint64_t)1 << j;
+    }
+}
+
 static int
 setup_kernel_metadata (cl_program program)
 {
@@ -642,6 +708,10 @@ setup_kernel_metadata (cl_program program)
         }
     }
 
+  if (program->specialize_args)
+    for (i = 0; i < program->num_kernels; ++i)
+      setup_specialized_args (program, &program->kernel_meta[i]);
+
   return CL_SUCCESS;
 }
 
@@ -689,6 +759,407 @@ check_device_supports (cl_device_id device, cl_version cl_c_version)
     }
 }
 
+/* The arguments of a build, and the results of the build options that
+   are needed after the options have been processed. */
+typedef struct pocl_build_job pocl_build_job;
+struct pocl_build_job
+{
+  cl_program program;
+  int compile_program;
+  int link_program;
+  int build_error_code;
+  int create_library;
+  int requires_cr_sqrt_div;
+  int spir_build;
+  cl_version cl_c_version;
+  cl_uint num_input_headers;
+  const cl_program *input_headers;
+  const char **header_include_names;
+  cl_uint num_input_programs;
+  const cl_program *input_programs;
+  void (CL_CALLBACK *pfn_notify) (cl_program program, void *user_data);
+  void *user_data;
+  pocl_build_job *next;
+};
+
+/* Builds the program for its devices and sets up the kernel metadata.
+   Returns the new build status (CL_BUILD_SUCCESS or CL_BUILD_ERROR) in
+   *status; the caller publishes it. The caller either holds the program
+   lock or has set the status to CL_BUILD_IN_PROGRESS, which keeps the other
+   API calls off the program until the status is published. */
+static cl_int
+build_program (pocl_build_job *job, cl_build_status *status)
+{
+  cl_program program = job->program;
+  unsigned device_i = 0, actually_built = 0;
+  int errcode, error;
+
+  /* Build the program for all requested devices. */
+  for (device_i = 0; device_i < program->num_devices; ++device_i)
+    {
+      cl_device_id device = program->devices[device_i];
+
+      if (job->cl_c_version
+          && check_device_supports (device, job->cl_c_version))
+        {
+          APPEND_TO_BUILD_LOG_GOTO (
+              job->build_error_code,
+              "Build option -cl-std specified OpenCL C version %u.%u,"
+              "but device %s doesn't support that OpenCL C version.\n",
+              CL_VERSION_MAJOR (job->cl_c_version),
+              CL_VERSION_MINOR (job->cl_c_version), device->short_name);
+        }
+
+      if (job->requires_cr_sqrt_div
+          && !(device->single_fp_config & CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT))
+        APPEND_TO_BUILD_LOG_GOTO (job->build_error_code,
+                                  REQUIRES_CR_SQRT_DIV_ERR " %s\n",
+                                  device->short_name);
+
+      /* clCreateProgramWithBuiltinKernels */
+      if (program->builtin_kernel_names)
+        {
+          if (device->ops->build_builtin)
+            {
+              error = device->ops->build_builtin (program, device_i);
+              if (error != CL_SUCCESS)
+                APPEND_TO_BUILD_LOG_GOTO (CL_BUILD_PROGRAM_FAILURE,
+                                          "Device %s failed to build the "
+                                          "program with builtin kernels\n",
+                                          device->long_name);
+            }
+        }
+      /* only link the program/library */
+      else if (!job->compile_program && job->link_program)
+        {
+          assert (job->num_input_programs > 0);
+
+          if (device->ops->link_program == NULL)
+            APPEND_TO_BUILD_LOG_GOTO (CL_LINK_PROGRAM_FAILURE,
+                                      "%s device's driver does "
+                                      "not support linking programs\n",
+                                      device->long_name);
+
+          error = device->ops->link_program (
+              program, device_i, job->num_input_programs, job->input_programs,
+              job->create_library);
+          if (error != CL_SUCCESS)
+            APPEND_TO_BUILD_LOG_GOTO (CL_LINK_PROGRAM_FAILURE,
+                                      "Device %s failed to link the program\n",
+                                      device->long_name);
+        }
+      /* compile and/or link from source */
+      else if (program->source)
+        {
+          if (device->ops->build_source == NULL)
+            APPEND_TO_BUILD_LOG_GOTO (
+                job->build_error_code,
+                "%s device's driver does not "
+                "support building programs from source\n",
+                device->long_name);
+
+          error = device->ops->build_source (
+              program, device_i, job->num_input_headers, job->input_headers,
+              job->header_include_names,
+              (job->create_library ? 0 : job->link_program));
+
+          if (error != CL_SUCCESS)
+            {
+              if (program->build_log[device_i])
+                POCL_MSG_ERR ("Build log for device %s:\n%s\n",
+                              device->long_name, program->build_log[device_i]);
+              APPEND_TO_BUILD_LOG_GOTO (job->build_error_code,
+                                        "Device %s failed to build"
+                                        " the program\n",
+                                        device->long_name);
+            }
+        }
+      /* compile and/or link from binary */
+      else
+        {
+          if (device->ops->build_binary == NULL)
+            APPEND_TO_BUILD_LOG_GOTO (job->build_error_code,
+                                      "%s device's driver does not support "
+                                      "building programs from binaries\n",
+                                      device->long_name);
+
+          if ((program->binary_sizes[device_i] == 0)
+              && (program->pocl_binary_sizes[device_i] == 0)
+              && (program->program_il_size == 0))
+            APPEND_TO_BUILD_LOG_GOTO (CL_INVALID_BINARY,
+                                      "No poclbinaries nor binaries "
+                                      "for device %s - can't build "
+                                      "the program\n",
+                                      device->short_name);
+
+          error = device->ops->build_binary (
+              program, device_i, (job->create_library ? 0 : job->link_program),
+              job->spir_build);
+
+          if (error != CL_SUCCESS)
+            {
+              if (program->build_log[device_i])
+                POCL_MSG_ERR ("Build log for device %s:\n%s\n",
+                              device->long_name, program->build_log[device_i]);
+              APPEND_TO_BUILD_LOG_GOTO (job->build_error_code,
+                                        "Device %s failed to build"
+                                        " the program\n",
+                                        device->long_name);
+            }
+        }
+
+      /* Maintain a 'last_accessed' file in every program's
+       * cache directory. Will be useful for cache pruning script
+       * that flushes old directories based on LRU */
+      if (!program->builtin_kernel_names)
+        pocl_cache_update_program_last_access (program, device_i);
+
+      ++actually_built;
+    }
+  assert (actually_built == program->num_devices);
+  assert(program->num_kernels == 0);
+
+  /* for executables & programs with builtin kernels,
+   * setup the kernel metadata */
+  /* if the program is not a finished executable, we don't need
+   * to setup kernel metadata */
+  if (program->binary_type == CL_PROGRAM_BINARY_TYPE_EXECUTABLE
+      || program->binary_type == CL_PROGRAM_BINARY_TYPE_NONE)
+    {
+      errcode = setup_kernel_metadata (program);
+      if (errcode != CL_SUCCESS)
+        {
+          POCL_MSG_ERR ("Program build: kernel metadata setup failed\n");
+          goto ERROR;
+        }
+
+      setup_device_kernel_hashes (program);
+    }
+
+  for (device_i = 0; device_i < program->num_devices; device_i++)
+    {
+      cl_device_id device = program->devices[device_i];
+
+      if (device->ops->post_build_program)
+        device->ops->post_build_program (program, device_i);
+    }
+
+  TP_BUILD_PROGRAM (program->context->id, program->id);
+
+  *status = CL_BUILD_SUCCESS;
+  return CL_SUCCESS;
+
+ERROR:
+  clean_program_on_rebuild (program, 1);
+  *status = CL_BUILD_ERROR;
+  return errcode;
+}
+
+/* The background builds, used when a pfn_notify is given. The workers are
+   started on demand, up to POCL_BUILD_THREADS. */
+#define MAX_BUILD_THREADS 64
+
+static pocl_build_job *build_queue = NULL;
+static pocl_lock_t build_queue_lock = POCL_LOCK_INITIALIZER;
+static pocl_cond_t build_queue_cond;
+static pocl_thread_t build_workers[MAX_BUILD_THREADS];
+static unsigned num_build_workers = 0;
+static unsigned idle_build_workers = 0;
+/* 0 until the first background build */
+static unsigned max_build_workers = 0;
+static int build_workers_shutdown = 0;
+
+static void
+free_build_job (pocl_build_job *job)
+{
+  cl_uint i;
+  for (i = 0; i < job->num_input_headers; ++i)
+    {
+      POname (clReleaseProgram) (job->input_headers[i]);
+      free ((char *)job->header_include_names[i]);
+    }
+  for (i = 0; i < job->num_input_programs; ++i)
+    POname (clReleaseProgram) (job->input_programs[i]);
+  free ((cl_program *)job->input_headers);
+  free (job->header_include_names);
+  free ((cl_program *)job->input_programs);
+  POname (clReleaseProgram) (job->program);
+  free (job);
+}
+
+static void
+run_build_job (pocl_build_job *job)
+{
+  cl_program program = job->program;
+  cl_build_status status;
+
+  /* The lock is only taken to publish the result, so the queries of the
+     program do not block for the whole compilation. */
+  build_program (job, &status);
+
+  POCL_LOCK_OBJ (program);
+  program->build_status = status;
+  POCL_BROADCAST_COND (program->build_cond);
+  POCL_UNLOCK_OBJ (program);
+
+  job->pfn_notify (program, job->user_data);
+  free_build_job (job);
+}
+
+static void *
+build_worker_func (void *arg)
+{
+  pocl_build_job *job;
+
+  POCL_LOCK (build_queue_lock);
+  while (1)
+    {
+      ++idle_build_workers;
+      while (build_queue == NULL && !build_workers_shutdown)
+        POCL_WAIT_COND (build_queue_cond, build_queue_lock);
+      --idle_build_workers;
+      if (build_workers_shutdown)
+        break;
+      job = build_queue;
+      LL_DELETE (build_queue, job);
+      POCL_UNLOCK (build_queue_lock);
+      run_build_job (job);
+      POCL_LOCK (build_queue_lock);
+    }
+  POCL_UNLOCK (build_queue_lock);
+  return NULL;
+}
+
+/* The builds in progress are finished at exit so the workers are not
+   running in the compiler while its static objects are destroyed. The
+   queued ones are dropped. */
+static void
+stop_build_workers ()
+{
+  unsigned i;
+  POCL_LOCK (build_queue_lock);
+  build_workers_shutdown = 1;
+  POCL_BROADCAST_COND (build_queue_cond);
+  POCL_UNLOCK (build_queue_lock);
+  for (i = 0; i < num_build_workers; ++i)
+    POCL_JOIN_THREAD (build_workers[i]);
+}
+
+/* Copies the arguments of the build job for the background build.
+   Returns NULL if out of memory. */
+static pocl_build_job *
+copy_build_job (const pocl_build_job *job)
+{
+  cl_uint i;
+  pocl_build_job *copy = (pocl_build_job *)malloc (sizeof (pocl_build_job));
+  if (copy == NULL)
+    return NULL;
+  memcpy (copy, job, sizeof (pocl_build_job));
+  copy->next = NULL;
+  copy->input_headers = NULL;
+  copy->header_include_names = NULL;
+  copy->input_programs = NULL;
+
+  if (job->num_input_headers)
+    {
+      cl_program *headers = (cl_program *)malloc (job->num_input_headers
+                                                  * sizeof (cl_program));
+      const char **names = (const char **)calloc (job->num_input_headers,
+                                                  sizeof (char *));
+      copy->input_headers = headers;
+      copy->header_include_names = names;
+      if (headers == NULL || names == NULL)
+        goto ERROR;
+      for (i = 0; i < job->num_input_headers; ++i)
+        {
+          names[i] = strdup (job->header_include_names[i]);
+          if (names[i] == NULL)
+            goto ERROR;
+        }
+      memcpy (headers, job->input_headers,
+              job->num_input_headers * sizeof (cl_program));
+    }
+
+  if (job->num_input_programs)
+    {
+      cl_program *inputs = (cl_program *)malloc (job->num_input_programs
+                                                 * sizeof (cl_program));
+      copy->input_programs = inputs;
+      if (inputs == NULL)
+        goto ERROR;
+      memcpy (inputs, job->input_programs,
+              job->num_input_programs * sizeof (cl_program));
+    }
+
+  for (i = 0; i < job->num_input_headers; ++i)
+    POname (clRetainProgram) (job->input_headers[i]);
+  for (i = 0; i < job->num_input_programs; ++i)
+    POname (clRetainProgram) (job->input_programs[i]);
+  /* the caller holds the program lock */
+  POCL_RETAIN_OBJECT_UNLOCKED (job->program);
+  return copy;
+
+ERROR:
+  if (copy->header_include_names)
+    for (i = 0; i < job->num_input_headers; ++i)
+      free ((char *)copy->header_include_names[i]);
+  free ((cl_program *)copy->input_headers);
+  free (copy->header_include_names);
+  free ((cl_program *)copy->input_programs);
+  free (copy);
+  return NULL;
+}
+
+/* Queues the build to the background workers, starting a new one if none
+   is idle. Returns 0 on success. */
+static int
+queue_build_job (const pocl_build_job *job)
+{
+  pocl_build_job *copy = copy_build_job (job);
+  if (copy == NULL)
+    return -1;
+
+  POCL_LOCK (build_queue_lock);
+  if (max_build_workers == 0)
+    {
+      int threads = pocl_get_int_option ("POCL_BUILD_THREADS", 2);
+      max_build_workers = (threads < 1) ? 1
+                          : (threads > MAX_BUILD_THREADS) ? MAX_BUILD_THREADS
+                                                          : threads;
+      POCL_INIT_COND (build_queue_cond);
+      atexit (stop_build_workers);
+    }
+  LL_APPEND (build_queue, copy);
+  if (idle_build_workers == 0 && num_build_workers < max_build_workers)
+    {
+      POCL_CREATE_THREAD (build_workers[num_build_workers], build_worker_func,
+                          NULL);
+      ++num_build_workers;
+    }
+  else
+    POCL_SIGNAL_COND (build_queue_cond);
+  POCL_UNLOCK (build_queue_lock);
+  return 0;
+}
+
+void
+pocl_init_program_object (cl_program program)
+{
+  POCL_INIT_OBJECT (program);
+  POCL_INIT_COND (program->build_cond);
+  program->build_status = CL_BUILD_NONE;
+  program->binary_type = CL_PROGRAM_BINARY_TYPE_NONE;
+}
+
+void
+pocl_wait_for_program_build (cl_program program)
+{
+  POCL_LOCK_OBJ (program);
+  while (program->build_status == CL_BUILD_IN_PROGRESS)
+    POCL_WAIT_COND (program->build_cond, program->pocl_lock);
+  POCL_UNLOCK_OBJ (program);
+}
+
 cl_int
 compile_and_link_program(int compile_program,
                          int link_program,
@@ -706,16 +1177,13 @@ compile_and_link_program(int compile_program,
                          void *user_data)
 {
   char link_options[512];
-  int errcode, error;
-  int create_library = 0;
-  int requires_cr_sqrt_div = 0;
-  int spir_build = 0;
-  cl_version cl_c_version = 0;
+  int errcode;
   unsigned flush_denorms = 0;
   cl_device_id *unique_devlist = NULL;
   unsigned device_i = 0, actually_built = 0;
   size_t i;
   char *temp_options = NULL;
+  pocl_build_job job;
 
   const char *extra_build_options =
     pocl_get_string_option ("POCL_EXTRA_BUILD_FLAGS", NULL);
@@ -723,6 +1191,19 @@ compile_and_link_program(int compile_program,
   int build_error_code
       = (link_program ? CL_BUILD_PROGRAM_FAILURE : CL_COMPILE_PROGRAM_FAILURE);
 
+  memset (&job, 0, sizeof (job));
+  job.program = program;
+  job.compile_program = compile_program;
+  job.link_program = link_program;
+  job.build_error_code = build_error_code;
+  job.num_input_headers = num_input_headers;
+  job.input_headers = input_headers;
+  job.header_include_names = header_include_names;
+  job.num_input_programs = num_input_programs;
+  job.input_programs = input_programs;
+  job.pfn_notify = pfn_notify;
+  job.user_data = user_data;
+
   POCL_GOTO_LABEL_COND (PFN_NOTIFY, (!IS_CL_OBJECT_VALID (program)),
                         CL_INVALID_PROGRAM);
 
@@ -736,6 +1217,11 @@ compile_and_link_program(int compile_program,
 
   POCL_LOCK_OBJ (program);
 
+  POCL_GOTO_LABEL_ON (FINISH,
+                      program->build_status == CL_BUILD_IN_PROGRESS,
+                      CL_INVALID_OPERATION,
+                      "The previous build of the program is in progress\n");
+
   POCL_GOTO_LABEL_ON (FINISH, program->kernels, CL_INVALID_OPERATION,
                       "Program already has kernels\n");
 
@@ -760,6 +1246,7 @@ compile_and_link_program(int compile_program,
 
   /* TODO this should be somehow utilized at linking */
   POCL_MEM_FREE (program->compiler_options);
+  POCL_MEM_FREE (program->specialize_args);
 
   if (extra_build_options)
     {
@@ -784,8 +1271,9 @@ compile_and_link_program(int compile_program,
       program->compiler_options = (char *)malloc (size);
       errcode = process_options (
           temp_options, program->compiler_options, link_options, program,
-          compile_program, link_program, &create_library, &flush_denorms,
-          &requires_cr_sqrt_div, &spir_build, &cl_c_version, size);
+          compile_program, link_program, &job.create_library, &flush_denorms,
+          &job.requires_cr_sqrt_div, &job.spir_build, &job.cl_c_version,
+          size);
       if (errcode != CL_SUCCESS)
         goto ERROR_CLEAN_OPTIONS;
     }
@@ -820,7 +1308,7 @@ compile_and_link_program(int compile_program,
    * CL_PROGRAM_BINARY_TYPE_LIBRARY.
    */
   program->binary_type = CL_PROGRAM_BINARY_TYPE_EXECUTABLE;
-  if (create_library)
+  if (job.create_library)
     program->binary_type = CL_PROGRAM_BINARY_TYPE_LIBRARY;
   if (compile_program && !link_program)
     program->binary_type = CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT;
@@ -849,158 +1337,27 @@ compile_and_link_program(int compile_program,
       "not available for the program, or do not exist: %u < %u\n",
       actually_built, program->num_devices);
 
-  /* Build the program for all requested devices. */
-  for (device_i = 0; device_i < program->num_devices; ++device_i)
-    {
-      cl_device_id device = program->devices[device_i];
-
-      if (cl_c_version && check_device_supports (device, cl_c_version))
-        {
-          APPEND_TO_BUILD_LOG_GOTO (
-              build_error_code,
-              "Build option -cl-std specified OpenCL C version %u.%u,"
-              "but device %s doesn't support that OpenCL C version.\n",
-              CL_VERSION_MAJOR (cl_c_version), CL_VERSION_MINOR (cl_c_version),
-              device->short_name);
-        }
-
-      if (requires_cr_sqrt_div
-          && !(device->single_fp_config & CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT))
-        APPEND_TO_BUILD_LOG_GOTO (build_error_code,
-                                  REQUIRES_CR_SQRT_DIV_ERR " %s\n",
-                                  device->short_name);
-
-      /* clCreateProgramWithBuiltinKernels */
-      if (program->builtin_kernel_names)
-        {
-          if (device->ops->build_builtin)
-            {
-              error = device->ops->build_builtin (program, device_i);
-              if (error != CL_SUCCESS)
-                APPEND_TO_BUILD_LOG_GOTO (CL_BUILD_PROGRAM_FAILURE,
-                                          "Device %s failed to build the "
-                                          "program with builtin kernels\n",
-                                          device->long_name);
-            }
-        }
-      /* only link the program/library */
-      else if (!compile_program && link_program)
-        {
-          assert (num_input_programs > 0);
-
-          if (device->ops->link_program == NULL)
-            APPEND_TO_BUILD_LOG_GOTO (CL_LINK_PROGRAM_FAILURE,
-                                      "%s device's driver does "
-                                      "not support linking programs\n",
-                                      device->long_name);
-
-          error = device->ops->link_program (program, device_i,
-                                             num_input_programs,
-                                             input_programs, create_library);
-          if (error != CL_SUCCESS)
-            APPEND_TO_BUILD_LOG_GOTO (CL_LINK_PROGRAM_FAILURE,
-                                      "Device %s failed to link the program\n",
-                                      device->long_name);
-        }
-      /* compile and/or link from source */
-      else if (program->source)
-        {
-          if (device->ops->build_source == NULL)
-            APPEND_TO_BUILD_LOG_GOTO (
-                build_error_code,
-                "%s device's driver does not "
-                "support building programs from source\n",
-                device->long_name);
-
-          error = device->ops->build_source (
-              program, device_i, num_input_headers, input_headers,
-              header_include_names, (create_library ? 0 : link_program));
-
-          if (error != CL_SUCCESS)
-            {
-              if (program->build_log[device_i])
-                POCL_MSG_ERR ("Build log for device %s:\n%s\n",
-                              device->long_name, program->build_log[device_i]);
-              APPEND_TO_BUILD_LOG_GOTO (build_error_code,
-                                        "Device %s failed to build"
-                                        " the program\n",
-                                        device->long_name);
-            }
-        }
-      /* compile and/or link from binary */
-      else
-        {
-          if (device->ops->build_binary == NULL)
-            APPEND_TO_BUILD_LOG_GOTO (build_error_code,
-                                      "%s device's driver does not support "
-                                      "building programs from binaries\n",
-                                      device->long_name);
-
-          if ((program->binary_sizes[device_i] == 0)
-              && (program->pocl_binary_sizes[device_i] == 0)
-              && (program->program_il_size == 0))
-            APPEND_TO_BUILD_LOG_GOTO (CL_INVALID_BINARY,
-                                      "No poclbinaries nor binaries "
-                                      "for device %s - can't build "
-                                      "the program\n",
-                                      device->short_name);
-
-          error = device->ops->build_binary (
-              program, device_i, (create_library ? 0 : link_program),
-              spir_build);
-
-          if (error != CL_SUCCESS)
-            {
-              if (program->build_log[device_i])
-                POCL_MSG_ERR ("Build log for device %s:\n%s\n",
-                              device->long_name, program->build_log[device_i]);
-              APPEND_TO_BUILD_LOG_GOTO (build_error_code,
-                                        "Device %s failed to build"
-                                        " the program\n",
-                                        device->long_name);
-            }
-        }
-
-      /* Maintain a 'last_accessed' file in every program's
-       * cache directory. Will be useful for cache pruning script
-       * that flushes old directories based on LRU */
-      if (!program->builtin_kernel_names)
-        pocl_cache_update_program_last_access (program, device_i);
-
-      ++actually_built;
-    }
-  assert (actually_built == program->num_devices);
-  assert(program->num_kernels == 0);
+  /* only process_options () needs these */
+  if (temp_options != options)
+    free (temp_options);
+  temp_options = (char *)options;
 
-  /* for executables & programs with builtin kernels,
-   * setup the kernel metadata */
-  /* if the program is not a finished executable, we don't need
-   * to setup kernel metadata */
-  if (program->binary_type == CL_PROGRAM_BINARY_TYPE_EXECUTABLE
-      || program->binary_type == CL_PROGRAM_BINARY_TYPE_NONE)
+  /* With a callback, the application does not need to wait for the build,
+     so it's done in the background. */
+  if (pfn_notify != NULL && pocl_get_bool_option ("POCL_ASYNC_BUILD", 1))
     {
-      errcode = setup_kernel_metadata (program);
-      if (errcode != CL_SUCCESS)
+      program->build_status = CL_BUILD_IN_PROGRESS;
+      if (queue_build_job (&job) == 0)
         {
-          POCL_MSG_ERR ("Program build: kernel metadata setup failed\n");
-          goto ERROR;
+          POCL_UNLOCK_OBJ (program);
+          return CL_SUCCESS;
         }
-
-      setup_device_kernel_hashes (program);
+      POCL_MSG_WARN ("Could not queue the build, building synchronously\n");
     }
 
-  for (device_i = 0; device_i < program->num_devices; device_i++)
-    {
-      cl_device_id device = program->devices[device_i];
-
-      if (device->ops->post_build_program)
-        device->ops->post_build_program (program, device_i);
-    }
-
-  TP_BUILD_PROGRAM (program->context->id, program->id);
-
-  program->build_status = CL_BUILD_SUCCESS;
-  errcode = CL_SUCCESS;
+  cl_build_status status;
+  errcode = build_program (&job, &status);
+  program->build_status = status;
   goto FINISH;
 
 ERROR:
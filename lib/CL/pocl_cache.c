@@ -27,6 +27,13 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
 #include "config.h"
 #include "pocl_build_timestamp.h"
 #include "pocl_version.h"
@@ -42,6 +49,7 @@
 
 #include "pocl_cl.h"
 #include "pocl_runtime_config.h"
+#include "pocl_timing.h"
 
 #define POCL_LAST_ACCESSED_FILENAME "/last_accessed"
 /* The filename in which the program's build log is stored */
@@ -181,8 +189,26 @@ pocl_cache_kernel_cachedir_path (char *kernel_cachedir_path,
   pocl_hash_clipped_name (kernel->name, POCL_MAX_DIRNAME_LENGTH,
                           &kernel_dir_name[0]);
 
+  /* The values of the -pocl-specialize-args arguments. Their SHA1 is used
+     instead of the 64-bit hash of the launch, which is not collision free
+     enough to name a persistent cache entry. */
+  char spec_args[SHA1_DIGEST_SIZE * 2 + 6] = "";
+  if (specialized && run_cmd->spec_args_hash != 0)
+    {
+      SHA1_CTX hash_ctx;
+      uint8_t digest[SHA1_DIGEST_SIZE];
+      unsigned i;
+      pocl_SHA1_Init (&hash_ctx);
+      pocl_SHA1_Update (&hash_ctx, run_cmd->spec_args,
+                        run_cmd->spec_args_size);
+      pocl_SHA1_Final (&hash_ctx, digest);
+      strcpy (spec_args, "-args");
+      for (i = 0; i < SHA1_DIGEST_SIZE; ++i)
+        sprintf (spec_args + 5 + 2 * i, "%02x", digest[i]);
+    }
+
   bytes_written = snprintf (
-      tempstring, POCL_MAX_PATHNAME_LENGTH, "/%s/%zu-%zu-%zu%s%s%s",
+      tempstring, POCL_MAX_PATHNAME_LENGTH, "/%s/%zu-%zu-%zu%s%s%s%s%s",
       kernel_dir_name, !specialized ? 0 : run_cmd->pc.local_size[0],
       !specialized ? 0 : run_cmd->pc.local_size[1],
       !specialized ? 0 : run_cmd->pc.local_size[2],
@@ -195,6 +221,7 @@ pocl_cache_kernel_cachedir_path (char *kernel_cachedir_path,
               && max_grid_width < dev->grid_width_specialization_limit
           ? "-smallgrid"
           : "",
+      specialized && run_cmd->noalias_args ? "-noalias" : "", spec_args,
       append_str);
   assert (bytes_written > 0 && bytes_written < POCL_MAX_PATHNAME_LENGTH);
 
@@ -333,6 +360,114 @@ pocl_cache_write_generic_objfile (char *objfile_path,
 
 /******************************************************************************/
 
+#define POCL_BUILD_LEASE_SUFFIX ".lock"
+#define POCL_BUILD_LEASE_MAX_POLL_US 50000
+
+/* The build lease of a cache artifact is an flock() on a lock file next to
+   it. The kernel drops the lock when its holder exits or crashes, so a stale
+   lock file left behind is simply taken over by the next process. The holder
+   removes the lock file before unlocking it; a waiter that gets the lock of
+   an already removed file retries with a fresh one. */
+
+int
+pocl_cache_acquire_build_lease (const char *path, int *lease_fd)
+{
+  *lease_fd = -1;
+
+#ifndef _WIN32
+  int timeout = pocl_get_int_option ("POCL_KERNEL_CACHE_LEASE_TIMEOUT", 60);
+  if (!use_kernel_cache || timeout <= 0)
+    return 1;
+
+  char lock_path[POCL_MAX_PATHNAME_LENGTH];
+  snprintf (lock_path, POCL_MAX_PATHNAME_LENGTH, "%s%s", path,
+            POCL_BUILD_LEASE_SUFFIX);
+
+  char *dir = strdup (lock_path);
+  char *dirpath = dirname (dir);
+  if (!pocl_exists (dirpath))
+    pocl_mkdir_p (dirpath);
+  free (dir);
+
+  uint64_t deadline = pocl_gettimemono_ns () + (uint64_t)timeout * 1000000000;
+  unsigned poll_us = 1000;
+  int waited = 0;
+
+  while (1)
+    {
+      int fd = open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (fd < 0)
+        return 1;
+
+      if (flock (fd, LOCK_EX | LOCK_NB) == 0)
+        {
+          struct stat fd_st, path_st;
+          if (fstat (fd, &fd_st) == 0 && stat (lock_path, &path_st) == 0
+              && fd_st.st_dev == path_st.st_dev
+              && fd_st.st_ino == path_st.st_ino)
+            {
+              /* the previous holder may have finished it */
+              if (pocl_exists (path))
+                {
+                  pocl_cache_release_build_lease (path, fd);
+                  return 0;
+                }
+              *lease_fd = fd;
+              return 1;
+            }
+          close (fd);
+          continue;
+        }
+
+      int lock_errno = errno;
+      close (fd);
+      /* no working locks on this filesystem */
+      if (lock_errno != EWOULDBLOCK)
+        return 1;
+
+      if (pocl_exists (path))
+        return 0;
+
+      if (!waited)
+        POCL_MSG_PRINT_INFO ("Waiting for another process to build %s\n",
+                             path);
+      waited = 1;
+
+      if (pocl_gettimemono_ns () > deadline)
+        {
+          POCL_MSG_WARN ("Timed out waiting for another process to build "
+                         "%s, building it here\n",
+                         path);
+          return 1;
+        }
+
+      usleep (poll_us);
+      poll_us = poll_us * 2 > POCL_BUILD_LEASE_MAX_POLL_US
+                    ? POCL_BUILD_LEASE_MAX_POLL_US
+                    : poll_us * 2;
+    }
+#else
+  return 1;
+#endif
+}
+
+void
+pocl_cache_release_build_lease (const char *path, int lease_fd)
+{
+#ifndef _WIN32
+  if (lease_fd < 0)
+    return;
+
+  char lock_path[POCL_MAX_PATHNAME_LENGTH];
+  snprintf (lock_path, POCL_MAX_PATHNAME_LENGTH, "%s%s", path,
+            POCL_BUILD_LEASE_SUFFIX);
+  unlink (lock_path);
+  close (lease_fd);
+#endif
+}
+
+/******************************************************************************/
+
 int pocl_cache_update_program_last_access(cl_program program,
                                           unsigned device_i) {
   if (!use_kernel_cache)
@@ -484,6 +619,18 @@ build_program_compute_hash (cl_program program, unsigned device_i,
         if (wg_method)
           pocl_SHA1_Update (&hash_ctx, (uint8_t *)wg_method,
                             strlen (wg_method));
+        pocl_SHA1_Update (&hash_ctx, (uint8_t *)&device->prefetch_latency,
+                          sizeof (cl_uint));
+        pocl_SHA1_Update (&hash_ctx, (uint8_t *)&device->prefetch_min_stride,
+                          sizeof (cl_uint));
+        pocl_SHA1_Update (&hash_ctx,
+                          (uint8_t *)&device->staging_copy_elimination,
+                          sizeof (cl_bool));
+        pocl_SHA1_Update (&hash_ctx, (uint8_t *)&device->barrier_elision,
+                          sizeof (cl_bool));
+        pocl_SHA1_Update (&hash_ctx,
+                          (uint8_t *)&device->native_sub_group_size,
+                          sizeof (cl_uint));
       }
 #endif
 
@@ -1084,6 +1084,18 @@ struct _cl_device_id {
      to reduce address computation overheads etc. */
   size_t grid_width_specialization_limit;
 
+  /* The memory latency in cycles that the software prefetches inserted to
+     the work-item loops should hide, 0 to not insert them. Loads with a
+     stride of at least prefetch_min_stride bytes per iteration are
+     prefetched, or of at least a cache line if it is 0. */
+  cl_uint prefetch_latency;
+  cl_uint prefetch_min_stride;
+
+  /* Whether the work-group compilation removes the staging copies to local
+     memory and the barriers that order no conflicting memory accesses. */
+  cl_bool staging_copy_elimination;
+  cl_bool barrier_elision;
+
   /* Device-specific linker flags that should be appended to the clang's
      argument list for a final linkage call when producing the final binary
      that can be uploaded to the device using the default LLVM-based
@@ -1146,6 +1158,10 @@ struct _cl_device_id {
   /* OpenCL 2.1 */
 
   cl_uint max_num_sub_groups;
+  /* The sub-group size of the kernels without intel_reqd_sub_group_size,
+     for local sizes whose x dimension it divides. 0 if the sub-group is
+     always the whole x dimension of the work-group. */
+  cl_uint native_sub_group_size;
   cl_bool sub_group_independent_forward_progress;
 
   /* image formats supported by the device, per image type */
@@ -1231,11 +1247,39 @@ struct _context_destructor_callback
   context_destructor_callback_t *next;
 };
 
+/* Categories of the memory accounting enabled with POCL_MEM_STATS, in the
+   order of the CL_MEM_CATEGORY_*_POCL indices of cl_ext_pocl.h. The last
+   ones are runtime-wide and not tied to a context. */
+#define POCL_MEM_BUFFER 0
+#define POCL_MEM_IMAGE 1
+#define POCL_MEM_SVM 2
+#define POCL_MEM_USM 3
+#define POCL_MEM_KERNEL_ARGS 4
+#define POCL_MEM_EVENTS 5
+#define POCL_MEM_COMMANDS 6
+#define POCL_MEM_KERNEL_MODULES 7
+#define POCL_MEM_PRINTF 8
+#define POCL_MEM_LOCAL_SCRATCH 9
+#define POCL_MEM_TOTAL 10
+#define POCL_MEM_CATEGORY_COUNT 11
+#define POCL_MEM_FIRST_GLOBAL_CATEGORY POCL_MEM_COMMANDS
+
+typedef struct
+{
+  /* bytes currently allocated, and their high-water mark */
+  size_t current[POCL_MEM_CATEGORY_COUNT];
+  size_t peak[POCL_MEM_CATEGORY_COUNT];
+  /* number of allocations done */
+  cl_ulong allocs[POCL_MEM_CATEGORY_COUNT];
+} pocl_mem_stats;
+
 typedef struct _pocl_svm_ptr pocl_svm_ptr;
 struct _pocl_svm_ptr
 {
   void *svm_ptr;
   size_t size;
+  /* allocated with clMemAllocINTEL & co (for memory accounting) */
+  int is_usm;
   struct _pocl_svm_ptr *prev, *next;
 };
 
@@ -1303,6 +1347,9 @@ struct _cl_context {
    * required for clMemBlockingFreeINTEL */
   struct _cl_command_queue *command_queues;
 
+  /* memory accounting (POCL_MEM_STATS) */
+  pocl_mem_stats mem_stats;
+
 #ifdef ENABLE_LLVM
   void *llvm_context_data;
 #endif
@@ -1366,13 +1413,41 @@ struct _cl_command_buffer_khr
    * wait lists when recording commands. */
   cl_uint num_syncpoints;
 
+  /* Set at finalize time if the sync points of the commands carry all the
+   * ordering they need on the in-order queue, so that the replay does not
+   * chain them after each other and independent commands can overlap. */
+  int explicit_order;
+
   _cl_command_node *cmds;
+
+  /* Handles of the commands recorded with a mutable_handle */
+  cl_mutable_command_khr mutable_cmds;
 };
 
+/* The fields of a mutable NDRange command that can be updated */
+#define POCL_MUTABLE_DISPATCH_FIELDS                                          \
+  (CL_MUTABLE_DISPATCH_GLOBAL_OFFSET_KHR | CL_MUTABLE_DISPATCH_GLOBAL_SIZE_KHR \
+   | CL_MUTABLE_DISPATCH_LOCAL_SIZE_KHR | CL_MUTABLE_DISPATCH_ARGUMENTS_KHR)
+
+/* cl_khr_command_buffer_mutable_dispatch: a handle to a recorded
+   NDRange command, whose launch state is updated in place in the node. */
 struct _cl_mutable_command_khr
 {
-  /* Unused in cl_khr_command_buffer but required in public API and used by
-   * follow-up extensions. */
+  cl_command_buffer_khr command_buffer;
+  cl_command_queue command_queue;
+  _cl_command_node *node;
+
+  /* The fields that clUpdateMutableCommandsKHR may change */
+  cl_mutable_dispatch_fields_khr updatable_fields;
+  /* 1 if the local size was chosen by the runtime, so that it is chosen
+     again when the global size changes */
+  int auto_local_size;
+
+  /* The properties given at recording, terminated by 0 */
+  cl_uint num_properties;
+  cl_ndrange_kernel_command_properties_khr *properties;
+
+  cl_mutable_command_khr next;
 };
 
 #define POCL_ON_SUB_MISALIGN(mem, que, operation)                             \
@@ -1475,6 +1550,12 @@ struct _cl_mem {
    * the mem_host_ptr is automatically freed */
   uint mem_host_ptr_refcount;
   int mem_host_ptr_is_svm;
+  /* mem_host_ptr was allocated by pocl_aligned_malloc, so its pages can be
+   * replaced with zero pages */
+  int mem_host_ptr_is_malloced;
+  /* pocl_cow_buffer of mem_host_ptr if it was allocated by pocl_cow_alloc,
+   * so pocl_cow_copy can copy it */
+  void *mem_host_ptr_cow;
 
   /* array of device-specific memory bookkeeping structs.
      The location of some device's struct is determined by
@@ -1553,6 +1634,15 @@ struct _cl_mem {
 
 typedef uint8_t SHA1_digest_t[SHA1_DIGEST_SIZE * 2 + 1];
 
+/* The values of the -pocl-specialize-args arguments of one specialized
+   WG function version, concatenated in the argument order. */
+typedef struct
+{
+  uint64_t hash;
+  size_t size;
+  unsigned char *values;
+} pocl_arg_spec;
+
 typedef struct pocl_kernel_metadata_s
 {
   cl_uint num_args;
@@ -1565,6 +1655,8 @@ typedef struct pocl_kernel_metadata_s
   size_t reqd_wg_size[OPENCL_MAX_DIMENSION];
   size_t wg_size_hint[OPENCL_MAX_DIMENSION];
   char vectypehint[16];
+  /* intel_reqd_sub_group_size, 0 if the kernel does not require one */
+  size_t reqd_sub_group_size;
 
   /* if we know the size of _every_ kernel argument, we store
    * the total size here. see struct _cl_kernel on why */
@@ -1598,6 +1690,14 @@ typedef struct pocl_kernel_metadata_s
    * Only applies to builtin kernels */
   size_t_3 builtin_max_global_work;
 
+  /* Bitmask of the scalar arguments selected with -pocl-specialize-args,
+     whose values are folded into the specialized WG functions. */
+  uint64_t specialized_args;
+  /* The argument value combinations that have a specialized version, at
+     most POCL_MAX_ARG_SPECIALIZATIONS. Protected by the program lock. */
+  pocl_arg_spec *arg_specs;
+  unsigned num_arg_specs;
+
   /* device-specific METAdata, void* array[program->num_devices] */
   void **data;
 } pocl_kernel_metadata_t;
@@ -1627,6 +1727,9 @@ struct _cl_program {
   char *source;
   /* The options in the last clBuildProgram call for this Program. */
   char *compiler_options;
+  /* Comma separated argument names given with -pocl-specialize-args,
+     or NULL. */
+  char *specialize_args;
 
   /* per-device binaries, in device-specific format */
   size_t *binary_sizes;
@@ -1659,6 +1762,8 @@ struct _cl_program {
   char main_build_log[MAIN_PROGRAM_LOG_SIZE];
   /* Use to store build status */
   cl_build_status build_status;
+  /* Signaled when a background build (CL_BUILD_IN_PROGRESS) finishes. */
+  pocl_cond_t build_cond;
   /* Use to store binary type */
   cl_program_binary_type binary_type;
   /* total size of program-scope variables. This depends on alignments
@@ -1755,6 +1860,17 @@ typedef struct _pocl_event_md
 } pocl_event_md;
 
 
+/* Indices of the hardware counters collected per command, by the CPU
+   drivers when POCL_PERF_COUNTERS is enabled, and by the Vortex driver on
+   profiling queues. */
+#define POCL_HW_COUNTER_CYCLES 0
+#define POCL_HW_COUNTER_INSTRUCTIONS 1
+#define POCL_HW_COUNTER_CACHE_MISSES 2
+#define POCL_HW_COUNTER_BRANCH_MISSES 3
+#define POCL_HW_COUNTER_STALLS 4
+#define POCL_HW_COUNTER_MEM_REQUESTS 5
+#define POCL_HW_COUNTER_COUNT 6
+
 typedef struct _cl_event _cl_event;
 struct _cl_event {
   POCL_ICD_OBJECT
@@ -1781,6 +1897,11 @@ struct _cl_event {
   cl_ulong time_start;  /* the time the command actually started executing */
   cl_ulong time_end;    /* the finish time of the command */
 
+  /* Hardware counter totals of the command (POCL_HW_COUNTER_*); bit i of
+     the mask is set if hw_counters[i] was collected. */
+  cl_ulong hw_counters[POCL_HW_COUNTER_COUNT];
+  cl_uint hw_counter_mask;
+
   /* Device specific data */
   void *data;
 
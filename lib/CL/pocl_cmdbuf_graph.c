@@ -0,0 +1,651 @@
+/* pocl_cmdbuf_graph.c: finalize time optimization of command buffers
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/* The recorded commands of a command buffer form a graph, in which a
+   command depends on the commands of its sync point wait list, and on the
+   ones the replay orders it after anyway: the previous command of an
+   in-order queue and the last barrier. At finalize time the graph is
+   rewritten, in the order of the passes below:
+
+   - on an in-order queue, if the memory every command accesses is known,
+     the order between the commands is replaced by the hazards between
+     them (a write and another access of the same memory), so that the
+     independent chains of commands can run concurrently. The memory of a
+     kernel whose arguments are mutable is not known;
+   - adjacent fills of contiguous ranges with the same pattern, and
+     adjacent copies of contiguous ranges between the same buffers, are
+     merged into one command;
+   - fills and copies whose whole destination range is written again by a
+     later fill or copy before any command can access it are removed;
+   - the dependencies implied by the other dependencies (transitive
+     reduction) are dropped from the wait lists.
+
+   The commands are kept in the order they were recorded in, which is a
+   topological order of the graph. The sync points are renumbered, which
+   is invisible to the application since no more commands can be recorded
+   after finalizing. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pocl_cl.h"
+#include "pocl_mem_management.h"
+#include "pocl_runtime_config.h"
+#include "pocl_util.h"
+#include "utlist.h"
+
+/* Above this, the ancestor bitmaps take too much memory for the benefit. */
+#define MAX_GRAPH_COMMANDS 4096
+
+typedef struct
+{
+  _cl_command_node *cmd;
+  /* indices of the earlier commands this one depends on */
+  unsigned *preds;
+  unsigned num_preds;
+  unsigned preds_capacity;
+  int removed;
+  /* the arguments of the kernel can be updated after finalizing, so it can
+     access any memory */
+  int mutable_args;
+} graph_node;
+
+typedef struct
+{
+  graph_node *nodes;
+  unsigned num_nodes;
+  /* the nodes each node transitively depends on, one bitmap per node */
+  uint64_t *ancestors;
+  unsigned words;
+  int in_order;
+  int explicit_order;
+} cmd_graph;
+
+static int
+add_pred (graph_node *node, unsigned pred)
+{
+  unsigned i;
+  for (i = 0; i < node->num_preds; ++i)
+    if (node->preds[i] == pred)
+      return 0;
+  if (node->num_preds == node->preds_capacity)
+    {
+      unsigned capacity = node->preds_capacity ? node->preds_capacity * 2 : 4;
+      unsigned *preds
+          = (unsigned *)realloc (node->preds, capacity * sizeof (unsigned));
+      if (preds == NULL)
+        return -1;
+      node->preds = preds;
+      node->preds_capacity = capacity;
+    }
+  node->preds[node->num_preds++] = pred;
+  return 0;
+}
+
+static void
+remove_pred (graph_node *node, unsigned pred)
+{
+  unsigned i;
+  for (i = 0; i < node->num_preds; ++i)
+    if (node->preds[i] == pred)
+      {
+        node->preds[i] = node->preds[--node->num_preds];
+        return;
+      }
+}
+
+static int
+has_pred (graph_node *node, unsigned pred)
+{
+  unsigned i;
+  for (i = 0; i < node->num_preds; ++i)
+    if (node->preds[i] == pred)
+      return 1;
+  return 0;
+}
+
+static int
+is_ancestor (cmd_graph *g, unsigned node, unsigned ancestor)
+{
+  return (g->ancestors[(size_t)node * g->words + ancestor / 64]
+          >> (ancestor % 64))
+         & 1;
+}
+
+static void
+compute_ancestors (cmd_graph *g)
+{
+  unsigned i, j, w;
+  memset (g->ancestors, 0, (size_t)g->num_nodes * g->words * 8);
+  for (i = 0; i < g->num_nodes; ++i)
+    {
+      uint64_t *anc = &g->ancestors[(size_t)i * g->words];
+      graph_node *node = &g->nodes[i];
+      for (j = 0; j < node->num_preds; ++j)
+        {
+          unsigned p = node->preds[j];
+          uint64_t *pred_anc = &g->ancestors[(size_t)p * g->words];
+          for (w = 0; w < g->words; ++w)
+            anc[w] |= pred_anc[w];
+          anc[p / 64] |= 1ULL << (p % 64);
+        }
+    }
+}
+
+/* Makes the later nodes that depend on node K depend on TARGETS instead. */
+static int
+redirect_dependents (cmd_graph *g, unsigned k, unsigned *targets,
+                     unsigned num_targets)
+{
+  unsigned i, j;
+  for (i = k + 1; i < g->num_nodes; ++i)
+    {
+      graph_node *node = &g->nodes[i];
+      if (node->removed || !has_pred (node, k))
+        continue;
+      remove_pred (node, k);
+      for (j = 0; j < num_targets; ++j)
+        if (add_pred (node, targets[j]))
+          return -1;
+    }
+  return 0;
+}
+
+static cl_mem
+mem_root (cl_mem mem)
+{
+  if (mem->is_image && mem->buffer != NULL)
+    mem = mem->buffer;
+  return mem->parent != NULL ? mem->parent : mem;
+}
+
+/* The range of its i-th memory object that the command accesses. */
+static void
+mem_range (_cl_command_node *cmd, unsigned i, size_t *start, size_t *end)
+{
+  *start = 0;
+  *end = SIZE_MAX;
+  if (cmd->type == CL_COMMAND_FILL_BUFFER && i == 0)
+    {
+      *start = cmd->command.memfill.offset;
+      *end = *start + cmd->command.memfill.size;
+    }
+  else if (cmd->type == CL_COMMAND_COPY_BUFFER && i < 2)
+    {
+      *start = i == 0 ? cmd->command.copy.src_offset
+                      : cmd->command.copy.dst_offset;
+      *end = *start + cmd->command.copy.size;
+    }
+}
+
+static int
+is_barrier (_cl_command_node *cmd)
+{
+  return cmd->type == CL_COMMAND_BARRIER;
+}
+
+/* Whether all the memory the command can access is in its memobj_list. */
+static int
+has_known_accesses (_cl_command_node *cmd)
+{
+  unsigned i;
+  switch (cmd->type)
+    {
+    case CL_COMMAND_NDRANGE_KERNEL:
+      for (i = 0; i < cmd->command.run.kernel->meta->num_args; ++i)
+        if (cmd->command.run.arguments[i].is_svm)
+          return 0;
+      return 1;
+    case CL_COMMAND_BARRIER:
+    case CL_COMMAND_FILL_BUFFER:
+    case CL_COMMAND_FILL_IMAGE:
+    case CL_COMMAND_COPY_BUFFER:
+    case CL_COMMAND_COPY_BUFFER_RECT:
+    case CL_COMMAND_COPY_BUFFER_TO_IMAGE:
+    case CL_COMMAND_COPY_IMAGE:
+    case CL_COMMAND_COPY_IMAGE_TO_BUFFER:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+static int
+has_program_scope_vars (cl_program program)
+{
+  unsigned i;
+  if (program->global_var_total_size == NULL)
+    return 0;
+  for (i = 0; i < program->num_devices; ++i)
+    if (program->global_var_total_size[i] > 0)
+      return 1;
+  return 0;
+}
+
+/* Whether the later command B must wait for A because of the memory they
+   access, i.e. they access overlapping ranges and either one writes. */
+static int
+has_hazard (_cl_command_node *a, _cl_command_node *b)
+{
+  unsigned i, j;
+
+  /* the program-scope variables are not memory objects */
+  if (a->type == CL_COMMAND_NDRANGE_KERNEL
+      && b->type == CL_COMMAND_NDRANGE_KERNEL
+      && a->command.run.kernel->program == b->command.run.kernel->program
+      && has_program_scope_vars (a->command.run.kernel->program))
+    return 1;
+
+  for (i = 0; i < a->memobj_count; ++i)
+    for (j = 0; j < b->memobj_count; ++j)
+      {
+        size_t a_start, a_end, b_start, b_end;
+        if (a->readonly_flag_list[i] && b->readonly_flag_list[j])
+          continue;
+        if (mem_root (a->memobj_list[i]) != mem_root (b->memobj_list[j]))
+          continue;
+        mem_range (a, i, &a_start, &a_end);
+        mem_range (b, j, &b_start, &b_end);
+        if (a_start < b_end && b_start < a_end)
+          return 1;
+      }
+  return 0;
+}
+
+/* Whether the dependency of node I on P is enforced by the replay without
+   it being in the wait list of I. */
+static int
+is_implicit_dep (cmd_graph *g, unsigned i, unsigned p)
+{
+  unsigned j;
+  if (g->in_order && !g->explicit_order)
+    {
+      for (j = i; j-- > 0;)
+        if (!g->nodes[j].removed)
+          break;
+      if (j == p)
+        return 1;
+    }
+  if (!g->in_order && is_barrier (g->nodes[i].cmd)
+      && !g->nodes[i].cmd->command.barrier.has_wait_list)
+    return 1;
+  /* the replay orders the commands other than barriers after the last
+     barrier */
+  if (is_barrier (g->nodes[p].cmd) && !is_barrier (g->nodes[i].cmd))
+    {
+      for (j = p + 1; j < i; ++j)
+        if (!g->nodes[j].removed && is_barrier (g->nodes[j].cmd))
+          return 0;
+      return 1;
+    }
+  return 0;
+}
+
+static int
+build_graph (cmd_graph *g, cl_command_buffer_khr command_buffer)
+{
+  _cl_command_node *cmd;
+  unsigned i, j, last_barrier = UINT32_MAX;
+
+  i = 0;
+  LL_FOREACH (command_buffer->cmds, cmd)
+  {
+    graph_node *node = &g->nodes[i++];
+    node->cmd = cmd;
+    cl_mutable_command_khr handle;
+    LL_FOREACH (command_buffer->mutable_cmds, handle)
+    {
+      if (handle->node == cmd
+          && (handle->updatable_fields & CL_MUTABLE_DISPATCH_ARGUMENTS_KHR))
+        node->mutable_args = 1;
+    }
+    if (node->mutable_args || !has_known_accesses (cmd))
+      g->explicit_order = 0;
+  }
+
+  for (i = 0; i < g->num_nodes; ++i)
+    {
+      graph_node *node = &g->nodes[i];
+      _cl_command_node *cmd = node->cmd;
+      for (j = 0; j < cmd->sync.syncpoint.num_sync_points_in_wait_list; ++j)
+        if (add_pred (node, cmd->sync.syncpoint.sync_point_wait_list[j] - 1))
+          return -1;
+
+      if (!is_barrier (cmd))
+        {
+          if (last_barrier != UINT32_MAX && add_pred (node, last_barrier))
+            return -1;
+        }
+      else
+        {
+          /* a barrier without a wait list waits for all the commands before
+             it, in either kind of queue */
+          if (!cmd->command.barrier.has_wait_list || g->explicit_order)
+            for (j = 0; j < i; ++j)
+              if (add_pred (node, j))
+                return -1;
+          last_barrier = i;
+        }
+
+      if (g->explicit_order)
+        {
+          for (j = 0; j < i; ++j)
+            if (has_hazard (g->nodes[j].cmd, cmd) && add_pred (node, j))
+              return -1;
+        }
+      else if (g->in_order && i > 0 && add_pred (node, i - 1))
+        return -1;
+    }
+  return 0;
+}
+
+static void
+free_removed_command (_cl_command_node *cmd)
+{
+  unsigned i;
+  if (cmd->type == CL_COMMAND_FILL_BUFFER)
+    POCL_MEM_FREE (cmd->command.memfill.pattern);
+  for (i = 0; i < cmd->memobj_count; ++i)
+    POname (clReleaseMemObject) (cmd->memobj_list[i]);
+  pocl_mem_manager_free_command (cmd);
+}
+
+/* Extends A with the range of the next command B if they can be done as
+   one command. */
+static int
+try_merge (_cl_command_node *a, _cl_command_node *b)
+{
+  if (a->type != b->type)
+    return 0;
+
+  if (a->type == CL_COMMAND_FILL_BUFFER)
+    {
+      _cl_command_fill_mem *fa = &a->command.memfill;
+      _cl_command_fill_mem *fb = &b->command.memfill;
+      if (fa->dst_mem_id != fb->dst_mem_id
+          || fa->pattern_size != fb->pattern_size
+          || memcmp (fa->pattern, fb->pattern, fa->pattern_size) != 0)
+        return 0;
+      if (fa->offset + fa->size == fb->offset)
+        fa->size += fb->size;
+      else if (fb->offset + fb->size == fa->offset)
+        {
+          fa->offset = fb->offset;
+          fa->size += fb->size;
+        }
+      else
+        return 0;
+      return 1;
+    }
+
+  if (a->type == CL_COMMAND_COPY_BUFFER)
+    {
+      _cl_command_copy *ca = &a->command.copy;
+      _cl_command_copy *cb = &b->command.copy;
+      /* the merged ranges of the same buffer could overlap */
+      if (ca->src != cb->src || ca->dst != cb->dst || ca->src == ca->dst
+          || ca->src_content_size != NULL || cb->src_content_size != NULL)
+        return 0;
+      if (ca->src_offset + ca->size == cb->src_offset
+          && ca->dst_offset + ca->size == cb->dst_offset)
+        ca->size += cb->size;
+      else if (cb->src_offset + cb->size == ca->src_offset
+               && cb->dst_offset + cb->size == ca->dst_offset)
+        {
+          ca->src_offset = cb->src_offset;
+          ca->dst_offset = cb->dst_offset;
+          ca->size += cb->size;
+        }
+      else
+        return 0;
+      return 1;
+    }
+
+  return 0;
+}
+
+static int
+merge_adjacent (cmd_graph *g)
+{
+  unsigned i, j, k, merged = 0;
+  for (i = 0; i < g->num_nodes; ++i)
+    {
+      graph_node *a = &g->nodes[i];
+      if (a->removed)
+        continue;
+      for (j = i + 1; j < g->num_nodes && g->nodes[j].removed; ++j)
+        ;
+      while (j < g->num_nodes && try_merge (a->cmd, g->nodes[j].cmd))
+        {
+          graph_node *b = &g->nodes[j];
+          for (k = 0; k < b->num_preds; ++k)
+            if (b->preds[k] != i && add_pred (a, b->preds[k]))
+              return -1;
+          if (redirect_dependents (g, j, &i, 1))
+            return -1;
+          b->removed = 1;
+          ++merged;
+          for (++j; j < g->num_nodes && g->nodes[j].removed; ++j)
+            ;
+        }
+    }
+  if (merged)
+    POCL_MSG_PRINT_GENERAL ("command buffer: merged %u commands\n", merged);
+  return 0;
+}
+
+/* The buffer and range a fill or a copy writes, 0 for other commands. */
+static int
+written_range (_cl_command_node *cmd, cl_mem *mem, size_t *start,
+               size_t *end)
+{
+  if (cmd->type == CL_COMMAND_FILL_BUFFER)
+    {
+      *mem = mem_root (cmd->memobj_list[0]);
+      mem_range (cmd, 0, start, end);
+      return 1;
+    }
+  /* a copy with a content size may write less than its size */
+  if (cmd->type == CL_COMMAND_COPY_BUFFER
+      && cmd->command.copy.src_content_size == NULL)
+    {
+      *mem = mem_root (cmd->memobj_list[1]);
+      mem_range (cmd, 1, start, end);
+      return 1;
+    }
+  return 0;
+}
+
+/* Whether the write of node W is overwritten by a later node before any
+   other command could access the memory. */
+static int
+is_dead_write (cmd_graph *g, unsigned w)
+{
+  cl_mem mem, x_mem;
+  size_t start, end, x_start, x_end;
+  unsigned x, r, i;
+
+  if (!written_range (g->nodes[w].cmd, &mem, &start, &end))
+    return 0;
+
+  for (x = w + 1; x < g->num_nodes; ++x)
+    {
+      _cl_command_node *cmd = g->nodes[x].cmd;
+      if (g->nodes[x].removed || !is_ancestor (g, x, w)
+          || !written_range (cmd, &x_mem, &x_start, &x_end) || x_mem != mem
+          || x_start > start || x_end < end)
+        continue;
+      /* X must not read the memory itself */
+      if (cmd->type == CL_COMMAND_COPY_BUFFER
+          && mem_root (cmd->memobj_list[0]) == mem)
+        continue;
+
+      /* every other access must be before W or after X */
+      int ordered = 1;
+      for (r = 0; r < g->num_nodes && ordered; ++r)
+        {
+          graph_node *node = &g->nodes[r];
+          if (r == w || r == x || node->removed || is_ancestor (g, w, r)
+              || is_ancestor (g, r, x))
+            continue;
+          if (node->mutable_args)
+            ordered = 0;
+          for (i = 0; i < node->cmd->memobj_count; ++i)
+            if (mem_root (node->cmd->memobj_list[i]) == mem)
+              ordered = 0;
+        }
+      if (ordered)
+        return 1;
+    }
+  return 0;
+}
+
+static int
+remove_dead_writes (cmd_graph *g)
+{
+  unsigned w, removed = 0;
+  for (w = 0; w < g->num_nodes; ++w)
+    {
+      graph_node *node = &g->nodes[w];
+      if (node->removed || !is_dead_write (g, w))
+        continue;
+      if (redirect_dependents (g, w, node->preds, node->num_preds))
+        return -1;
+      node->removed = 1;
+      ++removed;
+    }
+  if (removed)
+    POCL_MSG_PRINT_GENERAL ("command buffer: removed %u dead writes\n",
+                            removed);
+  return 0;
+}
+
+/* Drops the dependencies implied by the others, then writes the remaining
+   ones back to the commands as sync point wait lists. */
+static int
+write_back (cmd_graph *g, cl_command_buffer_khr command_buffer)
+{
+  unsigned i, j, k, n = 0;
+  unsigned *new_index = (unsigned *)malloc (g->num_nodes * sizeof (unsigned));
+  if (new_index == NULL)
+    return -1;
+
+  for (i = 0; i < g->num_nodes; ++i)
+    {
+      graph_node *node = &g->nodes[i];
+      if (node->removed)
+        continue;
+      new_index[i] = n++;
+
+      cl_sync_point_khr *wait_list = NULL;
+      unsigned num_waits = 0;
+      if (node->num_preds > 0)
+        {
+          wait_list = (cl_sync_point_khr *)malloc (node->num_preds
+                                                   * sizeof (cl_sync_point_khr));
+          if (wait_list == NULL)
+            {
+              free (new_index);
+              return -1;
+            }
+        }
+      for (j = 0; j < node->num_preds; ++j)
+        {
+          unsigned p = node->preds[j];
+          int redundant = 0;
+          for (k = 0; k < node->num_preds && !redundant; ++k)
+            if (k != j && is_ancestor (g, node->preds[k], p))
+              redundant = 1;
+          if (!redundant && !is_implicit_dep (g, i, p))
+            wait_list[num_waits++] = new_index[p] + 1;
+        }
+
+      _cl_command_node *cmd = node->cmd;
+      POCL_MEM_FREE (cmd->sync.syncpoint.sync_point_wait_list);
+      if (num_waits == 0)
+        POCL_MEM_FREE (wait_list);
+      cmd->sync.syncpoint.sync_point_wait_list = wait_list;
+      cmd->sync.syncpoint.num_sync_points_in_wait_list = num_waits;
+    }
+
+  for (i = 0; i < g->num_nodes; ++i)
+    if (g->nodes[i].removed)
+      {
+        LL_DELETE (command_buffer->cmds, g->nodes[i].cmd);
+        free_removed_command (g->nodes[i].cmd);
+      }
+
+  POCL_MSG_PRINT_GENERAL ("command buffer: %u commands, %u after "
+                          "optimization%s\n",
+                          command_buffer->num_syncpoints, n,
+                          g->explicit_order ? ", unchained" : "");
+  command_buffer->num_syncpoints = n;
+  command_buffer->explicit_order = g->explicit_order;
+  free (new_index);
+  return 0;
+}
+
+cl_int
+pocl_cmdbuf_optimize_graph (cl_command_buffer_khr command_buffer)
+{
+  cmd_graph g;
+  unsigned i;
+  int err = -1;
+
+  if (!pocl_get_bool_option ("POCL_COMMAND_BUFFER_OPTIMIZE", 1))
+    return CL_SUCCESS;
+  /* the commands recorded for other queues are not replayed separately */
+  if (command_buffer->num_queues != 1 || command_buffer->num_syncpoints < 2
+      || command_buffer->num_syncpoints > MAX_GRAPH_COMMANDS)
+    return CL_SUCCESS;
+
+  memset (&g, 0, sizeof (g));
+  g.num_nodes = command_buffer->num_syncpoints;
+  g.words = (g.num_nodes + 63) / 64;
+  g.in_order = !(command_buffer->queues[0]->properties
+                 & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+  g.explicit_order = g.in_order;
+  g.nodes = (graph_node *)calloc (g.num_nodes, sizeof (graph_node));
+  g.ancestors = (uint64_t *)malloc ((size_t)g.num_nodes * g.words * 8);
+  if (g.nodes == NULL || g.ancestors == NULL)
+    goto FINISH;
+
+  if (build_graph (&g, command_buffer))
+    goto FINISH;
+  if (merge_adjacent (&g))
+    goto FINISH;
+  compute_ancestors (&g);
+  if (remove_dead_writes (&g))
+    goto FINISH;
+  compute_ancestors (&g);
+  err = write_back (&g, command_buffer);
+
+FINISH:
+  if (g.nodes != NULL)
+    for (i = 0; i < g.num_nodes; ++i)
+      free (g.nodes[i].preds);
+  free (g.nodes);
+  free (g.ancestors);
+  return err ? CL_OUT_OF_HOST_MEMORY : CL_SUCCESS;
+}
@@ -0,0 +1,215 @@
+/* pocl_compress.c: a small LZ77 codec for the pocl binaries
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pocl_compress.h"
+
+#define HASH_LOG 14
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+/* No match starts in the last MATCH_LIMIT bytes, and the last LAST_LITERALS
+   bytes are always literals. */
+#define MATCH_LIMIT 12
+#define LAST_LITERALS 5
+
+static uint32_t
+read32 (const unsigned char *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof (v));
+  return v;
+}
+
+static uint32_t
+hash32 (uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/* Writes the extra bytes of a length whose nibble is 15. */
+static unsigned char *
+store_length (unsigned char *op, size_t len)
+{
+  while (len >= 255)
+    {
+      *op++ = 255;
+      len -= 255;
+    }
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+/* Writes a sequence of LIT_LEN literals at LIT and a match of MATCH_LEN
+   bytes OFFSET back, or only the literals if MATCH_LEN is 0. Returns NULL
+   if it does not fit before OEND. */
+static unsigned char *
+store_sequence (unsigned char *op, unsigned char *oend,
+                const unsigned char *lit, size_t lit_len, size_t offset,
+                size_t match_len)
+{
+  size_t needed = 1 + lit_len / 255 + 1 + lit_len;
+  if (match_len)
+    needed += 2 + match_len / 255 + 1;
+  if (needed > (size_t)(oend - op))
+    return NULL;
+
+  unsigned char *token = op++;
+  *token = (unsigned char)((lit_len >= 15 ? 15 : lit_len) << 4);
+  if (lit_len >= 15)
+    op = store_length (op, lit_len - 15);
+  memcpy (op, lit, lit_len);
+  op += lit_len;
+
+  if (match_len == 0)
+    return op;
+
+  *op++ = (unsigned char)(offset & 0xff);
+  *op++ = (unsigned char)(offset >> 8);
+  match_len -= MIN_MATCH;
+  *token |= (unsigned char)(match_len >= 15 ? 15 : match_len);
+  if (match_len >= 15)
+    op = store_length (op, match_len - 15);
+  return op;
+}
+
+size_t
+pocl_compress (const unsigned char *src, size_t size, unsigned char *dst,
+               size_t capacity)
+{
+  const unsigned char *ip = src, *anchor = src, *end = src + size;
+  unsigned char *op = dst, *oend = dst + capacity;
+
+  if (size > MATCH_LIMIT)
+    {
+      /* positions + 1 of the last 4-byte sequences seen, 0 for none */
+      uint32_t *table = (uint32_t *)calloc (1 << HASH_LOG, sizeof (uint32_t));
+      if (table == NULL)
+        return 0;
+
+      const unsigned char *match_limit = end - MATCH_LIMIT;
+      const unsigned char *match_end = end - LAST_LITERALS;
+      while (ip < match_limit)
+        {
+          uint32_t v = read32 (ip);
+          uint32_t h = hash32 (v);
+          uint32_t prev = table[h];
+          table[h] = (uint32_t)(ip - src) + 1;
+
+          const unsigned char *ref = src + prev - 1;
+          if (prev == 0 || ip - ref > MAX_OFFSET || read32 (ref) != v)
+            {
+              /* step faster over incompressible data */
+              ip += 1 + ((ip - anchor) >> 6);
+              continue;
+            }
+
+          size_t len = MIN_MATCH;
+          while (ip + len < match_end && ip[len] == ref[len])
+            ++len;
+
+          op = store_sequence (op, oend, anchor, ip - anchor, ip - ref, len);
+          if (op == NULL)
+            {
+              free (table);
+              return 0;
+            }
+          ip += len;
+          anchor = ip;
+        }
+      free (table);
+    }
+
+  op = store_sequence (op, oend, anchor, end - anchor, 0, 0);
+  return op == NULL ? 0 : (size_t)(op - dst);
+}
+
+/* Reads the extra bytes of a length whose nibble is 15. */
+static int
+read_length (const unsigned char **ip, const unsigned char *iend, size_t *len)
+{
+  unsigned char b;
+  do
+    {
+      if (*ip >= iend)
+        return -1;
+      b = *(*ip)++;
+      *len += b;
+    }
+  while (b == 255);
+  return 0;
+}
+
+int
+pocl_decompress (const unsigned char *src, size_t size, unsigned char *dst,
+                 size_t raw_size)
+{
+  const unsigned char *ip = src, *iend = src + size;
+  unsigned char *op = dst, *oend = dst + raw_size;
+
+  while (ip < iend)
+    {
+      unsigned token = *ip++;
+
+      size_t lit_len = token >> 4;
+      if (lit_len == 15 && read_length (&ip, iend, &lit_len))
+        return -1;
+      if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+        return -1;
+      memcpy (op, ip, lit_len);
+      op += lit_len;
+      ip += lit_len;
+
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return -1;
+      size_t offset = ip[0] | ((size_t)ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - dst))
+        return -1;
+
+      size_t match_len = token & 15;
+      if (match_len == 15 && read_length (&ip, iend, &match_len))
+        return -1;
+      match_len += MIN_MATCH;
+      if (match_len > (size_t)(oend - op))
+        return -1;
+
+      /* the match can overlap the output */
+      const unsigned char *ref = op - offset;
+      if (offset >= match_len)
+        {
+          memcpy (op, ref, match_len);
+          op += match_len;
+        }
+      else
+        while (match_len--)
+          *op++ = *ref++;
+    }
+
+  return op == oend ? 0 : -1;
+}
@@ -0,0 +1,53 @@
+/* pocl_compress.h: a small LZ77 codec for the pocl binaries
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef POCL_COMPRESS_H
+#define POCL_COMPRESS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The data is a sequence of LZ4 style blocks: a token byte with the number
+   of literals in the high and the match length minus 4 in the low nibble,
+   extra length bytes for either nibble of 15, the literals, and a 16-bit
+   little-endian match offset. The last sequence has literals only. */
+
+/* Compresses SIZE bytes of SRC into DST of CAPACITY bytes. Returns the
+   compressed size, or 0 if it would not fit. */
+size_t pocl_compress (const unsigned char *src, size_t size,
+                      unsigned char *dst, size_t capacity);
+
+/* Decompresses SIZE bytes of SRC into exactly RAW_SIZE bytes of DST.
+   Returns 0 on success and -1 on corrupt input, without touching memory
+   outside the two buffers. */
+int pocl_decompress (const unsigned char *src, size_t size,
+                     unsigned char *dst, size_t raw_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
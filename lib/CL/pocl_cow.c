@@ -0,0 +1,408 @@
+/* pocl_cow.c: copy-on-write copies between host buffers
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_MEMFD_CREATE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "pocl_cl.h"
+#include "pocl_cow.h"
+#include "pocl_runtime_config.h"
+
+/* Smaller buffers are not worth a file and mapping of their own. */
+#define COW_MIN_SIZE (1024 * 1024)
+
+#ifdef HAVE_MEMFD_CREATE
+
+/* A memfd shared by the buffers that map it. Once a page of it is mapped
+   privately, no shared mapping of the page exists anymore, so the file
+   keeps the content the page had at the time of the copy. */
+typedef struct
+{
+  int fd;
+  unsigned refcount;
+} cow_file;
+
+/* A range of a buffer mapped from a range of a file. */
+typedef struct
+{
+  size_t start;
+  size_t size;
+  cow_file *file;
+  size_t file_offset;
+  /* MAP_SHARED, i.e. the writes to the range go to the file */
+  int shared;
+} cow_segment;
+
+struct pocl_cow_buffer
+{
+  char *base;
+  size_t size;
+  /* sorted by start, covering the buffer */
+  cow_segment *segments;
+  unsigned num_segments;
+  unsigned capacity;
+};
+
+/* Protects the segments of all the buffers, a copy changes both sides. */
+static pocl_lock_t cow_lock = POCL_LOCK_INITIALIZER;
+static size_t page_size;
+
+static void
+release_file (cow_file *file)
+{
+  if (--file->refcount == 0)
+    {
+      close (file->fd);
+      free (file);
+    }
+}
+
+static int
+insert_segment (pocl_cow_buffer *buf, unsigned i, cow_segment seg)
+{
+  if (buf->num_segments == buf->capacity)
+    {
+      unsigned capacity = buf->capacity * 2;
+      cow_segment *segments = (cow_segment *)realloc (
+          buf->segments, capacity * sizeof (cow_segment));
+      if (segments == NULL)
+        return -1;
+      buf->segments = segments;
+      buf->capacity = capacity;
+    }
+  memmove (&buf->segments[i + 1], &buf->segments[i],
+           (buf->num_segments - i) * sizeof (cow_segment));
+  buf->segments[i] = seg;
+  ++seg.file->refcount;
+  ++buf->num_segments;
+  return 0;
+}
+
+static void
+remove_segments (pocl_cow_buffer *buf, unsigned first, unsigned last)
+{
+  unsigned i;
+  for (i = first; i < last; ++i)
+    release_file (buf->segments[i].file);
+  memmove (&buf->segments[first], &buf->segments[last],
+           (buf->num_segments - last) * sizeof (cow_segment));
+  buf->num_segments -= last - first;
+}
+
+/* Returns the index of the segment that starts at OFFSET, splitting the
+   one that contains it if needed, or -1 if out of memory. */
+static int
+split_at (pocl_cow_buffer *buf, size_t offset)
+{
+  unsigned i;
+  for (i = 0; i < buf->num_segments; ++i)
+    {
+      cow_segment *seg = &buf->segments[i];
+      if (seg->start == offset)
+        return i;
+      if (offset < seg->start + seg->size)
+        {
+          cow_segment tail = *seg;
+          size_t head_size = offset - seg->start;
+          tail.start = offset;
+          tail.size = seg->size - head_size;
+          tail.file_offset = seg->file_offset + head_size;
+          seg->size = head_size;
+          return insert_segment (buf, i + 1, tail) ? -1 : (int)(i + 1);
+        }
+    }
+  return buf->num_segments;
+}
+
+/* Joins the neighbours that continue each other in the same file. */
+static void
+merge_segments (pocl_cow_buffer *buf)
+{
+  unsigned i = 1;
+  while (i < buf->num_segments)
+    {
+      cow_segment *prev = &buf->segments[i - 1];
+      cow_segment *seg = &buf->segments[i];
+      if (prev->file == seg->file && prev->shared == seg->shared
+          && prev->file_offset + prev->size == seg->file_offset)
+        {
+          prev->size += seg->size;
+          remove_segments (buf, i, i + 1);
+        }
+      else
+        ++i;
+    }
+}
+
+static void
+map_private (char *addr, size_t size, cow_file *file, size_t file_offset)
+{
+  void *res = mmap (addr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, file->fd, (off_t)file_offset);
+  /* the old mapping is gone at this point */
+  if (res == MAP_FAILED)
+    POCL_ABORT ("copy-on-write remapping of a buffer failed\n");
+}
+
+/* Marks in DIRTY the pages of SIZE bytes at ADDR, a private file mapping,
+   that have been written and thus differ from the file. Assumes all of
+   them are if the page map cannot be read. */
+static void
+find_dirty_pages (char *addr, size_t size, char *dirty)
+{
+  size_t pages = size / page_size;
+  size_t i;
+  int fd = open ("/proc/self/pagemap", O_RDONLY);
+  uint64_t entries[512];
+
+  memset (dirty, 1, pages);
+  if (fd < 0)
+    return;
+  for (i = 0; i < pages; i += 512)
+    {
+      size_t n = pages - i < 512 ? pages - i : 512;
+      off_t pos = (off_t)(((uintptr_t)addr / page_size + i) * 8);
+      if (pread (fd, entries, n * 8, pos) != (ssize_t)(n * 8))
+        break;
+      for (size_t j = 0; j < n; ++j)
+        {
+          int present = (entries[j] >> 63) & 1;
+          int swapped = (entries[j] >> 62) & 1;
+          int file_page = (entries[j] >> 61) & 1;
+          /* written pages of a private mapping are anonymous */
+          dirty[i + j] = (present || swapped) && !file_page;
+        }
+    }
+  close (fd);
+}
+
+int
+pocl_cow_enabled (void)
+{
+  static int enabled = -1;
+  if (enabled < 0)
+    enabled = pocl_get_bool_option ("POCL_COW_BUFFER_COPY", 0);
+  return enabled;
+}
+
+void *
+pocl_cow_alloc (size_t size, pocl_cow_buffer **buf)
+{
+  if (!pocl_cow_enabled () || size < COW_MIN_SIZE)
+    return NULL;
+
+  if (page_size == 0)
+    page_size = (size_t)sysconf (_SC_PAGESIZE);
+  size_t mapped_size = (size + page_size - 1) & ~(page_size - 1);
+
+  cow_file *file = (cow_file *)calloc (1, sizeof (cow_file));
+  pocl_cow_buffer *b = (pocl_cow_buffer *)calloc (1, sizeof (pocl_cow_buffer));
+  if (file == NULL || b == NULL)
+    goto ERROR;
+
+  file->fd = memfd_create ("pocl_buffer", MFD_CLOEXEC);
+  if (file->fd < 0)
+    goto ERROR;
+  if (ftruncate (file->fd, (off_t)mapped_size) != 0)
+    goto ERROR_FD;
+
+  b->base = (char *)mmap (NULL, mapped_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, file->fd, 0);
+  if (b->base == MAP_FAILED)
+    goto ERROR_FD;
+  b->size = mapped_size;
+  b->capacity = 4;
+  b->segments = (cow_segment *)malloc (b->capacity * sizeof (cow_segment));
+  if (b->segments == NULL)
+    {
+      munmap (b->base, mapped_size);
+      goto ERROR_FD;
+    }
+  cow_segment whole = { 0, mapped_size, file, 0, 1 };
+  insert_segment (b, 0, whole);
+
+  *buf = b;
+  return b->base;
+
+ERROR_FD:
+  close (file->fd);
+ERROR:
+  free (file);
+  free (b);
+  return NULL;
+}
+
+void
+pocl_cow_free (pocl_cow_buffer *buf)
+{
+  POCL_LOCK (cow_lock);
+  munmap (buf->base, buf->size);
+  remove_segments (buf, 0, buf->num_segments);
+  POCL_UNLOCK (cow_lock);
+  free (buf->segments);
+  free (buf);
+}
+
+int
+pocl_cow_copy (pocl_cow_buffer *dst, size_t dst_offset, pocl_cow_buffer *src,
+               size_t src_offset, size_t size)
+{
+  size_t pages_size = size & ~(page_size - 1);
+  int src_first, src_last, dst_first, dst_last;
+  unsigned i;
+
+  if ((dst_offset | src_offset) & (page_size - 1) || pages_size < COW_MIN_SIZE)
+    return -1;
+
+  char *dirty = (char *)malloc (pages_size / page_size);
+  if (dirty == NULL)
+    return -1;
+
+  POCL_LOCK (cow_lock);
+
+  src_first = split_at (src, src_offset);
+  src_last = split_at (src, src_offset + pages_size);
+  if (src_first < 0 || src_last < 0)
+    goto ERROR;
+
+  /* Make the source's writes private from now on, the content stays. The
+     pages it had written in earlier private ranges differ from the file. */
+  memset (dirty, 0, pages_size / page_size);
+  for (i = src_first; i < (unsigned)src_last; ++i)
+    {
+      cow_segment *seg = &src->segments[i];
+      if (seg->shared)
+        {
+          map_private (src->base + seg->start, seg->size, seg->file,
+                       seg->file_offset);
+          seg->shared = 0;
+        }
+      else
+        find_dirty_pages (src->base + seg->start, seg->size,
+                          dirty + (seg->start - src_offset) / page_size);
+    }
+
+  /* the source segments, to replace the destination ones with; taken
+     before splitting the destination, which can be the same buffer */
+  unsigned count = src_last - src_first;
+  cow_segment *pieces = (cow_segment *)malloc (count * sizeof (cow_segment));
+  if (pieces == NULL)
+    goto ERROR;
+  memcpy (pieces, &src->segments[src_first], count * sizeof (cow_segment));
+  for (i = 0; i < count; ++i)
+    ++pieces[i].file->refcount;
+
+  dst_first = split_at (dst, dst_offset);
+  dst_last = split_at (dst, dst_offset + pages_size);
+  if (dst_first < 0 || dst_last < 0)
+    {
+      for (i = 0; i < count; ++i)
+        release_file (pieces[i].file);
+      free (pieces);
+      goto ERROR;
+    }
+
+  remove_segments (dst, dst_first, dst_last);
+  for (i = 0; i < count; ++i)
+    {
+      cow_segment seg = pieces[i];
+      seg.start = seg.start - src_offset + dst_offset;
+      map_private (dst->base + seg.start, seg.size, seg.file,
+                   seg.file_offset);
+      insert_segment (dst, dst_first + i, seg);
+      release_file (pieces[i].file);
+    }
+  free (pieces);
+
+  /* copy the pages that differ from the files */
+  size_t page = 0, pages = pages_size / page_size;
+  while (page < pages)
+    {
+      if (!dirty[page])
+        {
+          ++page;
+          continue;
+        }
+      size_t run = page;
+      while (run < pages && dirty[run])
+        ++run;
+      memcpy (dst->base + dst_offset + page * page_size,
+              src->base + src_offset + page * page_size,
+              (run - page) * page_size);
+      page = run;
+    }
+
+  merge_segments (src);
+  merge_segments (dst);
+  POCL_UNLOCK (cow_lock);
+  free (dirty);
+
+  /* the partial page at the end */
+  memcpy (dst->base + dst_offset + pages_size,
+          src->base + src_offset + pages_size, size - pages_size);
+  return 0;
+
+ERROR:
+  POCL_UNLOCK (cow_lock);
+  free (dirty);
+  return -1;
+}
+
+#else
+
+int
+pocl_cow_enabled (void)
+{
+  return 0;
+}
+
+void *
+pocl_cow_alloc (size_t size, pocl_cow_buffer **buf)
+{
+  return NULL;
+}
+
+void
+pocl_cow_free (pocl_cow_buffer *buf)
+{
+}
+
+int
+pocl_cow_copy (pocl_cow_buffer *dst, size_t dst_offset, pocl_cow_buffer *src,
+               size_t src_offset, size_t size)
+{
+  return -1;
+}
+
+#endif
@@ -0,0 +1,62 @@
+/* pocl_cow.h: copy-on-write copies between host buffers
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef POCL_COW_H
+#define POCL_COW_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The memory of a buffer is mapped from memfd files. A copy maps the pages
+   of the source's files privately into the destination, and turns the
+   source's own mapping of them private too, so that the files are not
+   written anymore and a page is copied only when either side writes it. */
+
+typedef struct pocl_cow_buffer pocl_cow_buffer;
+
+/* Whether POCL_COW_BUFFER_COPY enables the copy-on-write buffers, and
+   this system supports them. */
+int pocl_cow_enabled (void);
+
+/* Allocates SIZE bytes of page-aligned, zeroed memory that pocl_cow_copy
+   can copy from and to. Returns NULL if it is not possible, the memory
+   is at (*buf)->base otherwise. */
+void *pocl_cow_alloc (size_t size, pocl_cow_buffer **buf);
+
+void pocl_cow_free (pocl_cow_buffer *buf);
+
+/* Copies SIZE bytes from SRC_OFFSET of SRC to DST_OFFSET of DST, which can
+   be the same buffer if the ranges do not overlap. Returns 0 on success,
+   and -1 if the copy is not possible this way (offsets not page-aligned
+   or too small a size) and should be done with memcpy. */
+int pocl_cow_copy (pocl_cow_buffer *dst, size_t dst_offset,
+                   pocl_cow_buffer *src, size_t src_offset, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,6 +26,7 @@
 #include "pocl_cl.h"
 #include "pocl_util.h"
 
+#include <inttypes.h>
 /* for bzero */
 #include <strings.h>
 
@@ -37,11 +38,18 @@ int pocl_cq_profiling_enabled = 0;
 static unsigned cq_events_collected = 0;
 static cl_event *profiled_cq_events = NULL;
 
+static const char *hw_counter_names[POCL_HW_COUNTER_COUNT]
+    = { "cycles", "instructions", "cache misses", "branch misses", "stalls",
+        "mem requests" };
+
 struct kernel_stats
 {
   cl_kernel kernel;
   unsigned long time;
   unsigned long launches;
+  /* POCL_PERF_COUNTERS totals */
+  cl_ulong hw_counters[POCL_HW_COUNTER_COUNT];
+  unsigned long hw_launches;
 };
 
 static int
@@ -61,6 +69,7 @@ pocl_atexit ()
   unsigned long total_time = 0;
   unsigned long total_commands = 0;
   unsigned long different_kernels = 0;
+  cl_uint hw_counter_mask = 0;
 
   struct kernel_stats kernel_statistics[cq_events_collected];
   bzero_s (&kernel_statistics, sizeof (kernel_statistics));
@@ -87,6 +96,14 @@ pocl_atexit ()
         }
       kernel_statistics[k_i].time += kernel_t;
       kernel_statistics[k_i].launches++;
+
+      if (e->hw_counter_mask != 0)
+        {
+          for (unsigned c = 0; c < POCL_HW_COUNTER_COUNT; ++c)
+            kernel_statistics[k_i].hw_counters[c] += e->hw_counters[c];
+          kernel_statistics[k_i].hw_launches++;
+          hw_counter_mask |= e->hw_counter_mask;
+        }
     }
 
   printf ("\n");
@@ -110,6 +127,43 @@ pocl_atexit ()
   printf ("     %-30s %10lu %15lu %4s %10lu\n", "", total_commands, total_time,
           "100%", total_time / (total_commands + !total_commands) );
 
+  if (hw_counter_mask != 0)
+    {
+      /* Instructions per cycle, and cache and branch misses per thousand
+         instructions of the launches that were counted, followed by the
+         totals of the device specific counters that were collected. */
+      printf ("\n");
+      printf ("     %-30s %15s %15s %6s %8s %8s", "kernel", "cycles",
+              "instructions", "IPC", "cm/kI", "bm/kI");
+      for (unsigned c = POCL_HW_COUNTER_STALLS; c < POCL_HW_COUNTER_COUNT; ++c)
+        if (hw_counter_mask & (1U << c))
+          printf (" %15s", hw_counter_names[c]);
+      printf ("\n");
+      for (unsigned long i = 0; i < different_kernels; ++i)
+        {
+          struct kernel_stats *ks = &kernel_statistics[i];
+          if (ks->hw_launches == 0)
+            continue;
+          cl_ulong cycles = ks->hw_counters[POCL_HW_COUNTER_CYCLES];
+          cl_ulong insts = ks->hw_counters[POCL_HW_COUNTER_INSTRUCTIONS];
+          printf ("%3lu) %-30s %15" PRIu64 " %15" PRIu64 " %6.2f", i + 1,
+                  ks->kernel->name, cycles, insts,
+                  (double)insts / (cycles + !cycles));
+          for (unsigned c = POCL_HW_COUNTER_CACHE_MISSES;
+               c <= POCL_HW_COUNTER_BRANCH_MISSES; ++c)
+            if (hw_counter_mask & (1U << c))
+              printf (" %8.2f",
+                      ks->hw_counters[c] * 1000.0 / (insts + !insts));
+            else
+              printf (" %8s", "-");
+          for (unsigned c = POCL_HW_COUNTER_STALLS; c < POCL_HW_COUNTER_COUNT;
+               ++c)
+            if (hw_counter_mask & (1U << c))
+              printf (" %15" PRIu64, ks->hw_counters[c]);
+          printf ("\n");
+        }
+    }
+
   /* TODO: Critical path information of the task graph. */
 }
 
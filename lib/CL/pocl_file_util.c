@@ -27,8 +27,11 @@
 #include <string.h>
 
 #include "pocl.h"
+#include "pocl_cl.h"
 #include "pocl_debug.h"
 #include "pocl_file_util.h"
+#include "pocl_runtime_config.h"
+#include "utlist.h"
 
 #ifdef __ANDROID__
 
@@ -207,6 +210,233 @@ ERROR:
   return -1;
 }
 
+/* How pocl_write_file() and pocl_write_tempfile() make the written data
+   durable, from POCL_KERNEL_CACHE_SYNC. */
+enum
+{
+  POCL_FILE_SYNC_UNSET = -1,
+  /* fdatasync() before the rename, on the writing thread */
+  POCL_FILE_SYNC_FULL = 0,
+  /* a background thread syncs the files of all the waiting writers at
+     once, each writer renames its file after that */
+  POCL_FILE_SYNC_BATCH,
+  /* leave the writeback to the OS */
+  POCL_FILE_SYNC_NONE
+};
+
+/* A file waiting to be synced, on the stack of the writer. */
+typedef struct pocl_file_sync_item pocl_file_sync_item;
+struct pocl_file_sync_item
+{
+  int fd;
+  int done;
+  int err;
+  pocl_file_sync_item *next;
+  /* filesystem of the file, used by sync_batch () */
+  dev_t dev;
+  int dev_known;
+  int fs_synced;
+};
+
+static int file_sync_mode = POCL_FILE_SYNC_UNSET;
+static pocl_lock_t file_sync_lock = POCL_LOCK_INITIALIZER;
+static pocl_cond_t file_sync_cond = PTHREAD_COND_INITIALIZER;
+static pocl_cond_t file_sync_done_cond = PTHREAD_COND_INITIALIZER;
+static pocl_thread_t file_sync_thread;
+static pocl_file_sync_item *file_sync_queue = NULL;
+static int file_sync_thread_started = 0;
+static int file_sync_atfork_registered = 0;
+
+static int
+get_file_sync_mode ()
+{
+  int mode;
+  POCL_LOCK (file_sync_lock);
+  if (file_sync_mode == POCL_FILE_SYNC_UNSET)
+    {
+      const char *name
+          = pocl_get_string_option ("POCL_KERNEL_CACHE_SYNC", "full");
+      if (strcmp (name, "batch") == 0)
+        file_sync_mode = POCL_FILE_SYNC_BATCH;
+      else if (strcmp (name, "none") == 0)
+        file_sync_mode = POCL_FILE_SYNC_NONE;
+      else
+        {
+          if (strcmp (name, "full") != 0)
+            POCL_MSG_WARN ("Unknown POCL_KERNEL_CACHE_SYNC mode '%s', "
+                           "using 'full'\n",
+                           name);
+          file_sync_mode = POCL_FILE_SYNC_FULL;
+        }
+    }
+  mode = file_sync_mode;
+  POCL_UNLOCK (file_sync_lock);
+  return mode;
+}
+
+static int
+sync_fd (int fd)
+{
+#ifdef HAVE_FDATASYNC
+  return fdatasync (fd);
+#elif defined(HAVE_FSYNC)
+  return fsync (fd);
+#else
+  return 0;
+#endif
+}
+
+/* Syncs the files of a batch. A file alone on its filesystem is synced
+   with fdatasync (), which writes back only that file. Where several
+   files of the batch are on the same filesystem, one syncfs () covers
+   all of them. */
+static void
+sync_batch (pocl_file_sync_item *batch)
+{
+  pocl_file_sync_item *item, *other;
+
+#ifdef HAVE_SYNCFS
+  LL_FOREACH (batch, item)
+    {
+      struct stat st;
+      item->dev_known = fstat (item->fd, &st) == 0;
+      item->dev = st.st_dev;
+    }
+#endif
+
+  LL_FOREACH (batch, item)
+    {
+      int shared = 0;
+#ifdef HAVE_SYNCFS
+      if (item->dev_known)
+        {
+          LL_FOREACH (batch, other)
+            {
+              if (other == item || !other->dev_known
+                  || other->dev != item->dev)
+                continue;
+              shared = 1;
+              if (other->fs_synced)
+                break;
+            }
+        }
+      if (shared && other != NULL)
+        {
+          /* synced by the syncfs () of an earlier file */
+          item->err = 0;
+          continue;
+        }
+      if (shared)
+        {
+          item->err = syncfs (item->fd) ? errno : 0;
+          item->fs_synced = item->err == 0;
+          continue;
+        }
+#else
+      (void)other;
+      (void)shared;
+#endif
+      item->err = sync_fd (item->fd) ? errno : 0;
+    }
+}
+
+static void *
+file_sync_thread_func (void *arg)
+{
+  pocl_file_sync_item *batch, *item;
+
+  POCL_LOCK (file_sync_lock);
+  while (1)
+    {
+      while (file_sync_queue == NULL)
+        POCL_WAIT_COND (file_sync_cond, file_sync_lock);
+      /* Everything written while the previous batch was synced. */
+      batch = file_sync_queue;
+      file_sync_queue = NULL;
+      POCL_UNLOCK (file_sync_lock);
+
+      sync_batch (batch);
+
+      POCL_LOCK (file_sync_lock);
+      LL_FOREACH (batch, item)
+        item->done = 1;
+      POCL_BROADCAST_COND (file_sync_done_cond);
+    }
+  return NULL;
+}
+
+static void
+file_sync_atfork_prepare ()
+{
+  POCL_LOCK (file_sync_lock);
+}
+
+static void
+file_sync_atfork_parent ()
+{
+  POCL_UNLOCK (file_sync_lock);
+}
+
+/* The child has no sync thread and none of the waiting writers. The
+   condition variables may still count the waiters of the parent, so they
+   are initialized again. */
+static void
+file_sync_atfork_child ()
+{
+  file_sync_thread_started = 0;
+  file_sync_queue = NULL;
+  POCL_INIT_COND (file_sync_cond);
+  POCL_INIT_COND (file_sync_done_cond);
+  POCL_UNLOCK (file_sync_lock);
+}
+
+/* Waits until the background thread has synced the file open in FD,
+   together with the files of the other writers waiting meanwhile. Returns
+   0 or the errno of the failed sync. */
+static int
+wait_file_sync (int fd)
+{
+  pocl_file_sync_item item = { fd, 0, 0, NULL, 0, 0, 0 };
+
+  POCL_LOCK (file_sync_lock);
+  if (!file_sync_thread_started)
+    {
+      if (!file_sync_atfork_registered)
+        {
+          pthread_atfork (file_sync_atfork_prepare, file_sync_atfork_parent,
+                          file_sync_atfork_child);
+          file_sync_atfork_registered = 1;
+        }
+      POCL_CREATE_THREAD (file_sync_thread, file_sync_thread_func, NULL);
+      /* Nothing is queued while no writer waits, so the thread is not
+         joined at exit. */
+      pthread_detach (file_sync_thread);
+      file_sync_thread_started = 1;
+    }
+  LL_APPEND (file_sync_queue, &item);
+  POCL_SIGNAL_COND (file_sync_cond);
+  while (!item.done)
+    POCL_WAIT_COND (file_sync_done_cond, file_sync_lock);
+  POCL_UNLOCK (file_sync_lock);
+  return item.err;
+}
+
+/* Makes the data written to FD durable as selected by
+   POCL_KERNEL_CACHE_SYNC. Returns 0 or an errno. */
+static int
+sync_written_file (int fd)
+{
+  switch (get_file_sync_mode ())
+    {
+    case POCL_FILE_SYNC_FULL:
+      return sync_fd (fd) ? errno : 0;
+    case POCL_FILE_SYNC_BATCH:
+      return wait_file_sync (fd);
+    default:
+      return 0;
+    }
+}
+
 /* Atomic write - with rename() */
 int
 pocl_write_file (const char *path, const char *content, uint64_t count,
@@ -258,27 +488,25 @@ pocl_write_file (const char *path, const char *content, uint64_t count,
       return -1;
     }
 
-#ifdef HAVE_FDATASYNC
-  if (fdatasync (fd))
-    {
-      POCL_MSG_ERR ("fdatasync() failed\n");
-      return errno;
-    }
-#elif defined(HAVE_FSYNC)
-  if (fsync (fd))
+  err = sync_written_file (fd);
+  if (err)
     {
-      POCL_MSG_ERR ("fsync() failed\n");
-      return errno;
+      POCL_MSG_ERR ("syncing %s failed\n", path);
+      close (fd);
+      return err;
     }
-#endif
 
   if (close (fd) < 0)
     return errno;
 
-  if (append)
-    return 0;
-  else
-    return pocl_rename (path2, path);
+  if (!append)
+    {
+      err = pocl_rename (path2, path);
+      if (err)
+        return err;
+    }
+
+  return 0;
 }
 
 /****************************************************************************/
@@ -398,16 +626,12 @@ pocl_write_tempfile (char *output_path, const char *prefix, const char *suffix,
         }
     }
 
-#ifdef HAVE_FDATASYNC
-  if (fdatasync (fd))
+  err = sync_written_file (fd);
+  if (err)
     {
-      POCL_MSG_ERR ("fdatasync() failed\n");
-      return errno;
+      POCL_MSG_ERR ("syncing %s failed\n", output_path);
+      return err;
     }
-#elif defined(HAVE_FSYNC)
-  if (fsync (fd))
-    return errno;
-#endif
 
   err = 0;
   if (ret_fd)
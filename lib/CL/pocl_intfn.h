@@ -176,6 +176,10 @@ POdeclsym(clCommandFillBufferKHR)
 POdeclsym(clCommandFillImageKHR)
 POdeclsym(clGetCommandBufferInfoKHR)
 
+/* cl_khr_command_buffer_mutable_dispatch */
+POdeclsym(clUpdateMutableCommandsKHR)
+POdeclsym(clGetMutableCommandInfoKHR)
+
 /* cl_intel_unified_shared_memory */
 POdeclsym(clHostMemAllocINTEL)
 POdeclsym(clDeviceMemAllocINTEL)
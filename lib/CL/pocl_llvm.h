@@ -77,9 +77,13 @@ extern "C" {
                                              _cl_command_node *Command,
                                              int Specialize);
 
+  /* As above, but returns the llvm::Module instead of writing it to the
+   * cache. If @param Quick is set, the module is optimized only lightly, for
+   * the first tier of the tiered compilation.
+   */
   int pocl_llvm_generate_workgroup_function_nowrite (
       unsigned DeviceI, cl_device_id Device, cl_kernel Kernel,
-      _cl_command_node *Command, void **output, int Specialize);
+      _cl_command_node *Command, void **output, int Specialize, int Quick);
   /**
    * Free the LLVM IR of a program for a given device
    */
@@ -150,10 +154,21 @@ extern "C" {
   unsigned pocl_llvm_get_kernel_count (cl_program program, unsigned device_i);
 
   /** Compile the kernel in infile from LLVM bitcode to native object file for
-   * device, into outfile.
+   * device, into outfile. With quick set, the code generator optimizations
+   * are disabled and the fast instruction selector is used.
    */
   int pocl_llvm_codegen (cl_device_id device, cl_program program, void *modp,
-                         char **output, uint64_t *output_size);
+                         char **output, uint64_t *output_size, int quick);
+
+  /** Writes the source line table of the given function found in the native
+   * object file (as produced by pocl_llvm_codegen) to a text file, one
+   * "<hex offset from function start> <line> <file>" row per line. Used for
+   * the perf jitdump records. Returns 0 on success, or if the object has no
+   * debug info, in which case no file is written.
+   */
+  int pocl_llvm_write_line_table (const char *obj, uint64_t obj_size,
+                                  const char *func_name,
+                                  const char *output_path);
 
   /* Parse program file and populate program's llvm_irs */
   int pocl_llvm_read_program_llvm_irs (cl_program program, unsigned device_i,
@@ -799,6 +799,19 @@ int pocl_llvm_get_kernels_metadata(cl_program program, unsigned device_i) {
     }
 #endif
 
+    llvm::MDNode *ReqdSGSize =
+        KernelFunction->getMetadata("intel_reqd_sub_group_size");
+    if (ReqdSGSize != nullptr) {
+      size_t SGSize = (llvm::cast<ConstantInt>(
+                 llvm::dyn_cast<ConstantAsMetadata>(
+                   ReqdSGSize->getOperand(0))->getValue()))->getLimitedValue();
+      meta->reqd_sub_group_size = SGSize;
+      if (attrstr.tellp() > 0)
+        attrstr << " ";
+      attrstr << "__attribute__((intel_reqd_sub_group_size(" << SGSize
+              << ")))";
+    }
+
     std::string r = attrstr.str();
     if (r.size() > 0) {
       meta->attributes = (char *)malloc(r.size() + 1);
@@ -25,6 +25,7 @@
 */
 
 #include "AutomaticLocals.h"
+#include "SoftwarePrefetch.h"
 #include "config.h"
 #include "pocl.h"
 #include "pocl_cache.h"
@@ -56,6 +57,7 @@ IGNORE_COMPILER_WARNING("-Wunused-parameter")
 #include <llvm/ADT/StringRef.h>
 
 #include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 
@@ -68,6 +70,10 @@ IGNORE_COMPILER_WARNING("-Wunused-parameter")
 #include <llvm/PassRegistry.h>
 #include <llvm/PassInfo.h>
 
+#include <llvm/DebugInfo/DWARF/DWARFContext.h>
+#include <llvm/Object/ELFObjectFile.h>
+#include <llvm/Object/ObjectFile.h>
+
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
 #include <llvm/IR/LegacyPassManager.h>
@@ -96,6 +102,10 @@ using namespace llvm;
 
 static std::map<cl_device_id, llvm::TargetMachine *> targetMachines;
 static std::map<cl_device_id, PassManager *> kernelPasses;
+/* The same for the quickly compiled first tier of the tiered compilation
+   (POCL_TIERED_COMPILATION). */
+static std::map<cl_device_id, llvm::TargetMachine *> quickTargetMachines;
+static std::map<cl_device_id, PassManager *> quickKernelPasses;
 
 /* FIXME: these options should come from the cl_device, and
  * cl_program's options. */
@@ -114,6 +124,11 @@ void clearTargetMachines() {
     delete (llvm::TargetMachine *)i->second;
   }
   targetMachines.clear();
+  for (auto i = quickTargetMachines.begin(), e = quickTargetMachines.end();
+       i != e; ++i) {
+    delete (llvm::TargetMachine *)i->second;
+  }
+  quickTargetMachines.clear();
 }
 
 void clearKernelPasses() {
@@ -124,13 +139,25 @@ void clearKernelPasses() {
   }
 
   kernelPasses.clear();
+  for (auto i = quickKernelPasses.begin(), e = quickKernelPasses.end();
+       i != e; ++i) {
+    PassManager *pm = (PassManager *)i->second;
+    delete pm;
+  }
+
+  quickKernelPasses.clear();
 }
 
 // Returns the TargetMachine instance or zero if no triple is provided.
-static TargetMachine *GetTargetMachine(cl_device_id device, Triple &triple) {
+// The Quick one skips most of the code generator optimizations and uses
+// the fast instruction selector.
+static TargetMachine *GetTargetMachine(cl_device_id device, Triple &triple,
+                                       bool Quick = false) {
 
-  if (targetMachines.find(device) != targetMachines.end())
-    return targetMachines[device];
+  std::map<cl_device_id, llvm::TargetMachine *> &Machines =
+      Quick ? quickTargetMachines : targetMachines;
+  if (Machines.find(device) != Machines.end())
+    return Machines[device];
 
   std::string Error;
   // Triple TheTriple(device->llvm_target_triplet);
@@ -150,24 +177,32 @@ static TargetMachine *GetTargetMachine(cl_device_id device, Triple &triple) {
 
   TargetMachine *TM = TheTarget->createTargetMachine(
       triple.getTriple(), MCPU, StringRef("+m,+f"), GetTargetOptions(), Reloc::PIC_,      
-      CodeModel::Small, CodeGenOpt::Aggressive);
+      CodeModel::Small, Quick ? CodeGenOpt::None : CodeGenOpt::Aggressive);
 
   assert(TM != NULL && "llvm target has no targetMachine constructor");
+  if (Quick)
+    TM->setFastISel(true);
   if (device->ops->init_target_machine)
     device->ops->init_target_machine(device->data, TM);
-  targetMachines[device] = TM;
+  Machines[device] = TM;
 
   return TM;
 }
 /* helpers copied from LLVM opt END */
 
-static PassManager &kernel_compiler_passes(cl_device_id device) {
+/* With Quick, the standard optimizations are run at -O1 without the
+   vectorizers. This is used for the first tier of the tiered compilation,
+   where the compilation time matters more than the speed of the code. */
+static PassManager &kernel_compiler_passes(cl_device_id device,
+                                           bool Quick = false) {
 
   PassManager *Passes = nullptr;
   PassRegistry *Registry = nullptr;
 
-  if (kernelPasses.find(device) != kernelPasses.end()) {
-    return *kernelPasses[device];
+  std::map<cl_device_id, PassManager *> &PassesMap =
+      Quick ? quickKernelPasses : kernelPasses;
+  if (PassesMap.find(device) != PassesMap.end()) {
+    return *PassesMap[device];
   }
 
   bool SPMDDevice = device->spmd;
@@ -178,7 +213,7 @@ static PassManager &kernel_compiler_passes(cl_device_id device) {
 
   // Need to setup the target info for target specific passes. */
   Triple triple(device->llvm_target_triplet);
-  TargetMachine *Machine = GetTargetMachine(device, triple);
+  TargetMachine *Machine = GetTargetMachine(device, triple, Quick);
 
   if (Machine)
     Passes->add(
@@ -266,6 +301,11 @@ static PassManager &kernel_compiler_passes(cl_device_id device) {
     passes.push_back("simplifycfg");
     passes.push_back("loop-simplify");
     passes.push_back("uniformity");
+    // Before the barriers are turned into parallel region boundaries.
+    if (device->staging_copy_elimination)
+      passes.push_back("staging-copy-elimination");
+    if (device->barrier_elision)
+      passes.push_back("barrier-elision");
     passes.push_back("phistoallocas");
     passes.push_back("isolate-regions");
     passes.push_back("implicit-loop-barriers");
@@ -316,6 +356,15 @@ static PassManager &kernel_compiler_passes(cl_device_id device) {
   passes.push_back("dot-cfg");
 #endif
 
+  // Prefetch the strided and gathered loads of the work-item loops.
+  // -mem2reg first to turn the privatized local ids into induction
+  // variables for the SCEV analysis; -O3 then cleans up the address
+  // computations of the prefetches.
+  if (!SPMDDevice && !Quick && device->prefetch_latency > 0) {
+    passes.push_back("mem2reg");
+    passes.push_back("software-prefetch");
+  }
+
   passes.push_back("STANDARD_OPTS");
 
   // Due to unfortunate phase-ordering problems with store sinking,
@@ -330,7 +379,7 @@ static PassManager &kernel_compiler_passes(cl_device_id device) {
     // This is (more or less) -O3.
     if (passes[i] == "STANDARD_OPTS") {
       PassManagerBuilder Builder;
-      Builder.OptLevel = 3;
+      Builder.OptLevel = Quick ? 1 : 3;
       Builder.SizeLevel = 0;
 
       // These need to be setup in addition to invoking the passes
@@ -338,7 +387,7 @@ static PassManager &kernel_compiler_passes(cl_device_id device) {
       // devices do not want to vectorize intra work-item at this
       // stage.
       if ((CurrentWgMethod == "loopvec" || CurrentWgMethod == "cbs") &&
-          !SPMDDevice) {
+          !SPMDDevice && !Quick) {
         Builder.LoopVectorize = true;
         Builder.SLPVectorize = true;
       } else {
@@ -354,6 +403,17 @@ static PassManager &kernel_compiler_passes(cl_device_id device) {
       Passes->add(pocl::createAutomaticLocalsPass(device->autolocals_to_args));
       continue;
     }
+    if (passes[i] == "software-prefetch") {
+      unsigned LineSize = device->global_mem_cacheline_size > 0
+                              ? device->global_mem_cacheline_size
+                              : 64;
+      unsigned MinStride = device->prefetch_min_stride > 0
+                               ? device->prefetch_min_stride
+                               : LineSize;
+      Passes->add(pocl::createSoftwarePrefetchPass(device->prefetch_latency,
+                                                   MinStride, LineSize));
+      continue;
+    }
 
     const PassInfo *PIs = Registry->getPassInfo(StringRef(passes[i]));
     if (PIs) {
@@ -367,7 +427,7 @@ static PassManager &kernel_compiler_passes(cl_device_id device) {
     }
   }
 
-  kernelPasses[device] = Passes;
+  PassesMap[device] = Passes;
   return *Passes;
 }
 
@@ -631,9 +691,69 @@ int pocl_llvm_extract_kernel_spirv(void* ProgCtx,
   return r;
 }
 
+// Replaces the uses of the kernel arguments selected with
+// -pocl-specialize-args with their values in the launch command.
+static void foldSpecializedArgs(llvm::Module *M, cl_kernel Kernel,
+                                _cl_command_run *RunCommand) {
+  llvm::Function *F = M->getFunction(Kernel->name);
+  if (F == nullptr)
+    return;
+
+  for (unsigned i = 0; i < Kernel->meta->num_args && i < F->arg_size(); ++i) {
+    if (!(Kernel->meta->specialized_args & ((uint64_t)1 << i)))
+      continue;
+    struct pocl_argument *Arg = &RunCommand->arguments[i];
+    llvm::Argument *A = F->arg_begin() + i;
+    llvm::Type *T = A->getType();
+    unsigned Bits = Arg->size * 8;
+    uint64_t Value = 0;
+    memcpy(&Value, Arg->value, Arg->size);
+
+    llvm::Constant *C = nullptr;
+    if (T->isIntegerTy() && T->getScalarSizeInBits() == Bits)
+      C = llvm::ConstantInt::get(T, Value);
+    else if (T->isFloatingPointTy() && T->getScalarSizeInBits() == Bits)
+      C = llvm::ConstantFP::get(
+          T->getContext(),
+          llvm::APFloat(T->getFltSemantics(), llvm::APInt(Bits, Value)));
+    if (C == nullptr) {
+      POCL_MSG_WARN("Cannot fold argument %s of kernel %s, it is not passed "
+                    "as a scalar\n",
+                    Kernel->meta->arg_info[i].name, Kernel->name);
+      continue;
+    }
+    A->replaceAllUsesWith(C);
+  }
+}
+
+// Marks the buffer arguments of the kernel noalias and adds assumptions of
+// their alignment, which the launch time check in the CPU drivers has
+// verified for this command. The assumptions are used instead of align
+// attributes, as the latter would be dropped when the kernel is inlined to
+// the work-group function.
+static void addNoAliasArgs(llvm::Module *M, cl_kernel Kernel,
+                           cl_device_id Device) {
+  llvm::Function *F = M->getFunction(Kernel->name);
+  if (F == nullptr || F->isDeclaration())
+    return;
+
+  llvm::IRBuilder<> Builder(&*F->getEntryBlock().getFirstInsertionPt());
+  for (unsigned i = 0; i < Kernel->meta->num_args && i < F->arg_size(); ++i) {
+    pocl_argument_info *ArgInfo = &Kernel->meta->arg_info[i];
+    llvm::Argument *A = F->arg_begin() + i;
+    if (ArgInfo->type != POCL_ARG_TYPE_POINTER || ARGP_IS_LOCAL(ArgInfo) ||
+        !A->getType()->isPointerTy())
+      continue;
+    F->addParamAttr(i, llvm::Attribute::NoAlias);
+    if (Device->mem_base_addr_align > 1)
+      Builder.CreateAlignmentAssumption(M->getDataLayout(), A,
+                                        Device->mem_base_addr_align);
+  }
+}
+
 int pocl_llvm_generate_workgroup_function_nowrite(
     unsigned DeviceI, cl_device_id Device, cl_kernel Kernel,
-    _cl_command_node *Command, void **Output, int Specialize) {
+    _cl_command_node *Command, void **Output, int Specialize, int Quick) {
 
   _cl_command_run *RunCommand = &Command->command.run;
   cl_program Program = Kernel->program;
@@ -699,6 +819,11 @@ int pocl_llvm_generate_workgroup_function_nowrite(
     WGMaxGridDimWidth = 0;
   }
 
+  if (Specialize && RunCommand->spec_args_hash != 0)
+    foldSpecializedArgs(ParallelBC, Kernel, RunCommand);
+  if (Specialize && RunCommand->noalias_args)
+    addNoAliasArgs(ParallelBC, Kernel, Device);
+
   if (Device->device_aux_functions) {
     std::string concat;
     const char **tmp = Device->device_aux_functions;
@@ -748,12 +873,14 @@ int pocl_llvm_generate_workgroup_function_nowrite(
                        Device->max_work_item_sizes[1]);
   setModuleIntMetadata(ParallelBC, "device_max_witem_sizes_2",
                        Device->max_work_item_sizes[2]);
+  setModuleIntMetadata(ParallelBC, "device_native_sub_group_size",
+                       Device->native_sub_group_size);
 
 #ifdef DUMP_LLVM_PASS_TIMINGS
   llvm::TimePassesIsEnabled = true;
 #endif
   POCL_MEASURE_START(llvm_workgroup_ir_func_gen);
-  kernel_compiler_passes(Device).run(*ParallelBC);
+  kernel_compiler_passes(Device, Quick).run(*ParallelBC);
   POCL_MEASURE_FINISH(llvm_workgroup_ir_func_gen);
 #ifdef DUMP_LLVM_PASS_TIMINGS
   llvm::reportAndResetTimings();
@@ -811,7 +938,7 @@ int pocl_llvm_generate_workgroup_function(unsigned DeviceI, cl_device_id Device,
     return CL_SUCCESS;
 
   int Error = pocl_llvm_generate_workgroup_function_nowrite(
-      DeviceI, Device, Kernel, Command, &Module, Specialize);
+      DeviceI, Device, Kernel, Command, &Module, Specialize, 0);
   if (Error)
     return Error;
 
@@ -884,7 +1011,7 @@ static void initPassManagerForCodeGen(PassManager& PM, cl_device_id Device) {
  * modp = llvm::Module* of parallel.bc
  * Output native object file (<kernel>.so.o). */
 int pocl_llvm_codegen(cl_device_id Device, cl_program program, void *Modp,
-                      char **Output, uint64_t *OutputSize) {
+                      char **Output, uint64_t *OutputSize, int Quick) {
 
   cl_context ctx = program->context;
   PoclLLVMContextData *llvm_ctx = (PoclLLVMContextData *)ctx->llvm_context_data;
@@ -898,7 +1025,7 @@ int pocl_llvm_codegen(cl_device_id Device, cl_program program, void *Modp,
   initPassManagerForCodeGen(PMObj, Device);
 
   llvm::Triple Triple(Device->llvm_target_triplet);
-  llvm::TargetMachine *Target = GetTargetMachine(Device, Triple);
+  llvm::TargetMachine *Target = GetTargetMachine(Device, Triple, Quick);
 
   SmallVector<char, 4096> Data;
   llvm::raw_svector_ostream SOS(Data);
@@ -980,4 +1107,86 @@ int pocl_llvm_codegen(cl_device_id Device, cl_program program, void *Modp,
   return Res;
 
 }
+int pocl_llvm_write_line_table(const char *Obj, uint64_t ObjSize,
+                               const char *FuncName, const char *OutputPath) {
+
+  llvm::MemoryBufferRef Buf(llvm::StringRef(Obj, ObjSize), "kernel.so.o");
+  auto ObjOrErr = llvm::object::ObjectFile::createObjectFile(Buf);
+  if (!ObjOrErr) {
+    llvm::consumeError(ObjOrErr.takeError());
+    return -1;
+  }
+  llvm::object::ObjectFile &ObjFile = **ObjOrErr;
+
+  // Locate the function in the (unlinked) object. The line table addresses
+  // are section relative, same as the symbol value.
+  uint64_t FuncAddr = 0, FuncSize = 0, FuncSection = 0;
+  bool Found = false;
+  for (const llvm::object::SymbolRef &Sym : ObjFile.symbols()) {
+    auto NameOrErr = Sym.getName();
+    if (!NameOrErr) {
+      llvm::consumeError(NameOrErr.takeError());
+      continue;
+    }
+    if (*NameOrErr != FuncName)
+      continue;
+    auto AddrOrErr = Sym.getAddress();
+    auto SecOrErr = Sym.getSection();
+    if (!AddrOrErr || !SecOrErr || *SecOrErr == ObjFile.section_end()) {
+      if (!AddrOrErr)
+        llvm::consumeError(AddrOrErr.takeError());
+      if (!SecOrErr)
+        llvm::consumeError(SecOrErr.takeError());
+      return -1;
+    }
+    FuncAddr = *AddrOrErr;
+    FuncSection = (*SecOrErr)->getIndex();
+    if (llvm::isa<llvm::object::ELFObjectFileBase>(&ObjFile))
+      FuncSize = llvm::object::ELFSymbolRef(Sym).getSize();
+    Found = true;
+    break;
+  }
+  if (!Found || FuncSize == 0)
+    return -1;
+
+  std::unique_ptr<llvm::DWARFContext> DICtx =
+      llvm::DWARFContext::create(ObjFile);
+  if (DICtx->getNumCompileUnits() == 0)
+    return 0;
+
+  std::string Table;
+  llvm::raw_string_ostream OS(Table);
+  for (const auto &CU : DICtx->compile_units()) {
+    const llvm::DWARFDebugLine::LineTable *LT =
+        DICtx->getLineTableForUnit(CU.get());
+    if (LT == nullptr)
+      continue;
+    const char *CompDir = CU->getCompilationDir();
+    for (const llvm::DWARFDebugLine::Row &Row : LT->Rows) {
+      if (Row.EndSequence || Row.Line == 0)
+        continue;
+      if (Row.Address.SectionIndex != llvm::object::SectionedAddress::UndefSection &&
+          Row.Address.SectionIndex != FuncSection)
+        continue;
+      if (Row.Address.Address < FuncAddr ||
+          Row.Address.Address >= FuncAddr + FuncSize)
+        continue;
+      std::string FileName;
+      if (!LT->getFileNameByIndex(
+              Row.File, CompDir ? CompDir : "",
+              llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath,
+              FileName))
+        continue;
+      OS << llvm::format_hex_no_prefix(Row.Address.Address - FuncAddr, 1)
+         << " " << Row.Line << " " << FileName << "\n";
+    }
+  }
+  OS.flush();
+
+  if (Table.empty())
+    return 0;
+
+  return pocl_write_file(OutputPath, Table.data(), Table.size(), 0, 0);
+}
+
 /* vim: set ts=4 expandtab: */
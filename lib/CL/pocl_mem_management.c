@@ -106,7 +106,8 @@ _cl_command_node* pocl_mem_manager_new_command ()
   if ((cmd = mm->cmd_list))
     LL_DELETE (mm->cmd_list, cmd);
   POCL_UNLOCK (mm->cmd_lock);
-  
+
+  POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_COMMANDS, sizeof (_cl_command_node));
   if (cmd)
     {
       memset (cmd, 0, sizeof (struct _cl_command_node));
@@ -124,6 +125,7 @@ void pocl_mem_manager_free_command (_cl_command_node *cmd_ptr)
       POCL_MEM_FREE (cmd->memobj_list);
       POCL_MEM_FREE (cmd->readonly_flag_list);
     }
+  POCL_MEM_STATS_FREE (NULL, POCL_MEM_COMMANDS, sizeof (_cl_command_node));
   POCL_LOCK (mm->cmd_lock);
   LL_PREPEND (mm->cmd_list, cmd_ptr);
   POCL_UNLOCK(mm->cmd_lock);
@@ -22,6 +22,7 @@
 */
 
 #include "pocl_cl.h"
+#include "pocl_mem_stats.h"
 
 #ifdef __GNUC__
 #pragma GCC visibility push(hidden)
@@ -51,17 +52,28 @@ cl_event pocl_mem_manager_new_event ();
 
 #define pocl_mem_manager_free_event(event) POCL_MEM_FREE(event)
 
-#define pocl_mem_manager_new_command() \
-  (_cl_command_node*) calloc (1, sizeof (_cl_command_node))
+static inline _cl_command_node *
+pocl_mem_manager_new_command ()
+{
+  POCL_MEM_STATS_ALLOC (NULL, POCL_MEM_COMMANDS, sizeof (_cl_command_node));
+  return (_cl_command_node *)calloc (1, sizeof (_cl_command_node));
+}
 
 #define pocl_mem_manager_free_command(cmd)                                    \
-  if ((cmd) && (cmd)->buffered)                                               \
+  do                                                                          \
     {                                                                         \
-      POCL_MEM_FREE ((cmd)->sync.syncpoint.sync_point_wait_list);             \
-      POCL_MEM_FREE ((cmd)->memobj_list);                                     \
-      POCL_MEM_FREE ((cmd)->readonly_flag_list);                              \
+      if (cmd)                                                                \
+        POCL_MEM_STATS_FREE (NULL, POCL_MEM_COMMANDS,                         \
+                             sizeof (_cl_command_node));                      \
+      if ((cmd) && (cmd)->buffered)                                           \
+        {                                                                     \
+          POCL_MEM_FREE ((cmd)->sync.syncpoint.sync_point_wait_list);         \
+          POCL_MEM_FREE ((cmd)->memobj_list);                                 \
+          POCL_MEM_FREE ((cmd)->readonly_flag_list);                          \
+        }                                                                     \
+      POCL_MEM_FREE ((cmd));                                                  \
     }                                                                         \
-  POCL_MEM_FREE ((cmd));
+  while (0)
 
 #define pocl_mem_manager_new_event_node() \
   (event_node*) calloc (1, sizeof (event_node))
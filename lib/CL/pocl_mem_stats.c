@@ -0,0 +1,215 @@
+/* OpenCL runtime library: per-context memory accounting
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pocl_debug.h"
+#include "pocl_mem_stats.h"
+#include "pocl_runtime_config.h"
+#include "pocl_timing.h"
+
+int pocl_mem_stats_enabled = 0;
+
+/* The runtime-wide categories, and the allocations of the per-context
+   categories made without a context. Its total covers only these, not
+   the allocations of the contexts. */
+static pocl_mem_stats global_stats;
+
+static int dump_at_release = 0;
+static FILE *trace_file = NULL;
+static pocl_lock_t trace_lock;
+
+static const char *category_names[POCL_MEM_CATEGORY_COUNT]
+    = { "buffers",       "images",       "SVM",           "USM",
+        "kernel args",   "events",       "command nodes", "kernel modules",
+        "printf",        "local scratch", "total" };
+
+static void
+pocl_mem_stats_close_trace ()
+{
+  if (trace_file)
+    fclose (trace_file);
+  trace_file = NULL;
+}
+
+void
+pocl_mem_stats_init ()
+{
+  const char *trace = pocl_get_string_option ("POCL_MEM_STATS_TRACE", NULL);
+  dump_at_release = pocl_get_bool_option ("POCL_MEM_STATS", 0);
+
+  if (trace != NULL)
+    {
+      POCL_INIT_LOCK (trace_lock);
+      trace_file = fopen (trace, "w");
+      if (trace_file == NULL)
+        POCL_MSG_WARN ("Could not open the memory trace file %s\n", trace);
+      else
+        {
+          fprintf (trace_file, "# time_ns context category size current\n");
+          atexit (pocl_mem_stats_close_trace);
+        }
+    }
+
+  pocl_mem_stats_enabled = dump_at_release || trace_file != NULL;
+}
+
+static void
+update_peak (size_t *peak, size_t value)
+{
+  size_t old = __atomic_load_n (peak, __ATOMIC_RELAXED);
+  while (value > old
+         && !__atomic_compare_exchange_n (peak, &old, value, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static void
+account (cl_context context, unsigned category, size_t size, int is_alloc)
+{
+  assert (category < POCL_MEM_TOTAL);
+  pocl_mem_stats *stats;
+  size_t cur, total;
+
+  if (category >= POCL_MEM_FIRST_GLOBAL_CATEGORY || context == NULL)
+    stats = &global_stats;
+  else
+    stats = &context->mem_stats;
+
+  if (is_alloc)
+    {
+      cur = __atomic_add_fetch (&stats->current[category], size,
+                                __ATOMIC_RELAXED);
+      total = __atomic_add_fetch (&stats->current[POCL_MEM_TOTAL], size,
+                                  __ATOMIC_RELAXED);
+      __atomic_add_fetch (&stats->allocs[category], 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&stats->allocs[POCL_MEM_TOTAL], 1,
+                          __ATOMIC_RELAXED);
+      update_peak (&stats->peak[category], cur);
+      update_peak (&stats->peak[POCL_MEM_TOTAL], total);
+    }
+  else
+    {
+      cur = __atomic_sub_fetch (&stats->current[category], size,
+                                __ATOMIC_RELAXED);
+      __atomic_sub_fetch (&stats->current[POCL_MEM_TOTAL], size,
+                          __ATOMIC_RELAXED);
+    }
+
+  if (trace_file)
+    {
+      POCL_LOCK (trace_lock);
+      fprintf (trace_file, "%" PRIu64 " %" PRId64 " %s %c%zu %zu\n",
+               pocl_gettimemono_ns (),
+               (stats == &global_stats) ? (int64_t)-1 : context->id,
+               category_names[category], is_alloc ? '+' : '-', size, cur);
+      POCL_UNLOCK (trace_lock);
+    }
+}
+
+void
+pocl_mem_stats_alloc (cl_context context, unsigned category, size_t size)
+{
+  account (context, category, size, 1);
+}
+
+void
+pocl_mem_stats_free (cl_context context, unsigned category, size_t size)
+{
+  account (context, category, size, 0);
+}
+
+size_t
+pocl_mem_stats_args_size (unsigned num_args, const struct pocl_argument *args)
+{
+  size_t size;
+  unsigned i;
+
+  if (args == NULL)
+    return 0;
+
+  size = num_args * sizeof (struct pocl_argument);
+  for (i = 0; i < num_args; ++i)
+    if (args[i].value != NULL)
+      size += args[i].size;
+  return size;
+}
+
+void
+pocl_mem_stats_get (cl_context context, cl_ulong *current, cl_ulong *peak,
+                    cl_ulong *allocs)
+{
+  unsigned i;
+  for (i = 0; i < POCL_MEM_CATEGORY_COUNT; ++i)
+    {
+      pocl_mem_stats *stats = &context->mem_stats;
+      if (i >= POCL_MEM_FIRST_GLOBAL_CATEGORY && i != POCL_MEM_TOTAL)
+        stats = &global_stats;
+      if (current)
+        current[i] = __atomic_load_n (&stats->current[i], __ATOMIC_RELAXED);
+      if (peak)
+        peak[i] = __atomic_load_n (&stats->peak[i], __ATOMIC_RELAXED);
+      if (allocs)
+        allocs[i] = __atomic_load_n (&stats->allocs[i], __ATOMIC_RELAXED);
+    }
+}
+
+void
+pocl_mem_stats_dump (cl_context context)
+{
+  cl_ulong current[POCL_MEM_CATEGORY_COUNT];
+  cl_ulong peak[POCL_MEM_CATEGORY_COUNT];
+  cl_ulong allocs[POCL_MEM_CATEGORY_COUNT];
+  unsigned i;
+
+  if (trace_file)
+    {
+      POCL_LOCK (trace_lock);
+      fflush (trace_file);
+      POCL_UNLOCK (trace_lock);
+    }
+
+  if (!dump_at_release)
+    return;
+
+  pocl_mem_stats_get (context, current, peak, allocs);
+
+  fprintf (stderr, "\n*** Memory usage of context %" PRId64 " ***\n",
+           context->id);
+  fprintf (stderr, "%16s %16s %16s %12s\n", "category", "current (B)",
+           "peak (B)", "allocs");
+  for (i = 0; i < POCL_MEM_CATEGORY_COUNT; ++i)
+    {
+      /* the runtime-wide ones are listed after the context total */
+      unsigned c = (i < POCL_MEM_FIRST_GLOBAL_CATEGORY) ? i
+                   : (i == POCL_MEM_FIRST_GLOBAL_CATEGORY)
+                       ? POCL_MEM_TOTAL
+                       : i - 1;
+      if (c == POCL_MEM_FIRST_GLOBAL_CATEGORY)
+        fprintf (stderr, "runtime-wide:\n");
+      fprintf (stderr, "%16s %16" PRIu64 " %16" PRIu64 " %12" PRIu64 "\n",
+               category_names[c], current[c], peak[c], allocs[c]);
+    }
+}
@@ -0,0 +1,94 @@
+/* OpenCL runtime library: per-context memory accounting
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* When POCL_MEM_STATS is enabled, the runtime counts the bytes it allocates
+   per category (POCL_MEM_* in pocl_cl.h), with a high-water mark for each.
+   Memory objects, SVM/USM allocations, kernel arguments and events are
+   accounted to their context; command nodes, loaded kernel modules, printf
+   buffers and local memory scratch space are shared by all contexts and
+   accounted runtime-wide. The statistics can be queried with
+   clGetContextInfo (cl_pocl_memory_stats) and are printed when the context
+   is released. POCL_MEM_STATS_TRACE=<file> additionally logs every
+   allocation and deallocation. */
+
+#ifndef POCL_MEM_STATS_H
+#define POCL_MEM_STATS_H
+
+#include "pocl_cl.h"
+#include "pocl_export.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* This is set to 1 in case the accounting is enabled (POCL_MEM_STATS or
+   POCL_MEM_STATS_TRACE). */
+POCL_EXPORT
+extern int pocl_mem_stats_enabled;
+
+void pocl_mem_stats_init ();
+
+/* Accounts an allocation / a deallocation of SIZE bytes of the category.
+   CONTEXT can be NULL for the runtime-wide categories. */
+POCL_EXPORT
+void pocl_mem_stats_alloc (cl_context context, unsigned category,
+                           size_t size);
+POCL_EXPORT
+void pocl_mem_stats_free (cl_context context, unsigned category,
+                          size_t size);
+
+/* Returns the bytes of the argument copies in ARGS (may be NULL). */
+size_t pocl_mem_stats_args_size (unsigned num_args,
+                                 const struct pocl_argument *args);
+
+/* Copies the statistics of the context to the arrays of
+   POCL_MEM_CATEGORY_COUNT elements. The runtime-wide categories are taken
+   from the global statistics. Any of the pointers can be NULL. */
+void pocl_mem_stats_get (cl_context context, cl_ulong *current,
+                         cl_ulong *peak, cl_ulong *allocs);
+
+/* Prints the statistics of the context to stderr. */
+void pocl_mem_stats_dump (cl_context context);
+
+#define POCL_MEM_STATS_ALLOC(context, category, size)                         \
+  do                                                                          \
+    {                                                                         \
+      if (pocl_mem_stats_enabled)                                             \
+        pocl_mem_stats_alloc (context, category, size);                       \
+    }                                                                         \
+  while (0)
+
+#define POCL_MEM_STATS_FREE(context, category, size)                          \
+  do                                                                          \
+    {                                                                         \
+      if (pocl_mem_stats_enabled)                                             \
+        pocl_mem_stats_free (context, category, size);                        \
+    }                                                                         \
+  while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,11 +24,13 @@
 #include "pocl_cl.h"
 #include "pocl_local_size.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
+#include "pocl_shared.h"
 #include "pocl_util.h"
 
 #include <assert.h>
 
-static cl_int
+cl_int
 pocl_kernel_calc_wg_size (cl_command_queue command_queue, cl_kernel kernel,
                           unsigned device_i,
                           cl_uint work_dim, const size_t *global_work_offset,
@@ -210,8 +212,9 @@ SKIP_WG_SIZE_CALCULATION:
   return CL_SUCCESS;
 }
 
-static cl_int
+cl_int
 pocl_kernel_collect_mem_objs (cl_command_queue command_queue, cl_kernel kernel,
+                              const struct pocl_argument *arguments,
                               cl_uint *memobj_count, cl_mem *memobj_list,
                               char *readonly_flag_list)
 {
@@ -220,7 +223,7 @@ pocl_kernel_collect_mem_objs (cl_command_queue command_queue, cl_kernel kernel,
   for (unsigned i = 0; i < kernel->meta->num_args; ++i)
     {
       struct pocl_argument_info *a = &kernel->meta->arg_info[i];
-      struct pocl_argument *al = &(kernel->dyn_arguments[i]);
+      const struct pocl_argument *al = &(arguments[i]);
 
       POCL_RETURN_ERROR_ON ((!al->is_set), CL_INVALID_KERNEL_ARGS,
                             "The %i-th kernel argument is not set!\n", i);
@@ -270,11 +273,13 @@ pocl_kernel_collect_mem_objs (cl_command_queue command_queue, cl_kernel kernel,
   return CL_SUCCESS;
 }
 
+/* Copies the given arguments of the kernel to the command, allocating new
+   storage for their values. */
 cl_int
-pocl_kernel_copy_args (cl_kernel kernel, _cl_command_run *command)
+pocl_kernel_copy_args_from (cl_kernel kernel,
+                            const struct pocl_argument *arguments,
+                            _cl_command_run *command)
 {
-  /* Copy the currently set kernel arguments because the same kernel
-     object can be reused for new launches with different arguments. */
   command->arguments = (struct pocl_argument *)malloc (
       (kernel->meta->num_args) * sizeof (struct pocl_argument));
 
@@ -284,7 +289,7 @@ pocl_kernel_copy_args (cl_kernel kernel, _cl_command_run *command)
   for (unsigned i = 0; i < kernel->meta->num_args; ++i)
     {
       struct pocl_argument *arg = &command->arguments[i];
-      memcpy (arg, &kernel->dyn_arguments[i], sizeof (pocl_argument));
+      memcpy (arg, &arguments[i], sizeof (pocl_argument));
 
       if (arg->value != NULL)
         {
@@ -300,13 +305,119 @@ pocl_kernel_copy_args (cl_kernel kernel, _cl_command_run *command)
             arg_alloc_size = arg_alignment;
 
           arg->value = pocl_aligned_malloc (arg_alignment, arg_alloc_size);
-          memcpy (arg->value, kernel->dyn_arguments[i].value, arg->size);
+          memcpy (arg->value, arguments[i].value, arg->size);
         }
     }
 
+  POCL_MEM_STATS_ALLOC (
+      kernel->context, POCL_MEM_KERNEL_ARGS,
+      pocl_mem_stats_args_size (kernel->meta->num_args, command->arguments));
   return CL_SUCCESS;
 }
 
+cl_int
+pocl_kernel_copy_args (cl_kernel kernel, _cl_command_run *command)
+{
+  /* Copy the currently set kernel arguments because the same kernel
+     object can be reused for new launches with different arguments. */
+  return pocl_kernel_copy_args_from (kernel, kernel->dyn_arguments, command);
+}
+
+#define DEFAULT_MAX_ARG_SPECIALIZATIONS 8
+
+static int
+max_arg_specializations (void)
+{
+  static int max_specs = -1;
+  if (max_specs < 0)
+    max_specs = pocl_get_int_option ("POCL_MAX_ARG_SPECIALIZATIONS",
+                                     DEFAULT_MAX_ARG_SPECIALIZATIONS);
+  return max_specs;
+}
+
+/* Sets the hash and the values of the arguments selected with
+   -pocl-specialize-args in the command, if there still is room for them in
+   the specialization cache of the kernel. Otherwise leaves them unset, and
+   the launch uses a WG function without the values folded in. The values
+   are compared, not only the hash, so a hash collision cannot pick a WG
+   function that has other values folded in. */
+void
+pocl_kernel_set_spec_args_hash (cl_kernel kernel, _cl_command_run *run)
+{
+  pocl_kernel_metadata_t *meta = kernel->meta;
+  uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+  unsigned char *values, *pos;
+  size_t size = 0;
+  unsigned i, j;
+
+  run->spec_args_hash = 0;
+  run->spec_args = NULL;
+  run->spec_args_size = 0;
+  if (meta->specialized_args == 0)
+    return;
+
+  int max_specs = max_arg_specializations ();
+  if (max_specs <= 0)
+    return;
+
+  for (i = 0; i < meta->num_args; ++i)
+    {
+      if (!(meta->specialized_args & ((uint64_t)1 << i)))
+        continue;
+      if (run->arguments[i].value == NULL)
+        return;
+      size += run->arguments[i].size;
+    }
+
+  values = pos = (unsigned char *)malloc (size ? size : 1);
+  if (values == NULL)
+    return;
+  for (i = 0; i < meta->num_args; ++i)
+    {
+      if (!(meta->specialized_args & ((uint64_t)1 << i)))
+        continue;
+      const unsigned char *value = run->arguments[i].value;
+      for (j = 0; j < run->arguments[i].size; ++j)
+        hash = (hash ^ value[j]) * 1099511628211ULL;
+      memcpy (pos, value, run->arguments[i].size);
+      pos += run->arguments[i].size;
+    }
+  if (hash == 0)
+    hash = 1;
+
+  POCL_LOCK_OBJ (kernel->program);
+  for (i = 0; i < meta->num_arg_specs; ++i)
+    if (meta->arg_specs[i].hash == hash && meta->arg_specs[i].size == size
+        && memcmp (meta->arg_specs[i].values, values, size) == 0)
+      break;
+  if (i == meta->num_arg_specs && meta->num_arg_specs < (unsigned)max_specs)
+    {
+      if (meta->arg_specs == NULL)
+        meta->arg_specs
+            = (pocl_arg_spec *)calloc (max_specs, sizeof (pocl_arg_spec));
+      if (meta->arg_specs != NULL)
+        {
+          pocl_arg_spec *spec = &meta->arg_specs[meta->num_arg_specs++];
+          spec->hash = hash;
+          spec->size = size;
+          spec->values = values;
+          values = NULL;
+        }
+    }
+  if (i < meta->num_arg_specs)
+    {
+      run->spec_args_hash = hash;
+      run->spec_args = meta->arg_specs[i].values;
+      run->spec_args_size = size;
+    }
+  else
+    POCL_MSG_PRINT_GENERAL ("Kernel %s has %u argument value "
+                            "specializations, using the generic version\n",
+                            kernel->name, meta->num_arg_specs);
+  POCL_UNLOCK_OBJ (kernel->program);
+  free (values);
+}
+
 cl_int
 pocl_ndrange_kernel_common (
     cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
@@ -368,7 +479,8 @@ pocl_ndrange_kernel_common (
   POCL_RETURN_ERROR_ON (errcode != CL_SUCCESS, errcode,
                         "Error calculating wg size\n");
 
-  errcode = pocl_kernel_collect_mem_objs (command_queue, kernel, &memobj_count,
+  errcode = pocl_kernel_collect_mem_objs (command_queue, kernel,
+                                          kernel->dyn_arguments, &memobj_count,
                                           memobj_list, readonly_flag_list);
   POCL_RETURN_ERROR_ON (errcode != CL_SUCCESS, errcode,
                         "Error collecting mem objects for kernel arguments\n");
@@ -416,6 +528,8 @@ pocl_ndrange_kernel_common (
   if (errcode != CL_SUCCESS)
     goto ERROR;
 
+  pocl_kernel_set_spec_args_hash (kernel, &(*cmd)->command.run);
+
   return CL_SUCCESS;
 
 ERROR:
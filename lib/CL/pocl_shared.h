@@ -71,6 +71,15 @@ compile_and_link_program(int compile_program,
                                                          void *user_data),
                          void *user_data);
 
+/* Initializes the common parts of a newly allocated program object,
+   including its build_cond. Used by all the program creation paths. */
+void pocl_init_program_object (cl_program program);
+
+/* Waits until the build of the program queued by compile_and_link_program
+   (CL_BUILD_IN_PROGRESS) has finished. Returns immediately if there is
+   none. */
+void pocl_wait_for_program_build (cl_program program);
+
 int context_set_properties (cl_context context,
                             const cl_context_properties *properties);
 
@@ -81,6 +90,28 @@ cl_mem pocl_create_memobject (cl_context context, cl_mem_flags flags,
 
 cl_int pocl_kernel_copy_args (cl_kernel kernel, _cl_command_run *command);
 
+cl_int pocl_kernel_copy_args_from (cl_kernel kernel,
+                                   const struct pocl_argument *arguments,
+                                   _cl_command_run *command);
+
+cl_int pocl_kernel_calc_wg_size (cl_command_queue command_queue,
+                                 cl_kernel kernel, unsigned device_i,
+                                 cl_uint work_dim,
+                                 const size_t *global_work_offset,
+                                 const size_t *global_work_size,
+                                 const size_t *local_work_size,
+                                 size_t *global_offset, size_t *local_size,
+                                 size_t *num_groups);
+
+cl_int pocl_kernel_collect_mem_objs (cl_command_queue command_queue,
+                                     cl_kernel kernel,
+                                     const struct pocl_argument *arguments,
+                                     cl_uint *memobj_count,
+                                     cl_mem *memobj_list,
+                                     char *readonly_flag_list);
+
+void pocl_kernel_set_spec_args_hash (cl_kernel kernel, _cl_command_run *run);
+
 cl_int pocl_ndrange_kernel_common (
     cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
     const cl_ndrange_kernel_command_properties_khr *properties,
@@ -178,8 +209,13 @@ cl_int pocl_svm_migrate_mem_common (cl_command_type command_type,
                                     const cl_event *event_wait_list,
                                     cl_event *event);
 
+cl_int pocl_set_kernel_arg (cl_kernel kernel, struct pocl_argument *arguments,
+                            cl_uint arg_index, size_t arg_size,
+                            const void *arg_value);
+
 int
 pocl_set_kernel_arg_pointer(cl_kernel kernel,
+                            struct pocl_argument *arguments,
                             cl_uint arg_index,
                             const void *arg_value);
 
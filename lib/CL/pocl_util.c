@@ -45,13 +45,19 @@
 #include "vccompat.hpp"
 #endif
 
+#ifdef HAVE_MADVISE
+#include <sys/mman.h>
+#endif
+
 #include "common.h"
 #include "devices.h"
 #include "pocl_cache.h"
+#include "pocl_cow.h"
 #include "pocl_file_util.h"
 #include "pocl_llvm.h"
 #include "pocl_local_size.h"
 #include "pocl_mem_management.h"
+#include "pocl_mem_stats.h"
 #include "pocl_runtime_config.h"
 #include "pocl_timing.h"
 #include "pocl_util.h"
@@ -493,11 +499,17 @@ pocl_create_event (cl_event *event, cl_command_queue command_queue,
       memcpy ((*event)->mem_objs, buffers, num_buffers * sizeof (cl_mem));
     }
   (*event)->status = CL_QUEUED;
+  /* events are recycled by the memory manager */
+  memset ((*event)->hw_counters, 0, sizeof ((*event)->hw_counters));
+  (*event)->hw_counter_mask = 0;
 
   if (command_type == CL_COMMAND_USER)
     POCL_ATOMIC_INC (uevent_c);
   else
     POCL_ATOMIC_INC (event_c);
+  POCL_MEM_STATS_ALLOC (context, POCL_MEM_EVENTS,
+                        sizeof (struct _cl_event)
+                            + num_buffers * sizeof (cl_mem));
 
   POCL_MSG_PRINT_EVENTS ("Created event %" PRIu64 " (%p) Command %s\n",
                          (*event)->id, (*event),
@@ -651,6 +663,28 @@ ERROR:
   return errcode;
 }
 
+/* Allocates mem_host_ptr, from copy-on-write memory if it is enabled and
+   no device needs to register the host memory of the buffers. */
+static void
+alloc_mem_host_ptr (cl_mem mem)
+{
+  cl_device_id svm_dev = mem->context->svm_allocdev;
+  pocl_cow_buffer *cow = NULL;
+
+  if (!(svm_dev && svm_dev->ops->svm_register))
+    mem->mem_host_ptr = pocl_cow_alloc (mem->size, &cow);
+  if (mem->mem_host_ptr != NULL)
+    {
+      mem->mem_host_ptr_cow = cow;
+      mem->mem_host_ptr_is_malloced = 0;
+      return;
+    }
+
+  size_t align = max (mem->context->min_buffer_alignment, 16);
+  mem->mem_host_ptr = pocl_aligned_malloc (align, mem->size);
+  mem->mem_host_ptr_is_malloced = 1;
+}
+
 static int
 pocl_create_migration_commands (cl_device_id dev, cl_event final_event,
                                 cl_mem mem, pocl_mem_identifier *p,
@@ -855,8 +889,7 @@ FINISH_VER_SETUP:
       /* allocate mem_host_ptr here if needed... */
       if (mem->mem_host_ptr == NULL)
         {
-          size_t align = max (mem->context->min_buffer_alignment, 16);
-          mem->mem_host_ptr = pocl_aligned_malloc (align, mem->size);
+          alloc_mem_host_ptr (mem);
           assert ((mem->mem_host_ptr != NULL)
                   && "Cannot allocate backing memory for mem_host_ptr!\n");
         }
@@ -1072,6 +1105,18 @@ pocl_cmdbuf_choose_recording_queue (cl_command_buffer_khr command_buffer,
   return CL_SUCCESS;
 }
 
+cl_command_buffer_properties_khr
+pocl_cmdbuf_get_property (cl_command_buffer_khr command_buffer,
+                          cl_command_buffer_properties_khr name)
+{
+  for (unsigned i = 0; i < command_buffer->num_properties; ++i)
+    {
+      if (command_buffer->properties[2 * i] == name)
+        return command_buffer->properties[2 * i + 1];
+    }
+  return 0;
+}
+
 cl_int
 pocl_create_recorded_command (_cl_command_node **cmd,
                               cl_command_buffer_khr command_buffer,
@@ -1151,8 +1196,9 @@ pocl_command_record (cl_command_buffer_khr command_buffer,
 }
 
 /* call with node->sync.event.event UNLOCKED */
-void pocl_command_enqueue (cl_command_queue command_queue,
-                          _cl_command_node *node)
+static void
+command_enqueue (cl_command_queue command_queue, _cl_command_node *node,
+                 int chain_in_order)
 {
   cl_event event;
 
@@ -1160,7 +1206,8 @@ void pocl_command_enqueue (cl_command_queue command_queue,
 
   /* in case of in-order queue, synchronize to previously enqueued command
      if available */
-  if (!(command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+  if (chain_in_order
+      && !(command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
     {
       POCL_MSG_PRINT_EVENTS ("In-order Q; adding event syncs\n");
       if (command_queue->last_event.event)
@@ -1175,7 +1222,7 @@ void pocl_command_enqueue (cl_command_queue command_queue,
      if available */
   if (!(command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
     {
-      if (command_queue->last_event.event)
+      if (chain_in_order && command_queue->last_event.event)
         {
           pocl_create_event_sync (node->sync.event.event,
                                   command_queue->last_event.event);
@@ -1220,13 +1267,25 @@ void pocl_command_enqueue (cl_command_queue command_queue,
   /* node->sync.event.event is unlocked by device_ops->submit */
 }
 
+void
+pocl_command_enqueue (cl_command_queue command_queue, _cl_command_node *node)
+{
+  command_enqueue (command_queue, node, 1);
+}
+
+void
+pocl_command_enqueue_unchained (cl_command_queue command_queue,
+                                _cl_command_node *node)
+{
+  command_enqueue (command_queue, node, 0);
+}
+
 int
 pocl_alloc_or_retain_mem_host_ptr (cl_mem mem)
 {
   if (mem->mem_host_ptr == NULL)
     {
-      size_t align = max (mem->context->min_buffer_alignment, 16);
-      mem->mem_host_ptr = pocl_aligned_malloc (align, mem->size);
+      alloc_mem_host_ptr (mem);
       if (mem->mem_host_ptr == NULL)
         return -1;
       mem->mem_host_ptr_version = 0;
@@ -1243,9 +1302,14 @@ pocl_release_mem_host_ptr (cl_mem mem)
   --mem->mem_host_ptr_refcount;
   if (mem->mem_host_ptr_refcount == 0 && mem->mem_host_ptr != NULL)
     {
-      pocl_aligned_free (mem->mem_host_ptr);
+      if (mem->mem_host_ptr_cow)
+        pocl_cow_free ((pocl_cow_buffer *)mem->mem_host_ptr_cow);
+      else
+        pocl_aligned_free (mem->mem_host_ptr);
       mem->mem_host_ptr = NULL;
+      mem->mem_host_ptr_cow = NULL;
       mem->mem_host_ptr_version = 0;
+      mem->mem_host_ptr_is_malloced = 0;
     }
   return 0;
 }
@@ -1302,6 +1366,10 @@ void
 pocl_ndrange_node_cleanup (_cl_command_node *node)
 {
   cl_uint i;
+  cl_kernel kernel = node->command.run.kernel;
+  POCL_MEM_STATS_FREE (kernel->context, POCL_MEM_KERNEL_ARGS,
+                       pocl_mem_stats_args_size (kernel->meta->num_args,
+                                                 node->command.run.arguments));
   for (i = 0; i < node->command.run.kernel->meta->num_args; ++i)
     {
       pocl_aligned_free (node->command.run.arguments[i].value);
@@ -2625,6 +2693,27 @@ pocl_fill_aligned_buf_with_pattern (void *__restrict__ ptr, size_t offset,
   return 0;
 }
 
+void
+pocl_zero_fill_pages (void *ptr, size_t size)
+{
+#ifdef HAVE_MADVISE
+  static size_t page_size = 0;
+  if (page_size == 0)
+    page_size = (size_t)sysconf (_SC_PAGESIZE);
+
+  uintptr_t start = ((uintptr_t)ptr + page_size - 1) & ~(page_size - 1);
+  uintptr_t end = ((uintptr_t)ptr + size) & ~(page_size - 1);
+  /* on private anonymous memory the dropped pages read back as zeros */
+  if (end > start && madvise ((void *)start, end - start, MADV_DONTNEED) == 0)
+    {
+      memset (ptr, 0, start - (uintptr_t)ptr);
+      memset ((void *)end, 0, (uintptr_t)ptr + size - end);
+      return;
+    }
+#endif
+  memset (ptr, 0, size);
+}
+
 void
 pocl_free_kernel_metadata (cl_program program, unsigned kernel_i)
 {
@@ -2655,6 +2744,24 @@ pocl_free_kernel_metadata (cl_program program, unsigned kernel_i)
   POCL_MEM_FREE (meta->data);
   POCL_MEM_FREE (meta->local_sizes);
   POCL_MEM_FREE (meta->build_hash);
+  for (j = 0; j < meta->num_arg_specs; ++j)
+    POCL_MEM_FREE (meta->arg_specs[j].values);
+  POCL_MEM_FREE (meta->arg_specs);
+  meta->num_arg_specs = 0;
+}
+
+size_t
+pocl_kernel_sub_group_size (cl_device_id dev, pocl_kernel_metadata_t *meta,
+                            size_t local_x)
+{
+  if (meta->reqd_sub_group_size > 0)
+    return meta->reqd_sub_group_size;
+
+  if (dev->native_sub_group_size > 0
+      && local_x % dev->native_sub_group_size == 0)
+    return dev->native_sub_group_size;
+
+  return local_x;
 }
 
 int
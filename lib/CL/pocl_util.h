@@ -132,10 +132,26 @@ cl_int pocl_create_recorded_command (
 void pocl_command_enqueue (cl_command_queue command_queue,
                           _cl_command_node *node);
 
+/* Like pocl_command_enqueue, but does not order the command after the
+ * previously enqueued command of an in-order queue: the node's wait list
+ * must already contain all the commands it depends on. */
+void pocl_command_enqueue_unchained (cl_command_queue command_queue,
+                                     _cl_command_node *node);
+
+/* Rewrites the recorded commands of a command buffer being finalized into
+ * an equivalent but cheaper graph, see pocl_cmdbuf_graph.c. */
+cl_int pocl_cmdbuf_optimize_graph (cl_command_buffer_khr command_buffer);
+
 cl_int
 pocl_cmdbuf_choose_recording_queue (cl_command_buffer_khr command_buffer,
                                     cl_command_queue *command_queue);
 
+/* Returns the value of the property the command buffer was created with,
+ * or 0 if it was not given. */
+cl_command_buffer_properties_khr
+pocl_cmdbuf_get_property (cl_command_buffer_khr command_buffer,
+                          cl_command_buffer_properties_khr name);
+
 POCL_EXPORT
 int pocl_alloc_or_retain_mem_host_ptr (cl_mem mem);
 
@@ -268,6 +284,15 @@ float half_to_float (uint16_t value);
 
 void pocl_free_kernel_metadata (cl_program program, unsigned kernel_i);
 
+/* Returns the sub-group size of META's kernel on DEV for the local size
+   LOCAL_X in dimension x: the intel_reqd_sub_group_size of the kernel if it
+   has one, else the native sub-group size of the device if it divides
+   LOCAL_X, else LOCAL_X. With LOCAL_X 0, returns 0 if the size follows the
+   local size. The kernel compiler must use the same rule (Workgroup.cc). */
+size_t pocl_kernel_sub_group_size (cl_device_id dev,
+                                   pocl_kernel_metadata_t *meta,
+                                   size_t local_x);
+
 POCL_EXPORT
 int pocl_svm_check_pointer (cl_context context, const void *svm_ptr,
                             size_t size, size_t *buffer_size);
@@ -293,6 +318,12 @@ int pocl_fill_aligned_buf_with_pattern (void *__restrict__ ptr, size_t offset,
                                         const void *__restrict__ pattern,
                                         size_t pattern_size);
 
+/* Zeroes SIZE bytes at PTR by replacing the whole pages in the range with
+ * fresh zero pages, which the OS maps only when they are touched. PTR must
+ * be in private anonymous memory, e.g. from pocl_aligned_malloc. */
+POCL_EXPORT
+void pocl_zero_fill_pages (void *ptr, size_t size);
+
 POCL_EXPORT
 int pocl_get_private_datadir (char* private_datadir);
 
@@ -399,14 +430,13 @@ void pocl_str_tolower (char *out, const char *in);
   size_t i1d_origin[3] = { o[0] * px, o[1], o[2] };                           \
   size_t i1d_region[3] = { r[0] * px, r[1], r[2] };
 
-#define CMDBUF_VALIDATE_COMMON_HANDLES                                        \
+#define CMDBUF_VALIDATE_HANDLES                                               \
   do                                                                          \
     {                                                                         \
       POCL_RETURN_ERROR_COND ((!IS_CL_OBJECT_VALID (command_buffer)),         \
                               CL_INVALID_COMMAND_BUFFER_KHR);                 \
       POCL_RETURN_ERROR_COND ((command_queue != NULL),                        \
                               CL_INVALID_COMMAND_QUEUE);                      \
-      POCL_RETURN_ERROR_COND ((mutable_handle != NULL), CL_INVALID_VALUE);    \
       errcode = pocl_cmdbuf_choose_recording_queue (command_buffer,           \
                                                     &command_queue);          \
       if (errcode != CL_SUCCESS)                                              \
@@ -414,4 +444,13 @@ void pocl_str_tolower (char *out, const char *in);
     }                                                                         \
   while (0)
 
+/* Only NDRange commands can be mutable */
+#define CMDBUF_VALIDATE_COMMON_HANDLES                                        \
+  do                                                                          \
+    {                                                                         \
+      POCL_RETURN_ERROR_COND ((mutable_handle != NULL), CL_INVALID_VALUE);    \
+      CMDBUF_VALIDATE_HANDLES;                                                \
+    }                                                                         \
+  while (0)
+
 #endif
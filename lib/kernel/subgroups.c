@@ -23,8 +23,12 @@
 
 /* The default implementation of subgroups for CPU drivers. It uses work-group
    sized local buffers for exchanging the data. The subgroup size is by default
-   the local X dimension side, unless restricted with the
-   intel_reqd_sub_group_size metadata.
+   the native subgroup size of the device if it divides the local X dimension
+   size, else the local X dimension size, unless restricted with the
+   intel_reqd_sub_group_size metadata. The subgroups tile each row of the
+   local X dimension, so with a required size that does not divide it the
+   last subgroup of a row is partial. This must match
+   clGetKernelSubGroupInfo ().
  */
 
 #include <math.h>
@@ -65,22 +69,32 @@ size_t _CL_OVERLOADABLE get_local_id (unsigned int dimindx);
 extern uint _pocl_sub_group_size;
 
 uint _CL_OVERLOADABLE
-get_sub_group_size (void)
+get_max_sub_group_size (void)
 {
   return _pocl_sub_group_size;
 }
 
+/* The number of subgroups in a row of the local X dimension. */
+static uint
+sub_groups_per_row (void)
+{
+  uint size = get_max_sub_group_size ();
+  return ((uint)get_local_size (0) + size - 1) / size;
+}
+
 uint _CL_OVERLOADABLE
-get_max_sub_group_size (void)
+get_sub_group_size (void)
 {
-  return get_sub_group_size ();
+  uint size = get_max_sub_group_size ();
+  uint left = (uint)get_local_size (0) - (uint)get_local_id (0) / size * size;
+  return left < size ? left : size;
 }
 
 uint _CL_OVERLOADABLE
 get_num_sub_groups (void)
 {
-  return (uint)get_local_size (0) * get_local_size (1) * get_local_size (2)
-         / get_max_sub_group_size ();
+  return sub_groups_per_row () * (uint)get_local_size (1)
+         * (uint)get_local_size (2);
 }
 
 uint _CL_OVERLOADABLE
@@ -94,19 +108,24 @@ size_t _CL_OVERLOADABLE get_local_linear_id (void);
 uint _CL_OVERLOADABLE
 get_sub_group_id (void)
 {
-  return (uint)get_local_linear_id () / get_max_sub_group_size ();
+  uint row = (uint)get_local_id (2) * (uint)get_local_size (1)
+             + (uint)get_local_id (1);
+  return row * sub_groups_per_row ()
+         + (uint)get_local_id (0) / get_max_sub_group_size ();
 }
 
 uint _CL_OVERLOADABLE
 get_sub_group_local_id (void)
 {
-  return (uint)get_local_linear_id () % get_max_sub_group_size ();
+  return (uint)get_local_id (0) % get_max_sub_group_size ();
 }
 
+/* The local linear id of the first work-item of the subgroup: the
+   work-items of a subgroup are consecutive in the local X dimension. */
 static size_t _CL_OVERLOADABLE
 get_first_llid (void)
 {
-  return get_sub_group_id () * get_max_sub_group_size ();
+  return get_local_linear_id () - get_sub_group_local_id ();
 }
 
 void _CL_OVERLOADABLE sub_group_barrier (cl_mem_fence_flags flags);
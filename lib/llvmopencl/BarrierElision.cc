@@ -0,0 +1,540 @@
+// BarrierElision, an LLVM pass that removes the barriers that order no
+// conflicting memory accesses of different work-items.
+//
+// Copyright (c) 2023 pocl developers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+// Every barrier becomes a parallel region boundary in the CPU work-group
+// passes, which splits the work-item loops and spills the live values to
+// context arrays. Kernels written for GPUs often have barriers that are not
+// needed: the work-items only touch their own elements of the local or
+// global buffers, or only read what was written before the kernel.
+//
+// The addresses of the accesses are decomposed with SCEV into
+//
+//   object + sum (K[d] * local_id[d]) + sum (S[l] * iteration[l]) + C + U
+//
+// where U is a sum of products of values that are the same in all the
+// work-items of the work-group (kernel arguments, group ids, ...). Two
+// accesses of the same object with equal K, S and U overlap between
+// different work-items only if K . delta + S . epsilon + C1 - C2 falls
+// within the access sizes for some nonzero difference delta of the local
+// ids and some difference epsilon of the loop iterations, which is checked
+// by enumerating the differences allowed by the compile time local size and
+// the maximum trip counts of the loops. A
+// barrier is removed if no conflicting pair of accesses, one of them a
+// write, has one access that may execute before the barrier and the other
+// after it.
+//
+// The analysis gives up on the whole kernel if it finds calls, atomics or
+// fences, and it runs only for WG functions with a fixed local size.
+
+#include "CompilerWarnings.h"
+IGNORE_COMPILER_WARNING("-Wunused-parameter")
+
+#include "config.h"
+#include "pocl.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MathExtras.h>
+
+#include "Barrier.h"
+#include "BarrierElision.h"
+#include "LLVMUtils.h"
+#include "VariableUniformityAnalysis.h"
+#include "Workgroup.h"
+#include "pocl_llvm_api.h"
+
+POP_COMPILER_DIAGS
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#define DEBUG_TYPE "barrier-elision"
+
+STATISTIC(NumBarriersRemoved, "Number of barriers removed");
+
+using namespace llvm;
+using namespace pocl;
+
+namespace {
+static RegisterPass<BarrierElision>
+    X("barrier-elision",
+      "Removes barriers that order no conflicting memory accesses");
+}
+
+char BarrierElision::ID = 0;
+
+namespace {
+
+const char *LocalIdVariables[] = {"_local_id_x", "_local_id_y",
+                                  "_local_id_z"};
+
+// The pseudo variables that have the same value in all the work-items of
+// the work-group.
+const char *UniformVariables[] = {
+    "_local_size_x",    "_local_size_y",    "_local_size_z",
+    "_num_groups_x",    "_num_groups_y",    "_num_groups_z",
+    "_group_id_x",      "_group_id_y",      "_group_id_z",
+    "_global_offset_x", "_global_offset_y", "_global_offset_z",
+    "_work_dim",        "_pocl_sub_group_size"};
+
+// The largest number of local id and iteration count differences
+// enumerated for a pair of accesses before they are assumed to conflict.
+const uint64_t MaxDeltas = 1 << 16;
+
+#ifdef LLVM_OLDER_THAN_12_0
+bool isIntegralCast(const SCEV *S) {
+  return isa<SCEVTruncateExpr>(S) || isa<SCEVZeroExtendExpr>(S) ||
+         isa<SCEVSignExtendExpr>(S);
+}
+#else
+bool isIntegralCast(const SCEV *S) { return isa<SCEVIntegralCastExpr>(S); }
+#endif
+
+const Value *underlyingObject(const Value *V, const DataLayout &DL,
+                              unsigned MaxLookup = 6) {
+#ifdef LLVM_OLDER_THAN_12_0
+  return GetUnderlyingObject(V, DL, MaxLookup);
+#else
+  return getUnderlyingObject(V, MaxLookup);
+#endif
+}
+
+// The products of work-group uniform values in the address, keyed by the
+// sorted factors, mapped to their constant coefficients.
+typedef std::map<std::vector<const Value *>, int64_t> UniformTerms;
+
+struct Access {
+  Instruction *Inst;
+  bool IsWrite;
+  // the accessed argument or global variable, nullptr if not known
+  const Value *Object;
+  uint64_t Size;
+  // set if the offset to Object could be decomposed into the fields below
+  bool Affine;
+  int64_t LocalIdCoeffs[3];
+  // the coefficients of the iteration counts of the enclosing loops
+  std::map<const Loop *, int64_t> LoopCoeffs;
+  int64_t Const;
+  UniformTerms Uniform;
+};
+
+class AccessAnalysis {
+public:
+  AccessAnalysis(Function &F, ScalarEvolution &SE,
+                 const unsigned long *LocalSizes)
+      : F(F), SE(SE), DL(F.getParent()->getDataLayout()),
+        LocalSizes(LocalSizes) {}
+
+  bool collect(SmallVectorImpl<Instruction *> &Barriers);
+  bool mayConflict(const Access &A, const Access &B) const;
+
+  std::vector<Access> Accesses;
+
+private:
+  bool isPseudoVariable(const Value *Ptr) const;
+  bool classifyAtom(const Value *V, int &Dim) const;
+  bool decompose(const SCEV *S, int64_t Scale, Access &A) const;
+  bool objectsMayAlias(const Value *A, const Value *B) const;
+
+  Function &F;
+  ScalarEvolution &SE;
+  const DataLayout &DL;
+  const unsigned long *LocalSizes;
+};
+
+} // namespace
+
+bool AccessAnalysis::isPseudoVariable(const Value *Ptr) const {
+  const GlobalVariable *GV = dyn_cast<GlobalVariable>(Ptr->stripPointerCasts());
+  if (GV == nullptr)
+    return false;
+  StringRef Name = GV->getName();
+  return Name.startswith("_local_id_") ||
+         std::find(std::begin(UniformVariables), std::end(UniformVariables),
+                   Name) != std::end(UniformVariables) ||
+         Name == PoclGVarBufferName;
+}
+
+// Returns true if V is an atom of an address expression: a local id, in
+// which case Dim is set to its dimension, or a value that is uniform in the
+// work-group, in which case Dim is set to -1.
+bool AccessAnalysis::classifyAtom(const Value *V, int &Dim) const {
+  Dim = -1;
+  if (isa<Argument>(V) || isa<Constant>(V))
+    return true;
+  const LoadInst *Load = dyn_cast<LoadInst>(V);
+  if (Load == nullptr)
+    return false;
+  const GlobalVariable *GV =
+      dyn_cast<GlobalVariable>(Load->getPointerOperand()->stripPointerCasts());
+  if (GV == nullptr)
+    return false;
+  StringRef Name = GV->getName();
+  for (int D = 0; D < 3; ++D) {
+    if (Name == LocalIdVariables[D]) {
+      Dim = D;
+      return true;
+    }
+  }
+  return std::find(std::begin(UniformVariables), std::end(UniformVariables),
+                   Name) != std::end(UniformVariables);
+}
+
+// Adds Scale * S to the fields of A. Casts are looked through: an address
+// that wraps around within a work-group is not a concern of valid kernels.
+bool AccessAnalysis::decompose(const SCEV *S, int64_t Scale,
+                               Access &A) const {
+  if (const SCEVConstant *C = dyn_cast<SCEVConstant>(S)) {
+    if (C->getAPInt().getMinSignedBits() > 48)
+      return false;
+    int64_t Term;
+    return !MulOverflow(Scale, C->getAPInt().getSExtValue(), Term) &&
+           !AddOverflow(A.Const, Term, A.Const);
+  }
+  if (isIntegralCast(S))
+    return decompose(cast<SCEVCastExpr>(S)->getOperand(), Scale, A);
+  if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S)) {
+    int Dim;
+    if (!classifyAtom(U->getValue(), Dim))
+      return false;
+    if (Dim >= 0)
+      return !AddOverflow(A.LocalIdCoeffs[Dim], Scale, A.LocalIdCoeffs[Dim]);
+    int64_t &Coeff = A.Uniform[{U->getValue()}];
+    return !AddOverflow(Coeff, Scale, Coeff);
+  }
+  if (const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S)) {
+    const SCEVConstant *Step =
+        dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+    if (!AR->isAffine() || Step == nullptr ||
+        Step->getAPInt().getMinSignedBits() > 48)
+      return false;
+    int64_t Term;
+    int64_t &Coeff = A.LoopCoeffs[AR->getLoop()];
+    if (MulOverflow(Scale, Step->getAPInt().getSExtValue(), Term) ||
+        AddOverflow(Coeff, Term, Coeff))
+      return false;
+    return decompose(AR->getStart(), Scale, A);
+  }
+  if (const SCEVAddExpr *Add = dyn_cast<SCEVAddExpr>(S)) {
+    for (const SCEV *Op : Add->operands())
+      if (!decompose(Op, Scale, A))
+        return false;
+    return true;
+  }
+  if (const SCEVMulExpr *Mul = dyn_cast<SCEVMulExpr>(S)) {
+    int64_t Factor = Scale;
+    SmallVector<const SCEV *, 4> Rest;
+    for (const SCEV *Op : Mul->operands()) {
+      const SCEVConstant *C = dyn_cast<SCEVConstant>(Op);
+      if (C == nullptr) {
+        Rest.push_back(Op);
+        continue;
+      }
+      if (C->getAPInt().getMinSignedBits() > 48 ||
+          MulOverflow(Factor, C->getAPInt().getSExtValue(), Factor))
+        return false;
+    }
+    if (Rest.size() == 1)
+      return decompose(Rest[0], Factor, A);
+
+    // A product of uniform values. A local id multiplied by a value not
+    // known at compile time is not handled.
+    std::vector<const Value *> Factors;
+    for (const SCEV *Op : Rest) {
+      while (isIntegralCast(Op))
+        Op = cast<SCEVCastExpr>(Op)->getOperand();
+      const SCEVUnknown *U = dyn_cast<SCEVUnknown>(Op);
+      int Dim;
+      if (U == nullptr || !classifyAtom(U->getValue(), Dim) || Dim >= 0)
+        return false;
+      Factors.push_back(U->getValue());
+    }
+    std::sort(Factors.begin(), Factors.end());
+    int64_t &Coeff = A.Uniform[Factors];
+    return !AddOverflow(Coeff, Factor, Coeff);
+  }
+  return false;
+}
+
+// Collects the memory accesses of the kernel that may be seen by other
+// work-items, and the barriers. Returns false if the kernel has memory
+// operations that are not analyzed.
+bool AccessAnalysis::collect(SmallVectorImpl<Instruction *> &Barriers) {
+  for (Instruction &I : instructions(F)) {
+    if (isa<Barrier>(&I)) {
+      Barriers.push_back(&I);
+      continue;
+    }
+    if (!I.mayReadOrWriteMemory())
+      continue;
+    if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I)) {
+      if (II->isLifetimeStartOrEnd() || isa<DbgInfoIntrinsic>(II) ||
+          II->getIntrinsicID() == Intrinsic::assume)
+        continue;
+#ifndef LLVM_OLDER_THAN_13_0
+      if (II->getIntrinsicID() == Intrinsic::experimental_noalias_scope_decl)
+        continue;
+#endif
+    }
+
+    Value *Ptr;
+    Type *Ty;
+    bool IsWrite;
+    if (LoadInst *Load = dyn_cast<LoadInst>(&I)) {
+      if (!Load->isSimple())
+        return false;
+      Ptr = Load->getPointerOperand();
+      Ty = Load->getType();
+      IsWrite = false;
+    } else if (StoreInst *Store = dyn_cast<StoreInst>(&I)) {
+      if (!Store->isSimple())
+        return false;
+      Ptr = Store->getPointerOperand();
+      Ty = Store->getValueOperand()->getType();
+      IsWrite = true;
+    } else if (MemIntrinsic *MI = dyn_cast<MemIntrinsic>(&I)) {
+      // Copies and fills are fine as long as they touch only private memory.
+      if (!isa<AllocaInst>(underlyingObject(MI->getDest(), DL)))
+        return false;
+      if (MemTransferInst *MT = dyn_cast<MemTransferInst>(MI))
+        if (!isa<AllocaInst>(underlyingObject(MT->getSource(), DL)))
+          return false;
+      continue;
+    } else {
+      // Calls, atomics and fences.
+      return false;
+    }
+
+    if (isPseudoVariable(Ptr))
+      continue;
+    const Value *Obj = underlyingObject(Ptr, DL, 0);
+    if (isa<AllocaInst>(Obj))
+      continue;
+
+    Access A = {};
+    A.Inst = &I;
+    A.IsWrite = IsWrite;
+#ifdef LLVM_OLDER_THAN_12_0
+    A.Size = DL.getTypeStoreSize(Ty).getKnownMinSize();
+#else
+    A.Size = DL.getTypeStoreSize(Ty).getKnownMinValue();
+#endif
+    if (isa<Argument>(Obj) || isa<GlobalVariable>(Obj))
+      A.Object = Obj;
+
+    if (A.Object != nullptr && SE.isSCEVable(Ptr->getType())) {
+      const SCEV *S = SE.getSCEV(Ptr);
+      const SCEVUnknown *Base = dyn_cast<SCEVUnknown>(SE.getPointerBase(S));
+      if (Base != nullptr &&
+          underlyingObject(Base->getValue(), DL, 0) == A.Object) {
+        A.Affine = decompose(SE.getMinusSCEV(S, Base), 1, A);
+        for (auto It = A.Uniform.begin(); It != A.Uniform.end();) {
+          if (It->second == 0)
+            It = A.Uniform.erase(It);
+          else
+            ++It;
+        }
+        for (auto It = A.LoopCoeffs.begin(); It != A.LoopCoeffs.end();) {
+          if (It->second == 0)
+            It = A.LoopCoeffs.erase(It);
+          else
+            ++It;
+        }
+      }
+    }
+    Accesses.push_back(A);
+  }
+  return true;
+}
+
+bool AccessAnalysis::objectsMayAlias(const Value *A, const Value *B) const {
+  // Global variables do not alias each other nor the buffers given to the
+  // kernel.
+  if (isa<GlobalVariable>(A) || isa<GlobalVariable>(B))
+    return false;
+  const Argument *ArgA = cast<Argument>(A);
+  const Argument *ArgB = cast<Argument>(B);
+  // Each local buffer argument gets its own allocation.
+  if (isLocalMemFunctionArg(&F, ArgA->getArgNo()) ||
+      isLocalMemFunctionArg(&F, ArgB->getArgNo()))
+    return false;
+  return !ArgA->hasNoAliasAttr() && !ArgB->hasNoAliasAttr();
+}
+
+// Returns true if A executed by one work-item and B executed by another one
+// may access the same bytes, and one of them writes.
+bool AccessAnalysis::mayConflict(const Access &A, const Access &B) const {
+  if (!A.IsWrite && !B.IsWrite)
+    return false;
+  if (A.Object == nullptr || B.Object == nullptr)
+    return true;
+  if (A.Object != B.Object)
+    return objectsMayAlias(A.Object, B.Object);
+  if (!A.Affine || !B.Affine || A.Uniform != B.Uniform ||
+      !std::equal(std::begin(A.LocalIdCoeffs), std::end(A.LocalIdCoeffs),
+                  std::begin(B.LocalIdCoeffs)))
+    return true;
+
+  if (A.LoopCoeffs != B.LoopCoeffs)
+    return true;
+
+  // The coefficients of the differences of the local ids and of the
+  // iteration counts, and the largest differences.
+  SmallVector<int64_t, 8> Coeffs, Limits;
+  bool OtherWorkItems = false;
+  for (int Dim = 0; Dim < 3; ++Dim) {
+    if (A.LocalIdCoeffs[Dim] == 0) {
+      // Work-items that differ only in the dimensions that do not affect
+      // the address.
+      OtherWorkItems |= LocalSizes[Dim] > 1;
+      continue;
+    }
+    Coeffs.push_back(A.LocalIdCoeffs[Dim]);
+    Limits.push_back((int64_t)LocalSizes[Dim] - 1);
+  }
+  unsigned LocalIdDims = Coeffs.size();
+  for (const auto &LC : A.LoopCoeffs) {
+    const SCEVConstant *MaxBTC =
+        dyn_cast<SCEVConstant>(SE.getConstantMaxBackedgeTakenCount(LC.first));
+    if (MaxBTC == nullptr ||
+        MaxBTC->getAPInt().getActiveBits() > 32)
+      return true;
+    Coeffs.push_back(LC.second);
+    Limits.push_back((int64_t)MaxBTC->getAPInt().getZExtValue());
+  }
+
+  uint64_t Deltas = 1;
+  for (int64_t Limit : Limits) {
+    Deltas *= 2 * Limit + 1;
+    if (Deltas > MaxDeltas)
+      return true;
+  }
+
+  // Work-item W1 running A and W2 running B touch the same bytes if the
+  // difference of their offsets minus D is strictly between -A.Size and
+  // B.Size.
+  int64_t D = B.Const - A.Const;
+  int64_t Low = D - (int64_t)A.Size;
+  int64_t High = D + (int64_t)B.Size;
+  SmallVector<int64_t, 8> Delta(Limits.size());
+  for (unsigned I = 0; I < Limits.size(); ++I)
+    Delta[I] = -Limits[I];
+  while (true) {
+    bool SameWorkItem = !OtherWorkItems;
+    int64_t V = 0;
+    for (unsigned I = 0; I < Delta.size(); ++I) {
+      V += Coeffs[I] * Delta[I];
+      if (I < LocalIdDims && Delta[I] != 0)
+        SameWorkItem = false;
+    }
+    if (!SameWorkItem && V > Low && V < High)
+      return true;
+
+    unsigned I = 0;
+    while (I < Delta.size() && Delta[I] == Limits[I]) {
+      Delta[I] = -Limits[I];
+      ++I;
+    }
+    if (I == Delta.size())
+      return false;
+    ++Delta[I];
+  }
+}
+
+void BarrierElision::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
+  AU.addPreserved<VariableUniformityAnalysis>();
+  AU.setPreservesCFG();
+}
+
+bool BarrierElision::runOnFunction(Function &F) {
+  if (!Workgroup::isKernelToProcess(F))
+    return false;
+
+  const Module &M = *F.getParent();
+  bool DynamicLocalSize = false;
+  getModuleBoolMetadata(M, "WGDynamicLocalSize", DynamicLocalSize);
+  unsigned long LocalSizes[3] = {0, 0, 0};
+  getModuleIntMetadata(M, "WGLocalSizeX", LocalSizes[0]);
+  getModuleIntMetadata(M, "WGLocalSizeY", LocalSizes[1]);
+  getModuleIntMetadata(M, "WGLocalSizeZ", LocalSizes[2]);
+  if (DynamicLocalSize || LocalSizes[0] == 0 || LocalSizes[1] == 0 ||
+      LocalSizes[2] == 0)
+    return false;
+
+  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+  AccessAnalysis AA(F, SE, LocalSizes);
+  SmallVector<Instruction *, 8> Barriers;
+  if (!AA.collect(Barriers) || Barriers.empty())
+    return false;
+
+  const std::vector<Access> &Accesses = AA.Accesses;
+  SmallVector<Instruction *, 8> Removable;
+  for (Instruction *B : Barriers) {
+    std::vector<const Access *> Before, After;
+    for (const Access &A : Accesses) {
+      if (isPotentiallyReachable(A.Inst, B, nullptr, &DT, &LI))
+        Before.push_back(&A);
+      if (isPotentiallyReachable(B, A.Inst, nullptr, &DT, &LI))
+        After.push_back(&A);
+    }
+    bool Needed = false;
+    for (const Access *X : Before) {
+      for (const Access *Y : After) {
+        if (AA.mayConflict(*X, *Y)) {
+          Needed = true;
+          break;
+        }
+      }
+      if (Needed)
+        break;
+    }
+    if (!Needed)
+      Removable.push_back(B);
+  }
+
+  for (Instruction *B : Removable)
+    B->eraseFromParent();
+  NumBarriersRemoved += Removable.size();
+
+  POCL_MSG_PRINT_LLVM("Removed %zu of %zu barriers from kernel %s\n",
+                      (size_t)Removable.size(), (size_t)Barriers.size(),
+                      F.getName().str().c_str());
+  return !Removable.empty();
+}
@@ -289,6 +289,16 @@ bool isLocalMemFunctionArg(llvm::Function *F, unsigned ArgIndex) {
            SPIR_ADDRESS_SPACE_LOCAL;
 }
 
+bool isRestrictFunctionArg(llvm::Function *F, unsigned ArgIndex) {
+
+  MDNode *MD = F->getMetadata("kernel_arg_type_qual");
+
+  if (MD == nullptr || MD->getNumOperands() <= ArgIndex)
+    return false;
+  MDString *Qual = dyn_cast<MDString>(MD->getOperand(ArgIndex));
+  return Qual != nullptr && Qual->getString().contains("restrict");
+}
+
 bool isProgramScopeVariable(GlobalVariable &GVar, unsigned DeviceLocalAS) {
 
   bool retval = false;
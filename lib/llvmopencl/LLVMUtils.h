@@ -62,6 +62,9 @@ bool isGVarUsedByFunction(llvm::GlobalVariable *GVar, llvm::Function *F);
 // Checks if the given argument of Func is a local buffer.
 bool isLocalMemFunctionArg(llvm::Function *Func, unsigned ArgIndex);
 
+// Checks if the given argument of Func is a restrict qualified buffer.
+bool isRestrictFunctionArg(llvm::Function *Func, unsigned ArgIndex);
+
 // determines if GVar is OpenCL program-scope variable
 // if it has empty name, sets it to __anonymous_global_as.XYZ
 bool isProgramScopeVariable(llvm::GlobalVariable &GVar, unsigned DeviceLocalAS);
@@ -0,0 +1,448 @@
+// LLVM function pass that inserts software prefetches to the work-item loops.
+//
+// Copyright (c) 2023 pocl developers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+// After the work-item loops have been formed, the loads indexed by the
+// local id are ordinary loop accesses whose stride per work-item is known
+// from the SCEV of their address. This pass prefetches the loads whose
+// stride is too large for the hardware prefetchers to follow, and the
+// gathers A[B[i]] whose index B[i] is itself strided, a number of iterations
+// ahead that covers the memory latency of the device.
+//
+// A loop with a prefetch is not vectorized by the LLVM 14 loop vectorizer,
+// so only the loops with such loads, which vectorize poorly to begin with,
+// are touched.
+
+#include "CompilerWarnings.h"
+IGNORE_COMPILER_WARNING("-Wunused-parameter")
+
+#include "config.h"
+#include "pocl.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Module.h>
+#ifdef LLVM_OLDER_THAN_11_0
+#include <llvm/Analysis/ScalarEvolutionExpander.h>
+#else
+#include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
+#endif
+
+#include "SoftwarePrefetch.h"
+
+POP_COMPILER_DIAGS
+
+#include <cstdlib>
+
+using namespace llvm;
+
+namespace {
+
+// The prefetch distance is capped so that the prefetched lines are not
+// evicted before the loads reach them.
+const unsigned MaxPrefetchIterations = 64;
+
+// How deep the address computation of a gather is searched for its index.
+const unsigned MaxGatherChainDepth = 8;
+
+struct Gather {
+  LoadInst *Load;
+  // the strided load of the index the address is computed from
+  LoadInst *Index;
+  int64_t IndexStride;
+  // the instructions from Index to the address of Load, in order
+  SmallVector<Instruction *, 8> Chain;
+};
+
+class SoftwarePrefetch : public FunctionPass {
+public:
+  static char ID;
+  SoftwarePrefetch(unsigned Latency = 0, unsigned MinStride = 64,
+                   unsigned LineSize = 64)
+      : FunctionPass(ID), Latency(Latency), MinStride(MinStride),
+        LineSize(LineSize) {}
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+  virtual bool runOnFunction(Function &F);
+
+private:
+  unsigned Latency;
+  unsigned MinStride;
+  unsigned LineSize;
+
+  ScalarEvolution *SE;
+  DominatorTree *DT;
+  const TargetTransformInfo *TTI;
+
+  bool prefetchLoop(Loop *L);
+  unsigned prefetchDistance(const Loop *L);
+  Optional<int64_t> strideOf(const SCEV *S, const Loop *L, bool AllowTrunc);
+  bool collectGatherChain(Value *V, const Loop *L, unsigned Depth,
+                          Gather &G);
+};
+
+} // namespace
+
+char SoftwarePrefetch::ID = 0;
+static RegisterPass<SoftwarePrefetch>
+    X("software-prefetch",
+      "Inserts software prefetches for strided and gathered loads");
+
+llvm::FunctionPass *pocl::createSoftwarePrefetchPass(unsigned Latency,
+                                                     unsigned MinStride,
+                                                     unsigned LineSize) {
+  return new SoftwarePrefetch(Latency, MinStride, LineSize);
+}
+
+void SoftwarePrefetch::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
+  AU.addRequired<TargetTransformInfoWrapperPass>();
+  AU.setPreservesCFG();
+}
+
+// The work-item loops are marked parallel by WorkitemLoops and
+// SubCFGFormation. Only they and the kernel's own loops inside them are
+// prefetched.
+static bool isInWorkItemLoop(const Loop *L) {
+  for (; L != nullptr; L = L->getParentLoop())
+    if (findOptionMDForLoop(L, "llvm.loop.parallel_accesses") != nullptr)
+      return true;
+  return false;
+}
+
+static Value *offsetPointer(IRBuilder<> &Builder, Value *Ptr,
+                            Value *Offset) {
+  unsigned AS = Ptr->getType()->getPointerAddressSpace();
+  Value *BytePtr = Builder.CreatePointerCast(Ptr, Builder.getInt8PtrTy(AS));
+  return Builder.CreateGEP(Builder.getInt8Ty(), BytePtr, Offset);
+}
+
+static void insertPrefetch(IRBuilder<> &Builder, Value *Addr) {
+  Module *M = Builder.GetInsertBlock()->getModule();
+  Type *PtrTy =
+      Builder.getInt8PtrTy(Addr->getType()->getPointerAddressSpace());
+  Function *Prefetch =
+      Intrinsic::getDeclaration(M, Intrinsic::prefetch, PtrTy);
+  // a read with high temporal locality to the data cache
+  Builder.CreateCall(Prefetch, {Builder.CreatePointerCast(Addr, PtrTy),
+                                Builder.getInt32(0), Builder.getInt32(3),
+                                Builder.getInt32(1)});
+}
+
+bool SoftwarePrefetch::runOnFunction(Function &F) {
+  if (Latency == 0 || F.isDeclaration())
+    return false;
+
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  TTI = &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+
+  bool Changed = false;
+  for (Loop *L : LI.getLoopsInPreorder()) {
+#ifdef LLVM_OLDER_THAN_12_0
+    bool Innermost = L->empty();
+#else
+    bool Innermost = L->isInnermost();
+#endif
+    if (Innermost && isInWorkItemLoop(L))
+      Changed |= prefetchLoop(L);
+  }
+  return Changed;
+}
+
+#ifdef LLVM_OLDER_THAN_12_0
+static uint64_t positiveCost(int Cost) { return Cost > 0 ? Cost : 0; }
+#else
+static uint64_t positiveCost(InstructionCost Cost) {
+  return Cost.isValid() && *Cost.getValue() > 0 ? *Cost.getValue() : 0;
+}
+#endif
+
+// Estimates how many iterations of the loop take as long as the memory
+// latency, from the latencies of the instructions of the loop body.
+unsigned SoftwarePrefetch::prefetchDistance(const Loop *L) {
+  uint64_t Cycles = 0;
+  for (BasicBlock *BB : L->blocks()) {
+    for (Instruction &I : *BB)
+      Cycles += positiveCost(
+          TTI->getInstructionCost(&I, TargetTransformInfo::TCK_Latency));
+  }
+  if (Cycles == 0)
+    Cycles = 1;
+  return std::min<uint64_t>((Latency + Cycles - 1) / Cycles,
+                            MaxPrefetchIterations);
+}
+
+// Returns the change of S in bytes per iteration of L, if it is a constant.
+// The extensions are looked through as if they did not wrap, which is
+// enough for computing addresses to prefetch.
+Optional<int64_t> SoftwarePrefetch::strideOf(const SCEV *S, const Loop *L,
+                                             bool AllowTrunc) {
+  if (SE->isLoopInvariant(S, L))
+    return 0;
+
+  if (const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S)) {
+    if (AR->getLoop() != L || !AR->isAffine())
+      return None;
+    const SCEVConstant *Step =
+        dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE));
+    if (Step == nullptr || Step->getAPInt().getMinSignedBits() > 64)
+      return None;
+    return Step->getAPInt().getSExtValue();
+  }
+
+  if (const SCEVAddExpr *Add = dyn_cast<SCEVAddExpr>(S)) {
+    int64_t Sum = 0;
+    for (const SCEV *Op : Add->operands()) {
+      Optional<int64_t> OpStride = strideOf(Op, L, AllowTrunc);
+      if (!OpStride)
+        return None;
+      Sum += *OpStride;
+    }
+    return Sum;
+  }
+
+  if (const SCEVMulExpr *Mul = dyn_cast<SCEVMulExpr>(S)) {
+    int64_t Factor = 1;
+    Optional<int64_t> VariantStride;
+    for (const SCEV *Op : Mul->operands()) {
+      if (const SCEVConstant *C = dyn_cast<SCEVConstant>(Op)) {
+        if (C->getAPInt().getMinSignedBits() > 32)
+          return None;
+        Factor *= C->getAPInt().getSExtValue();
+      } else if (VariantStride || SE->isLoopInvariant(Op, L)) {
+        // the stride is not a constant
+        return None;
+      } else {
+        VariantStride = strideOf(Op, L, AllowTrunc);
+        if (!VariantStride)
+          return None;
+      }
+    }
+    return (VariantStride ? *VariantStride : 0) * Factor;
+  }
+
+  if (const SCEVCastExpr *Cast = dyn_cast<SCEVCastExpr>(S)) {
+    if (isa<SCEVTruncateExpr>(Cast) && !AllowTrunc)
+      return None;
+#ifdef LLVM_OLDER_THAN_12_0
+    if (isa<SCEVTruncateExpr>(Cast) || isa<SCEVZeroExtendExpr>(Cast) ||
+        isa<SCEVSignExtendExpr>(Cast))
+#else
+    if (isa<SCEVIntegralCastExpr>(Cast))
+#endif
+      return strideOf(Cast->getOperand(), L, AllowTrunc);
+  }
+
+  return None;
+}
+
+// Collects the side-effect free instructions of L that compute V from a
+// single load of L, operands first. Returns false if the address depends on
+// anything else in the loop than that load and the induction variables.
+bool SoftwarePrefetch::collectGatherChain(Value *V, const Loop *L,
+                                          unsigned Depth, Gather &G) {
+  Instruction *I = dyn_cast<Instruction>(V);
+  if (I == nullptr || !L->contains(I) || isa<PHINode>(I))
+    return true;
+
+  if (LoadInst *Ld = dyn_cast<LoadInst>(I)) {
+    if (G.Index != nullptr && G.Index != Ld)
+      return false;
+    G.Index = Ld;
+    return true;
+  }
+
+  if (Depth == 0 || I->isIntDivRem() ||
+      !(isa<GetElementPtrInst>(I) || isa<CastInst>(I) ||
+        isa<BinaryOperator>(I)))
+    return false;
+
+  if (is_contained(G.Chain, I))
+    return true;
+  for (Value *Op : I->operands())
+    if (!collectGatherChain(Op, L, Depth - 1, G))
+      return false;
+  G.Chain.push_back(I);
+  return true;
+}
+
+bool SoftwarePrefetch::prefetchLoop(Loop *L) {
+  const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+
+  // Loading the index of a gather ahead is safe only if the load is
+  // executed on every iteration and the iterations can be counted.
+  PHINode *IV = L->getCanonicalInductionVariable();
+  const SCEV *BTC = SE->getBackedgeTakenCount(L);
+  SCEVExpander Expander(*SE, DL, "prefetch");
+  bool CanGather = IV != nullptr && L->getLoopPreheader() != nullptr &&
+                   L->getExitingBlock() == L->getLoopLatch() &&
+                   !isa<SCEVCouldNotCompute>(BTC);
+#ifdef LLVM_OLDER_THAN_16_0
+  CanGather = CanGather && isSafeToExpand(BTC, *SE);
+#else
+  CanGather = CanGather && Expander.isSafeToExpand(BTC);
+#endif
+
+  SmallVector<std::pair<LoadInst *, int64_t>, 8> Strided;
+  SmallVector<const SCEV *, 8> Covered;
+  SmallVector<Gather, 4> Gathers;
+
+  for (BasicBlock *BB : L->blocks()) {
+    for (Instruction &I : *BB) {
+      LoadInst *Ld = dyn_cast<LoadInst>(&I);
+      if (Ld == nullptr || !Ld->isSimple())
+        continue;
+      Value *Ptr = Ld->getPointerOperand();
+      // the private variables stay in the cache anyway
+#ifdef LLVM_OLDER_THAN_12_0
+      if (isa<AllocaInst>(GetUnderlyingObject(Ptr, DL)))
+#else
+      if (isa<AllocaInst>(getUnderlyingObject(Ptr)))
+#endif
+        continue;
+      const SCEV *PtrS = SE->getSCEV(Ptr);
+      if (SE->isLoopInvariant(PtrS, L))
+        continue;
+
+      Optional<int64_t> Stride = strideOf(PtrS, L, true);
+      if (Stride) {
+        if ((uint64_t)std::llabs(*Stride) < MinStride)
+          continue;
+        // loads within a cache line from each other share the prefetch
+        bool Shared = false;
+        for (const SCEV *C : Covered) {
+          if (SE->getEffectiveSCEVType(C->getType()) !=
+              SE->getEffectiveSCEVType(PtrS->getType()))
+            continue;
+          const SCEVConstant *Diff =
+              dyn_cast<SCEVConstant>(SE->getMinusSCEV(PtrS, C));
+          if (Diff != nullptr && Diff->getAPInt().getMinSignedBits() <= 64 &&
+              (uint64_t)std::llabs(Diff->getAPInt().getSExtValue()) <
+                  LineSize) {
+            Shared = true;
+            break;
+          }
+        }
+        if (!Shared) {
+          Covered.push_back(PtrS);
+          Strided.push_back(std::make_pair(Ld, *Stride));
+        }
+        continue;
+      }
+
+      if (!CanGather)
+        continue;
+      Gather G;
+      G.Load = Ld;
+      G.Index = nullptr;
+      if (!collectGatherChain(Ptr, L, MaxGatherChainDepth, G) ||
+          G.Index == nullptr || !G.Index->isSimple() ||
+          !DT->dominates(G.Index->getParent(), L->getLoopLatch()))
+        continue;
+      Optional<int64_t> IndexStride =
+          strideOf(SE->getSCEV(G.Index->getPointerOperand()), L, false);
+      if (!IndexStride || *IndexStride == 0)
+        continue;
+      G.IndexStride = *IndexStride;
+      Gathers.push_back(G);
+    }
+  }
+
+  if (Strided.empty() && Gathers.empty())
+    return false;
+
+  unsigned Distance = prefetchDistance(L);
+
+  for (auto &S : Strided) {
+    LoadInst *Ld = S.first;
+    IRBuilder<> Builder(Ld);
+    Type *OffsetTy = DL.getIndexType(Ld->getPointerOperandType());
+    insertPrefetch(Builder,
+                   offsetPointer(Builder, Ld->getPointerOperand(),
+                                 ConstantInt::get(OffsetTy,
+                                                  S.second * Distance)));
+  }
+
+  if (Gathers.empty())
+    return true;
+
+  // The index is loaded from Distance iterations ahead while that
+  // iteration exists, and from the current iteration after that.
+  Value *Last =
+      Expander.expandCodeFor(SE->getTruncateOrZeroExtend(BTC, IV->getType()),
+                             IV->getType(),
+                             L->getLoopPreheader()->getTerminator());
+  for (Gather &G : Gathers) {
+    IRBuilder<> Builder(G.Load);
+    Value *D = ConstantInt::get(IV->getType(), Distance);
+    Value *InRange = Builder.CreateAnd(
+        Builder.CreateICmpUGE(Last, D),
+        Builder.CreateICmpULE(IV, Builder.CreateSub(Last, D)));
+    Type *OffsetTy = DL.getIndexType(G.Index->getPointerOperandType());
+    Value *Offset =
+        Builder.CreateSelect(InRange,
+                             ConstantInt::get(OffsetTy,
+                                              G.IndexStride * Distance),
+                             ConstantInt::get(OffsetTy, 0));
+    Value *IndexAddr = Builder.CreatePointerCast(
+        offsetPointer(Builder, G.Index->getPointerOperand(), Offset),
+        G.Index->getPointerOperandType());
+#ifdef LLVM_OLDER_THAN_11_0
+    Value *AheadIndex = Builder.CreateAlignedLoad(
+        G.Index->getType(), IndexAddr, MaybeAlign(G.Index->getAlignment()));
+#else
+    Value *AheadIndex = Builder.CreateAlignedLoad(
+        G.Index->getType(), IndexAddr, G.Index->getAlign());
+#endif
+
+    DenseMap<Value *, Value *> Map;
+    Map[G.Index] = AheadIndex;
+    for (Instruction *I : G.Chain) {
+      Instruction *Clone = I->clone();
+      // the flags held for the original index only
+      Clone->dropPoisonGeneratingFlags();
+      for (unsigned i = 0; i < Clone->getNumOperands(); ++i) {
+        auto It = Map.find(Clone->getOperand(i));
+        if (It != Map.end())
+          Clone->setOperand(i, It->second);
+      }
+      Builder.Insert(Clone);
+      Map[I] = Clone;
+    }
+    insertPrefetch(Builder, Map[G.Load->getPointerOperand()]);
+  }
+  return true;
+}
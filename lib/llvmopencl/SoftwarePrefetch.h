@@ -0,0 +1,39 @@
+// Header for SoftwarePrefetch, an LLVM pass that inserts software prefetches
+// for the strided and gathered loads of the work-item loops.
+//
+// Copyright (c) 2023 pocl developers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef _POCL_SOFTWARE_PREFETCH_H
+#define _POCL_SOFTWARE_PREFETCH_H
+
+#include <llvm/Pass.h>
+
+namespace pocl {
+
+// Latency is the memory latency in cycles the prefetches should hide
+// (0 disables the pass), MinStride the smallest stride in bytes that is
+// prefetched and LineSize the cache line size of the device.
+llvm::FunctionPass *createSoftwarePrefetchPass(unsigned Latency,
+                                               unsigned MinStride,
+                                               unsigned LineSize);
+} // namespace pocl
+
+#endif
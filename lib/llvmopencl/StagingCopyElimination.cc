@@ -0,0 +1,593 @@
+// StagingCopyElimination, an LLVM pass that replaces the reads of local
+// memory tiles copied from read-only global buffers with reads of the global
+// buffers.
+//
+// Copyright (c) 2023 pocl developers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+// Kernels tuned for GPUs often stage a tile of a global buffer in local
+// memory:
+//
+//   tile[ly][lx] = in[f (lx, ly, ...)];
+//   barrier (CLK_LOCAL_MEM_FENCE);
+//   ... tile[i][j] ...
+//
+// On the CPU devices the local memory is ordinary cached memory, so the copy
+// only doubles the memory traffic and adds a barrier. This pass finds local
+// objects whose only store copies, for each work-item, a load of a global
+// buffer that is not written by the kernel, to an offset that is a one to
+// one function of the local id. Each read of the tile that is ordered after
+// the copy by a barrier, and within the same iteration of the loops around
+// the copy, is rewritten to compute the local id of the work-item that
+// copied the element and to load the element from the global buffer with
+// the address computation of the copy. The copy is then removed, and the
+// barrier-elision pass that runs next can remove the barrier. A tile whose
+// reads cannot all be rewritten is left as is.
+
+#include "CompilerWarnings.h"
+IGNORE_COMPILER_WARNING("-Wunused-parameter")
+
+#include "config.h"
+#include "pocl.h"
+
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MathExtras.h>
+
+#include "Barrier.h"
+#include "LLVMUtils.h"
+#include "StagingCopyElimination.h"
+#include "VariableUniformityAnalysis.h"
+#include "Workgroup.h"
+#include "pocl_llvm_api.h"
+
+POP_COMPILER_DIAGS
+
+#include <algorithm>
+
+#define DEBUG_TYPE "staging-copy-elimination"
+
+STATISTIC(NumStagingCopiesRemoved,
+          "Number of local memory staging copies removed");
+
+using namespace llvm;
+using namespace pocl;
+
+namespace {
+static RegisterPass<StagingCopyElimination>
+    X("staging-copy-elimination",
+      "Reads staged global data from the global buffers directly");
+}
+
+char StagingCopyElimination::ID = 0;
+
+namespace {
+
+const char *LocalIdVariables[] = {"_local_id_x", "_local_id_y",
+                                  "_local_id_z"};
+
+// How deep the address computation of the copied load is searched for the
+// local ids.
+const unsigned MaxChainDepth = 16;
+
+struct StagedObject {
+  // the only store to the object, nullptr if there is none
+  StoreInst *Copy = nullptr;
+  SmallVector<LoadInst *, 8> Reads;
+  bool Valid = true;
+};
+
+// How the reads of a staged object are rewritten.
+struct Rewrite {
+  Value *Object;
+  StoreInst *Copy;
+  LoadInst *Source;
+  SmallVector<LoadInst *, 8> Reads;
+  // the byte offset of the element copied by local id 0
+  int64_t Const;
+  // the byte stride of the local ids, 0 for the dimensions of size 1
+  int64_t Coeffs[3];
+  // the dimensions of size > 1, from the largest stride to the smallest
+  SmallVector<unsigned, 3> Dims;
+  // the local id dependent part of the address computation of Source, in
+  // def-use order
+  SmallSetVector<Instruction *, 16> Chain;
+};
+
+class StagingAnalysis {
+public:
+  StagingAnalysis(Function &F, DominatorTree &DT, PostDominatorTree &PDT,
+                  LoopInfo &LI, ScalarEvolution &SE,
+                  VariableUniformityAnalysis &VUA,
+                  const unsigned long *LocalSizes)
+      : F(F), DT(DT), PDT(PDT), LI(LI), SE(SE), VUA(VUA),
+        DL(F.getParent()->getDataLayout()), LocalSizes(LocalSizes) {}
+
+  bool collect(MapVector<Value *, StagedObject> &Objects);
+  bool analyze(Value *Object, StagedObject &SO, Rewrite &RW);
+  void rewrite(Rewrite &RW);
+
+private:
+  bool isLocalObject(Value *Obj);
+  bool isReadOnlyObject(Value *Obj);
+  bool isRestrictedObject(Value *Obj);
+  bool isDivergentlyExecuted(BasicBlock *BB);
+  Value *underlyingObject(Value *Ptr);
+  bool decomposeOffset(const SCEV *S, int64_t Scale, int64_t *Coeffs,
+                       int64_t &Const);
+  bool collectChain(Value *V, SetVector<Instruction *> &Chain,
+                    unsigned Depth);
+  const SCEV *offsetFrom(Value *Ptr, Value *Object);
+
+  Function &F;
+  DominatorTree &DT;
+  PostDominatorTree &PDT;
+  LoopInfo &LI;
+  ScalarEvolution &SE;
+  VariableUniformityAnalysis &VUA;
+  const DataLayout &DL;
+  const unsigned long *LocalSizes;
+
+  SmallVector<Instruction *, 8> Barriers;
+  // the underlying objects of all the stores of the kernel
+  SmallVector<Value *, 16> WrittenObjects;
+};
+
+} // namespace
+
+// Returns the dimension of the local id V is loaded from, -1 if it is not a
+// local id.
+static int localIdDimension(const Value *V) {
+  const LoadInst *Load = dyn_cast<LoadInst>(V);
+  if (Load == nullptr)
+    return -1;
+  const GlobalVariable *GV =
+      dyn_cast<GlobalVariable>(Load->getPointerOperand()->stripPointerCasts());
+  if (GV == nullptr)
+    return -1;
+  for (int D = 0; D < 3; ++D)
+    if (GV->getName() == LocalIdVariables[D])
+      return D;
+  return -1;
+}
+
+#ifdef LLVM_OLDER_THAN_12_0
+static bool isIntegralCast(const SCEV *S) {
+  return isa<SCEVTruncateExpr>(S) || isa<SCEVZeroExtendExpr>(S) ||
+         isa<SCEVSignExtendExpr>(S);
+}
+#else
+static bool isIntegralCast(const SCEV *S) {
+  return isa<SCEVIntegralCastExpr>(S);
+}
+#endif
+
+// Returns the object Ptr points to, looking through the address
+// computations of the kernel.
+Value *StagingAnalysis::underlyingObject(Value *Ptr) {
+#ifdef LLVM_OLDER_THAN_12_0
+  return GetUnderlyingObject(Ptr, DL, 0);
+#else
+  return getUnderlyingObject(Ptr, 0);
+#endif
+}
+
+bool StagingAnalysis::isLocalObject(Value *Obj) {
+  if (Argument *Arg = dyn_cast<Argument>(Obj))
+    return isLocalMemFunctionArg(&F, Arg->getArgNo());
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Obj))
+    return isAutomaticLocal(&F, *GV);
+  return false;
+}
+
+// Returns true if Obj is a buffer argument that is not accessed through the
+// other arguments of the kernel.
+bool StagingAnalysis::isRestrictedObject(Value *Obj) {
+  Argument *Arg = dyn_cast<Argument>(Obj);
+  return Arg != nullptr &&
+         (Arg->hasNoAliasAttr() || isRestrictFunctionArg(&F, Arg->getArgNo()));
+}
+
+// Returns true if the kernel does not write the global object Obj.
+bool StagingAnalysis::isReadOnlyObject(Value *Obj) {
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Obj))
+    return GV->isConstant();
+  Argument *Arg = dyn_cast<Argument>(Obj);
+  if (Arg == nullptr || isLocalObject(Arg))
+    return false;
+  bool Restricted = isRestrictedObject(Arg);
+  for (Value *W : WrittenObjects) {
+    if (W == Obj)
+      return false;
+    if (isa<AllocaInst>(W) || isLocalObject(W))
+      continue;
+    if (isa<GlobalVariable>(W))
+      continue;
+    Argument *WArg = dyn_cast<Argument>(W);
+    if (WArg == nullptr)
+      return false;
+    if (!Restricted && !isRestrictedObject(WArg))
+      return false;
+  }
+  return true;
+}
+
+// Returns true if whether BB is executed depends on a branch that is not
+// uniform in the work-group, i.e. if some of the work-items may skip it.
+bool StagingAnalysis::isDivergentlyExecuted(BasicBlock *BB) {
+  for (BasicBlock &X : F) {
+    Instruction *T = X.getTerminator();
+    if (T->getNumSuccessors() < 2 || PDT.dominates(BB, &X))
+      continue;
+    Value *Cond = nullptr;
+    if (BranchInst *Br = dyn_cast<BranchInst>(T))
+      Cond = Br->getCondition();
+    else if (SwitchInst *Sw = dyn_cast<SwitchInst>(T))
+      Cond = Sw->getCondition();
+    if (Cond != nullptr && VUA.isUniform(&F, Cond))
+      continue;
+    for (BasicBlock *Succ : successors(&X))
+      if (PDT.dominates(BB, Succ))
+        return true;
+  }
+  return false;
+}
+
+// Collects the loads and stores of the local objects, the barriers and the
+// written objects. Returns false if the kernel has memory operations that
+// are not analyzed.
+bool StagingAnalysis::collect(MapVector<Value *, StagedObject> &Objects) {
+  for (Instruction &I : instructions(F)) {
+    if (isa<Barrier>(&I)) {
+      Barriers.push_back(&I);
+      continue;
+    }
+    if (!I.mayReadOrWriteMemory())
+      continue;
+    if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I)) {
+      if (II->isLifetimeStartOrEnd() || isa<DbgInfoIntrinsic>(II) ||
+          II->getIntrinsicID() == Intrinsic::assume)
+        continue;
+#ifndef LLVM_OLDER_THAN_13_0
+      if (II->getIntrinsicID() == Intrinsic::experimental_noalias_scope_decl)
+        continue;
+#endif
+    }
+
+    if (LoadInst *Load = dyn_cast<LoadInst>(&I)) {
+      Value *Obj = underlyingObject(Load->getPointerOperand());
+      if (!isLocalObject(Obj))
+        continue;
+      StagedObject &SO = Objects[Obj];
+      if (Load->isSimple())
+        SO.Reads.push_back(Load);
+      else
+        SO.Valid = false;
+    } else if (StoreInst *Store = dyn_cast<StoreInst>(&I)) {
+      Value *Obj = underlyingObject(Store->getPointerOperand());
+      WrittenObjects.push_back(Obj);
+      if (!isLocalObject(Obj))
+        continue;
+      StagedObject &SO = Objects[Obj];
+      if (SO.Copy != nullptr || !Store->isSimple())
+        SO.Valid = false;
+      SO.Copy = Store;
+    } else if (MemIntrinsic *MI = dyn_cast<MemIntrinsic>(&I)) {
+      Value *Dest = underlyingObject(MI->getDest());
+      WrittenObjects.push_back(Dest);
+      if (isLocalObject(Dest))
+        Objects[Dest].Valid = false;
+      if (MemTransferInst *MT = dyn_cast<MemTransferInst>(MI)) {
+        Value *Src = underlyingObject(MT->getSource());
+        if (isLocalObject(Src))
+          Objects[Src].Valid = false;
+      }
+    } else {
+      // Calls, atomics and fences.
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the byte offset of Ptr from Object as a SCEV, nullptr if it is not
+// known.
+const SCEV *StagingAnalysis::offsetFrom(Value *Ptr, Value *Object) {
+  if (!SE.isSCEVable(Ptr->getType()))
+    return nullptr;
+  const SCEV *S = SE.getSCEV(Ptr);
+  const SCEVUnknown *Base = dyn_cast<SCEVUnknown>(SE.getPointerBase(S));
+  if (Base == nullptr || Base->getValue()->stripPointerCasts() != Object)
+    return nullptr;
+  const SCEV *Offset = SE.getMinusSCEV(S, Base);
+  return isa<SCEVCouldNotCompute>(Offset) ? nullptr : Offset;
+}
+
+// Adds Scale * S to Coeffs and Const, if S is a sum of constant multiples of
+// the local ids. Casts are looked through, as the local ids and the tile
+// offsets are small.
+bool StagingAnalysis::decomposeOffset(const SCEV *S, int64_t Scale,
+                                      int64_t *Coeffs, int64_t &Const) {
+  if (const SCEVConstant *C = dyn_cast<SCEVConstant>(S)) {
+    int64_t Term;
+    return C->getAPInt().getMinSignedBits() <= 48 &&
+           !MulOverflow(Scale, C->getAPInt().getSExtValue(), Term) &&
+           !AddOverflow(Const, Term, Const);
+  }
+  if (isIntegralCast(S))
+    return decomposeOffset(cast<SCEVCastExpr>(S)->getOperand(), Scale, Coeffs,
+                           Const);
+  if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S)) {
+    int Dim = localIdDimension(U->getValue());
+    return Dim >= 0 && !AddOverflow(Coeffs[Dim], Scale, Coeffs[Dim]);
+  }
+  if (const SCEVAddExpr *Add = dyn_cast<SCEVAddExpr>(S)) {
+    for (const SCEV *Op : Add->operands())
+      if (!decomposeOffset(Op, Scale, Coeffs, Const))
+        return false;
+    return true;
+  }
+  if (const SCEVMulExpr *Mul = dyn_cast<SCEVMulExpr>(S)) {
+    const SCEVConstant *C = dyn_cast<SCEVConstant>(Mul->getOperand(0));
+    if (Mul->getNumOperands() != 2 || C == nullptr ||
+        C->getAPInt().getMinSignedBits() > 48 ||
+        MulOverflow(Scale, C->getAPInt().getSExtValue(), Scale))
+      return false;
+    return decomposeOffset(Mul->getOperand(1), Scale, Coeffs, Const);
+  }
+  return false;
+}
+
+// Adds the instructions of the computation of V that are not uniform in
+// the work-group to Chain, operands first. Returns false if some of them
+// cannot be recomputed for another work-item: all the values they depend
+// on must be local ids or uniform.
+bool StagingAnalysis::collectChain(Value *V, SetVector<Instruction *> &Chain,
+                                   unsigned Depth) {
+  if (localIdDimension(V) >= 0 || VUA.isUniform(&F, V))
+    return true;
+  Instruction *I = dyn_cast<Instruction>(V);
+  if (I == nullptr)
+    return false;
+  if (Chain.count(I))
+    return true;
+  if (Depth == MaxChainDepth ||
+      (!isa<BinaryOperator>(I) && !isa<CastInst>(I) &&
+       !isa<GetElementPtrInst>(I) && !isa<CmpInst>(I) && !isa<SelectInst>(I)))
+    return false;
+  for (Value *Op : I->operands())
+    if (!collectChain(Op, Chain, Depth + 1))
+      return false;
+  Chain.insert(I);
+  return true;
+}
+
+bool StagingAnalysis::analyze(Value *Object, StagedObject &SO, Rewrite &RW) {
+  StoreInst *Copy = SO.Copy;
+  if (!SO.Valid || Copy == nullptr || SO.Reads.empty())
+    return false;
+  LoadInst *Source = dyn_cast<LoadInst>(Copy->getValueOperand());
+  if (Source == nullptr || !Source->isSimple() ||
+      !isReadOnlyObject(underlyingObject(Source->getPointerOperand())))
+    return false;
+
+  Type *Ty = Source->getType();
+  uint64_t Size = DL.getTypeStoreSize(Ty).getFixedSize();
+  if (!isPowerOf2_64(Size))
+    return false;
+
+  // Each work-item must copy its own element: the offset of the copy must
+  // be a one to one function of the local id.
+  const SCEV *Offset = offsetFrom(Copy->getPointerOperand(), Object);
+  int64_t Coeffs[3] = {0, 0, 0};
+  int64_t Const = 0;
+  if (Offset == nullptr || !decomposeOffset(Offset, 1, Coeffs, Const))
+    return false;
+  SmallVector<unsigned, 3> Dims;
+  for (unsigned D = 0; D < 3; ++D) {
+    if (LocalSizes[D] == 1) {
+      Coeffs[D] = 0;
+      continue;
+    }
+    if (Coeffs[D] <= 0 || Coeffs[D] % (int64_t)Size != 0)
+      return false;
+    Dims.push_back(D);
+  }
+  std::sort(Dims.begin(), Dims.end(),
+            [&](unsigned A, unsigned B) { return Coeffs[A] < Coeffs[B]; });
+  int64_t Span = Size;
+  for (unsigned D : Dims) {
+    if (Coeffs[D] < Span)
+      return false;
+    Span = Coeffs[D] * (int64_t)(LocalSizes[D] - 1) + Span;
+  }
+  std::reverse(Dims.begin(), Dims.end());
+
+  // The copy must be done by all the work-items before a barrier that is
+  // before the reads. A guarded copy leaves the elements of the other
+  // work-items unset, and the rewritten reads of those would load from
+  // outside the copied range of the global buffer. The reads must be within the same iteration of the
+  // loops around the copy, so that the address computation of the copied
+  // load can be reused.
+  if (isDivergentlyExecuted(Copy->getParent()))
+    return false;
+  SmallVector<Instruction *, 4> After;
+  for (Instruction *B : Barriers)
+    if (DT.dominates(Copy, B) &&
+        PDT.dominates(B->getParent(), Copy->getParent()))
+      After.push_back(B);
+  Loop *CopyLoop = LI.getLoopFor(Copy->getParent());
+  for (LoadInst *Read : SO.Reads) {
+    if (Read->getType() != Ty)
+      return false;
+    if (CopyLoop != nullptr && !CopyLoop->contains(Read))
+      return false;
+    if (std::none_of(After.begin(), After.end(), [&](Instruction *B) {
+          return DT.dominates(B, Read);
+        }))
+      return false;
+    const SCEV *ReadOffset = offsetFrom(Read->getPointerOperand(), Object);
+    if (ReadOffset == nullptr)
+      return false;
+    const SCEV *Rel = SE.getMinusSCEV(
+        ReadOffset, SE.getConstant(ReadOffset->getType(), Const, true));
+    if (SE.GetMinTrailingZeros(Rel) < Log2_64(Size))
+      return false;
+  }
+
+  SetVector<Instruction *> Chain;
+  if (!collectChain(Source->getPointerOperand(), Chain, 0))
+    return false;
+
+  RW.Object = Object;
+  RW.Copy = Copy;
+  RW.Source = Source;
+  RW.Reads = SO.Reads;
+  RW.Const = Const;
+  std::copy(std::begin(Coeffs), std::end(Coeffs), std::begin(RW.Coeffs));
+  RW.Dims = Dims;
+  RW.Chain.insert(Chain.begin(), Chain.end());
+  return true;
+}
+
+void StagingAnalysis::rewrite(Rewrite &RW) {
+  for (LoadInst *Read : RW.Reads) {
+    IRBuilder<> Builder(Read);
+    Type *IntTy = DL.getIntPtrType(Read->getPointerOperand()->getType());
+
+    // The local id of the work-item that copied the element.
+    Value *Offset = Builder.CreateSub(
+        Builder.CreatePtrToInt(Read->getPointerOperand(), IntTy),
+        Builder.CreatePtrToInt(RW.Object, IntTy));
+    Offset = Builder.CreateSub(Offset, ConstantInt::get(IntTy, RW.Const));
+    Value *LocalIds[3] = {ConstantInt::get(IntTy, 0),
+                          ConstantInt::get(IntTy, 0),
+                          ConstantInt::get(IntTy, 0)};
+    for (unsigned D : RW.Dims) {
+      Constant *Stride = ConstantInt::get(IntTy, RW.Coeffs[D]);
+      LocalIds[D] = Builder.CreateURem(Builder.CreateUDiv(Offset, Stride),
+                                       ConstantInt::get(IntTy, LocalSizes[D]));
+      Offset = Builder.CreateURem(Offset, Stride);
+    }
+
+    // Recompute the address of the copied load for that work-item.
+    DenseMap<Value *, Value *> VMap;
+    SmallVector<Instruction *, 16> Clones;
+    for (Instruction *I : RW.Chain) {
+      for (Value *Op : I->operands()) {
+        int Dim = localIdDimension(Op);
+        if (Dim >= 0 && VMap.count(Op) == 0)
+          VMap[Op] = Builder.CreateZExtOrTrunc(LocalIds[Dim], Op->getType());
+      }
+      Instruction *Clone = I->clone();
+      Builder.Insert(Clone);
+      VMap[I] = Clone;
+      Clones.push_back(Clone);
+    }
+    for (Instruction *Clone : Clones)
+      for (Use &Op : Clone->operands())
+        if (VMap.count(Op.get()))
+          Op.set(VMap[Op.get()]);
+
+    Value *Ptr = RW.Source->getPointerOperand();
+    if (VMap.count(Ptr))
+      Ptr = VMap[Ptr];
+#ifdef LLVM_OLDER_THAN_11_0
+    LoadInst *Load = Builder.CreateAlignedLoad(
+        RW.Source->getType(), Ptr, MaybeAlign(RW.Source->getAlignment()));
+#else
+    LoadInst *Load = Builder.CreateAlignedLoad(RW.Source->getType(), Ptr,
+                                               RW.Source->getAlign());
+#endif
+    Load->copyMetadata(*RW.Source);
+    Load->takeName(Read);
+    Read->replaceAllUsesWith(Load);
+    Read->eraseFromParent();
+  }
+
+  RW.Copy->eraseFromParent();
+  if (RW.Source->use_empty())
+    RW.Source->eraseFromParent();
+}
+
+void StagingCopyElimination::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<PostDominatorTreeWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
+  AU.addRequired<VariableUniformityAnalysis>();
+  AU.addPreserved<VariableUniformityAnalysis>();
+  AU.setPreservesCFG();
+}
+
+bool StagingCopyElimination::runOnFunction(Function &F) {
+  if (!Workgroup::isKernelToProcess(F))
+    return false;
+
+  const Module &M = *F.getParent();
+  bool DynamicLocalSize = false;
+  getModuleBoolMetadata(M, "WGDynamicLocalSize", DynamicLocalSize);
+  unsigned long LocalSizes[3] = {0, 0, 0};
+  getModuleIntMetadata(M, "WGLocalSizeX", LocalSizes[0]);
+  getModuleIntMetadata(M, "WGLocalSizeY", LocalSizes[1]);
+  getModuleIntMetadata(M, "WGLocalSizeZ", LocalSizes[2]);
+  if (DynamicLocalSize || LocalSizes[0] == 0 || LocalSizes[1] == 0 ||
+      LocalSizes[2] == 0)
+    return false;
+
+  StagingAnalysis SA(F, getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+                     getAnalysis<PostDominatorTreeWrapperPass>().getPostDomTree(),
+                     getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                     getAnalysis<ScalarEvolutionWrapperPass>().getSE(),
+                     getAnalysis<VariableUniformityAnalysis>(), LocalSizes);
+  MapVector<Value *, StagedObject> Objects;
+  if (!SA.collect(Objects))
+    return false;
+
+  SmallVector<Rewrite, 4> Rewrites;
+  for (auto &Entry : Objects) {
+    Rewrite RW;
+    if (SA.analyze(Entry.first, Entry.second, RW))
+      Rewrites.push_back(RW);
+  }
+  for (Rewrite &RW : Rewrites)
+    SA.rewrite(RW);
+
+  NumStagingCopiesRemoved += Rewrites.size();
+  if (!Rewrites.empty())
+    POCL_MSG_PRINT_LLVM("Removed %zu local memory staging copies from "
+                        "kernel %s\n",
+                        (size_t)Rewrites.size(), F.getName().str().c_str());
+  return !Rewrites.empty();
+}
@@ -280,6 +280,29 @@ getLocalSizeValues(llvm::Function &F, llvm::ArrayRef<unsigned long> LocalSizes,
   return LocalSize;
 }
 
+// the compile time sub-group size of a kernel that uses sub-groups, if it is
+// a fixed size instead of the whole x dimension, else 0. follows the rule of
+// Workgroup::privatizeContext.
+unsigned long getFixedSubgroupSize(llvm::Function &F) {
+  llvm::Module *M = F.getParent();
+  llvm::GlobalVariable *SGSizeGV = M->getGlobalVariable("_pocl_sub_group_size");
+  if (SGSizeGV == nullptr || !isGVarUsedByFunction(SGSizeGV, &F))
+    return 0;
+
+  if (llvm::MDNode *SGSizeMD = F.getMetadata("intel_reqd_sub_group_size"))
+    return llvm::mdconst::extract<llvm::ConstantInt>(SGSizeMD->getOperand(0))
+        ->getZExtValue();
+
+  unsigned long NativeSGSize = 0, LocalSizeX = 0;
+  bool WGDynamicLocalSize = false;
+  getModuleIntMetadata(*M, "device_native_sub_group_size", NativeSGSize);
+  getModuleIntMetadata(*M, "WGLocalSizeX", LocalSizeX);
+  getModuleBoolMetadata(*M, "WGDynamicLocalSize", WGDynamicLocalSize);
+  if (WGDynamicLocalSize || NativeSGSize == 0 || LocalSizeX % NativeSGSize)
+    return 0;
+  return NativeSGSize;
+}
+
 // create the wi-loops around a kernel or subCFG, LastHeader input should be the
 // load block, ContiguousIdx may be any identifyable value (load from undef)
 void createLoopsAround(llvm::Function &F, llvm::BasicBlock *AfterBB,
@@ -336,11 +359,23 @@ void createLoopsAround(llvm::Function &F, llvm::BasicBlock *AfterBB,
                                              IndVars[D]->getParent());
   }
 
-  auto *MDWorkItemLoop = llvm::MDNode::get(
-      F.getContext(),
-      {llvm::MDString::get(F.getContext(), PoclMDKind::WorkItemLoop)});
-  auto *LoopID = llvm::makePostTransformationMetadata(F.getContext(), nullptr,
-                                                      {}, {MDWorkItemLoop});
+  auto &C = F.getContext();
+  llvm::SmallVector<llvm::MDNode *, 3> LoopMD{llvm::MDNode::get(
+      C, {llvm::MDString::get(C, PoclMDKind::WorkItemLoop)})};
+  // vectorize the x loop by the sub-group size, so that a vector iteration
+  // executes exactly one sub-group and the sub-group collectives between the
+  // sub-CFGs work on whole vectors.
+  unsigned long SGSize = getFixedSubgroupSize(F);
+  if (SGSize > 1) {
+    LoopMD.push_back(llvm::MDNode::get(
+        C, {llvm::MDString::get(C, "llvm.loop.vectorize.width"),
+            llvm::ConstantAsMetadata::get(
+                llvm::ConstantInt::get(llvm::Type::getInt32Ty(C), SGSize))}));
+    LoopMD.push_back(llvm::MDNode::get(
+        C, {llvm::MDString::get(C, "llvm.loop.vectorize.enable"),
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(C))}));
+  }
+  auto *LoopID = llvm::makePostTransformationMetadata(C, nullptr, {}, LoopMD);
   Latches[0]->getTerminator()->setMetadata("llvm.loop", LoopID);
   VMap[AfterBB] = Latches[0];
 
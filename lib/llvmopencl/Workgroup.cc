@@ -124,6 +124,8 @@ Workgroup::runOnModule(Module &M) {
   getModuleIntMetadata(M, "device_max_witem_sizes_0", DeviceMaxWItemSizes[0]);
   getModuleIntMetadata(M, "device_max_witem_sizes_1", DeviceMaxWItemSizes[1]);
   getModuleIntMetadata(M, "device_max_witem_sizes_2", DeviceMaxWItemSizes[2]);
+  DeviceNativeSGSize = 0;
+  getModuleIntMetadata(M, "device_native_sub_group_size", DeviceNativeSGSize);
 
   HiddenArgs = 0;
   SizeTWidth = address_bits;
@@ -894,12 +896,24 @@ Workgroup::privatizeContext(Function *F)
       Builder, {"_num_groups_x", "_num_groups_y", "_num_groups_z"},
       PC_NUM_GROUPS));
 
-  // Privatize the subgroup size (for CPUs), if referred.
+  // Privatize the subgroup size (for CPUs), if referred. The rule must match
+  // pocl_kernel_sub_group_size() of the runtime.
   if (M->getGlobalVariable("_pocl_sub_group_size") != nullptr) {
     Value *SGSize = getRequiredSubgroupSize(*F);
     if (SGSize == nullptr) {
-      SGSize = Builder.CreateLoad(LocalSizeAllocas[0]->getAllocatedType(),
-                                  LocalSizeAllocas[0]);
+      Value *LocalSizeX = Builder.CreateLoad(
+          LocalSizeAllocas[0]->getAllocatedType(), LocalSizeAllocas[0]);
+      SGSize = LocalSizeX;
+      if (DeviceNativeSGSize > 0) {
+        // The native size if it divides the local size x, else the whole x
+        // dimension. Folds to a constant unless the local size is dynamic.
+        Constant *Native =
+            ConstantInt::get(LocalSizeX->getType(), DeviceNativeSGSize);
+        Value *Divides = Builder.CreateICmpEQ(
+            Builder.CreateURem(LocalSizeX, Native),
+            ConstantInt::get(LocalSizeX->getType(), 0));
+        SGSize = Builder.CreateSelect(Divides, Native, LocalSizeX);
+      }
     }
     assert(SGSize != nullptr);
     privatizeGlobals(F, Builder, {"_pocl_sub_group_size"}, {SGSize});
@@ -1653,8 +1667,8 @@ Workgroup::hasWorkgroupBarriers(const Function &F)
 }
 
 // The subgroup size is currently defined for the CPU implementations
-// via the intel_reqd_subgroup_size metadata or the local dimension
-// x size (the default).
+// via the intel_reqd_subgroup_size metadata, or else the native sub-group
+// size of the device or the local dimension x size.
 llvm::Value *Workgroup::getRequiredSubgroupSize(llvm::Function &F) {
 
   if (MDNode *SGSizeMD = F.getMetadata("intel_reqd_sub_group_size")) {
@@ -134,6 +134,7 @@ namespace pocl {
     bool DeviceAllocaLocals;
     unsigned long DeviceMaxWItemDim;
     unsigned long DeviceMaxWItemSizes[3];
+    unsigned long DeviceNativeSGSize;
   };
 }
 
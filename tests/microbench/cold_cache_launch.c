@@ -0,0 +1,116 @@
+/* Latency of the first launches of kernels that are not in the kernel cache
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Builds and launches a number of programs that differ only by a define, so
+   that every build and every first launch writes its files to the kernel
+   cache, and prints the average build and first launch times. Meant for
+   comparing POCL_KERNEL_CACHE_SYNC=full, batch and none, preferably with
+   POCL_CACHE_DIR on the filesystem of interest.
+
+   Usage: cold_cache_launch [-n programs] */
+
+#include "microbench.h"
+
+#define DEFAULT_PROGRAMS 10
+#define GLOBAL_SIZE 1024
+
+static const char kernel_source[]
+    = "kernel void work (global float *out)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = (float)i * (float)RUN_ID;\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+  unsigned programs = DEFAULT_PROGRAMS;
+  size_t gws = GLOBAL_SIZE;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "n:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          programs = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-n programs]\n", argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (programs == 0)
+    programs = DEFAULT_PROGRAMS;
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_mem out = clCreateBuffer (context, CL_MEM_WRITE_ONLY,
+                               sizeof (float) * gws, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  uint64_t run_id = microbench_run_id ();
+  uint64_t build_ns = 0, first_ns = 0;
+  unsigned i;
+
+  for (i = 0; i < programs; ++i)
+    {
+      char options[64];
+      snprintf (options, sizeof (options), "-DRUN_ID=%lluu",
+                (unsigned long long)(run_id + i));
+
+      cl_program program;
+      uint64_t start = now_ns ();
+      if (microbench_build (context, device, kernel_source, options,
+                            &program) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+      build_ns += now_ns () - start;
+
+      cl_kernel kernel = clCreateKernel (program, "work", &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+      CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &out));
+
+      start = now_ns ();
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &gws,
+                                              NULL, 0, NULL, NULL));
+      CHECK_CL_ERROR (clFinish (queue));
+      first_ns += now_ns () - start;
+
+      CHECK_CL_ERROR (clReleaseKernel (kernel));
+      CHECK_CL_ERROR (clReleaseProgram (program));
+    }
+
+  printf ("programs     %10u\n", programs);
+  printf ("build        %10.3f ms\n", build_ns / 1e6 / programs);
+  printf ("first launch %10.3f ms\n", first_ns / 1e6 / programs);
+
+  CHECK_CL_ERROR (clReleaseMemObject (out));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
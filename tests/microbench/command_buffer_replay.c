@@ -0,0 +1,220 @@
+/* Replaying a recorded solver-like pipeline with clEnqueueCommandBufferKHR
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Records a number of independent chains on an in-order queue, each doing
+   iteration steps of the form
+
+     clear the accumulator in chunks (fills)
+     acc = x * 0.5 + 1 (kernel)
+     x = acc in chunks (copies)
+
+   with sync points on the previous command, as a generic recording layer
+   would, then replays the command buffer and prints the average time of a
+   replay. Meant for comparing POCL_COMMAND_BUFFER_OPTIMIZE=0 and the
+   default.
+
+   Usage: command_buffer_replay [-c chains] [-s steps] [-i replays] */
+
+#include "microbench.h"
+
+#define DEFAULT_CHAINS 4
+#define DEFAULT_STEPS 8
+#define DEFAULT_REPLAYS 100
+#define ELEMENTS 4096
+#define CHUNKS 4
+
+static const char kernel_source[]
+    = "kernel void step (global const float *x, global float *acc)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  acc[i] += x[i] * 0.5f + 1.0f;\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+#if defined(cl_khr_command_buffer) && cl_khr_command_buffer == 1
+  unsigned chains = DEFAULT_CHAINS;
+  unsigned steps = DEFAULT_STEPS;
+  unsigned replays = DEFAULT_REPLAYS;
+  size_t gws = ELEMENTS;
+  size_t chunk = ELEMENTS / CHUNKS * sizeof (cl_float);
+  cl_platform_id platform;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  cl_float zero = 0.0f;
+  unsigned c, s, k, i;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "c:s:i:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'c':
+          chains = (unsigned)atoi (optarg);
+          break;
+        case 's':
+          steps = (unsigned)atoi (optarg);
+          break;
+        case 'i':
+          replays = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-c chains] [-s steps] [-i replays]\n",
+                   argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (chains == 0)
+    chains = DEFAULT_CHAINS;
+  if (steps == 0)
+    steps = DEFAULT_STEPS;
+  if (replays == 0)
+    replays = DEFAULT_REPLAYS;
+
+  if (microbench_setup (&context, &device, &queue, &platform) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  clCreateCommandBufferKHR_fn createCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clCreateCommandBufferKHR");
+  clCommandFillBufferKHR_fn commandFillBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clCommandFillBufferKHR");
+  clCommandCopyBufferKHR_fn commandCopyBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clCommandCopyBufferKHR");
+  clCommandNDRangeKernelKHR_fn commandNDRangeKernel
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clCommandNDRangeKernelKHR");
+  clFinalizeCommandBufferKHR_fn finalizeCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (
+          platform, "clFinalizeCommandBufferKHR");
+  clEnqueueCommandBufferKHR_fn enqueueCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clEnqueueCommandBufferKHR");
+  clReleaseCommandBufferKHR_fn releaseCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clReleaseCommandBufferKHR");
+
+  cl_program program;
+  if (microbench_build (context, device, kernel_source, NULL,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_mem *x = calloc (chains, sizeof (cl_mem));
+  cl_mem *acc = calloc (chains, sizeof (cl_mem));
+  cl_kernel *kernels = calloc (chains, sizeof (cl_kernel));
+  for (c = 0; c < chains; ++c)
+    {
+      x[c] = clCreateBuffer (context, CL_MEM_READ_WRITE,
+                             ELEMENTS * sizeof (cl_float), NULL, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+      acc[c] = clCreateBuffer (context, CL_MEM_READ_WRITE,
+                               ELEMENTS * sizeof (cl_float), NULL, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+      kernels[c] = clCreateKernel (program, "step", &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+      CHECK_CL_ERROR (clSetKernelArg (kernels[c], 0, sizeof (cl_mem), &x[c]));
+      CHECK_CL_ERROR (
+          clSetKernelArg (kernels[c], 1, sizeof (cl_mem), &acc[c]));
+    }
+
+  cl_command_buffer_khr cmdbuf = createCommandBuffer (1, &queue, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandBufferKHR");
+
+  /* x = 0 at the start of a replay */
+  cl_sync_point_khr *last = calloc (chains, sizeof (cl_sync_point_khr));
+  for (c = 0; c < chains; ++c)
+    CHECK_CL_ERROR (commandFillBuffer (cmdbuf, NULL, x[c], &zero,
+                                       sizeof (zero), 0,
+                                       ELEMENTS * sizeof (cl_float), 0, NULL,
+                                       &last[c], NULL));
+  for (s = 0; s < steps; ++s)
+    for (c = 0; c < chains; ++c)
+      {
+        for (k = 0; k < CHUNKS; ++k)
+          CHECK_CL_ERROR (commandFillBuffer (cmdbuf, NULL, acc[c], &zero,
+                                             sizeof (zero), k * chunk, chunk,
+                                             1, &last[c], &last[c], NULL));
+        CHECK_CL_ERROR (commandNDRangeKernel (cmdbuf, NULL, NULL, kernels[c],
+                                              1, NULL, &gws, NULL, 1,
+                                              &last[c], &last[c], NULL));
+        for (k = 0; k < CHUNKS; ++k)
+          CHECK_CL_ERROR (commandCopyBuffer (cmdbuf, NULL, acc[c], x[c],
+                                             k * chunk, k * chunk, chunk, 1,
+                                             &last[c], &last[c], NULL));
+      }
+  CHECK_CL_ERROR (finalizeCommandBuffer (cmdbuf));
+
+  /* the first replay includes the kernel compilation */
+  CHECK_CL_ERROR (enqueueCommandBuffer (0, NULL, cmdbuf, 0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+
+  uint64_t start = now_ns ();
+  for (i = 0; i < replays; ++i)
+    CHECK_CL_ERROR (enqueueCommandBuffer (0, NULL, cmdbuf, 0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  uint64_t replay_ns = now_ns () - start;
+
+  /* x_{n+1} = x_n * 0.5 + 1 from x_0 = 0 */
+  cl_float expected = 0.0f, result;
+  for (s = 0; s < steps; ++s)
+    expected = expected * 0.5f + 1.0f;
+  for (c = 0; c < chains; ++c)
+    {
+      CHECK_CL_ERROR (clEnqueueReadBuffer (
+          queue, x[c], CL_TRUE, (ELEMENTS - 1) * sizeof (cl_float),
+          sizeof (cl_float), &result, 0, NULL, NULL));
+      if (result != expected)
+        {
+          fprintf (stderr, "wrong result %f in chain %u, expected %f\n",
+                   result, c, expected);
+          return EXIT_FAILURE;
+        }
+    }
+
+  printf ("commands       %10u\n", chains * (1 + steps * (2 * CHUNKS + 1)));
+  printf ("replay         %10.3f us\n", replay_ns / 1e3 / replays);
+
+  CHECK_CL_ERROR (releaseCommandBuffer (cmdbuf));
+  for (c = 0; c < chains; ++c)
+    {
+      CHECK_CL_ERROR (clReleaseMemObject (x[c]));
+      CHECK_CL_ERROR (clReleaseMemObject (acc[c]));
+      CHECK_CL_ERROR (clReleaseKernel (kernels[c]));
+    }
+  free (x);
+  free (acc);
+  free (kernels);
+  free (last);
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+#else
+  return 77;
+#endif
+}
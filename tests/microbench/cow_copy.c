@@ -0,0 +1,151 @@
+/* Snapshots of a large buffer with clEnqueueCopyBuffer
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* A snapshot-then-modify loop on a buffer of the given size: every
+   iteration copies the state buffer to a snapshot buffer, after which a
+   kernel updates a sparse subset of the state. The snapshot is checked to
+   have kept the state of the time of the copy.
+
+   Prints the average time of a copy and the resident memory added by the
+   loop. Meant for comparing POCL_COW_BUFFER_COPY=1 and the default.
+
+   Usage: cow_copy [-s megabytes] [-i iterations] */
+
+#include "microbench.h"
+
+#define DEFAULT_MEGABYTES 512
+#define DEFAULT_ITERATIONS 10
+/* the kernel touches one float in this many */
+#define STRIDE 65536
+
+static const char kernel_source[]
+    = "kernel void update (global float *state, uint stride)\n"
+      "{\n"
+      "  size_t i = get_global_id (0) * stride;\n"
+      "  state[i] += 1.0f;\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+  size_t megabytes = DEFAULT_MEGABYTES;
+  unsigned iterations = DEFAULT_ITERATIONS;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  cl_float zero = 0.0f;
+  unsigned i;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "s:i:")) != -1)
+    {
+      switch (opt)
+        {
+        case 's':
+          megabytes = (size_t)atol (optarg);
+          break;
+        case 'i':
+          iterations = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-s megabytes] [-i iterations]\n",
+                   argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (megabytes == 0)
+    megabytes = DEFAULT_MEGABYTES;
+  if (iterations == 0)
+    iterations = DEFAULT_ITERATIONS;
+
+  size_t size = megabytes << 20;
+  size_t gws = size / sizeof (cl_float) / STRIDE;
+  cl_uint stride = STRIDE;
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_program program;
+  if (microbench_build (context, device, kernel_source, NULL,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  cl_kernel kernel = clCreateKernel (program, "update", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  cl_mem state = clCreateBuffer (context, CL_MEM_READ_WRITE, size, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  cl_mem snapshot
+      = clCreateBuffer (context, CL_MEM_READ_WRITE, size, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clEnqueueFillBuffer (queue, state, &zero, sizeof (zero), 0,
+                                       size, 0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueFillBuffer (queue, snapshot, &zero, sizeof (zero),
+                                       0, size, 0, NULL, NULL));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &state));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_uint), &stride));
+  CHECK_CL_ERROR (clFinish (queue));
+
+  long resident_before = resident_kb ();
+  uint64_t copy_ns = 0;
+  for (i = 0; i < iterations; ++i)
+    {
+      uint64_t start = now_ns ();
+      CHECK_CL_ERROR (clEnqueueCopyBuffer (queue, state, snapshot, 0, 0, size,
+                                           0, NULL, NULL));
+      CHECK_CL_ERROR (clFinish (queue));
+      copy_ns += now_ns () - start;
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &gws,
+                                              NULL, 0, NULL, NULL));
+    }
+  CHECK_CL_ERROR (clFinish (queue));
+  long resident_added = resident_kb () - resident_before;
+
+  /* the state was updated once more after the last snapshot */
+  cl_float first[2];
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, snapshot, CL_TRUE, 0,
+                                       sizeof (cl_float), &first[0], 0, NULL,
+                                       NULL));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, state, CL_TRUE, 0,
+                                       sizeof (cl_float), &first[1], 0, NULL,
+                                       NULL));
+  if (first[0] != (cl_float)(iterations - 1)
+      || first[1] != (cl_float)iterations)
+    {
+      fprintf (stderr, "wrong result %f / %f, expected %f / %f\n", first[0],
+               first[1], (cl_float)(iterations - 1), (cl_float)iterations);
+      return EXIT_FAILURE;
+    }
+
+  printf ("buffer         %10zu MB\n", megabytes);
+  printf ("copy           %10.3f ms\n", copy_ns / 1e6 / iterations);
+  printf ("resident       %10ld kB added\n", resident_added);
+
+  CHECK_CL_ERROR (clReleaseMemObject (snapshot));
+  CHECK_CL_ERROR (clReleaseMemObject (state));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
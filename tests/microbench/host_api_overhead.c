@@ -0,0 +1,483 @@
+/* Host API overhead microbenchmarks
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Measures the time the runtime itself spends in frequently used API calls
+   (the kernels do no work), and prints percentile latencies and calls per
+   second for each. With -b, the median latencies are compared against a
+   baseline file written earlier with -w on the same machine, and the
+   program fails if any of them got slower than the tolerance allows.
+
+   Usage: host_api_overhead [-n iterations] [-c cpu] [-t tolerance_percent]
+                            [-b baseline_file] [-w baseline_file]
+
+   The calling thread is pinned to one CPU (-c, default: the first CPU
+   the process may run on) to reduce the run-to-run noise. For the pthread
+   device, also set POCL_AFFINITY=1 to pin the worker threads. */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <errno.h>
+
+#include "microbench.h"
+
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_TOLERANCE 20.0
+#define MAX_BENCHMARKS 16
+
+/* Each sample is the latency of one call (or one short call sequence) in
+   nanoseconds. */
+typedef uint64_t sample_t;
+
+struct bench_ctx
+{
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_program program;
+  cl_kernel kernel;
+  cl_mem buffer;
+};
+
+static const char empty_kernel_source[]
+    = "kernel void empty (global int *a, int b) { }\n";
+
+static int
+bench_set_kernel_arg (struct bench_ctx *b, unsigned n, sample_t *samples)
+{
+  for (unsigned i = 0; i < n; ++i)
+    {
+      cl_int v = (cl_int)i;
+      sample_t start = now_ns ();
+      cl_int err = clSetKernelArg (b->kernel, 1, sizeof (cl_int), &v);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clSetKernelArg");
+    }
+  return EXIT_SUCCESS;
+}
+
+/* Only the enqueue call is timed; the queue is drained every 64 commands
+   so its length does not grow with the iteration count. */
+static int
+bench_enqueue_empty_kernel (struct bench_ctx *b, unsigned n, sample_t *samples)
+{
+  size_t gws = 1;
+  for (unsigned i = 0; i < n; ++i)
+    {
+      sample_t start = now_ns ();
+      cl_int err = clEnqueueNDRangeKernel (b->queue, b->kernel, 1, NULL, &gws,
+                                           NULL, 0, NULL, NULL);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clEnqueueNDRangeKernel");
+      if ((i % 64) == 63)
+        CHECK_CL_ERROR (clFinish (b->queue));
+    }
+  CHECK_CL_ERROR (clFinish (b->queue));
+  return EXIT_SUCCESS;
+}
+
+static int
+bench_enqueue_finish (struct bench_ctx *b, unsigned n, sample_t *samples)
+{
+  size_t gws = 1;
+  for (unsigned i = 0; i < n; ++i)
+    {
+      sample_t start = now_ns ();
+      cl_int err = clEnqueueNDRangeKernel (b->queue, b->kernel, 1, NULL, &gws,
+                                           NULL, 0, NULL, NULL);
+      CHECK_OPENCL_ERROR_IN ("clEnqueueNDRangeKernel");
+      err = clFinish (b->queue);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clFinish");
+    }
+  return EXIT_SUCCESS;
+}
+
+static int
+bench_finish_empty_queue (struct bench_ctx *b, unsigned n, sample_t *samples)
+{
+  for (unsigned i = 0; i < n; ++i)
+    {
+      sample_t start = now_ns ();
+      cl_int err = clFinish (b->queue);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clFinish");
+    }
+  return EXIT_SUCCESS;
+}
+
+static int
+bench_event_create_release (struct bench_ctx *b, unsigned n,
+                            sample_t *samples)
+{
+  cl_int err;
+  for (unsigned i = 0; i < n; ++i)
+    {
+      sample_t start = now_ns ();
+      cl_event ev = clCreateUserEvent (b->context, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateUserEvent");
+      err = clSetUserEventStatus (ev, CL_COMPLETE);
+      CHECK_OPENCL_ERROR_IN ("clSetUserEventStatus");
+      err = clReleaseEvent (ev);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clReleaseEvent");
+    }
+  return EXIT_SUCCESS;
+}
+
+static int
+bench_marker_event (struct bench_ctx *b, unsigned n, sample_t *samples)
+{
+  for (unsigned i = 0; i < n; ++i)
+    {
+      cl_event ev = NULL;
+      sample_t start = now_ns ();
+      cl_int err = clEnqueueMarkerWithWaitList (b->queue, 0, NULL, &ev);
+      CHECK_OPENCL_ERROR_IN ("clEnqueueMarkerWithWaitList");
+      err = clWaitForEvents (1, &ev);
+      CHECK_OPENCL_ERROR_IN ("clWaitForEvents");
+      err = clReleaseEvent (ev);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clReleaseEvent");
+    }
+  return EXIT_SUCCESS;
+}
+
+static int
+bench_map_unmap_small (struct bench_ctx *b, unsigned n, sample_t *samples)
+{
+  cl_int err;
+  for (unsigned i = 0; i < n; ++i)
+    {
+      sample_t start = now_ns ();
+      void *p = clEnqueueMapBuffer (b->queue, b->buffer, CL_TRUE,
+                                    CL_MAP_READ | CL_MAP_WRITE, 0,
+                                    sizeof (cl_int) * 16, 0, NULL, NULL, &err);
+      CHECK_OPENCL_ERROR_IN ("clEnqueueMapBuffer");
+      err = clEnqueueUnmapMemObject (b->queue, b->buffer, p, 0, NULL, NULL);
+      CHECK_OPENCL_ERROR_IN ("clEnqueueUnmapMemObject");
+      err = clFinish (b->queue);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clFinish");
+    }
+  return EXIT_SUCCESS;
+}
+
+/* The program was built once at setup, so every iteration here is served
+   from the kernel cache. */
+static int
+bench_build_from_cache (struct bench_ctx *b, unsigned n, sample_t *samples)
+{
+  const char *src = empty_kernel_source;
+  cl_int err;
+  for (unsigned i = 0; i < n; ++i)
+    {
+      sample_t start = now_ns ();
+      cl_program p
+          = clCreateProgramWithSource (b->context, 1, &src, NULL, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+      err = clBuildProgram (p, 1, &b->device, NULL, NULL, NULL);
+      CHECK_OPENCL_ERROR_IN ("clBuildProgram");
+      err = clReleaseProgram (p);
+      samples[i] = now_ns () - start;
+      CHECK_OPENCL_ERROR_IN ("clReleaseProgram");
+    }
+  return EXIT_SUCCESS;
+}
+
+static const struct
+{
+  const char *name;
+  int (*run) (struct bench_ctx *b, unsigned n, sample_t *samples);
+  /* the iteration count is divided by this for the slow benchmarks */
+  unsigned divisor;
+} benchmarks[] = {
+  { "set_kernel_arg", bench_set_kernel_arg, 1 },
+  { "enqueue_empty_kernel", bench_enqueue_empty_kernel, 1 },
+  { "enqueue_finish", bench_enqueue_finish, 1 },
+  { "finish_empty_queue", bench_finish_empty_queue, 1 },
+  { "event_create_release", bench_event_create_release, 1 },
+  { "marker_event_wait", bench_marker_event, 1 },
+  { "map_unmap_small", bench_map_unmap_small, 1 },
+  { "build_from_cache", bench_build_from_cache, 100 },
+};
+
+#define NUM_BENCHMARKS (sizeof (benchmarks) / sizeof (benchmarks[0]))
+
+struct bench_result
+{
+  sample_t p50, p90, p99, max;
+  double calls_per_sec;
+};
+
+static int
+compare_samples (const void *a, const void *b)
+{
+  sample_t x = *(const sample_t *)a;
+  sample_t y = *(const sample_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void
+compute_result (sample_t *samples, unsigned n, struct bench_result *r)
+{
+  long double sum = 0;
+  for (unsigned i = 0; i < n; ++i)
+    sum += samples[i];
+  qsort (samples, n, sizeof (sample_t), compare_samples);
+  r->p50 = samples[n / 2];
+  r->p90 = samples[(n * 90) / 100];
+  r->p99 = samples[(n * 99) / 100];
+  r->max = samples[n - 1];
+  r->calls_per_sec = sum > 0 ? (double)(n * 1e9L / sum) : 0.0;
+}
+
+static void
+pin_to_cpu (int cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  if (cpu < 0)
+    {
+      if (sched_getaffinity (0, sizeof (set), &set) != 0)
+        return;
+      for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET (cpu, &set))
+          break;
+    }
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+  if (sched_setaffinity (0, sizeof (set), &set) != 0)
+    fprintf (stderr, "Could not pin to CPU %d: %s\n", cpu, strerror (errno));
+  else
+    printf ("Pinned to CPU %d\n", cpu);
+#else
+  (void)cpu;
+#endif
+}
+
+/* Baseline file format: one "<benchmark> <median ns>" pair per line,
+   lines starting with '#' are comments. A baseline without any known
+   benchmark is an error, as it would never catch a regression. */
+static int
+read_baseline (const char *path, double baseline[NUM_BENCHMARKS])
+{
+  char line[256];
+  unsigned entries = 0;
+  FILE *f = fopen (path, "r");
+  if (f == NULL)
+    {
+      fprintf (stderr, "Cannot open baseline file %s\n", path);
+      return -1;
+    }
+  for (unsigned i = 0; i < NUM_BENCHMARKS; ++i)
+    baseline[i] = -1.0;
+  while (fgets (line, sizeof (line), f))
+    {
+      char name[128];
+      double ns;
+      if (line[0] == '#' || sscanf (line, "%127s %lf", name, &ns) != 2)
+        continue;
+      for (unsigned i = 0; i < NUM_BENCHMARKS; ++i)
+        if (strcmp (name, benchmarks[i].name) == 0)
+          {
+            baseline[i] = ns;
+            ++entries;
+          }
+    }
+  fclose (f);
+  if (entries == 0)
+    {
+      fprintf (stderr, "No benchmark entries in baseline file %s\n", path);
+      return -1;
+    }
+  return 0;
+}
+
+static int
+write_baseline (const char *path, struct bench_result *results)
+{
+  FILE *f = fopen (path, "w");
+  if (f == NULL)
+    {
+      fprintf (stderr, "Cannot write baseline file %s\n", path);
+      return -1;
+    }
+  fprintf (f, "# host_api_overhead median latencies in ns\n");
+  for (unsigned i = 0; i < NUM_BENCHMARKS; ++i)
+    fprintf (f, "%s %llu\n", benchmarks[i].name,
+             (unsigned long long)results[i].p50);
+  fclose (f);
+  return 0;
+}
+
+static int
+setup (struct bench_ctx *b)
+{
+  cl_int err;
+
+  if (microbench_setup (&b->context, &b->device, &b->queue,
+                        NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  if (microbench_build (b->context, b->device, empty_kernel_source, NULL,
+                        &b->program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  b->kernel = clCreateKernel (b->program, "empty", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  b->buffer = clCreateBuffer (b->context, CL_MEM_READ_WRITE,
+                              sizeof (cl_int) * 16, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  cl_int zero = 0;
+  CHECK_CL_ERROR (clSetKernelArg (b->kernel, 0, sizeof (cl_mem), &b->buffer));
+  CHECK_CL_ERROR (clSetKernelArg (b->kernel, 1, sizeof (cl_int), &zero));
+  return EXIT_SUCCESS;
+}
+
+static int
+teardown (struct bench_ctx *b)
+{
+  CHECK_CL_ERROR (clReleaseMemObject (b->buffer));
+  CHECK_CL_ERROR (clReleaseKernel (b->kernel));
+  CHECK_CL_ERROR (clReleaseProgram (b->program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (b->queue));
+  CHECK_CL_ERROR (clReleaseContext (b->context));
+  return EXIT_SUCCESS;
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned iterations = DEFAULT_ITERATIONS;
+  double tolerance = DEFAULT_TOLERANCE;
+  const char *baseline_in = NULL;
+  const char *baseline_out = NULL;
+  int cpu = -1;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "n:c:t:b:w:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          iterations = (unsigned)atoi (optarg);
+          break;
+        case 'c':
+          cpu = atoi (optarg);
+          break;
+        case 't':
+          tolerance = atof (optarg);
+          break;
+        case 'b':
+          baseline_in = optarg;
+          break;
+        case 'w':
+          baseline_out = optarg;
+          break;
+        default:
+          fprintf (stderr,
+                   "Usage: %s [-n iterations] [-c cpu] [-t tolerance_%%] "
+                   "[-b baseline_file] [-w baseline_file]\n",
+                   argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (iterations < 100)
+    iterations = 100;
+
+  pin_to_cpu (cpu);
+
+  struct bench_ctx b;
+  memset (&b, 0, sizeof (b));
+  if (setup (&b) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  sample_t *samples = (sample_t *)malloc (sizeof (sample_t) * iterations);
+  TEST_ASSERT (samples != NULL);
+  struct bench_result results[NUM_BENCHMARKS];
+
+  printf ("%-22s %8s %10s %10s %10s %10s %12s\n", "benchmark", "calls",
+          "p50 ns", "p90 ns", "p99 ns", "max ns", "calls/s");
+  for (unsigned i = 0; i < NUM_BENCHMARKS; ++i)
+    {
+      unsigned n = iterations / benchmarks[i].divisor;
+      if (n < 10)
+        n = 10;
+      /* warm up the code paths and the allocators */
+      if (benchmarks[i].run (&b, n / 10, samples) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+      if (benchmarks[i].run (&b, n, samples) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+      compute_result (samples, n, &results[i]);
+      printf ("%-22s %8u %10llu %10llu %10llu %10llu %12.0f\n",
+              benchmarks[i].name, n, (unsigned long long)results[i].p50,
+              (unsigned long long)results[i].p90,
+              (unsigned long long)results[i].p99,
+              (unsigned long long)results[i].max, results[i].calls_per_sec);
+    }
+  free (samples);
+
+  if (teardown (&b) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  if (baseline_out && write_baseline (baseline_out, results) != 0)
+    return EXIT_FAILURE;
+
+  if (baseline_in == NULL)
+    return EXIT_SUCCESS;
+
+  double baseline[NUM_BENCHMARKS];
+  if (read_baseline (baseline_in, baseline) != 0)
+    return EXIT_FAILURE;
+
+  unsigned regressions = 0;
+  printf ("\nComparison against %s (tolerance %.1f%%):\n", baseline_in,
+          tolerance);
+  for (unsigned i = 0; i < NUM_BENCHMARKS; ++i)
+    {
+      if (baseline[i] <= 0.0)
+        {
+          printf ("%-22s no baseline\n", benchmarks[i].name);
+          continue;
+        }
+      double change = ((double)results[i].p50 - baseline[i]) * 100.0
+                      / baseline[i];
+      int regressed = change > tolerance;
+      regressions += regressed;
+      printf ("%-22s %10.0f -> %10llu ns %+7.1f%%%s\n", benchmarks[i].name,
+              baseline[i], (unsigned long long)results[i].p50, change,
+              regressed ? "  REGRESSION" : "");
+    }
+
+  if (regressions)
+    {
+      printf ("%u benchmark(s) regressed\n", regressions);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+/* Shared helpers of the microbenchmarks
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#include "microbench.h"
+
+#include "config.h"
+
+uint64_t
+now_ns ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+long
+resident_kb ()
+{
+  FILE *statm = fopen ("/proc/self/statm", "r");
+  long size = 0, resident = 0;
+
+  if (statm == NULL)
+    return 0;
+  if (fscanf (statm, "%ld %ld", &size, &resident) != 2)
+    resident = 0;
+  fclose (statm);
+  return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+uint64_t
+microbench_run_id ()
+{
+  return now_ns () ^ ((uint64_t)getpid () << 32);
+}
+
+int
+microbench_setup (cl_context *context, cl_device_id *device,
+                  cl_command_queue *queue, cl_platform_id *platform)
+{
+  CHECK_CL_ERROR (poclu_get_any_device (context, device, queue));
+  if (platform != NULL)
+    CHECK_CL_ERROR (clGetDeviceInfo (*device, CL_DEVICE_PLATFORM,
+                                     sizeof (cl_platform_id), platform,
+                                     NULL));
+  return EXIT_SUCCESS;
+}
+
+int
+microbench_build (cl_context context, cl_device_id device,
+                  const char *source, const char *options,
+                  cl_program *program)
+{
+  cl_int err;
+
+  *program = clCreateProgramWithSource (context, 1, &source, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  err = clBuildProgram (*program, 1, &device, options, NULL, NULL);
+  if (err == CL_BUILD_PROGRAM_FAILURE)
+    poclu_show_program_build_log (*program);
+  CHECK_OPENCL_ERROR_IN ("clBuildProgram");
+  return EXIT_SUCCESS;
+}
+
+int
+microbench_build_file (cl_context context, cl_device_id device,
+                       const char *filename, const char *options,
+                       cl_program *program)
+{
+  char path[4096];
+  int err;
+
+  snprintf (path, sizeof (path), "%s/%s", SRCDIR, filename);
+  char *source = poclu_read_file (path);
+  if (source == NULL)
+    {
+      fprintf (stderr, "Could not read %s\n", path);
+      return EXIT_FAILURE;
+    }
+  err = microbench_build (context, device, source, options, program);
+  free (source);
+  return err;
+}
+
+const char *
+microbench_fresh_cache_dir (char *template)
+{
+  if (getenv ("POCL_CACHE_DIR") == NULL)
+    {
+      if (mkdtemp (template) == NULL)
+        {
+          perror ("mkdtemp");
+          return NULL;
+        }
+      setenv ("POCL_CACHE_DIR", template, 1);
+    }
+  return getenv ("POCL_CACHE_DIR");
+}
+
+int
+microbench_time_kernel (cl_command_queue queue, cl_kernel kernel,
+                        cl_uint dims, const size_t *gws, unsigned repeats,
+                        double *us)
+{
+  unsigned i;
+  uint64_t start;
+
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, dims, NULL, gws,
+                                          NULL, 0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+
+  start = now_ns ();
+  for (i = 0; i < repeats; ++i)
+    CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, dims, NULL, gws,
+                                            NULL, 0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  *us = (now_ns () - start) / 1e3 / repeats;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/* Shared helpers of the microbenchmarks
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+#ifndef POCL_MICROBENCH_H
+#define POCL_MICROBENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "poclu.h"
+
+/* Returns CLOCK_MONOTONIC in nanoseconds. */
+uint64_t now_ns ();
+
+/* Returns the resident set size of the process in kB, or 0 if it is not
+   known. */
+long resident_kb ();
+
+/* Returns a value that differs between runs, for defines that keep a
+   program out of the kernel cache. */
+uint64_t microbench_run_id ();
+
+/* Sets up a context and an in-order queue for the first device. PLATFORM
+   can be NULL. */
+int microbench_setup (cl_context *context, cl_device_id *device,
+                      cl_command_queue *queue, cl_platform_id *platform);
+
+/* Creates a program of SOURCE and builds it for DEVICE with OPTIONS, which
+   can be NULL. Prints the build log on failure. */
+int microbench_build (cl_context context, cl_device_id device,
+                      const char *source, const char *options,
+                      cl_program *program);
+
+/* As microbench_build, but reads the source from FILENAME, relative to the
+   pocl source directory (e.g. "benchmarks/saxpy/kernel.cl"). */
+int microbench_build_file (cl_context context, cl_device_id device,
+                           const char *filename, const char *options,
+                           cl_program *program);
+
+/* Points POCL_CACHE_DIR to a new directory made from TEMPLATE (as for
+   mkdtemp) unless it is set already. Returns the cache directory or NULL
+   on failure. */
+const char *microbench_fresh_cache_dir (char *template);
+
+/* Launches KERNEL once to build its WG function and then REPEATS times,
+   and stores the average time of a launch in microseconds. */
+int microbench_time_kernel (cl_command_queue queue, cl_kernel kernel,
+                            cl_uint dims, const size_t *gws,
+                            unsigned repeats, double *us);
+
+#endif
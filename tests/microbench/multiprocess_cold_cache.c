@@ -0,0 +1,179 @@
+/* Latency of N processes launching the same kernel against a cold cache
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Starts a number of identical processes that build the same program and
+   launch the same kernel at the same time, all against one kernel cache that
+   does not have it yet, like the workers of a fresh deployment. Prints the
+   average and the slowest time from the start to the end of the first
+   launch. Meant for comparing POCL_KERNEL_CACHE_LEASE_TIMEOUT=0 (every
+   process compiles) with the default (one process compiles).
+
+   Unless POCL_CACHE_DIR is set, a new cache directory is created under
+   /tmp, and left there for inspection.
+
+   Usage: multiprocess_cold_cache [-n processes] */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "microbench.h"
+
+#define DEFAULT_PROCESSES 8
+#define GLOBAL_SIZE 1024
+
+/* Large enough for the compilation to dominate. */
+static const char kernel_source[]
+    = "kernel void work (global float *out)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  float acc = (float)RUN_ID;\n"
+      "  for (int j = 0; j < 64; ++j)\n"
+      "    acc = sin (acc) * cos ((float)i + j) + sqrt (acc * acc + j);\n"
+      "  out[i] = acc;\n"
+      "}\n";
+
+static int
+run_worker (uint64_t run_id, uint64_t start, uint64_t *elapsed)
+{
+  size_t gws = GLOBAL_SIZE;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_mem out = clCreateBuffer (context, CL_MEM_WRITE_ONLY,
+                               sizeof (float) * gws, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  char options[64];
+  snprintf (options, sizeof (options), "-DRUN_ID=%lluu",
+            (unsigned long long)run_id);
+
+  cl_program program;
+  if (microbench_build (context, device, kernel_source, options,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_kernel kernel = clCreateKernel (program, "work", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &out));
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &gws, NULL,
+                                          0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  *elapsed = now_ns () - start;
+
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseMemObject (out));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned processes = DEFAULT_PROCESSES;
+  unsigned i;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "n:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          processes = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-n processes]\n", argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (processes == 0)
+    processes = DEFAULT_PROCESSES;
+
+  char cache_template[] = "/tmp/pocl_mp_cacheXXXXXX";
+  const char *cache_dir = microbench_fresh_cache_dir (cache_template);
+  if (cache_dir == NULL)
+    return EXIT_FAILURE;
+  printf ("cache dir    %s\n", cache_dir);
+
+  /* the per-process results */
+  uint64_t *elapsed = mmap (NULL, sizeof (uint64_t) * processes,
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                            -1, 0);
+  if (elapsed == MAP_FAILED)
+    {
+      perror ("mmap");
+      return EXIT_FAILURE;
+    }
+
+  /* The same source and options in every process, but a new kernel for
+     every run of the benchmark. */
+  uint64_t run_id = microbench_run_id ();
+  uint64_t start = now_ns ();
+
+  for (i = 0; i < processes; ++i)
+    {
+      pid_t pid = fork ();
+      if (pid < 0)
+        {
+          perror ("fork");
+          return EXIT_FAILURE;
+        }
+      if (pid == 0)
+        _exit (run_worker (run_id, start, &elapsed[i]));
+    }
+
+  int failed = 0;
+  for (i = 0; i < processes; ++i)
+    {
+      int status;
+      if (wait (&status) < 0 || !WIFEXITED (status)
+          || WEXITSTATUS (status) != EXIT_SUCCESS)
+        failed = 1;
+    }
+  if (failed)
+    {
+      fprintf (stderr, "a worker process failed\n");
+      return EXIT_FAILURE;
+    }
+
+  uint64_t total = 0, slowest = 0;
+  for (i = 0; i < processes; ++i)
+    {
+      total += elapsed[i];
+      if (elapsed[i] > slowest)
+        slowest = elapsed[i];
+    }
+
+  printf ("processes    %10u\n", processes);
+  printf ("average      %10.3f ms\n", total / 1e6 / processes);
+  printf ("slowest      %10.3f ms\n", slowest / 1e6);
+
+  munmap (elapsed, sizeof (uint64_t) * processes);
+  return EXIT_SUCCESS;
+}
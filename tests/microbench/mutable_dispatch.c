@@ -0,0 +1,348 @@
+/* Time stepping with a mutable command buffer versus re-recording it
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* A double-buffered time-stepping loop over a number of independent
+   fields: every step runs one kernel per field that computes
+   out = in + step from the buffers of the previous step, and then swaps
+   in and out. The steps are run
+
+     update:    by updating the arguments of the kernel commands of one
+                mutable command buffer with clUpdateMutableCommandsKHR and
+                enqueueing it,
+     re-record: by recording, finalizing, enqueueing and releasing a new
+                command buffer,
+     enqueue:   by clEnqueueNDRangeKernel for every kernel,
+
+   and the average time of a step is printed for each.
+
+   Usage: mutable_dispatch [-k kernels] [-s steps] */
+
+#include "microbench.h"
+
+#define DEFAULT_KERNELS 16
+#define DEFAULT_STEPS 200
+#define ELEMENTS 1024
+
+static const char kernel_source[]
+    = "kernel void step (global const int *in, global int *out, int value)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[i] + value;\n"
+      "}\n";
+
+#if defined(cl_khr_command_buffer_mutable_dispatch)                           \
+    && cl_khr_command_buffer_mutable_dispatch == 1
+
+static clCreateCommandBufferKHR_fn createCommandBuffer;
+static clCommandNDRangeKernelKHR_fn commandNDRangeKernel;
+static clFinalizeCommandBufferKHR_fn finalizeCommandBuffer;
+static clEnqueueCommandBufferKHR_fn enqueueCommandBuffer;
+static clReleaseCommandBufferKHR_fn releaseCommandBuffer;
+static clUpdateMutableCommandsKHR_fn updateMutableCommands;
+
+static unsigned kernels = DEFAULT_KERNELS;
+static unsigned steps = DEFAULT_STEPS;
+static cl_command_queue queue;
+static cl_kernel *kernel_objs;
+/* bufs[2 * k] and bufs[2 * k + 1] are the fields of kernel K */
+static cl_mem *bufs;
+
+enum mode
+{
+  MODE_UPDATE,
+  MODE_RERECORD,
+  MODE_ENQUEUE
+};
+
+static int
+set_step_args (unsigned k, unsigned s, cl_int *value)
+{
+  *value = (cl_int)s;
+  CHECK_CL_ERROR (clSetKernelArg (kernel_objs[k], 0, sizeof (cl_mem),
+                                  &bufs[2 * k + s % 2]));
+  CHECK_CL_ERROR (clSetKernelArg (kernel_objs[k], 1, sizeof (cl_mem),
+                                  &bufs[2 * k + (s + 1) % 2]));
+  CHECK_CL_ERROR (
+      clSetKernelArg (kernel_objs[k], 2, sizeof (cl_int), value));
+  return CL_SUCCESS;
+}
+
+static int
+record (cl_command_buffer_properties_khr *props,
+        cl_mutable_command_khr *commands, cl_command_buffer_khr *cmdbuf_ret)
+{
+  size_t gws = ELEMENTS;
+  cl_int err;
+  unsigned k;
+
+  cl_command_buffer_khr cmdbuf
+      = createCommandBuffer (1, &queue, props, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandBufferKHR");
+  for (k = 0; k < kernels; ++k)
+    CHECK_CL_ERROR (commandNDRangeKernel (
+        cmdbuf, NULL, NULL, kernel_objs[k], 1, NULL, &gws, NULL, 0, NULL,
+        NULL, commands ? &commands[k] : NULL));
+  CHECK_CL_ERROR (finalizeCommandBuffer (cmdbuf));
+  *cmdbuf_ret = cmdbuf;
+  return CL_SUCCESS;
+}
+
+/* Runs the steps and stores the average time of a step in ns. */
+static int
+run_steps (enum mode mode, double *step_ns)
+{
+  cl_command_buffer_properties_khr props[]
+      = { CL_COMMAND_BUFFER_FLAGS_KHR, CL_COMMAND_BUFFER_MUTABLE_KHR, 0 };
+  cl_mutable_command_khr *commands
+      = calloc (kernels, sizeof (cl_mutable_command_khr));
+  cl_mutable_dispatch_config_khr *dispatch
+      = calloc (kernels, sizeof (cl_mutable_dispatch_config_khr));
+  cl_mutable_dispatch_arg_khr *args
+      = calloc (kernels * 3, sizeof (cl_mutable_dispatch_arg_khr));
+  cl_int *values = calloc (kernels, sizeof (cl_int));
+  cl_command_buffer_khr cmdbuf = NULL;
+  size_t gws = ELEMENTS;
+  unsigned k, s;
+
+  for (k = 0; k < kernels; ++k)
+    CHECK_CL_ERROR (set_step_args (k, 0, &values[k]));
+  if (mode == MODE_UPDATE)
+    CHECK_CL_ERROR (record (props, commands, &cmdbuf));
+
+  uint64_t start = now_ns ();
+  for (s = 0; s < steps; ++s)
+    {
+      switch (mode)
+        {
+        case MODE_UPDATE:
+          {
+            cl_mutable_base_config_khr config;
+            for (k = 0; k < kernels; ++k)
+              {
+                cl_mutable_dispatch_arg_khr *a = &args[3 * k];
+                values[k] = (cl_int)s;
+                a[0].arg_index = 0;
+                a[0].arg_size = sizeof (cl_mem);
+                a[0].arg_value = &bufs[2 * k + s % 2];
+                a[1].arg_index = 1;
+                a[1].arg_size = sizeof (cl_mem);
+                a[1].arg_value = &bufs[2 * k + (s + 1) % 2];
+                a[2].arg_index = 2;
+                a[2].arg_size = sizeof (cl_int);
+                a[2].arg_value = &values[k];
+                memset (&dispatch[k], 0, sizeof (dispatch[k]));
+                dispatch[k].type
+                    = CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR;
+                dispatch[k].command = commands[k];
+                dispatch[k].num_args = 3;
+                dispatch[k].arg_list = a;
+              }
+            memset (&config, 0, sizeof (config));
+            config.type = CL_STRUCTURE_TYPE_MUTABLE_BASE_CONFIG_KHR;
+            config.num_mutable_dispatch = kernels;
+            config.mutable_dispatch_list = dispatch;
+            CHECK_CL_ERROR (updateMutableCommands (cmdbuf, &config));
+            CHECK_CL_ERROR (
+                enqueueCommandBuffer (0, NULL, cmdbuf, 0, NULL, NULL));
+            break;
+          }
+        case MODE_RERECORD:
+          for (k = 0; k < kernels; ++k)
+            CHECK_CL_ERROR (set_step_args (k, s, &values[k]));
+          CHECK_CL_ERROR (record (NULL, NULL, &cmdbuf));
+          CHECK_CL_ERROR (
+              enqueueCommandBuffer (0, NULL, cmdbuf, 0, NULL, NULL));
+          CHECK_CL_ERROR (releaseCommandBuffer (cmdbuf));
+          cmdbuf = NULL;
+          break;
+        case MODE_ENQUEUE:
+          for (k = 0; k < kernels; ++k)
+            {
+              CHECK_CL_ERROR (set_step_args (k, s, &values[k]));
+              CHECK_CL_ERROR (clEnqueueNDRangeKernel (
+                  queue, kernel_objs[k], 1, NULL, &gws, NULL, 0, NULL, NULL));
+            }
+          break;
+        }
+    }
+  CHECK_CL_ERROR (clFinish (queue));
+  uint64_t elapsed = now_ns () - start;
+
+  if (cmdbuf != NULL)
+    CHECK_CL_ERROR (releaseCommandBuffer (cmdbuf));
+  free (commands);
+  free (dispatch);
+  free (args);
+  free (values);
+  *step_ns = (double)elapsed / steps;
+  return CL_SUCCESS;
+}
+
+/* Every element of the fields is the sum of the step numbers. */
+static int
+check_and_reset (const char *name)
+{
+  cl_int *result = malloc (ELEMENTS * sizeof (cl_int));
+  cl_int expected = 0, zero = 0;
+  unsigned k, s, i;
+  int errors = 0;
+
+  for (s = 0; s < steps; ++s)
+    expected += (cl_int)s;
+  for (k = 0; k < kernels; ++k)
+    {
+      CHECK_CL_ERROR (clEnqueueReadBuffer (
+          queue, bufs[2 * k + steps % 2], CL_TRUE, 0,
+          ELEMENTS * sizeof (cl_int), result, 0, NULL, NULL));
+      for (i = 0; i < ELEMENTS; ++i)
+        if (result[i] != expected && errors++ == 0)
+          fprintf (stderr, "%s: wrong result %d in field %u, expected %d\n",
+                   name, result[i], k, expected);
+    }
+  for (k = 0; k < 2 * kernels; ++k)
+    CHECK_CL_ERROR (clEnqueueFillBuffer (queue, bufs[k], &zero,
+                                         sizeof (zero), 0,
+                                         ELEMENTS * sizeof (cl_int), 0, NULL,
+                                         NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  free (result);
+  return errors;
+}
+
+#endif
+
+int
+main (int argc, char **argv)
+{
+#if defined(cl_khr_command_buffer_mutable_dispatch)                           \
+    && cl_khr_command_buffer_mutable_dispatch == 1
+  cl_platform_id platform;
+  cl_context context;
+  cl_device_id device;
+  cl_int err;
+  cl_int zero = 0;
+  unsigned k;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "k:s:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'k':
+          kernels = (unsigned)atoi (optarg);
+          break;
+        case 's':
+          steps = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-k kernels] [-s steps]\n", argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (kernels == 0)
+    kernels = DEFAULT_KERNELS;
+  if (steps == 0)
+    steps = DEFAULT_STEPS;
+
+  if (microbench_setup (&context, &device, &queue, &platform) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  char extensions[4096];
+  CHECK_CL_ERROR (clGetDeviceInfo (device, CL_DEVICE_EXTENSIONS,
+                                   sizeof (extensions), extensions, NULL));
+  if (strstr (extensions, "cl_khr_command_buffer_mutable_dispatch") == NULL)
+    {
+      fprintf (stderr,
+               "cl_khr_command_buffer_mutable_dispatch is not supported\n");
+      return 77;
+    }
+
+  createCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clCreateCommandBufferKHR");
+  commandNDRangeKernel = clGetExtensionFunctionAddressForPlatform (
+      platform, "clCommandNDRangeKernelKHR");
+  finalizeCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clFinalizeCommandBufferKHR");
+  enqueueCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clEnqueueCommandBufferKHR");
+  releaseCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clReleaseCommandBufferKHR");
+  updateMutableCommands = clGetExtensionFunctionAddressForPlatform (
+      platform, "clUpdateMutableCommandsKHR");
+
+  cl_program program;
+  if (microbench_build (context, device, kernel_source, NULL,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  kernel_objs = calloc (kernels, sizeof (cl_kernel));
+  bufs = calloc (2 * kernels, sizeof (cl_mem));
+  for (k = 0; k < kernels; ++k)
+    {
+      kernel_objs[k] = clCreateKernel (program, "step", &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+    }
+  for (k = 0; k < 2 * kernels; ++k)
+    {
+      bufs[k] = clCreateBuffer (context, CL_MEM_READ_WRITE,
+                                ELEMENTS * sizeof (cl_int), NULL, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+      CHECK_CL_ERROR (clEnqueueFillBuffer (queue, bufs[k], &zero,
+                                           sizeof (zero), 0,
+                                           ELEMENTS * sizeof (cl_int), 0,
+                                           NULL, NULL));
+    }
+
+  /* the first run includes the kernel compilation */
+  double update_ns, rerecord_ns, enqueue_ns;
+  CHECK_CL_ERROR (run_steps (MODE_ENQUEUE, &enqueue_ns));
+  int errors = check_and_reset ("warm-up");
+
+  CHECK_CL_ERROR (run_steps (MODE_UPDATE, &update_ns));
+  errors += check_and_reset ("update");
+  CHECK_CL_ERROR (run_steps (MODE_RERECORD, &rerecord_ns));
+  errors += check_and_reset ("re-record");
+  CHECK_CL_ERROR (run_steps (MODE_ENQUEUE, &enqueue_ns));
+  errors += check_and_reset ("enqueue");
+  if (errors)
+    return EXIT_FAILURE;
+
+  printf ("kernels        %10u\n", kernels);
+  printf ("update         %10.3f us/step\n", update_ns / 1e3);
+  printf ("re-record      %10.3f us/step\n", rerecord_ns / 1e3);
+  printf ("enqueue        %10.3f us/step\n", enqueue_ns / 1e3);
+
+  for (k = 0; k < kernels; ++k)
+    CHECK_CL_ERROR (clReleaseKernel (kernel_objs[k]));
+  for (k = 0; k < 2 * kernels; ++k)
+    CHECK_CL_ERROR (clReleaseMemObject (bufs[k]));
+  free (kernel_objs);
+  free (bufs);
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+#else
+  return 77;
+#endif
+}
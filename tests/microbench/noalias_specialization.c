@@ -0,0 +1,167 @@
+/* Kernel time with and without the no-alias buffer argument specialization
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Runs the kernels of benchmarks/saxpy, benchmarks/vecadd and
+   benchmarks/sgemm with distinct buffers, which get the WG function
+   specialized with noalias and alignment facts on the CPU drivers, and with
+   the same buffer bound to two of the arguments, which makes the launch fall
+   back to the generic version. POCL_NOALIAS_SPECIALIZATION=0 turns the
+   specialization off for both.
+
+   Usage: noalias_specialization [-n size] [-r repeats] */
+
+#include "microbench.h"
+
+#define DEFAULT_SIZE (1 << 20)
+#define DEFAULT_SGEMM_N 256
+#define DEFAULT_REPEATS 20
+
+static void
+report (const char *name, double distinct_us, double aliased_us)
+{
+  printf ("%-8s %14.1f %14.1f %9.2fx\n", name, distinct_us, aliased_us,
+          aliased_us / distinct_us);
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t size = DEFAULT_SIZE;
+  unsigned repeats = DEFAULT_REPEATS;
+  cl_int sgemm_n = DEFAULT_SGEMM_N;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "n:r:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          size = (size_t)atol (optarg);
+          break;
+        case 'r':
+          repeats = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-n size] [-r repeats]\n", argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (repeats == 0)
+    repeats = DEFAULT_REPEATS;
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_program saxpy_program, vecadd_program, sgemm_program;
+  if (microbench_build_file (context, device, "benchmarks/saxpy/kernel.cl",
+                             NULL, &saxpy_program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  if (microbench_build_file (context, device, "benchmarks/vecadd/kernel.cl",
+                             NULL, &vecadd_program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  if (microbench_build_file (context, device, "benchmarks/sgemm/kernel.cl",
+                             NULL, &sgemm_program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_kernel saxpy = clCreateKernel (saxpy_program, "saxpy", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  cl_kernel vecadd = clCreateKernel (vecadd_program, "vecadd", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  cl_kernel sgemm = clCreateKernel (sgemm_program, "sgemm", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  size_t sgemm_elems = (size_t)sgemm_n * sgemm_n;
+  size_t bytes = sizeof (float) * (size > sgemm_elems ? size : sgemm_elems);
+  cl_mem bufs[3];
+  unsigned i;
+  float zero = 0.0f, factor = 2.0f;
+  for (i = 0; i < 3; ++i)
+    {
+      bufs[i] = clCreateBuffer (context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+      CHECK_CL_ERROR (clEnqueueFillBuffer (queue, bufs[i], &zero,
+                                           sizeof (zero), 0, bytes, 0, NULL,
+                                           NULL));
+    }
+  CHECK_CL_ERROR (clFinish (queue));
+
+  printf ("%-8s %14s %14s %10s\n", "kernel", "distinct (us)", "aliased (us)",
+          "ratio");
+
+  size_t gws1[1] = { size };
+  double distinct, aliased;
+
+  CHECK_CL_ERROR (clSetKernelArg (saxpy, 0, sizeof (cl_mem), &bufs[0]));
+  CHECK_CL_ERROR (clSetKernelArg (saxpy, 1, sizeof (cl_mem), &bufs[1]));
+  CHECK_CL_ERROR (clSetKernelArg (saxpy, 2, sizeof (float), &factor));
+  if (microbench_time_kernel (queue, saxpy, 1, gws1, repeats,
+                              &distinct) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  CHECK_CL_ERROR (clSetKernelArg (saxpy, 1, sizeof (cl_mem), &bufs[0]));
+  if (microbench_time_kernel (queue, saxpy, 1, gws1, repeats,
+                              &aliased) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  report ("saxpy", distinct, aliased);
+
+  CHECK_CL_ERROR (clSetKernelArg (vecadd, 0, sizeof (cl_mem), &bufs[0]));
+  CHECK_CL_ERROR (clSetKernelArg (vecadd, 1, sizeof (cl_mem), &bufs[1]));
+  CHECK_CL_ERROR (clSetKernelArg (vecadd, 2, sizeof (cl_mem), &bufs[2]));
+  if (microbench_time_kernel (queue, vecadd, 1, gws1, repeats,
+                              &distinct) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  CHECK_CL_ERROR (clSetKernelArg (vecadd, 1, sizeof (cl_mem), &bufs[0]));
+  if (microbench_time_kernel (queue, vecadd, 1, gws1, repeats,
+                              &aliased) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  report ("vecadd", distinct, aliased);
+
+  size_t gws2[2] = { (size_t)sgemm_n, (size_t)sgemm_n };
+  CHECK_CL_ERROR (clSetKernelArg (sgemm, 0, sizeof (cl_mem), &bufs[0]));
+  CHECK_CL_ERROR (clSetKernelArg (sgemm, 1, sizeof (cl_mem), &bufs[1]));
+  CHECK_CL_ERROR (clSetKernelArg (sgemm, 2, sizeof (cl_mem), &bufs[2]));
+  CHECK_CL_ERROR (clSetKernelArg (sgemm, 3, sizeof (cl_int), &sgemm_n));
+  if (microbench_time_kernel (queue, sgemm, 2, gws2, repeats,
+                              &distinct) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  CHECK_CL_ERROR (clSetKernelArg (sgemm, 1, sizeof (cl_mem), &bufs[0]));
+  if (microbench_time_kernel (queue, sgemm, 2, gws2, repeats,
+                              &aliased) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  report ("sgemm", distinct, aliased);
+
+  for (i = 0; i < 3; ++i)
+    CHECK_CL_ERROR (clReleaseMemObject (bufs[i]));
+  CHECK_CL_ERROR (clReleaseKernel (saxpy));
+  CHECK_CL_ERROR (clReleaseKernel (vecadd));
+  CHECK_CL_ERROR (clReleaseKernel (sgemm));
+  CHECK_CL_ERROR (clReleaseProgram (saxpy_program));
+  CHECK_CL_ERROR (clReleaseProgram (vecadd_program));
+  CHECK_CL_ERROR (clReleaseProgram (sgemm_program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/* First launches of the kernels of a program with many kernels
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Builds a program with a number of kernels and launches each of them once,
+   then prints the average first launch latency, the number of kernel objects
+   mapped from the kernel cache and the resident memory of the process.
+   Meant for comparing POCL_CPU_PROGRAM_BUNDLE=0 and 1.
+
+   Unless POCL_CACHE_DIR is set, a new cache directory is created under
+   /tmp, so that the kernels are not in the cache yet, and left there for
+   inspection.
+
+   Usage: program_bundle [-k kernels] */
+
+#include "microbench.h"
+
+#define DEFAULT_KERNELS 32
+#define GLOBAL_SIZE 1024
+
+static const char kernel_template[]
+    = "kernel void work%u (global float *out)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = sin ((float)i) * %u.0f + out[i];\n"
+      "}\n";
+
+/* Counts the distinct files under DIR mapped to this process. */
+static unsigned
+count_mapped_files (const char *dir)
+{
+  FILE *maps = fopen ("/proc/self/maps", "r");
+  char line[4096], last[4096] = "";
+  unsigned count = 0;
+
+  if (maps == NULL)
+    return 0;
+  while (fgets (line, sizeof (line), maps))
+    {
+      char *path = strchr (line, '/');
+      if (path == NULL || strncmp (path, dir, strlen (dir)) != 0)
+        continue;
+      if (strcmp (path, last) != 0)
+        ++count;
+      strcpy (last, path);
+    }
+  fclose (maps);
+  return count;
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned kernels = DEFAULT_KERNELS;
+  size_t gws = GLOBAL_SIZE;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  unsigned i;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "k:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'k':
+          kernels = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-k kernels]\n", argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (kernels == 0)
+    kernels = DEFAULT_KERNELS;
+
+  char cache_template[] = "/tmp/pocl_bundle_cacheXXXXXX";
+  const char *cache_dir = microbench_fresh_cache_dir (cache_template);
+  if (cache_dir == NULL)
+    return EXIT_FAILURE;
+
+  size_t source_size = kernels * (sizeof (kernel_template) + 32);
+  char *source = malloc (source_size);
+  size_t len = 0;
+  for (i = 0; i < kernels; ++i)
+    len += snprintf (source + len, source_size - len, kernel_template, i, i);
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_mem out = clCreateBuffer (context, CL_MEM_READ_WRITE,
+                               sizeof (float) * gws, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  cl_program program;
+  if (microbench_build (context, device, source, NULL,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  long resident_before = resident_kb ();
+  uint64_t first_ns = 0;
+  cl_kernel *k = calloc (kernels, sizeof (cl_kernel));
+
+  for (i = 0; i < kernels; ++i)
+    {
+      char name[32];
+      snprintf (name, sizeof (name), "work%u", i);
+      k[i] = clCreateKernel (program, name, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+      CHECK_CL_ERROR (clSetKernelArg (k[i], 0, sizeof (cl_mem), &out));
+
+      uint64_t start = now_ns ();
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, k[i], 1, NULL, &gws,
+                                              NULL, 0, NULL, NULL));
+      CHECK_CL_ERROR (clFinish (queue));
+      first_ns += now_ns () - start;
+    }
+
+  printf ("kernels        %10u\n", kernels);
+  printf ("first launch   %10.3f ms\n", first_ns / 1e6 / kernels);
+  printf ("mapped objects %10u\n", count_mapped_files (cache_dir));
+  printf ("resident       %10ld kB (+%ld kB)\n", resident_kb (),
+          resident_kb () - resident_before);
+
+  for (i = 0; i < kernels; ++i)
+    CHECK_CL_ERROR (clReleaseKernel (k[i]));
+  free (k);
+  free (source);
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseMemObject (out));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+/* Kernel time of strided and gathered loads, for the software prefetching
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Runs memory-bound kernels whose loads advance by 1, 16 and 64 floats per
+   work-item, and a gather through a random permutation, and prints the
+   average kernel time and the bandwidth of the loaded cache lines. Meant
+   for comparing POCL_PREFETCH_LATENCY=0 against the default: the large
+   strides and the gather should get faster with the prefetches, and the
+   contiguous kernel should stay the same.
+
+   Usage: software_prefetch [-n work-items] [-r repeats] */
+
+#include "microbench.h"
+
+#define DEFAULT_SIZE (1 << 18)
+#define DEFAULT_REPEATS 20
+#define MAX_STRIDE 64
+#define CACHE_LINE 64
+
+static const char kernel_source[]
+    = "kernel void strided_1 (global const float *in, global float *out)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[i] * 2.0f;\n"
+      "}\n"
+      "kernel void strided_16 (global const float *in, global float *out)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[i * 16] * 2.0f;\n"
+      "}\n"
+      "kernel void strided_64 (global const float *in, global float *out)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[i * 64] * 2.0f;\n"
+      "}\n"
+      "kernel void gather (global const float *in, global float *out,\n"
+      "                    global const uint *idx)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[idx[i]] * 2.0f;\n"
+      "}\n";
+
+/* LINES is the number of cache lines the kernel loads. */
+static void
+report (const char *name, double us, double lines)
+{
+  printf ("%-12s %12.1f %12.2f\n", name, us, lines * CACHE_LINE / us / 1e3);
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t size = DEFAULT_SIZE;
+  unsigned repeats = DEFAULT_REPEATS;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "n:r:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          size = (size_t)atol (optarg);
+          break;
+        case 'r':
+          repeats = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-n work-items] [-r repeats]\n",
+                   argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (repeats == 0)
+    repeats = DEFAULT_REPEATS;
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_program program;
+  if (microbench_build (context, device, kernel_source, NULL,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  const char *names[] = { "strided_1", "strided_16", "strided_64", "gather" };
+  const unsigned strides[] = { 1, 16, 64 };
+  cl_kernel kernels[4];
+  unsigned i;
+  for (i = 0; i < 4; ++i)
+    {
+      kernels[i] = clCreateKernel (program, names[i], &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+    }
+
+  /* A random permutation of the input for the gather, spread over the
+     whole input buffer. */
+  size_t in_elems = size * MAX_STRIDE;
+  cl_uint *idx = (cl_uint *)malloc (sizeof (cl_uint) * size);
+  TEST_ASSERT (idx != NULL);
+  srand (1234);
+  for (i = 0; i < size; ++i)
+    idx[i] = (cl_uint)i * MAX_STRIDE;
+  for (i = size - 1; i > 0; --i)
+    {
+      unsigned j
+          = (unsigned)((((uint64_t)rand () << 16) ^ rand ()) % (i + 1));
+      cl_uint tmp = idx[i];
+      idx[i] = idx[j];
+      idx[j] = tmp;
+    }
+
+  float zero = 0.0f;
+  cl_mem in = clCreateBuffer (context, CL_MEM_READ_ONLY,
+                              sizeof (float) * in_elems, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clEnqueueFillBuffer (queue, in, &zero, sizeof (zero), 0,
+                                       sizeof (float) * in_elems, 0, NULL,
+                                       NULL));
+  cl_mem out = clCreateBuffer (context, CL_MEM_WRITE_ONLY,
+                               sizeof (float) * size, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  cl_mem idx_buf
+      = clCreateBuffer (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        sizeof (cl_uint) * size, idx, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clFinish (queue));
+  free (idx);
+
+  printf ("%-12s %12s %12s\n", "kernel", "time (us)", "lines (GB/s)");
+
+  for (i = 0; i < 4; ++i)
+    {
+      CHECK_CL_ERROR (clSetKernelArg (kernels[i], 0, sizeof (cl_mem), &in));
+      CHECK_CL_ERROR (clSetKernelArg (kernels[i], 1, sizeof (cl_mem), &out));
+      if (i == 3)
+        CHECK_CL_ERROR (
+            clSetKernelArg (kernels[i], 2, sizeof (cl_mem), &idx_buf));
+
+      double us;
+      if (microbench_time_kernel (queue, kernels[i], 1, &size, repeats,
+                                  &us) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+      /* every gathered or strided load touches a line of its own */
+      double lines
+          = (i < 3 && strides[i] * sizeof (float) < CACHE_LINE)
+                ? (double)size * strides[i] * sizeof (float) / CACHE_LINE
+                : (double)size;
+      report (names[i], us, lines);
+    }
+
+  for (i = 0; i < 4; ++i)
+    CHECK_CL_ERROR (clReleaseKernel (kernels[i]));
+  CHECK_CL_ERROR (clReleaseMemObject (in));
+  CHECK_CL_ERROR (clReleaseMemObject (out));
+  CHECK_CL_ERROR (clReleaseMemObject (idx_buf));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/* First launch latency and steady-state throughput of a kernel
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Measures the latency of the first launch of a freshly built kernel, which
+   includes building its work-group function, and then the launches per
+   second over time until the end of the run. Meant for comparing
+   POCL_TIERED_COMPILATION=0 and =1: with the tiered compilation, the first
+   launch should get faster and the throughput should reach the same steady
+   state once the optimized version has been swapped in.
+
+   Usage: tiered_compilation [-s seconds] [-i interval_ms] [-g global_size]
+
+   The kernel source gets a unique define for every run, so the work-group
+   function is never found in the kernel cache. */
+
+#include "microbench.h"
+
+#define DEFAULT_SECONDS 5
+#define DEFAULT_INTERVAL_MS 250
+#define DEFAULT_GLOBAL_SIZE 4096
+#define TABLE_SIZE 1024
+
+static const char kernel_source[]
+    = "kernel void work (global float *out, global const float *in)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  float acc = (float)RUN_ID;\n"
+      "  for (int k = 0; k < 256; ++k)\n"
+      "    acc = acc * 0.999f + in[(i + k) & 1023] * (float)k;\n"
+      "  out[i] = acc;\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+  unsigned seconds = DEFAULT_SECONDS;
+  unsigned interval_ms = DEFAULT_INTERVAL_MS;
+  size_t gws = DEFAULT_GLOBAL_SIZE;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "s:i:g:")) != -1)
+    {
+      switch (opt)
+        {
+        case 's':
+          seconds = (unsigned)atoi (optarg);
+          break;
+        case 'i':
+          interval_ms = (unsigned)atoi (optarg);
+          break;
+        case 'g':
+          gws = (size_t)atol (optarg);
+          break;
+        default:
+          fprintf (stderr,
+                   "Usage: %s [-s seconds] [-i interval_ms] "
+                   "[-g global_size]\n",
+                   argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (interval_ms == 0)
+    interval_ms = DEFAULT_INTERVAL_MS;
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  char options[64];
+  snprintf (options, sizeof (options), "-DRUN_ID=%lluu",
+            (unsigned long long)microbench_run_id ());
+
+  uint64_t start = now_ns ();
+  cl_program program;
+  if (microbench_build (context, device, kernel_source, options,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  uint64_t build_ns = now_ns () - start;
+
+  cl_kernel kernel = clCreateKernel (program, "work", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  float *table = (float *)malloc (sizeof (float) * TABLE_SIZE);
+  TEST_ASSERT (table != NULL);
+  for (unsigned i = 0; i < TABLE_SIZE; ++i)
+    table[i] = (float)(i % 17) * 0.25f;
+
+  cl_mem in = clCreateBuffer (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                              sizeof (float) * TABLE_SIZE, table, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  cl_mem out = clCreateBuffer (context, CL_MEM_WRITE_ONLY,
+                               sizeof (float) * gws, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  free (table);
+
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &out));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &in));
+
+  start = now_ns ();
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &gws, NULL,
+                                          0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  uint64_t first_ns = now_ns () - start;
+
+  printf ("build %10.3f ms\n", build_ns / 1e6);
+  printf ("first launch %10.3f ms\n", first_ns / 1e6);
+  printf ("%10s %12s %14s\n", "time (ms)", "launches/s", "ns/launch");
+
+  /* Launch back to back and report the throughput of each interval. */
+  uint64_t run_start = now_ns ();
+  uint64_t run_end = run_start + (uint64_t)seconds * 1000000000ULL;
+  uint64_t interval_start = run_start;
+  double first_rate = 0.0, last_rate = 0.0;
+  unsigned launches = 0;
+  uint64_t t;
+
+  do
+    {
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &gws,
+                                              NULL, 0, NULL, NULL));
+      CHECK_CL_ERROR (clFinish (queue));
+      ++launches;
+      t = now_ns ();
+      if (t - interval_start >= (uint64_t)interval_ms * 1000000ULL)
+        {
+          double rate = launches * 1e9 / (double)(t - interval_start);
+          if (first_rate == 0.0)
+            first_rate = rate;
+          last_rate = rate;
+          printf ("%10.0f %12.1f %14.0f\n", (t - run_start) / 1e6, rate,
+                  1e9 / rate);
+          launches = 0;
+          interval_start = t;
+        }
+    }
+  while (t < run_end);
+
+  printf ("first interval %12.1f launches/s\n", first_rate);
+  printf ("steady state   %12.1f launches/s\n", last_rate);
+
+  CHECK_CL_ERROR (clReleaseMemObject (in));
+  CHECK_CL_ERROR (clReleaseMemObject (out));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/* Clearing large buffers with clEnqueueFillBuffer
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Two allocate-then-clear patterns on a buffer of the given size:
+
+   - a new buffer cleared with a zero fill, as done before its first use;
+   - an accumulator that is cleared on every iteration, after which a
+     kernel adds to a sparse subset of it.
+
+   Prints the time of the first clear, the resident memory it added, and the
+   average time of an iteration. Meant for comparing POCL_LAZY_ZERO_FILL=0
+   and the default.
+
+   Usage: zero_fill [-s megabytes] [-i iterations] */
+
+#include "microbench.h"
+
+#define DEFAULT_MEGABYTES 1024
+#define DEFAULT_ITERATIONS 10
+/* the kernel touches one float in this many */
+#define STRIDE 4096
+
+static const char kernel_source[]
+    = "kernel void accumulate (global float *acc, uint stride)\n"
+      "{\n"
+      "  size_t i = get_global_id (0) * stride;\n"
+      "  acc[i] += (float)get_global_id (0);\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+  size_t megabytes = DEFAULT_MEGABYTES;
+  unsigned iterations = DEFAULT_ITERATIONS;
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  cl_float zero = 0.0f;
+  unsigned i;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "s:i:")) != -1)
+    {
+      switch (opt)
+        {
+        case 's':
+          megabytes = (size_t)atol (optarg);
+          break;
+        case 'i':
+          iterations = (unsigned)atoi (optarg);
+          break;
+        default:
+          fprintf (stderr, "Usage: %s [-s megabytes] [-i iterations]\n",
+                   argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+  if (megabytes == 0)
+    megabytes = DEFAULT_MEGABYTES;
+  if (iterations == 0)
+    iterations = DEFAULT_ITERATIONS;
+
+  size_t size = megabytes << 20;
+  size_t gws = size / sizeof (cl_float) / STRIDE;
+  cl_uint stride = STRIDE;
+
+  if (microbench_setup (&context, &device, &queue, NULL) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_program program;
+  if (microbench_build (context, device, kernel_source, NULL,
+                        &program) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  cl_kernel kernel = clCreateKernel (program, "accumulate", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  /* a new buffer, cleared before its first use */
+  long resident_before = resident_kb ();
+  uint64_t start = now_ns ();
+  cl_mem acc = clCreateBuffer (context, CL_MEM_READ_WRITE, size, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clEnqueueFillBuffer (queue, acc, &zero, sizeof (zero), 0,
+                                       size, 0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  uint64_t first_ns = now_ns () - start;
+  long resident_added = resident_kb () - resident_before;
+
+  /* an accumulator cleared on every iteration */
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &acc));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_uint), &stride));
+  start = now_ns ();
+  for (i = 0; i < iterations; ++i)
+    {
+      CHECK_CL_ERROR (clEnqueueFillBuffer (queue, acc, &zero, sizeof (zero),
+                                           0, size, 0, NULL, NULL));
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &gws,
+                                              NULL, 0, NULL, NULL));
+    }
+  CHECK_CL_ERROR (clFinish (queue));
+  uint64_t loop_ns = now_ns () - start;
+
+  cl_float last;
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, acc, CL_TRUE,
+                                       (gws - 1) * STRIDE * sizeof (cl_float),
+                                       sizeof (cl_float), &last, 0, NULL,
+                                       NULL));
+  if (last != (cl_float)(gws - 1))
+    {
+      fprintf (stderr, "wrong result %f, expected %f\n", last,
+               (cl_float)(gws - 1));
+      return EXIT_FAILURE;
+    }
+
+  printf ("buffer         %10zu MB\n", megabytes);
+  printf ("first clear    %10.3f ms\n", first_ns / 1e6);
+  printf ("resident       %10ld kB added\n", resident_added);
+  printf ("iteration      %10.3f ms\n", loop_ns / 1e6 / iterations);
+
+  CHECK_CL_ERROR (clReleaseMemObject (acc));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  return EXIT_SUCCESS;
+}
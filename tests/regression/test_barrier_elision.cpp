@@ -0,0 +1,295 @@
+/* Tests that the barrier elision keeps the barriers that order conflicting
+   accesses of different work-items, and that the kernels whose barriers it
+   removes still compute the right results. Run with POCL_DEBUG=llvm, the
+   test registration checks the messages of the pass.
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_opencl.h"
+
+// Enable OpenCL C++ exceptions
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#include <CL/opencl.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#define LOCAL_SIZE 16
+#define WORK_ITEMS (4 * LOCAL_SIZE)
+
+static const char *SourceCode = R"CLC(
+#define LOCAL_SIZE 16
+
+/* Each work-item reads the element another work-item wrote to the local
+   tile: the barrier is needed. */
+kernel void reverse_tile(global const int *in, global int *out) {
+  local int tile[LOCAL_SIZE];
+  int lid = get_local_id(0);
+  tile[lid] = in[get_global_id(0)];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  out[get_global_id(0)] = tile[LOCAL_SIZE - 1 - lid];
+}
+
+/* The input and the output are the same buffer when the kernel is run:
+   the barrier is needed although the input argument is const. */
+kernel void shift_right(global const int *in, global int *out) {
+  int gid = get_global_id(0);
+  int v = in[gid];
+  barrier(CLK_GLOBAL_MEM_FENCE);
+  out[gid + 1] = v;
+}
+
+/* Each work-item reads back only the elements it wrote itself, and the
+   buffers do not alias: the barriers can be removed. */
+kernel void private_tile(global const int *restrict in,
+                         global int *restrict out) {
+  local int tile[4 * LOCAL_SIZE];
+  int lid = get_local_id(0);
+  for (int i = 0; i < 4; ++i)
+    tile[4 * lid + i] = in[get_global_id(0)] * (i + 1);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  int sum = 0;
+  for (int i = 0; i < 4; ++i)
+    sum += tile[4 * lid + i];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  out[get_global_id(0)] = sum;
+}
+
+/* Each work-item reads the element its neighbor wrote: the barrier is
+   needed. */
+kernel void neighbor_shift(global const int *restrict in,
+                           global int *restrict out) {
+  local int tile[LOCAL_SIZE + 1];
+  int lid = get_local_id(0);
+  tile[lid + 1] = in[get_global_id(0)];
+  if (lid == 0)
+    tile[0] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  out[get_global_id(0)] = tile[lid];
+}
+
+/* A reduction with a barrier in the loop: all the barriers are needed. */
+kernel void tree_reduction(global const int *restrict in,
+                           global int *restrict out) {
+  local int tile[LOCAL_SIZE];
+  int lid = get_local_id(0);
+  tile[lid] = in[get_global_id(0)];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (int s = LOCAL_SIZE / 2; s > 0; s >>= 1) {
+    if (lid < s)
+      tile[lid] += tile[lid + s];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  out[get_global_id(0)] = tile[0];
+}
+
+/* The tile is written and read by other work-items in every iteration:
+   the first barrier orders the reads after the writes, the second one the
+   writes of the next iteration after the reads. */
+kernel void loop_exchange(global const int *restrict in,
+                          global int *restrict out) {
+  local int tile[LOCAL_SIZE];
+  int lid = get_local_id(0);
+  int v = in[get_global_id(0)];
+  for (int it = 0; it < 4; ++it) {
+    tile[lid] = v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    v = tile[LOCAL_SIZE - 1 - lid] + it;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  out[get_global_id(0)] = v;
+}
+
+/* The work-items exchange data through a global buffer: the barrier is
+   needed. */
+kernel void global_exchange(global int *restrict buf,
+                            global int *restrict out) {
+  int gid = get_global_id(0);
+  int lid = get_local_id(0);
+  buf[gid] = buf[gid] * 2;
+  barrier(CLK_GLOBAL_MEM_FENCE);
+  out[gid] = buf[get_group_id(0) * LOCAL_SIZE + LOCAL_SIZE - 1 - lid];
+}
+)CLC";
+
+static bool
+check (const char *Name, const std::vector<int> &Got,
+       const std::vector<int> &Expected)
+{
+  for (size_t i = 0; i < Expected.size (); ++i)
+    {
+      if (Got[i] != Expected[i])
+        {
+          std::cout << Name << ": element " << i << " is " << Got[i]
+                    << ", expected " << Expected[i] << std::endl;
+          return false;
+        }
+    }
+  return true;
+}
+
+int
+main (void)
+{
+  std::vector<int> In (WORK_ITEMS + 1);
+  for (int i = 0; i < WORK_ITEMS + 1; ++i)
+    In[i] = 3 * i + 1;
+
+  try
+    {
+      std::vector<cl::Platform> platformList;
+      cl::Platform::get (&platformList);
+      cl_context_properties cprops[]
+          = { CL_CONTEXT_PLATFORM, (cl_context_properties)(platformList[0])(),
+              0 };
+      cl::Context context (CL_DEVICE_TYPE_ALL, cprops);
+      std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES> ();
+
+      cl::Program::Sources sources ({ SourceCode });
+      cl::Program program (context, sources);
+      program.build (devices);
+
+      cl::CommandQueue queue (context, devices[0], 0);
+      size_t BufSize = (WORK_ITEMS + 1) * sizeof (int);
+      cl::Buffer InBuf (context, CL_MEM_READ_WRITE, BufSize);
+      cl::Buffer OutBuf (context, CL_MEM_READ_WRITE, BufSize);
+      std::vector<int> Out (WORK_ITEMS + 1);
+      bool ok = true;
+
+      cl::Kernel Reverse (program, "reverse_tile");
+      queue.enqueueWriteBuffer (InBuf, CL_TRUE, 0, BufSize, In.data ());
+      Reverse.setArg (0, InBuf);
+      Reverse.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Reverse, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      std::vector<int> Expected (WORK_ITEMS);
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        {
+          int Group = i / LOCAL_SIZE * LOCAL_SIZE;
+          Expected[i] = In[Group + LOCAL_SIZE - 1 - (i - Group)];
+        }
+      ok &= check ("reverse_tile", Out, Expected);
+
+      /* The whole range in a single work-group so that the barrier orders
+         all the reads before all the writes. */
+      cl::Kernel Shift (program, "shift_right");
+      queue.enqueueWriteBuffer (InBuf, CL_TRUE, 0, BufSize, In.data ());
+      Shift.setArg (0, InBuf);
+      Shift.setArg (1, InBuf);
+      queue.enqueueNDRangeKernel (Shift, cl::NullRange,
+                                  cl::NDRange (LOCAL_SIZE),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (InBuf, CL_TRUE, 0, BufSize, Out.data ());
+      Expected.assign (In.begin (), In.begin () + LOCAL_SIZE + 1);
+      for (int i = 0; i < LOCAL_SIZE; ++i)
+        Expected[i + 1] = In[i];
+      ok &= check ("shift_right", Out, Expected);
+
+      cl::Kernel Private (program, "private_tile");
+      queue.enqueueWriteBuffer (InBuf, CL_TRUE, 0, BufSize, In.data ());
+      Private.setArg (0, InBuf);
+      Private.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Private, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      Expected.resize (WORK_ITEMS);
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        Expected[i] = In[i] * (1 + 2 + 3 + 4);
+      ok &= check ("private_tile", Out, Expected);
+
+      cl::Kernel Neighbor (program, "neighbor_shift");
+      Neighbor.setArg (0, InBuf);
+      Neighbor.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Neighbor, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        Expected[i] = i % LOCAL_SIZE == 0 ? 0 : In[i - 1];
+      ok &= check ("neighbor_shift", Out, Expected);
+
+      cl::Kernel Reduction (program, "tree_reduction");
+      Reduction.setArg (0, InBuf);
+      Reduction.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Reduction, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        {
+          int Group = i / LOCAL_SIZE * LOCAL_SIZE;
+          Expected[i] = 0;
+          for (int j = 0; j < LOCAL_SIZE; ++j)
+            Expected[i] += In[Group + j];
+        }
+      ok &= check ("tree_reduction", Out, Expected);
+
+      cl::Kernel Exchange (program, "loop_exchange");
+      Exchange.setArg (0, InBuf);
+      Exchange.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Exchange, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      /* reversed four times, adding 0 + 1 + 2 + 3 */
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        Expected[i] = In[i] + 6;
+      ok &= check ("loop_exchange", Out, Expected);
+
+      cl::Kernel Global (program, "global_exchange");
+      queue.enqueueWriteBuffer (InBuf, CL_TRUE, 0, BufSize, In.data ());
+      Global.setArg (0, InBuf);
+      Global.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Global, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        {
+          int Group = i / LOCAL_SIZE * LOCAL_SIZE;
+          Expected[i] = In[Group + LOCAL_SIZE - 1 - (i - Group)] * 2;
+        }
+      ok &= check ("global_exchange", Out, Expected);
+
+      queue.finish ();
+      platformList[0].unloadCompiler ();
+
+      if (ok)
+        {
+          std::cout << "OK" << std::endl;
+          return EXIT_SUCCESS;
+        }
+    }
+  catch (cl::Error &err)
+    {
+      std::cerr << "ERROR: " << err.what () << "(" << err.err () << ")"
+                << std::endl;
+    }
+
+  return EXIT_FAILURE;
+}
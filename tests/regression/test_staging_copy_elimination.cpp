@@ -0,0 +1,298 @@
+/* Tests that the staging copy elimination rewrites the reads of the local
+   memory tiles that only stage global data, and leaves the other tiles
+   alone, and that all the kernels compute the right results. Run with
+   POCL_DEBUG=llvm, the test registration checks the messages of the pass.
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_opencl.h"
+
+// Enable OpenCL C++ exceptions
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#include <CL/opencl.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#define TILE 8
+#define N 32
+#define LOCAL_SIZE 16
+#define WORK_ITEMS (4 * LOCAL_SIZE)
+#define GUARD_ITEMS 40
+
+static const char *SourceCode = R"CLC(
+#define TILE 8
+#define LOCAL_SIZE 16
+
+/* Both tiles only stage the inputs: rewritten. */
+kernel void tiled_gemm(global const int *restrict A,
+                       global const int *restrict B,
+                       global int *restrict C, int n) {
+  local int As[TILE][TILE];
+  local int Bs[TILE][TILE];
+  int lx = get_local_id(0), ly = get_local_id(1);
+  int col = get_global_id(0), row = get_global_id(1);
+  int sum = 0;
+  for (int t = 0; t < n / TILE; ++t) {
+    As[ly][lx] = A[row * n + t * TILE + lx];
+    Bs[ly][lx] = B[(t * TILE + ly) * n + col];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int k = 0; k < TILE; ++k)
+      sum += As[ly][k] * Bs[k][lx];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  C[row * n + col] = sum;
+}
+
+/* A three point stencil clamped to the tile: rewritten. */
+kernel void stencil(global const int *restrict in, global int *restrict out) {
+  local int tile[LOCAL_SIZE];
+  int lid = get_local_id(0);
+  tile[lid] = in[get_global_id(0)];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  int left = tile[lid > 0 ? lid - 1 : lid];
+  int right = tile[lid < LOCAL_SIZE - 1 ? lid + 1 : lid];
+  out[get_global_id(0)] = left + 2 * tile[lid] + right;
+}
+
+/* The halo elements are copied by the edge work-items: kept. */
+kernel void padded_tile(global const int *restrict in,
+                        global int *restrict out) {
+  local int tile[LOCAL_SIZE + 2];
+  int lid = get_local_id(0);
+  int gid = get_global_id(0);
+  int last = get_global_size(0) - 1;
+  tile[lid + 1] = in[gid];
+  if (lid == 0)
+    tile[0] = in[gid > 0 ? gid - 1 : 0];
+  if (lid == LOCAL_SIZE - 1)
+    tile[LOCAL_SIZE + 1] = in[gid < last ? gid + 1 : last];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  out[gid] = tile[lid] + 2 * tile[lid + 1] + tile[lid + 2];
+}
+
+/* Only the work-items within the input copy their element: kept. */
+kernel void guarded_copy(global const int *restrict in,
+                         global int *restrict out, int n) {
+  local int tile[LOCAL_SIZE];
+  int lid = get_local_id(0);
+  int gid = get_global_id(0);
+  if (gid < n)
+    tile[lid] = in[gid];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (gid < n)
+    out[gid] = tile[lid > 0 ? lid - 1 : lid];
+}
+
+/* The tile is updated after the barrier: kept. */
+kernel void write_back(global const int *restrict in,
+                       global int *restrict out) {
+  local int tile[LOCAL_SIZE];
+  int lid = get_local_id(0);
+  tile[lid] = in[get_global_id(0)];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  int v = tile[LOCAL_SIZE - 1 - lid];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  tile[lid] = v * 2;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  out[get_global_id(0)] = tile[LOCAL_SIZE - 1 - lid] + 1;
+}
+
+/* The input and the output are the same buffer when the kernel is run:
+   kept, as the arguments are not restrict qualified. */
+kernel void aliased_tile(global const int *in, global int *out) {
+  local int tile[LOCAL_SIZE];
+  int lid = get_local_id(0);
+  tile[lid] = in[get_global_id(0)];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  out[get_global_id(0)] = tile[LOCAL_SIZE - 1 - lid];
+}
+)CLC";
+
+static bool
+check (const char *Name, const std::vector<int> &Got,
+       const std::vector<int> &Expected)
+{
+  for (size_t i = 0; i < Expected.size (); ++i)
+    {
+      if (Got[i] != Expected[i])
+        {
+          std::cout << Name << ": element " << i << " is " << Got[i]
+                    << ", expected " << Expected[i] << std::endl;
+          return false;
+        }
+    }
+  return true;
+}
+
+int
+main (void)
+{
+  std::vector<int> In (WORK_ITEMS);
+  for (int i = 0; i < WORK_ITEMS; ++i)
+    In[i] = 3 * i + 1;
+  std::vector<int> A (N * N), B (N * N);
+  for (int i = 0; i < N * N; ++i)
+    {
+      A[i] = i % 7 - 3;
+      B[i] = i % 5 + 1;
+    }
+
+  try
+    {
+      std::vector<cl::Platform> platformList;
+      cl::Platform::get (&platformList);
+      cl_context_properties cprops[]
+          = { CL_CONTEXT_PLATFORM, (cl_context_properties)(platformList[0])(),
+              0 };
+      cl::Context context (CL_DEVICE_TYPE_ALL, cprops);
+      std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES> ();
+
+      cl::Program::Sources sources ({ SourceCode });
+      cl::Program program (context, sources);
+      program.build (devices);
+
+      cl::CommandQueue queue (context, devices[0], 0);
+      size_t BufSize = WORK_ITEMS * sizeof (int);
+      cl::Buffer InBuf (context, CL_MEM_READ_WRITE, BufSize);
+      cl::Buffer OutBuf (context, CL_MEM_READ_WRITE, BufSize);
+      std::vector<int> Out (WORK_ITEMS);
+      std::vector<int> Expected (WORK_ITEMS);
+      bool ok = true;
+
+      /* The kernels are run in the order the test registration expects the
+         messages of the pass in. */
+      size_t MatSize = N * N * sizeof (int);
+      cl::Buffer ABuf (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                       MatSize, A.data ());
+      cl::Buffer BBuf (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                       MatSize, B.data ());
+      cl::Buffer CBuf (context, CL_MEM_WRITE_ONLY, MatSize);
+      cl::Kernel Gemm (program, "tiled_gemm");
+      Gemm.setArg (0, ABuf);
+      Gemm.setArg (1, BBuf);
+      Gemm.setArg (2, CBuf);
+      Gemm.setArg (3, N);
+      queue.enqueueNDRangeKernel (Gemm, cl::NullRange, cl::NDRange (N, N),
+                                  cl::NDRange (TILE, TILE));
+      std::vector<int> C (N * N), ExpectedC (N * N, 0);
+      queue.enqueueReadBuffer (CBuf, CL_TRUE, 0, MatSize, C.data ());
+      for (int r = 0; r < N; ++r)
+        for (int c = 0; c < N; ++c)
+          for (int k = 0; k < N; ++k)
+            ExpectedC[r * N + c] += A[r * N + k] * B[k * N + c];
+      ok &= check ("tiled_gemm", C, ExpectedC);
+
+      queue.enqueueWriteBuffer (InBuf, CL_TRUE, 0, BufSize, In.data ());
+      cl::Kernel Stencil (program, "stencil");
+      Stencil.setArg (0, InBuf);
+      Stencil.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Stencil, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        {
+          int lid = i % LOCAL_SIZE;
+          int Left = In[lid > 0 ? i - 1 : i];
+          int Right = In[lid < LOCAL_SIZE - 1 ? i + 1 : i];
+          Expected[i] = Left + 2 * In[i] + Right;
+        }
+      ok &= check ("stencil", Out, Expected);
+
+      cl::Kernel Padded (program, "padded_tile");
+      Padded.setArg (0, InBuf);
+      Padded.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (Padded, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        {
+          int Left = In[i > 0 ? i - 1 : 0];
+          int Right = In[i < WORK_ITEMS - 1 ? i + 1 : WORK_ITEMS - 1];
+          Expected[i] = Left + 2 * In[i] + Right;
+        }
+      ok &= check ("padded_tile", Out, Expected);
+
+      /* The input buffer is only as large as the guarded range. */
+      cl::Buffer GuardBuf (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                           GUARD_ITEMS * sizeof (int), In.data ());
+      cl::Kernel Guarded (program, "guarded_copy");
+      Guarded.setArg (0, GuardBuf);
+      Guarded.setArg (1, OutBuf);
+      Guarded.setArg (2, GUARD_ITEMS);
+      queue.enqueueNDRangeKernel (Guarded, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      std::vector<int> GuardOut (Out.begin (), Out.begin () + GUARD_ITEMS);
+      std::vector<int> GuardExpected (GUARD_ITEMS);
+      for (int i = 0; i < GUARD_ITEMS; ++i)
+        GuardExpected[i] = In[i % LOCAL_SIZE > 0 ? i - 1 : i];
+      ok &= check ("guarded_copy", GuardOut, GuardExpected);
+
+      cl::Kernel WriteBack (program, "write_back");
+      WriteBack.setArg (0, InBuf);
+      WriteBack.setArg (1, OutBuf);
+      queue.enqueueNDRangeKernel (WriteBack, cl::NullRange,
+                                  cl::NDRange (WORK_ITEMS),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (OutBuf, CL_TRUE, 0, BufSize, Out.data ());
+      /* reversed twice */
+      for (int i = 0; i < WORK_ITEMS; ++i)
+        Expected[i] = In[i] * 2 + 1;
+      ok &= check ("write_back", Out, Expected);
+
+      /* The whole range in a single work-group, reversed in place. */
+      cl::Kernel Aliased (program, "aliased_tile");
+      Aliased.setArg (0, InBuf);
+      Aliased.setArg (1, InBuf);
+      queue.enqueueNDRangeKernel (Aliased, cl::NullRange,
+                                  cl::NDRange (LOCAL_SIZE),
+                                  cl::NDRange (LOCAL_SIZE));
+      queue.enqueueReadBuffer (InBuf, CL_TRUE, 0, BufSize, Out.data ());
+      Expected = In;
+      for (int i = 0; i < LOCAL_SIZE; ++i)
+        Expected[i] = In[LOCAL_SIZE - 1 - i];
+      ok &= check ("aliased_tile", Out, Expected);
+
+      queue.finish ();
+      platformList[0].unloadCompiler ();
+
+      if (ok)
+        {
+          std::cout << "OK" << std::endl;
+          return EXIT_SUCCESS;
+        }
+    }
+  catch (cl::Error &err)
+    {
+      std::cerr << "ERROR: " << err.what () << "(" << err.err () << ")"
+                << std::endl;
+    }
+
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,195 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Launches a kernel that writes through two buffer arguments with distinct
+   buffers, with the same buffer passed twice, and with two overlapping
+   sub-buffers of one buffer. The last two must use the WG function without
+   the no-alias specialization, and all the results must match a
+   sequential run on the host. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poclu.h"
+
+/* A single work-item walks through the elements, so the result only
+   depends on the order of the accesses within it. */
+static const char source[]
+    = "kernel void twice (global int *a, global int *b, int n)\n"
+      "{\n"
+      "  for (int i = 0; i < n; ++i)\n"
+      "    {\n"
+      "      a[i] = i;\n"
+      "      b[i] = 2 * i + 1;\n"
+      "      a[i] += 10;\n"
+      "    }\n"
+      "}\n";
+
+/* Runs the kernel on the host. */
+static void
+run_on_host (cl_int *a, cl_int *b, int n)
+{
+  int i;
+  for (i = 0; i < n; ++i)
+    {
+      a[i] = i;
+      b[i] = 2 * i + 1;
+      a[i] += 10;
+    }
+}
+
+static int
+check (const char *name, const cl_int *result, const cl_int *expected,
+       size_t count)
+{
+  size_t i;
+  int errors = 0;
+  for (i = 0; i < count; ++i)
+    if (result[i] != expected[i])
+      {
+        if (errors < 10)
+          printf ("%s: element %zu is %d, expected %d\n", name, i, result[i],
+                  expected[i]);
+        ++errors;
+      }
+  return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  cl_context context = NULL;
+  cl_device_id device = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem parent = NULL, other = NULL, sub_a = NULL, sub_b = NULL;
+  cl_uint align_bits;
+  size_t one = 1;
+  int err, errors = 0;
+
+  err = poclu_get_any_device (&context, &device, &queue);
+  CHECK_OPENCL_ERROR_IN ("poclu_get_any_device");
+
+  CHECK_CL_ERROR (clGetDeviceInfo (device, CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                                   sizeof (align_bits), &align_bits, NULL));
+  /* the offset of the second sub-buffer, in elements */
+  size_t shift = align_bits / 8 / sizeof (cl_int);
+  if (shift == 0)
+    shift = 1;
+  int n = (int)(4 * shift + 3);
+  size_t total = n + shift;
+  size_t bytes = total * sizeof (cl_int);
+
+  cl_int *expected = (cl_int *)calloc (total, sizeof (cl_int));
+  cl_int *result = (cl_int *)calloc (total, sizeof (cl_int));
+  cl_int *scratch = (cl_int *)calloc (total, sizeof (cl_int));
+
+  const char *src = source;
+  program = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (clBuildProgram (program, 1, &device, NULL, NULL, NULL));
+  kernel = clCreateKernel (program, "twice", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 2, sizeof (int), &n));
+
+  parent = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                           bytes, result, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  other = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                          bytes, result, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  /* Distinct buffers. */
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &parent));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &other));
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &one, NULL,
+                                          0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, parent, CL_TRUE, 0, bytes,
+                                       result, 0, NULL, NULL));
+  memset (expected, 0, bytes);
+  run_on_host (expected, scratch, n);
+  errors += check ("distinct", result, expected, total);
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, other, CL_TRUE, 0, bytes,
+                                       result, 0, NULL, NULL));
+  errors += check ("distinct, second buffer", result, scratch, total);
+
+  /* The same buffer passed twice. */
+  memset (result, 0, bytes);
+  CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, parent, CL_TRUE, 0, bytes,
+                                        result, 0, NULL, NULL));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &parent));
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &one, NULL,
+                                          0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, parent, CL_TRUE, 0, bytes,
+                                       result, 0, NULL, NULL));
+  memset (expected, 0, bytes);
+  run_on_host (expected, expected, n);
+  errors += check ("same buffer", result, expected, total);
+
+  /* Overlapping sub-buffers, the second one starting SHIFT elements into
+     the first one. */
+  cl_buffer_region region_a = { 0, n * sizeof (cl_int) };
+  cl_buffer_region region_b = { shift * sizeof (cl_int), n * sizeof (cl_int) };
+  sub_a = clCreateSubBuffer (parent, CL_MEM_READ_WRITE,
+                             CL_BUFFER_CREATE_TYPE_REGION, &region_a, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateSubBuffer");
+  sub_b = clCreateSubBuffer (parent, CL_MEM_READ_WRITE,
+                             CL_BUFFER_CREATE_TYPE_REGION, &region_b, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateSubBuffer");
+
+  memset (result, 0, bytes);
+  CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, parent, CL_TRUE, 0, bytes,
+                                        result, 0, NULL, NULL));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &sub_a));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &sub_b));
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &one, NULL,
+                                          0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, parent, CL_TRUE, 0, bytes,
+                                       result, 0, NULL, NULL));
+  memset (expected, 0, bytes);
+  run_on_host (expected, expected + shift, n);
+  errors += check ("overlapping sub-buffers", result, expected, total);
+
+  CHECK_CL_ERROR (clReleaseMemObject (sub_a));
+  CHECK_CL_ERROR (clReleaseMemObject (sub_b));
+  CHECK_CL_ERROR (clReleaseMemObject (parent));
+  CHECK_CL_ERROR (clReleaseMemObject (other));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+  free (expected);
+  free (result);
+  free (scratch);
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Builds programs with a pfn_notify callback, which pocl does in the
+   background (POCL_ASYNC_BUILD). Queries the build status and log while
+   the build may still be in progress, checks that clCreateKernel and
+   clGetProgramInfo wait for the build, and that the callback sees the
+   final status, for a program that builds and one that does not. */
+
+#include "pocl_opencl.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_KERNELS 32
+#define ITEMS 64
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+typedef struct
+{
+  cl_device_id device;
+  int notified;
+  cl_build_status status;
+} notify_data;
+
+static void CL_CALLBACK
+build_notify (cl_program program, void *user_data)
+{
+  notify_data *data = (notify_data *)user_data;
+  cl_build_status status = CL_BUILD_NONE;
+
+  clGetProgramBuildInfo (program, data->device, CL_PROGRAM_BUILD_STATUS,
+                         sizeof (status), &status, NULL);
+  pthread_mutex_lock (&lock);
+  data->status = status;
+  ++data->notified;
+  pthread_cond_broadcast (&cond);
+  pthread_mutex_unlock (&lock);
+}
+
+static void
+wait_notify (notify_data *data)
+{
+  pthread_mutex_lock (&lock);
+  while (data->notified == 0)
+    pthread_cond_wait (&cond, &lock);
+  pthread_mutex_unlock (&lock);
+}
+
+/* Polls the status and the log until the build is done. Returns the
+   final status. */
+static cl_build_status
+poll_build (cl_program program, cl_device_id device, unsigned *in_progress)
+{
+  cl_build_status status;
+  do
+    {
+      size_t log_size = 0;
+      CHECK_CL_ERROR (clGetProgramBuildInfo (program, device,
+                                             CL_PROGRAM_BUILD_STATUS,
+                                             sizeof (status), &status, NULL));
+      CHECK_CL_ERROR (clGetProgramBuildInfo (
+          program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size));
+      char *log = (char *)malloc (log_size);
+      CHECK_CL_ERROR (clGetProgramBuildInfo (
+          program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL));
+      TEST_ASSERT (log_size > 0 && log[log_size - 1] == 0);
+      free (log);
+      if (status == CL_BUILD_IN_PROGRESS)
+        ++*in_progress;
+    }
+  while (status == CL_BUILD_IN_PROGRESS);
+  return status;
+}
+
+int
+main (void)
+{
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  cl_int err;
+  unsigned i, in_progress = 0;
+  notify_data good = { 0 }, bad = { 0 };
+
+  CHECK_CL_ERROR (poclu_get_any_device (&context, &device, &queue));
+  TEST_ASSERT (context);
+  TEST_ASSERT (device);
+  TEST_ASSERT (queue);
+  good.device = bad.device = device;
+
+  /* enough kernels for the build to take a while */
+  char *source = (char *)malloc (NUM_KERNELS * 256);
+  char *pos = source;
+  for (i = 0; i < NUM_KERNELS; ++i)
+    pos += sprintf (pos,
+                    "kernel void k%u (global int *a)\n"
+                    "{\n"
+                    "  size_t i = get_global_id (0);\n"
+                    "  for (int j = 0; j < %u; ++j)\n"
+                    "    a[i] = a[i] * 3 + j;\n"
+                    "  a[i] += %u;\n"
+                    "}\n",
+                    i, i % 5 + 1, i);
+  const char *src = source;
+
+  /* 1. The first program builds. */
+  cl_program program
+      = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (
+      clBuildProgram (program, 1, &device, NULL, build_notify, &good));
+  cl_build_status status = poll_build (program, device, &in_progress);
+  TEST_ASSERT (status == CL_BUILD_SUCCESS);
+  wait_notify (&good);
+  TEST_ASSERT (good.notified == 1);
+  TEST_ASSERT (good.status == CL_BUILD_SUCCESS);
+
+  /* 2. The same source again: clCreateKernel and clGetProgramInfo wait
+     for the build instead of failing while it is in progress. */
+  memset (&good, 0, sizeof (good));
+  good.device = device;
+  cl_program program2
+      = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (
+      clBuildProgram (program2, 1, &device, NULL, build_notify, &good));
+  cl_kernel kernel = clCreateKernel (program2, "k7", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  cl_uint num_kernels = 0;
+  CHECK_CL_ERROR (clGetProgramInfo (program2, CL_PROGRAM_NUM_KERNELS,
+                                    sizeof (num_kernels), &num_kernels,
+                                    NULL));
+  TEST_ASSERT (num_kernels == NUM_KERNELS);
+  CHECK_CL_ERROR (clGetProgramBuildInfo (program2, device,
+                                         CL_PROGRAM_BUILD_STATUS,
+                                         sizeof (status), &status, NULL));
+  TEST_ASSERT (status == CL_BUILD_SUCCESS);
+
+  cl_int data[ITEMS];
+  size_t global = ITEMS;
+  for (i = 0; i < ITEMS; ++i)
+    data[i] = (cl_int)i;
+  cl_mem buf = clCreateBuffer (context, CL_MEM_READ_WRITE
+                               | CL_MEM_COPY_HOST_PTR, sizeof (data), data,
+                               &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &buf));
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &global,
+                                          NULL, 0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, buf, CL_TRUE, 0, sizeof (data),
+                                       data, 0, NULL, NULL));
+  for (i = 0; i < ITEMS; ++i)
+    {
+      /* k7: three rounds of a = a * 3 + j, then + 7 */
+      cl_int expected = (cl_int)i;
+      int j;
+      for (j = 0; j < 3; ++j)
+        expected = expected * 3 + j;
+      expected += 7;
+      TEST_ASSERT (data[i] == expected);
+    }
+  wait_notify (&good);
+  TEST_ASSERT (good.status == CL_BUILD_SUCCESS);
+
+  /* 3. A program that does not build: clBuildProgram has already returned
+     when the build fails, the callback and the status report it, and the
+     log is there once the build is done. */
+  const char *broken = "kernel void broken (global int *a) { a[0] = b; }\n";
+  cl_program program3
+      = clCreateProgramWithSource (context, 1, &broken, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  err = clBuildProgram (program3, 1, &device, NULL, build_notify, &bad);
+  TEST_ASSERT (err == CL_SUCCESS || err == CL_BUILD_PROGRAM_FAILURE);
+  status = poll_build (program3, device, &in_progress);
+  TEST_ASSERT (status == CL_BUILD_ERROR);
+  wait_notify (&bad);
+  TEST_ASSERT (bad.status == CL_BUILD_ERROR);
+  size_t log_size = 0;
+  CHECK_CL_ERROR (clGetProgramBuildInfo (program3, device,
+                                         CL_PROGRAM_BUILD_LOG, 0, NULL,
+                                         &log_size));
+  TEST_ASSERT (log_size > 1);
+  cl_kernel no_kernel = clCreateKernel (program3, "broken", &err);
+  TEST_ASSERT (no_kernel == NULL && err == CL_INVALID_PROGRAM_EXECUTABLE);
+
+  printf ("the build was seen in progress %u times\n", in_progress);
+
+  CHECK_CL_ERROR (clReleaseMemObject (buf));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseProgram (program2));
+  CHECK_CL_ERROR (clReleaseProgram (program3));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+  free (source);
+
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+/* Test the finalize time optimization of cl_khr_command_buffer graphs
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Records a pipeline of copies and fills with mergeable neighbours, writes
+   that are overwritten before being read, writes that are read before
+   being overwritten, and two independent chains, on an in-order and on an
+   out-of-order queue, and checks the results of several replays. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poclu.h"
+
+#define ELEMENTS 4096
+#define CHUNKS 4
+#define REPLAYS 8
+
+#if defined(cl_khr_command_buffer) && cl_khr_command_buffer == 1
+
+static clCreateCommandBufferKHR_fn createCommandBuffer;
+static clCommandCopyBufferKHR_fn commandCopyBuffer;
+static clCommandFillBufferKHR_fn commandFillBuffer;
+static clFinalizeCommandBufferKHR_fn finalizeCommandBuffer;
+static clEnqueueCommandBufferKHR_fn enqueueCommandBuffer;
+static clReleaseCommandBufferKHR_fn releaseCommandBuffer;
+
+/* The commands of a chain wait for the previous one, which is required on
+   an out-of-order queue and redundant on an in-order one. */
+static int
+fill (cl_command_buffer_khr cmdbuf, cl_mem buf, cl_int value, size_t first,
+      size_t count, cl_sync_point_khr *chain)
+{
+  return commandFillBuffer (cmdbuf, NULL, buf, &value, sizeof (value),
+                            first * sizeof (cl_int), count * sizeof (cl_int),
+                            *chain ? 1 : 0, *chain ? chain : NULL, chain,
+                            NULL);
+}
+
+static int
+copy (cl_command_buffer_khr cmdbuf, cl_mem src, cl_mem dst, size_t first,
+      size_t count, cl_sync_point_khr *chain)
+{
+  return commandCopyBuffer (cmdbuf, NULL, src, dst, first * sizeof (cl_int),
+                            first * sizeof (cl_int), count * sizeof (cl_int),
+                            *chain ? 1 : 0, *chain ? chain : NULL, chain,
+                            NULL);
+}
+
+static int
+run_pipeline (cl_context context, cl_device_id device,
+              cl_command_queue_properties properties)
+{
+  cl_int err;
+  size_t size = ELEMENTS * sizeof (cl_int);
+  size_t chunk = ELEMENTS / CHUNKS;
+  unsigned i, r;
+  int errors = 0;
+
+  cl_command_queue queue
+      = clCreateCommandQueue (context, device, properties, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandQueue");
+
+  /* src -> a -> out_a, b -> out_b, c -> d */
+  cl_mem bufs[7];
+  for (i = 0; i < 7; ++i)
+    {
+      bufs[i] = clCreateBuffer (context, CL_MEM_READ_WRITE, size, NULL, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+    }
+  cl_mem src = bufs[0], a = bufs[1], out_a = bufs[2], b = bufs[3],
+         out_b = bufs[4], c = bufs[5], d = bufs[6];
+
+  cl_command_buffer_khr cmdbuf = createCommandBuffer (1, &queue, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandBufferKHR");
+
+  cl_sync_point_khr chain_a = 0, chain_b = 0, chain_c = 0;
+
+  /* a is cleared in chunks, then overwritten by the copy from src */
+  for (i = 0; i < CHUNKS; ++i)
+    CHECK_CL_ERROR (fill (cmdbuf, a, 0, i * chunk, chunk, &chain_a));
+  CHECK_CL_ERROR (copy (cmdbuf, src, a, 0, ELEMENTS, &chain_a));
+  for (i = 0; i < CHUNKS; ++i)
+    CHECK_CL_ERROR (copy (cmdbuf, a, out_a, i * chunk, chunk, &chain_a));
+  CHECK_CL_ERROR (fill (cmdbuf, out_a, 5, 0, chunk / 2, &chain_a));
+
+  /* independent of the chain above */
+  CHECK_CL_ERROR (fill (cmdbuf, b, 7, 0, ELEMENTS, &chain_b));
+  CHECK_CL_ERROR (copy (cmdbuf, b, out_b, 0, ELEMENTS / 2, &chain_b));
+  CHECK_CL_ERROR (fill (cmdbuf, b, 9, ELEMENTS / 2, ELEMENTS / 2, &chain_b));
+  CHECK_CL_ERROR (copy (cmdbuf, b, out_b, ELEMENTS / 2, ELEMENTS / 2,
+                        &chain_b));
+
+  /* c is read between the fills, so neither can be removed */
+  CHECK_CL_ERROR (fill (cmdbuf, c, 3, 0, ELEMENTS, &chain_c));
+  CHECK_CL_ERROR (copy (cmdbuf, c, d, 0, ELEMENTS, &chain_c));
+  CHECK_CL_ERROR (fill (cmdbuf, c, 4, 0, ELEMENTS, &chain_c));
+
+  CHECK_CL_ERROR (finalizeCommandBuffer (cmdbuf));
+
+  cl_int *host = (cl_int *)malloc (size);
+  cl_int *result = (cl_int *)malloc (size);
+  for (r = 0; r < REPLAYS; ++r)
+    {
+      cl_event written, done;
+      for (i = 0; i < ELEMENTS; ++i)
+        host[i] = (cl_int)(i * 3 + r);
+      CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, src, CL_FALSE, 0, size,
+                                            host, 0, NULL, &written));
+      CHECK_CL_ERROR (
+          enqueueCommandBuffer (0, NULL, cmdbuf, 1, &written, &done));
+
+      cl_mem outs[5] = { out_a, out_b, c, d, a };
+      for (unsigned o = 0; o < 5; ++o)
+        {
+          CHECK_CL_ERROR (clEnqueueReadBuffer (queue, outs[o], CL_TRUE, 0,
+                                               size, result, 1, &done, NULL));
+          for (i = 0; i < ELEMENTS; ++i)
+            {
+              cl_int expected;
+              if (outs[o] == out_a)
+                expected = i < chunk / 2 ? 5 : host[i];
+              else if (outs[o] == out_b)
+                expected = i < ELEMENTS / 2 ? 7 : 9;
+              else if (outs[o] == c)
+                expected = 4;
+              else if (outs[o] == d)
+                expected = 3;
+              else
+                expected = host[i];
+              if (result[i] != expected && errors++ < 10)
+                printf ("FAIL: queue %s, replay %u, buffer %u, element %u: "
+                        "%d instead of %d\n",
+                        properties ? "out-of-order" : "in-order", r, o, i,
+                        result[i], expected);
+            }
+        }
+
+      /* clobber the outputs, the next replay has to write them again */
+      memset (result, 0xff, size);
+      for (unsigned o = 0; o < 4; ++o)
+        CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, outs[o], CL_TRUE, 0,
+                                              size, result, 0, NULL, NULL));
+      CHECK_CL_ERROR (clReleaseEvent (written));
+      CHECK_CL_ERROR (clReleaseEvent (done));
+    }
+
+  CHECK_CL_ERROR (clFinish (queue));
+  CHECK_CL_ERROR (releaseCommandBuffer (cmdbuf));
+  for (i = 0; i < 7; ++i)
+    CHECK_CL_ERROR (clReleaseMemObject (bufs[i]));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  free (host);
+  free (result);
+  return errors;
+}
+
+#endif
+
+int
+main (int argc, char **argv)
+{
+#if defined(cl_khr_command_buffer) && cl_khr_command_buffer == 1
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_int err;
+
+  CHECK_CL_ERROR (clGetPlatformIDs (1, &platform, NULL));
+  CHECK_CL_ERROR (
+      clGetDeviceIDs (platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL));
+
+  createCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clCreateCommandBufferKHR");
+  commandCopyBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clCommandCopyBufferKHR");
+  commandFillBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clCommandFillBufferKHR");
+  finalizeCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clFinalizeCommandBufferKHR");
+  enqueueCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clEnqueueCommandBufferKHR");
+  releaseCommandBuffer = clGetExtensionFunctionAddressForPlatform (
+      platform, "clReleaseCommandBufferKHR");
+
+  cl_context context = clCreateContext (NULL, 1, &device, NULL, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateContext");
+
+  int errors = run_pipeline (context, device, 0);
+  errors += run_pipeline (context, device,
+                          CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+#else
+  return 77;
+#endif
+}
@@ -0,0 +1,267 @@
+/* Test updating the kernel commands of cl_khr_command_buffer_mutable_dispatch
+
+   Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+*/
+
+/* Records one kernel command into a mutable command buffer and updates its
+   arguments between the replays as a double-buffered time-stepping loop
+   would, then its global offset and size. Also checks that an update with
+   an invalid part changes nothing, and that the arguments set to the kernel
+   object after recording do not leak into the replays. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poclu.h"
+
+#define STR(x) #x
+#define ELEMENTS 1024
+#define STEPS 5
+
+int
+main (int argc, char **argv)
+{
+#if defined(cl_khr_command_buffer_mutable_dispatch)                           \
+    && cl_khr_command_buffer_mutable_dispatch == 1
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_int err;
+  size_t size = ELEMENTS * sizeof (cl_int);
+  unsigned i, s;
+  int errors = 0;
+
+  CHECK_CL_ERROR (clGetPlatformIDs (1, &platform, NULL));
+  CHECK_CL_ERROR (
+      clGetDeviceIDs (platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL));
+
+  char extensions[4096];
+  CHECK_CL_ERROR (clGetDeviceInfo (device, CL_DEVICE_EXTENSIONS,
+                                   sizeof (extensions), extensions, NULL));
+  if (strstr (extensions, "cl_khr_command_buffer_mutable_dispatch") == NULL)
+    {
+      printf ("cl_khr_command_buffer_mutable_dispatch is not supported\n");
+      return 77;
+    }
+
+  clCreateCommandBufferKHR_fn createCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clCreateCommandBufferKHR");
+  clCommandNDRangeKernelKHR_fn commandNDRangeKernel
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clCommandNDRangeKernelKHR");
+  clFinalizeCommandBufferKHR_fn finalizeCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (
+          platform, "clFinalizeCommandBufferKHR");
+  clEnqueueCommandBufferKHR_fn enqueueCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clEnqueueCommandBufferKHR");
+  clReleaseCommandBufferKHR_fn releaseCommandBuffer
+      = clGetExtensionFunctionAddressForPlatform (platform,
+                                                  "clReleaseCommandBufferKHR");
+  clUpdateMutableCommandsKHR_fn updateMutableCommands
+      = clGetExtensionFunctionAddressForPlatform (
+          platform, "clUpdateMutableCommandsKHR");
+  clGetMutableCommandInfoKHR_fn getMutableCommandInfo
+      = clGetExtensionFunctionAddressForPlatform (
+          platform, "clGetMutableCommandInfoKHR");
+
+  cl_context context = clCreateContext (NULL, 1, &device, NULL, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateContext");
+  cl_command_queue queue = clCreateCommandQueue (context, device, 0, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandQueue");
+
+  const char *code = STR (kernel void step (
+      global const int *in, global int *out, int value) {
+    size_t i = get_global_id (0);
+    out[i] = in[i] + value;
+  });
+  cl_program program = clCreateProgramWithSource (context, 1, &code, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (clBuildProgram (program, 1, &device, NULL, NULL, NULL));
+  cl_kernel kernel = clCreateKernel (program, "step", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  cl_int *host = (cl_int *)malloc (size);
+  for (i = 0; i < ELEMENTS; ++i)
+    host[i] = (cl_int)i;
+  cl_mem bufs[2];
+  for (i = 0; i < 2; ++i)
+    {
+      bufs[i] = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                size, host, &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+    }
+
+  cl_int value = 0;
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &bufs[0]));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &bufs[1]));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 2, sizeof (cl_int), &value));
+
+  cl_command_buffer_properties_khr cmdbuf_props[]
+      = { CL_COMMAND_BUFFER_FLAGS_KHR, CL_COMMAND_BUFFER_MUTABLE_KHR, 0 };
+  cl_command_buffer_khr cmdbuf
+      = createCommandBuffer (1, &queue, cmdbuf_props, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandBufferKHR");
+
+  cl_ndrange_kernel_command_properties_khr props[]
+      = { CL_MUTABLE_DISPATCH_UPDATABLE_FIELDS_KHR,
+          CL_MUTABLE_DISPATCH_ARGUMENTS_KHR
+              | CL_MUTABLE_DISPATCH_GLOBAL_OFFSET_KHR
+              | CL_MUTABLE_DISPATCH_GLOBAL_SIZE_KHR,
+          0 };
+  size_t gws = ELEMENTS;
+  cl_mutable_command_khr command = NULL;
+  CHECK_CL_ERROR (commandNDRangeKernel (cmdbuf, NULL, props, kernel, 1, NULL,
+                                        &gws, NULL, 0, NULL, NULL, &command));
+  TEST_ASSERT (command != NULL);
+  CHECK_CL_ERROR (finalizeCommandBuffer (cmdbuf));
+
+  /* in -> out, out -> in, ... with the step number as the value */
+  cl_mutable_dispatch_arg_khr args[3];
+  cl_mutable_dispatch_config_khr dispatch;
+  cl_mutable_base_config_khr config;
+  cl_int expected_sum = 0;
+  for (s = 0; s < STEPS; ++s)
+    {
+      value = (cl_int)s;
+      args[0].arg_index = 0;
+      args[0].arg_size = sizeof (cl_mem);
+      args[0].arg_value = &bufs[s % 2];
+      args[1].arg_index = 1;
+      args[1].arg_size = sizeof (cl_mem);
+      args[1].arg_value = &bufs[(s + 1) % 2];
+      args[2].arg_index = 2;
+      args[2].arg_size = sizeof (cl_int);
+      args[2].arg_value = &value;
+
+      memset (&dispatch, 0, sizeof (dispatch));
+      dispatch.type = CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR;
+      dispatch.command = command;
+      dispatch.num_args = 3;
+      dispatch.arg_list = args;
+      memset (&config, 0, sizeof (config));
+      config.type = CL_STRUCTURE_TYPE_MUTABLE_BASE_CONFIG_KHR;
+      config.num_mutable_dispatch = 1;
+      config.mutable_dispatch_list = &dispatch;
+      CHECK_CL_ERROR (updateMutableCommands (cmdbuf, &config));
+      CHECK_CL_ERROR (enqueueCommandBuffer (0, NULL, cmdbuf, 0, NULL, NULL));
+      expected_sum += (cl_int)s;
+    }
+
+  cl_int *result = (cl_int *)malloc (size);
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, bufs[STEPS % 2], CL_TRUE, 0,
+                                       size, result, 0, NULL, NULL));
+  for (i = 0; i < ELEMENTS; ++i)
+    if (result[i] != host[i] + expected_sum && errors++ < 10)
+      printf ("FAIL: time step element %u: %d instead of %d\n", i, result[i],
+              host[i] + expected_sum);
+
+  /* the second half of bufs[0] = bufs[1] + 100 */
+  value = 100;
+  args[0].arg_value = &bufs[1];
+  args[1].arg_value = &bufs[0];
+  size_t offset = ELEMENTS / 2, half = ELEMENTS / 2;
+  dispatch.global_work_offset = &offset;
+  dispatch.global_work_size = &half;
+  CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, bufs[0], CL_TRUE, 0, size,
+                                        host, 0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, bufs[1], CL_TRUE, 0, size,
+                                        host, 0, NULL, NULL));
+  CHECK_CL_ERROR (updateMutableCommands (cmdbuf, &config));
+
+  /* neither the updates with an invalid part nor the arguments set to the
+     kernel object change the command */
+  cl_int wrong_value = 1000;
+  cl_mutable_dispatch_arg_khr wrong_arg = { 2, sizeof (cl_int), &wrong_value };
+  size_t local = 1;
+  cl_mutable_dispatch_config_khr invalid[2];
+  memset (invalid, 0, sizeof (invalid));
+  invalid[0].type = CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR;
+  invalid[0].command = command;
+  invalid[0].num_args = 1;
+  invalid[0].arg_list = &wrong_arg;
+  /* the same command twice in one call */
+  invalid[1] = invalid[0];
+  config.num_mutable_dispatch = 2;
+  config.mutable_dispatch_list = invalid;
+  TEST_ASSERT (updateMutableCommands (cmdbuf, &config) == CL_INVALID_VALUE);
+  /* a local size that is not mutable */
+  invalid[0].local_work_size = &local;
+  config.num_mutable_dispatch = 1;
+  TEST_ASSERT (updateMutableCommands (cmdbuf, &config)
+               == CL_INVALID_OPERATION);
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 2, sizeof (cl_int), &wrong_value));
+
+  CHECK_CL_ERROR (enqueueCommandBuffer (0, NULL, cmdbuf, 0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, bufs[0], CL_TRUE, 0, size,
+                                       result, 0, NULL, NULL));
+  for (i = 0; i < ELEMENTS; ++i)
+    {
+      cl_int expected = i < offset ? host[i] : host[i] + 100;
+      if (result[i] != expected && errors++ < 10)
+        printf ("FAIL: offset element %u: %d instead of %d\n", i, result[i],
+                expected);
+    }
+
+  cl_uint dims;
+  size_t info_offset, info_size;
+  cl_kernel info_kernel;
+  CHECK_CL_ERROR (getMutableCommandInfo (command,
+                                         CL_MUTABLE_DISPATCH_DIMENSIONS_KHR,
+                                         sizeof (dims), &dims, NULL));
+  CHECK_CL_ERROR (getMutableCommandInfo (
+      command, CL_MUTABLE_DISPATCH_GLOBAL_WORK_OFFSET_KHR,
+      sizeof (info_offset), &info_offset, NULL));
+  CHECK_CL_ERROR (getMutableCommandInfo (
+      command, CL_MUTABLE_DISPATCH_GLOBAL_WORK_SIZE_KHR, sizeof (info_size),
+      &info_size, NULL));
+  CHECK_CL_ERROR (getMutableCommandInfo (command,
+                                         CL_MUTABLE_DISPATCH_KERNEL_KHR,
+                                         sizeof (info_kernel), &info_kernel,
+                                         NULL));
+  TEST_ASSERT (dims == 1);
+  TEST_ASSERT (info_offset == offset);
+  TEST_ASSERT (info_size == half);
+  TEST_ASSERT (info_kernel == kernel);
+
+  CHECK_CL_ERROR (releaseCommandBuffer (cmdbuf));
+  CHECK_CL_ERROR (clReleaseMemObject (bufs[0]));
+  CHECK_CL_ERROR (clReleaseMemObject (bufs[1]));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+  free (host);
+  free (result);
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+#else
+  return 77;
+#endif
+}
@@ -0,0 +1,185 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "poclu.h"
+
+/*
+  Concurrent queues test. Every device gets its own buffer and a chain of
+  kernels on its own queue, all enqueued before waiting for any of them, so
+  that the devices run at the same time. Then every device runs the kernel
+  once more on the buffer of the next device, which migrates the buffers
+  between the devices, and the results are read back and verified.
+
+  Meant to be run with several instances of the same device, for example
+  POCL_DEVICES="vortex vortex" on simx.
+*/
+
+#define ITEMS 1024
+#define ROUNDS 8
+
+static const char source[]
+    = "kernel void scale (global float *buf, float f)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  buf[i] = buf[i] * f + 1.0f;\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+  cl_platform_id platform = NULL;
+  cl_context context = NULL;
+  cl_device_id *devices = NULL;
+  cl_command_queue *queues = NULL;
+  cl_uint i, j, r, num_devices = 0;
+  cl_program program = NULL;
+  cl_kernel *kernels = NULL;
+  cl_mem *bufs = NULL;
+  cl_float *data = NULL, *expected = NULL;
+  size_t global_work_size = ITEMS;
+  cl_float factor = 2.0f;
+  int err, total_err = 0;
+
+  err = poclu_get_multiple_devices (&platform, &context, 0, &num_devices,
+                                    &devices, &queues);
+  CHECK_OPENCL_ERROR_IN ("poclu_get_multiple_devices");
+
+  printf ("NUM DEVICES: %u \n", num_devices);
+  if (num_devices < 2)
+    {
+      printf ("NOT ENOUGH DEVICES! (need 2)\n");
+      err = 77;
+      goto EARLY_EXIT;
+    }
+
+  const char *src = source;
+  program = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (
+      clBuildProgram (program, num_devices, devices, NULL, NULL, NULL));
+
+  kernels = (cl_kernel *)calloc (num_devices, sizeof (cl_kernel));
+  bufs = (cl_mem *)calloc (num_devices, sizeof (cl_mem));
+  data = (cl_float *)malloc (num_devices * ITEMS * sizeof (cl_float));
+  expected = (cl_float *)malloc (num_devices * ITEMS * sizeof (cl_float));
+
+  /* small integers, so that all the results are exact */
+  for (i = 0; i < num_devices * ITEMS; ++i)
+    data[i] = expected[i] = (cl_float)(i % 16);
+
+  for (i = 0; i < num_devices; ++i)
+    {
+      kernels[i] = clCreateKernel (program, "scale", &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+      bufs[i] = clCreateBuffer (context,
+                                CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                ITEMS * sizeof (cl_float), data + i * ITEMS,
+                                &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+      CHECK_CL_ERROR (
+          clSetKernelArg (kernels[i], 1, sizeof (cl_float), &factor));
+    }
+
+  /* independent chains, one per device and queue */
+  for (i = 0; i < num_devices; ++i)
+    {
+      CHECK_CL_ERROR (
+          clSetKernelArg (kernels[i], 0, sizeof (cl_mem), &bufs[i]));
+      for (r = 0; r < ROUNDS; ++r)
+        CHECK_CL_ERROR (clEnqueueNDRangeKernel (queues[i], kernels[i], 1,
+                                                NULL, &global_work_size, NULL,
+                                                0, NULL, NULL));
+      CHECK_CL_ERROR (clFlush (queues[i]));
+    }
+  for (i = 0; i < num_devices; ++i)
+    CHECK_CL_ERROR (clFinish (queues[i]));
+
+  /* one more round on the buffer of the next device */
+  for (i = 0; i < num_devices; ++i)
+    {
+      cl_mem next = bufs[(i + 1) % num_devices];
+      CHECK_CL_ERROR (clSetKernelArg (kernels[i], 0, sizeof (cl_mem), &next));
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queues[i], kernels[i], 1, NULL,
+                                              &global_work_size, NULL, 0, NULL,
+                                              NULL));
+    }
+  for (i = 0; i < num_devices; ++i)
+    CHECK_CL_ERROR (clFinish (queues[i]));
+
+  for (i = 0; i < num_devices; ++i)
+    CHECK_CL_ERROR (clEnqueueReadBuffer (queues[i], bufs[i], CL_TRUE, 0,
+                                         ITEMS * sizeof (cl_float),
+                                         data + i * ITEMS, 0, NULL, NULL));
+
+  for (i = 0; i < num_devices * ITEMS; ++i)
+    for (r = 0; r < ROUNDS + 1; ++r)
+      expected[i] = expected[i] * factor + 1.0f;
+
+  for (i = 0; i < num_devices; ++i)
+    {
+      err = 0;
+      for (j = 0; j < ITEMS; ++j)
+        {
+          if (data[i * ITEMS + j] != expected[i * ITEMS + j])
+            {
+              if (err < 10)
+                printf ("FAIL at DEV %u ITEM %u: EXPECTED %e ACTUAL %e\n", i,
+                        j, expected[i * ITEMS + j], data[i * ITEMS + j]);
+              ++err;
+              ++total_err;
+            }
+        }
+      if (err > 0)
+        printf ("DEV %u FAILED: %i errs\n", i, err);
+      else
+        printf ("DEV %u PASS\n", i);
+    }
+  if (total_err == 0)
+    printf ("OK\n");
+  else
+    printf ("FAIL\n");
+  err = total_err ? EXIT_FAILURE : EXIT_SUCCESS;
+
+  for (i = 0; i < num_devices; ++i)
+    {
+      CHECK_CL_ERROR (clReleaseMemObject (bufs[i]));
+      CHECK_CL_ERROR (clReleaseKernel (kernels[i]));
+    }
+  CHECK_CL_ERROR (clReleaseProgram (program));
+
+EARLY_EXIT:
+  for (i = 0; i < num_devices; ++i)
+    CHECK_CL_ERROR (clReleaseCommandQueue (queues[i]));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadPlatformCompiler (platform));
+  free (kernels);
+  free (bufs);
+  free (data);
+  free (expected);
+  free (devices);
+  free (queues);
+
+  return err;
+}
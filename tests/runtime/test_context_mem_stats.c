@@ -0,0 +1,137 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* The cl_pocl_memory_stats queries of clGetContextInfo: the current bytes,
+   the high-water mark and the allocation count of the buffers of a
+   context, as buffers are created and released. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "poclu.h"
+
+#include "include/CL/cl_ext_pocl.h"
+
+#define BIG_SIZE (1 << 20)
+#define SMALL_SIZE (1 << 16)
+
+static int
+get_stats (cl_context context, cl_context_info param,
+           cl_ulong stats[CL_MEM_CATEGORY_COUNT_POCL])
+{
+  return clGetContextInfo (context, param,
+                           sizeof (cl_ulong) * CL_MEM_CATEGORY_COUNT_POCL,
+                           stats, NULL);
+}
+
+/* Reads all three statistics of CONTEXT. */
+static int
+get_all_stats (cl_context context, cl_ulong current[],
+               cl_ulong peak[], cl_ulong allocs[])
+{
+  int err = get_stats (context, CL_CONTEXT_MEM_CURRENT_POCL, current);
+  if (err == CL_SUCCESS)
+    err = get_stats (context, CL_CONTEXT_MEM_PEAK_POCL, peak);
+  if (err == CL_SUCCESS)
+    err = get_stats (context, CL_CONTEXT_MEM_ALLOCS_POCL, allocs);
+  return err;
+}
+
+int
+main (int argc, char **argv)
+{
+  cl_context context = NULL, other_context = NULL;
+  cl_device_id device = NULL;
+  cl_command_queue queue = NULL;
+  cl_ulong current0[CL_MEM_CATEGORY_COUNT_POCL];
+  cl_ulong peak0[CL_MEM_CATEGORY_COUNT_POCL];
+  cl_ulong allocs0[CL_MEM_CATEGORY_COUNT_POCL];
+  cl_ulong current[CL_MEM_CATEGORY_COUNT_POCL];
+  cl_ulong peak[CL_MEM_CATEGORY_COUNT_POCL];
+  cl_ulong allocs[CL_MEM_CATEGORY_COUNT_POCL];
+  size_t size_ret = 0;
+  cl_int err;
+  const unsigned buf = CL_MEM_CATEGORY_BUFFER_POCL;
+  const unsigned total = CL_MEM_CATEGORY_TOTAL_POCL;
+
+  /* the statistics are collected only when enabled */
+  setenv ("POCL_MEM_STATS", "1", 1);
+
+  CHECK_CL_ERROR (poclu_get_any_device (&context, &device, &queue));
+
+  CHECK_CL_ERROR (clGetContextInfo (context, CL_CONTEXT_MEM_CURRENT_POCL, 0,
+                                    NULL, &size_ret));
+  TEST_ASSERT (size_ret == sizeof (cl_ulong) * CL_MEM_CATEGORY_COUNT_POCL);
+  TEST_ASSERT (clGetContextInfo (context, CL_CONTEXT_MEM_CURRENT_POCL,
+                                 sizeof (cl_ulong), current, NULL)
+               == CL_INVALID_VALUE);
+
+  CHECK_CL_ERROR (get_all_stats (context, current0, peak0, allocs0));
+
+  cl_mem big = clCreateBuffer (context, CL_MEM_READ_WRITE, BIG_SIZE, NULL,
+                               &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (get_all_stats (context, current, peak, allocs));
+  TEST_ASSERT (current[buf] == current0[buf] + BIG_SIZE);
+  TEST_ASSERT (peak[buf] == current0[buf] + BIG_SIZE);
+  TEST_ASSERT (allocs[buf] == allocs0[buf] + 1);
+  TEST_ASSERT (current[total] == current0[total] + BIG_SIZE);
+  TEST_ASSERT (allocs[total] == allocs0[total] + 1);
+
+  /* releasing keeps the high-water mark and the allocation count */
+  CHECK_CL_ERROR (clReleaseMemObject (big));
+  CHECK_CL_ERROR (get_all_stats (context, current, peak, allocs));
+  TEST_ASSERT (current[buf] == current0[buf]);
+  TEST_ASSERT (peak[buf] == current0[buf] + BIG_SIZE);
+  TEST_ASSERT (allocs[buf] == allocs0[buf] + 1);
+  TEST_ASSERT (current[total] == current0[total]);
+
+  /* a smaller buffer does not raise the high-water mark */
+  cl_mem small = clCreateBuffer (context, CL_MEM_READ_WRITE, SMALL_SIZE,
+                                 NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (get_all_stats (context, current, peak, allocs));
+  TEST_ASSERT (current[buf] == current0[buf] + SMALL_SIZE);
+  TEST_ASSERT (peak[buf] == current0[buf] + BIG_SIZE);
+  TEST_ASSERT (allocs[buf] == allocs0[buf] + 2);
+
+  /* the buffers of a context are not counted in another one */
+  other_context = clCreateContext (NULL, 1, &device, NULL, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateContext");
+  CHECK_CL_ERROR (get_all_stats (other_context, current, peak, allocs));
+  TEST_ASSERT (current[buf] == 0);
+  TEST_ASSERT (peak[buf] == 0);
+  TEST_ASSERT (allocs[buf] == 0);
+
+  CHECK_CL_ERROR (clReleaseMemObject (small));
+  CHECK_CL_ERROR (get_all_stats (context, current, peak, allocs));
+  TEST_ASSERT (current[buf] == current0[buf]);
+
+  CHECK_CL_ERROR (clReleaseContext (other_context));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Tests that the buffer copies with POCL_COW_BUFFER_COPY=1 behave as real
+   copies: writing either side of a copy, before or after further copies,
+   must not show in the other buffers. Every operation is also applied to
+   host-side copies of the buffers, to which all the buffers are compared
+   after each step. */
+
+#include "pocl_opencl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* large enough for the copy-on-write buffers, and the offsets below are
+   multiples of any page size */
+#define MIB (1024 * 1024)
+#define BUF_SIZE (8 * MIB)
+#define NUM_BUFS 3
+
+static cl_command_queue queue;
+static cl_mem bufs[NUM_BUFS];
+static unsigned char *expected[NUM_BUFS];
+static unsigned seed = 1;
+
+static void
+fill (unsigned char *p, size_t size)
+{
+  size_t i;
+  for (i = 0; i < size; ++i)
+    {
+      seed = seed * 1103515245 + 12345;
+      p[i] = (unsigned char)(seed >> 16);
+    }
+}
+
+static int
+write_buf (int b, size_t offset, size_t size)
+{
+  unsigned char *data = (unsigned char *)malloc (size);
+  TEST_ASSERT (data != NULL);
+  fill (data, size);
+  CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, bufs[b], CL_TRUE, offset, size,
+                                        data, 0, NULL, NULL));
+  memcpy (expected[b] + offset, data, size);
+  free (data);
+  return EXIT_SUCCESS;
+}
+
+/* writes through a mapping, i.e. directly to the host memory of the
+   buffer on the CPU devices */
+static int
+write_mapped (int b, size_t offset, size_t size)
+{
+  cl_int err;
+  unsigned char *p = (unsigned char *)clEnqueueMapBuffer (
+      queue, bufs[b], CL_TRUE, CL_MAP_WRITE, offset, size, 0, NULL, NULL,
+      &err);
+  CHECK_OPENCL_ERROR_IN ("clEnqueueMapBuffer");
+  fill (p, size);
+  memcpy (expected[b] + offset, p, size);
+  CHECK_CL_ERROR (
+      clEnqueueUnmapMemObject (queue, bufs[b], p, 0, NULL, NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  return EXIT_SUCCESS;
+}
+
+static int
+copy_buf (int dst, size_t dst_offset, int src, size_t src_offset,
+          size_t size)
+{
+  CHECK_CL_ERROR (clEnqueueCopyBuffer (queue, bufs[src], bufs[dst],
+                                       src_offset, dst_offset, size, 0, NULL,
+                                       NULL));
+  CHECK_CL_ERROR (clFinish (queue));
+  memmove (expected[dst] + dst_offset, expected[src] + src_offset, size);
+  return EXIT_SUCCESS;
+}
+
+static int
+check_bufs (const char *step)
+{
+  unsigned char *data = (unsigned char *)malloc (BUF_SIZE);
+  int b;
+  size_t i;
+
+  TEST_ASSERT (data != NULL);
+  for (b = 0; b < NUM_BUFS; ++b)
+    {
+      CHECK_CL_ERROR (clEnqueueReadBuffer (queue, bufs[b], CL_TRUE, 0,
+                                           BUF_SIZE, data, 0, NULL, NULL));
+      for (i = 0; i < BUF_SIZE; ++i)
+        if (data[i] != expected[b][i])
+          {
+            printf ("%s: byte %zu of buffer %c is %u, expected %u\n", step, i,
+                    'A' + b, data[i], expected[b][i]);
+            free (data);
+            return EXIT_FAILURE;
+          }
+    }
+  free (data);
+  return EXIT_SUCCESS;
+}
+
+#define STEP(call)                                                            \
+  do                                                                          \
+    {                                                                         \
+      if ((call) != EXIT_SUCCESS)                                             \
+        return EXIT_FAILURE;                                                  \
+    }                                                                         \
+  while (0)
+
+enum
+{
+  A,
+  B,
+  C
+};
+
+int
+main (void)
+{
+  cl_context context;
+  cl_device_id device;
+  cl_int err;
+  int b;
+
+  setenv ("POCL_COW_BUFFER_COPY", "1", 1);
+
+  CHECK_CL_ERROR (poclu_get_any_device (&context, &device, &queue));
+  TEST_ASSERT (context);
+  TEST_ASSERT (device);
+  TEST_ASSERT (queue);
+
+  for (b = 0; b < NUM_BUFS; ++b)
+    {
+      bufs[b] = clCreateBuffer (context, CL_MEM_READ_WRITE, BUF_SIZE, NULL,
+                                &err);
+      CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+      expected[b] = (unsigned char *)malloc (BUF_SIZE);
+      TEST_ASSERT (expected[b] != NULL);
+      STEP (write_buf (b, 0, BUF_SIZE));
+    }
+  STEP (check_bufs ("initial contents"));
+
+  /* writing the source must not change the copy */
+  STEP (copy_buf (B, 0, A, 0, BUF_SIZE));
+  STEP (write_buf (A, MIB + 100, 5000));
+  STEP (write_mapped (A, 3 * MIB, MIB));
+  STEP (check_bufs ("write the source after a copy"));
+
+  /* nor writing the copy the source */
+  STEP (copy_buf (B, 0, A, 0, BUF_SIZE));
+  STEP (write_buf (B, 0, 10));
+  STEP (write_mapped (B, 5 * MIB - 7, 20));
+  STEP (check_bufs ("write the destination after a copy"));
+
+  /* a copy of a copy, with writes to all three in between and after */
+  STEP (write_buf (A, 0, BUF_SIZE));
+  STEP (copy_buf (B, 0, A, 0, BUF_SIZE));
+  STEP (write_buf (B, 2 * MIB, 4096));
+  STEP (write_buf (A, 2 * MIB + 4096, 4096));
+  STEP (copy_buf (C, 0, B, 0, BUF_SIZE));
+  STEP (write_mapped (B, 6 * MIB, 12345));
+  STEP (write_buf (A, 6 * MIB, 100));
+  STEP (write_buf (C, 7 * MIB, 64));
+  STEP (check_bufs ("chained copies"));
+
+  /* and a copy of the chain back to its start */
+  STEP (copy_buf (A, 0, C, 0, BUF_SIZE));
+  STEP (write_buf (C, 0, BUF_SIZE / 2));
+  STEP (check_bufs ("copy back to the first buffer"));
+
+  /* sub-ranges at page-aligned offsets, with a partial last page */
+  STEP (copy_buf (B, 4 * MIB, A, MIB, 3 * MIB + 100));
+  STEP (write_buf (A, MIB, 64));
+  STEP (write_buf (B, 7 * MIB - 32, 64));
+  STEP (check_bufs ("sub-range copy"));
+
+  STEP (copy_buf (C, 2 * MIB, C, 5 * MIB, 2 * MIB));
+  STEP (write_mapped (C, 5 * MIB, 4096));
+  STEP (write_buf (C, 3 * MIB, 4096));
+  STEP (check_bufs ("sub-range copy within a buffer"));
+
+  for (b = 0; b < NUM_BUFS; ++b)
+    {
+      CHECK_CL_ERROR (clReleaseMemObject (bufs[b]));
+      free (expected[b]);
+    }
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
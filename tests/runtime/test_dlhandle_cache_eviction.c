@@ -0,0 +1,158 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Launches the same kernel with and without aliased buffer arguments, with
+   several specialized argument values and local sizes, on two queues
+   without waiting in between, while only two WG functions may stay loaded.
+   Every launch must keep the WG function it uses loaded until it is done,
+   and release the reference of that one only. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "poclu.h"
+
+#define ITEMS 256
+#define ROUNDS 4
+#define NUM_VALUES 3
+#define NUM_LOCAL_SIZES 2
+#define LAUNCHES (ROUNDS * NUM_VALUES * NUM_LOCAL_SIZES * 2)
+
+static const char source[]
+    = "kernel void axpb (global int *out, global const int *in, int a,\n"
+      "                  int b)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[i] * a + b;\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+  cl_context context = NULL;
+  cl_device_id device = NULL;
+  cl_command_queue queues[2] = { NULL, NULL };
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem in_buf = NULL, bufs[LAUNCHES];
+  cl_int in[ITEMS], out[ITEMS];
+  /* a, b */
+  const cl_int values[NUM_VALUES][2] = { { 2, 1 }, { 3, -1 }, { -7, 0 } };
+  const size_t local_sizes[NUM_LOCAL_SIZES] = { 16, 32 };
+  cl_int launch_values[LAUNCHES][2];
+  size_t global_work_size = ITEMS;
+  unsigned i, l = 0, r, v, s;
+  int err, errors = 0;
+
+  setenv ("POCL_MAX_WORK_GROUP_FUNCTIONS", "2", 1);
+  setenv ("POCL_MAX_ARG_SPECIALIZATIONS", "2", 1);
+
+  err = poclu_get_any_device (&context, &device, &queues[0]);
+  CHECK_OPENCL_ERROR_IN ("poclu_get_any_device");
+  queues[1] = clCreateCommandQueue (context, device, 0, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandQueue");
+
+  const char *src = source;
+  program = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (clBuildProgram (program, 1, &device,
+                                  "-pocl-specialize-args=a,b", NULL, NULL));
+  kernel = clCreateKernel (program, "axpb", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  for (i = 0; i < ITEMS; ++i)
+    in[i] = (cl_int)i - ITEMS / 2;
+  in_buf = clCreateBuffer (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                           sizeof (in), in, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  /* Every launch writes its own buffer. The odd ones compute it in place,
+     so their arguments alias, the even ones read in_buf. */
+  for (r = 0; r < ROUNDS; ++r)
+    for (v = 0; v < NUM_VALUES; ++v)
+      for (s = 0; s < NUM_LOCAL_SIZES; ++s)
+        {
+          unsigned aliased;
+          for (aliased = 0; aliased < 2; ++aliased, ++l)
+            {
+              cl_command_queue queue = queues[l % 2];
+              bufs[l] = clCreateBuffer (context,
+                                        CL_MEM_READ_WRITE
+                                            | CL_MEM_COPY_HOST_PTR,
+                                        sizeof (in), in, &err);
+              CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+              launch_values[l][0] = values[v][0];
+              launch_values[l][1] = values[v][1];
+
+              CHECK_CL_ERROR (
+                  clSetKernelArg (kernel, 0, sizeof (cl_mem), &bufs[l]));
+              CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem),
+                                              aliased ? &bufs[l] : &in_buf));
+              CHECK_CL_ERROR (
+                  clSetKernelArg (kernel, 2, sizeof (cl_int), &values[v][0]));
+              CHECK_CL_ERROR (
+                  clSetKernelArg (kernel, 3, sizeof (cl_int), &values[v][1]));
+              CHECK_CL_ERROR (clEnqueueNDRangeKernel (
+                  queue, kernel, 1, NULL, &global_work_size, &local_sizes[s],
+                  0, NULL, NULL));
+              CHECK_CL_ERROR (clFlush (queue));
+            }
+        }
+
+  CHECK_CL_ERROR (clFinish (queues[0]));
+  CHECK_CL_ERROR (clFinish (queues[1]));
+
+  for (l = 0; l < LAUNCHES; ++l)
+    {
+      CHECK_CL_ERROR (clEnqueueReadBuffer (queues[0], bufs[l], CL_TRUE, 0,
+                                           sizeof (out), out, 0, NULL, NULL));
+      for (i = 0; i < ITEMS; ++i)
+        {
+          cl_int expected = in[i] * launch_values[l][0] + launch_values[l][1];
+          if (out[i] != expected)
+            {
+              if (errors < 10)
+                printf ("launch %u: out[%u] = %d, expected %d\n", l, i,
+                        out[i], expected);
+              ++errors;
+            }
+        }
+      CHECK_CL_ERROR (clReleaseMemObject (bufs[l]));
+    }
+
+  CHECK_CL_ERROR (clReleaseMemObject (in_buf));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queues[0]));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queues[1]));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Enqueues chains of small commands, which the pthread driver runs on the
+   enqueuing thread when they are ready (POCL_INLINE_COMMANDS), and checks
+   that the event statuses, the completion callbacks and the in-order
+   execution stay correct. The second chain starts with a user event in the
+   wait list, so none of it may run before the user event is completed. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "poclu.h"
+
+#define ITEMS 64
+#define CHAIN 6
+#define ADDS 3
+
+static const char source[]
+    = "kernel void add1 (global int *buf, int n)\n"
+      "{\n"
+      "  for (int i = 0; i < n; ++i)\n"
+      "    buf[i] += 1;\n"
+      "}\n";
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int completions[2 * CHAIN];
+static int num_completions = 0;
+
+static void CL_CALLBACK
+complete_callback (cl_event event, cl_int status, void *user_data)
+{
+  int i = (int)(intptr_t)user_data;
+  pthread_mutex_lock (&lock);
+  if (status == CL_COMPLETE)
+    ++completions[i];
+  ++num_completions;
+  pthread_mutex_unlock (&lock);
+}
+
+static int
+callback_count ()
+{
+  int n;
+  pthread_mutex_lock (&lock);
+  n = num_completions;
+  pthread_mutex_unlock (&lock);
+  return n;
+}
+
+/* Waits for up to 10 seconds for COUNT callbacks in total. */
+static int
+wait_for_callbacks (int count)
+{
+  int i;
+  for (i = 0; i < 1000 && callback_count () < count; ++i)
+    usleep (10000);
+  return callback_count ();
+}
+
+/* Checks that the events completed and ran in order. */
+static int
+check_chain (const char *name, cl_event *events, int first)
+{
+  cl_ulong prev_end = 0;
+  int i, errors = 0;
+  for (i = 0; i < CHAIN; ++i)
+    {
+      cl_int status;
+      cl_ulong start, end;
+      CHECK_CL_ERROR (clGetEventInfo (events[i],
+                                      CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                      sizeof (status), &status, NULL));
+      CHECK_CL_ERROR (clGetEventProfilingInfo (
+          events[i], CL_PROFILING_COMMAND_START, sizeof (start), &start,
+          NULL));
+      CHECK_CL_ERROR (clGetEventProfilingInfo (
+          events[i], CL_PROFILING_COMMAND_END, sizeof (end), &end, NULL));
+      if (status != CL_COMPLETE)
+        {
+          printf ("%s: command %d has status %d\n", name, i, status);
+          ++errors;
+        }
+      if (start < prev_end)
+        {
+          printf ("%s: command %d started before the previous one "
+                  "ended\n",
+                  name, i);
+          ++errors;
+        }
+      prev_end = end;
+      pthread_mutex_lock (&lock);
+      if (completions[first + i] != 1)
+        {
+          printf ("%s: command %d got %d CL_COMPLETE callbacks\n", name, i,
+                  completions[first + i]);
+          ++errors;
+        }
+      pthread_mutex_unlock (&lock);
+    }
+  return errors;
+}
+
+/* Enqueues a write of INPUT to BUF (after WAIT_EVENT, if not NULL), ADDS
+   launches of KERNEL on it, a copy to BUF2 and a non-blocking read of BUF2
+   to OUTPUT. */
+static int
+enqueue_chain (cl_command_queue queue, cl_kernel kernel, cl_mem buf,
+               cl_mem buf2, const cl_int *input, cl_int *output,
+               cl_event wait_event, cl_event *events, int first)
+{
+  size_t one = 1, bytes = ITEMS * sizeof (cl_int);
+  int i, e = 0;
+
+  CHECK_CL_ERROR (clEnqueueWriteBuffer (queue, buf, CL_FALSE, 0, bytes,
+                                        input, wait_event ? 1 : 0,
+                                        wait_event ? &wait_event : NULL,
+                                        &events[e++]));
+  for (i = 0; i < ADDS; ++i)
+    CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &one,
+                                            &one, 0, NULL, &events[e++]));
+  CHECK_CL_ERROR (clEnqueueCopyBuffer (queue, buf, buf2, 0, 0, bytes, 0,
+                                       NULL, &events[e++]));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, buf2, CL_FALSE, 0, bytes,
+                                       output, 0, NULL, &events[e++]));
+  for (i = 0; i < CHAIN; ++i)
+    CHECK_CL_ERROR (clSetEventCallback (events[i], CL_COMPLETE,
+                                        complete_callback,
+                                        (void *)(intptr_t)(first + i)));
+  return CL_SUCCESS;
+}
+
+static int
+check_output (const char *name, const cl_int *input, const cl_int *output)
+{
+  int i, errors = 0;
+  for (i = 0; i < ITEMS; ++i)
+    if (output[i] != input[i] + ADDS)
+      {
+        if (errors < 10)
+          printf ("%s: output[%d] = %d, expected %d\n", name, i, output[i],
+                  input[i] + ADDS);
+        ++errors;
+      }
+  return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  cl_platform_id platform = NULL;
+  cl_context context = NULL;
+  cl_device_id device = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem buf = NULL, buf2 = NULL;
+  cl_event events[2 * CHAIN], user_event = NULL;
+  cl_int input[ITEMS], output[ITEMS], n = ITEMS;
+  int i, err, errors = 0;
+
+  setenv ("POCL_INLINE_COMMANDS", "1", 1);
+
+  CHECK_CL_ERROR (clGetPlatformIDs (1, &platform, NULL));
+  CHECK_CL_ERROR (
+      clGetDeviceIDs (platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL));
+  context = clCreateContext (NULL, 1, &device, NULL, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateContext");
+  queue = clCreateCommandQueue (context, device, CL_QUEUE_PROFILING_ENABLE,
+                                &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandQueue");
+
+  const char *src = source;
+  program = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (clBuildProgram (program, 1, &device, NULL, NULL, NULL));
+  kernel = clCreateKernel (program, "add1", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  buf = clCreateBuffer (context, CL_MEM_READ_WRITE, sizeof (input), NULL,
+                        &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  buf2 = clCreateBuffer (context, CL_MEM_READ_WRITE, sizeof (input), NULL,
+                         &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &buf));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_int), &n));
+
+  /* Everything is ready at enqueue time. */
+  for (i = 0; i < ITEMS; ++i)
+    input[i] = i;
+  memset (output, 0, sizeof (output));
+  CHECK_CL_ERROR (enqueue_chain (queue, kernel, buf, buf2, input, output,
+                                 NULL, events, 0));
+  CHECK_CL_ERROR (clWaitForEvents (1, &events[CHAIN - 1]));
+  errors += check_output ("ready chain", input, output);
+  if (wait_for_callbacks (CHAIN) != CHAIN)
+    {
+      printf ("ready chain: missing callbacks\n");
+      ++errors;
+    }
+  errors += check_chain ("ready chain", events, 0);
+
+  /* The chain waits for a user event. */
+  user_event = clCreateUserEvent (context, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateUserEvent");
+  for (i = 0; i < ITEMS; ++i)
+    input[i] = 1000 - i;
+  memset (output, 0, sizeof (output));
+  CHECK_CL_ERROR (enqueue_chain (queue, kernel, buf, buf2, input, output,
+                                 user_event, events + CHAIN, CHAIN));
+  CHECK_CL_ERROR (clFlush (queue));
+  usleep (100000);
+  for (i = 0; i < CHAIN; ++i)
+    {
+      cl_int status;
+      CHECK_CL_ERROR (clGetEventInfo (events[CHAIN + i],
+                                      CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                      sizeof (status), &status, NULL));
+      if (status == CL_COMPLETE)
+        {
+          printf ("user event chain: command %d completed before the user "
+                  "event\n",
+                  i);
+          ++errors;
+        }
+    }
+  if (callback_count () != CHAIN)
+    {
+      printf ("user event chain: callbacks before the user event\n");
+      ++errors;
+    }
+  if (output[0] != 0)
+    {
+      printf ("user event chain: the read ran before the user event\n");
+      ++errors;
+    }
+
+  CHECK_CL_ERROR (clSetUserEventStatus (user_event, CL_COMPLETE));
+  CHECK_CL_ERROR (clWaitForEvents (1, &events[2 * CHAIN - 1]));
+  errors += check_output ("user event chain", input, output);
+  if (wait_for_callbacks (2 * CHAIN) != 2 * CHAIN)
+    {
+      printf ("user event chain: missing callbacks\n");
+      ++errors;
+    }
+  errors += check_chain ("user event chain", events + CHAIN, CHAIN);
+
+  CHECK_CL_ERROR (clFinish (queue));
+  for (i = 0; i < 2 * CHAIN; ++i)
+    CHECK_CL_ERROR (clReleaseEvent (events[i]));
+  CHECK_CL_ERROR (clReleaseEvent (user_event));
+  CHECK_CL_ERROR (clReleaseMemObject (buf));
+  CHECK_CL_ERROR (clReleaseMemObject (buf2));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
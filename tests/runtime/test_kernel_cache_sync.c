@@ -0,0 +1,216 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Writes files from several threads with POCL_KERNEL_CACHE_SYNC=batch and
+   checks that each of them is in place and complete once its writer
+   returns, and that no temporary files are left behind. */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pocl_export.h"
+#include "pocl_file_util.h"
+
+#define WRITERS 8
+#define FILES_PER_WRITER 16
+
+static char dir[] = "/tmp/pocl_cache_sync_XXXXXX";
+
+static void
+file_path (char *path, size_t size, unsigned writer, unsigned file)
+{
+  snprintf (path, size, "%s/w%u_f%u.bin", dir, writer, file);
+}
+
+/* A different size and content for every file. */
+static size_t
+file_size (unsigned writer, unsigned file)
+{
+  return 4096 * (1 + file % 5) + writer * 17 + file;
+}
+
+static char
+file_byte (unsigned writer, unsigned file, size_t i)
+{
+  return (char)(i * 31 + writer * 7 + file * 13);
+}
+
+static int
+write_one (unsigned writer, unsigned file)
+{
+  char path[256];
+  size_t size = file_size (writer, file);
+  char *content = malloc (size);
+  size_t i;
+
+  if (content == NULL)
+    return -1;
+  for (i = 0; i < size; ++i)
+    content[i] = file_byte (writer, file, i);
+  file_path (path, sizeof (path), writer, file);
+  int err = pocl_write_file (path, content, size, 0, 0);
+  free (content);
+  return err;
+}
+
+/* Returns the number of the files of the writer that are not complete. */
+static unsigned
+check_writer (unsigned writer, unsigned files)
+{
+  unsigned file, errors = 0;
+  for (file = 0; file < files; ++file)
+    {
+      char path[256];
+      char *content = NULL;
+      uint64_t size = 0;
+      size_t i;
+
+      file_path (path, sizeof (path), writer, file);
+      if (pocl_read_file (path, &content, &size) != 0)
+        {
+          printf ("FAIL: cannot read %s\n", path);
+          ++errors;
+          continue;
+        }
+      if (size != file_size (writer, file))
+        {
+          printf ("FAIL: %s has %llu bytes instead of %zu\n", path,
+                  (unsigned long long)size, file_size (writer, file));
+          ++errors;
+        }
+      else
+        for (i = 0; i < size; ++i)
+          if (content[i] != file_byte (writer, file, i))
+            {
+              printf ("FAIL: %s differs at byte %zu\n", path, i);
+              ++errors;
+              break;
+            }
+      free (content);
+    }
+  return errors;
+}
+
+static void *
+writer_func (void *arg)
+{
+  unsigned writer = (unsigned)(uintptr_t)arg;
+  unsigned file;
+  uintptr_t errors = 0;
+
+  for (file = 0; file < FILES_PER_WRITER; ++file)
+    {
+      if (write_one (writer, file) != 0)
+        {
+          printf ("FAIL: writer %u could not write file %u\n", writer, file);
+          ++errors;
+        }
+      /* the files written so far must be complete already */
+      errors += check_writer (writer, file + 1);
+    }
+  return (void *)errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  pthread_t threads[WRITERS];
+  unsigned i, errors = 0;
+
+  setenv ("POCL_KERNEL_CACHE_SYNC", "batch", 1);
+  if (mkdtemp (dir) == NULL)
+    {
+      perror ("mkdtemp");
+      return EXIT_FAILURE;
+    }
+
+  /* a batch of a single file */
+  if (write_one (WRITERS, 0) != 0)
+    {
+      printf ("FAIL: could not write a single file\n");
+      ++errors;
+    }
+  errors += check_writer (WRITERS, 1);
+
+  /* batches of the files of concurrent writers */
+  for (i = 0; i < WRITERS; ++i)
+    if (pthread_create (&threads[i], NULL, writer_func,
+                        (void *)(uintptr_t)i))
+      {
+        perror ("pthread_create");
+        return EXIT_FAILURE;
+      }
+  for (i = 0; i < WRITERS; ++i)
+    {
+      void *ret;
+      pthread_join (threads[i], &ret);
+      errors += (unsigned)(uintptr_t)ret;
+    }
+
+  /* only the final files, no temporary ones */
+  unsigned entries = 0;
+  DIR *d = opendir (dir);
+  struct dirent *entry;
+  if (d == NULL)
+    {
+      perror ("opendir");
+      return EXIT_FAILURE;
+    }
+  while ((entry = readdir (d)) != NULL)
+    {
+      char path[512];
+      if (strcmp (entry->d_name, ".") == 0
+          || strcmp (entry->d_name, "..") == 0)
+        continue;
+      if (strstr (entry->d_name, ".temp") != NULL)
+        {
+          printf ("FAIL: temporary file %s left behind\n", entry->d_name);
+          ++errors;
+        }
+      ++entries;
+      snprintf (path, sizeof (path), "%s/%s", dir, entry->d_name);
+      pocl_remove (path);
+    }
+  closedir (d);
+  pocl_remove (dir);
+
+  if (entries != WRITERS * FILES_PER_WRITER + 1)
+    {
+      printf ("FAIL: %u files instead of %u\n", entries,
+              WRITERS * FILES_PER_WRITER + 1);
+      ++errors;
+    }
+
+  if (errors)
+    {
+      printf ("FAIL: %u errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Round trips of the kernel cache file codec of the pocl binaries, and its
+   handling of incompressible and corrupt data. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pocl_compress.h"
+
+static uint32_t rng_state = 12345;
+
+static unsigned char
+next_random ()
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return (unsigned char)rng_state;
+}
+
+/* Compresses and decompresses SIZE bytes of DATA. Returns the compressed
+   size, or 0 after printing the error. */
+static size_t
+round_trip (const char *name, const unsigned char *data, size_t size)
+{
+  /* the worst case of the format: all literals */
+  size_t capacity = size + size / 255 + 16;
+  unsigned char *compressed = (unsigned char *)malloc (capacity);
+  unsigned char *restored = (unsigned char *)malloc (size + 1);
+  size_t stored = pocl_compress (data, size, compressed, capacity);
+
+  if (stored == 0)
+    printf ("FAIL: %s: %zu bytes did not compress into %zu\n", name, size,
+            capacity);
+  else if (pocl_decompress (compressed, stored, restored, size) != 0)
+    {
+      printf ("FAIL: %s: decompressing %zu bytes failed\n", name, size);
+      stored = 0;
+    }
+  else if (memcmp (restored, data, size) != 0)
+    {
+      printf ("FAIL: %s: %zu bytes changed in the round trip\n", name, size);
+      stored = 0;
+    }
+  /* a wrong raw size is corrupt input */
+  else if (pocl_decompress (compressed, stored, restored, size + 1) == 0
+           || (size > 0
+               && pocl_decompress (compressed, stored, restored, size - 1)
+                      == 0))
+    {
+      printf ("FAIL: %s: decompressing to a wrong size succeeded\n", name);
+      stored = 0;
+    }
+
+  free (compressed);
+  free (restored);
+  return stored;
+}
+
+int
+main (void)
+{
+  const size_t size = 1 << 20;
+  unsigned char *data = (unsigned char *)malloc (size);
+  unsigned char *out = (unsigned char *)malloc (size);
+  size_t i, stored;
+  int errors = 0;
+
+  /* the sizes around the shortest input that can have a match */
+  for (i = 0; i < 40; ++i)
+    {
+      memset (data, 'a', i);
+      errors += round_trip ("short", data, i) == 0;
+    }
+
+  /* long matches with overlapping copies */
+  memset (data, 0, size);
+  stored = round_trip ("zeros", data, size);
+  if (stored == 0 || stored > size / 100)
+    {
+      printf ("FAIL: zeros: %zu bytes compressed into %zu\n", size, stored);
+      ++errors;
+    }
+
+  /* text-like data with repeats at all distances */
+  const char *words[] = { "kernel ", "void ", "global ", "float ",
+                          "get_global_id ", "barrier ", "(0);\n", "int " };
+  for (i = 0; i < size;)
+    {
+      const char *w = words[next_random () % 8];
+      size_t len = strlen (w);
+      if (len > size - i)
+        len = size - i;
+      memcpy (data + i, w, len);
+      i += len;
+    }
+  stored = round_trip ("text", data, size);
+  if (stored == 0 || stored > size / 2)
+    {
+      printf ("FAIL: text: %zu bytes compressed into %zu\n", size, stored);
+      ++errors;
+    }
+
+  /* random blocks repeated both within and beyond the largest match
+     offset */
+  for (i = 0; i < size; ++i)
+    data[i] = next_random ();
+  memcpy (data + 65535, data, 4096);
+  memcpy (data + 300000, data + 200000, 4096);
+  errors += round_trip ("repeated random", data, size) == 0;
+
+  /* incompressible: the binary stores the file as it is when it does not
+     fit in one byte less than the raw size */
+  for (i = 0; i < size; ++i)
+    data[i] = next_random ();
+  errors += round_trip ("random", data, size) == 0;
+  if (pocl_compress (data, size, out, size - 1) != 0)
+    {
+      printf ("FAIL: random data compressed below its size\n");
+      ++errors;
+    }
+
+  /* truncated and damaged input must fail without overrunning the
+     buffers */
+  memset (data, 'x', size);
+  unsigned char *compressed = (unsigned char *)malloc (size);
+  stored = pocl_compress (data, size, compressed, size);
+  if (stored < 4 || pocl_decompress (compressed, stored - 1, out, size) == 0)
+    {
+      printf ("FAIL: truncated input was accepted\n");
+      ++errors;
+    }
+  /* an offset reaching before the start of the output */
+  compressed[0] = 0x00;
+  compressed[1] = 0xff;
+  compressed[2] = 0xff;
+  if (pocl_decompress (compressed, 3, out, 4) == 0)
+    {
+      printf ("FAIL: an out of range offset was accepted\n");
+      ++errors;
+    }
+  free (compressed);
+
+  free (data);
+  free (out);
+  if (errors)
+    return EXIT_FAILURE;
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
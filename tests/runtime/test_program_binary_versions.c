@@ -0,0 +1,206 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Tests that the programs created from pocl binaries run, with the kernel
+   files stored compressed or as they are, and in the layouts of the older
+   supported binary format versions. */
+
+#include "pocl_opencl.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 256
+
+/* the offsets of the fields in the pocl binary header */
+#define POCLBIN_VERSION_OFFSET 16
+#define POCLBIN_FLAGS_OFFSET 24
+#define POCLBIN_FLAG_COMPRESSED (1 << 2)
+
+/* the header is little-endian */
+static uint64_t
+read_le (const unsigned char *p, unsigned bytes)
+{
+  uint64_t v = 0;
+  while (bytes--)
+    v = (v << 8) | p[bytes];
+  return v;
+}
+
+static void
+write_le (unsigned char *p, uint64_t v, unsigned bytes)
+{
+  unsigned i;
+  for (i = 0; i < bytes; ++i, v >>= 8)
+    p[i] = (unsigned char)v;
+}
+
+static const char *source
+    = "kernel void scale (global const int *in, global int *out, int k)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[i] * k + (int)i;\n"
+      "}\n";
+
+static int
+get_binary (cl_context context, cl_device_id device, unsigned char **binary,
+            size_t *size)
+{
+  cl_int err;
+  cl_program program
+      = clCreateProgramWithSource (context, 1, &source, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (clBuildProgram (program, 0, NULL, NULL, NULL, NULL));
+
+  CHECK_CL_ERROR (clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES,
+                                    sizeof (size_t), size, NULL));
+  *binary = (unsigned char *)malloc (*size);
+  TEST_ASSERT (*binary != NULL);
+  CHECK_CL_ERROR (clGetProgramInfo (program, CL_PROGRAM_BINARIES,
+                                    sizeof (unsigned char *), binary, NULL));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  return EXIT_SUCCESS;
+}
+
+/* Creates a program from the binary, runs its kernel and checks the
+   results. */
+static int
+run_binary (const char *name, cl_context context, cl_device_id device,
+            cl_command_queue queue, const unsigned char *binary, size_t size)
+{
+  cl_int err, binary_status;
+  int in[N], out[N];
+  size_t i, global = N;
+  int k = 3;
+
+  for (i = 0; i < N; ++i)
+    in[i] = (int)i - 100;
+  memset (out, 0, sizeof (out));
+
+  cl_program program = clCreateProgramWithBinary (
+      context, 1, &device, &size, &binary, &binary_status, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithBinary");
+  CHECK_CL_ERROR (binary_status);
+  CHECK_CL_ERROR (clBuildProgram (program, 0, NULL, NULL, NULL, NULL));
+
+  cl_kernel kernel = clCreateKernel (program, "scale", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  cl_mem in_buf = clCreateBuffer (context, CL_MEM_READ_ONLY
+                                  | CL_MEM_COPY_HOST_PTR, sizeof (in), in,
+                                  &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  cl_mem out_buf
+      = clCreateBuffer (context, CL_MEM_WRITE_ONLY, sizeof (out), NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_buf));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &out_buf));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 2, sizeof (int), &k));
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &global,
+                                          NULL, 0, NULL, NULL));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, out_buf, CL_TRUE, 0,
+                                       sizeof (out), out, 0, NULL, NULL));
+
+  CHECK_CL_ERROR (clReleaseMemObject (in_buf));
+  CHECK_CL_ERROR (clReleaseMemObject (out_buf));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+
+  for (i = 0; i < N; ++i)
+    {
+      if (out[i] != in[i] * k + (int)i)
+        {
+          printf ("%s: element %zu is %d, expected %d\n", name, i, out[i],
+                  in[i] * k + (int)i);
+          return EXIT_FAILURE;
+        }
+    }
+  return EXIT_SUCCESS;
+}
+
+int
+main (void)
+{
+  cl_context context;
+  cl_device_id device;
+  cl_command_queue queue;
+  unsigned char *binary, *compressed;
+  size_t size, compressed_size;
+  uint32_t version;
+  uint64_t flags;
+
+  /* unpack every binary into a fresh cache directory */
+  setenv ("POCL_KERNEL_CACHE", "0", 1);
+  unsetenv ("POCL_BINARY_COMPRESSION");
+
+  CHECK_CL_ERROR (poclu_get_any_device (&context, &device, &queue));
+  TEST_ASSERT (context);
+  TEST_ASSERT (device);
+  TEST_ASSERT (queue);
+
+  if (get_binary (context, device, &binary, &size) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  if (size < POCLBIN_FLAGS_OFFSET + sizeof (flags)
+      || memcmp (binary, "poclbin", 7) != 0)
+    {
+      printf ("The device does not produce pocl binaries, skipping\n");
+      return 77;
+    }
+
+  flags = read_le (binary + POCLBIN_FLAGS_OFFSET, sizeof (flags));
+  TEST_ASSERT ((flags & POCLBIN_FLAG_COMPRESSED) == 0);
+  if (run_binary ("uncompressed", context, device, queue, binary, size))
+    return EXIT_FAILURE;
+
+  /* version 11 has no compression and version 12 no required sub-group
+     sizes; the binaries that use neither have the same layout */
+  for (version = 11; version <= 12; ++version)
+    {
+      char name[32];
+      write_le (binary + POCLBIN_VERSION_OFFSET, version, sizeof (version));
+      snprintf (name, sizeof (name), "version %u", version);
+      if (run_binary (name, context, device, queue, binary, size))
+        return EXIT_FAILURE;
+    }
+
+  setenv ("POCL_BINARY_COMPRESSION", "1", 1);
+  if (get_binary (context, device, &compressed, &compressed_size)
+      != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  flags = read_le (compressed + POCLBIN_FLAGS_OFFSET, sizeof (flags));
+  TEST_ASSERT ((flags & POCLBIN_FLAG_COMPRESSED) != 0);
+  if (run_binary ("compressed", context, device, queue, compressed,
+                  compressed_size))
+    return EXIT_FAILURE;
+
+  free (binary);
+  free (compressed);
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
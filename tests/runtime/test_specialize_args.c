@@ -0,0 +1,128 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Launches a kernel built with -pocl-specialize-args with several
+   different values of the selected arguments, and again with the first
+   ones, and checks every result. The number of specializations is limited
+   to two, so the later combinations use the generic WG function, while the
+   repeated one reuses its specialized version. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "poclu.h"
+
+#define ITEMS 256
+
+static const char source[]
+    = "kernel void axpb (global int *out, global const int *in, int a,\n"
+      "                  int b)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  out[i] = in[i] * a + b;\n"
+      "}\n";
+
+int
+main (int argc, char **argv)
+{
+  cl_context context = NULL;
+  cl_device_id device = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem in_buf = NULL, out_buf = NULL;
+  cl_int in[ITEMS], out[ITEMS];
+  size_t global_work_size = ITEMS;
+  /* a, b */
+  const cl_int values[][2] = { { 2, 1 }, { 3, 1 }, { 2, 5 }, { -7, 0 },
+                               { 2, 1 }, { 3, 1 } };
+  unsigned i, v;
+  int err, errors = 0;
+
+  setenv ("POCL_MAX_ARG_SPECIALIZATIONS", "2", 1);
+
+  err = poclu_get_any_device (&context, &device, &queue);
+  CHECK_OPENCL_ERROR_IN ("poclu_get_any_device");
+
+  const char *src = source;
+  program = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (clBuildProgram (program, 1, &device,
+                                  "-pocl-specialize-args=a,b", NULL, NULL));
+  kernel = clCreateKernel (program, "axpb", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  for (i = 0; i < ITEMS; ++i)
+    in[i] = (cl_int)i - ITEMS / 2;
+
+  in_buf = clCreateBuffer (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                           sizeof (in), in, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  out_buf = clCreateBuffer (context, CL_MEM_WRITE_ONLY, sizeof (out), NULL,
+                            &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &out_buf));
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &in_buf));
+
+  for (v = 0; v < sizeof (values) / sizeof (values[0]); ++v)
+    {
+      CHECK_CL_ERROR (
+          clSetKernelArg (kernel, 2, sizeof (cl_int), &values[v][0]));
+      CHECK_CL_ERROR (
+          clSetKernelArg (kernel, 3, sizeof (cl_int), &values[v][1]));
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL,
+                                              &global_work_size, NULL, 0,
+                                              NULL, NULL));
+      CHECK_CL_ERROR (clEnqueueReadBuffer (queue, out_buf, CL_TRUE, 0,
+                                           sizeof (out), out, 0, NULL, NULL));
+      for (i = 0; i < ITEMS; ++i)
+        {
+          cl_int expected = in[i] * values[v][0] + values[v][1];
+          if (out[i] != expected)
+            {
+              if (errors < 10)
+                printf ("launch %u (a=%d, b=%d): out[%u] = %d, expected "
+                        "%d\n",
+                        v, values[v][0], values[v][1], i, out[i], expected);
+              ++errors;
+            }
+        }
+    }
+
+  CHECK_CL_ERROR (clReleaseMemObject (in_buf));
+  CHECK_CL_ERROR (clReleaseMemObject (out_buf));
+  CHECK_CL_ERROR (clReleaseKernel (kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
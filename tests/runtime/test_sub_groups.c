@@ -0,0 +1,209 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* The sub-groups of the CPU devices: clGetKernelSubGroupInfo and the
+   kernel-side sub-group functions must agree, for local x sizes the
+   sub-group size divides and ones it does not, with the native size and
+   with intel_reqd_sub_group_size. The sub-groups tile each row of the
+   local x dimension, so the last one of a row can be partial. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poclu.h"
+
+/* the native sub-group size, set with POCL_CPU_SUB_GROUP_SIZE */
+#define NATIVE_SIZE 4
+#define REQD_SIZE 3
+#define NUM_GROUPS 2
+/* the values each work-item records */
+#define FIELDS 5
+
+static const char source[]
+    = "void record (global uint *out)\n"
+      "{\n"
+      "  size_t i = get_global_id (1) * get_global_size (0)\n"
+      "             + get_global_id (0);\n"
+      "  out[i * 5] = get_sub_group_size ();\n"
+      "  out[i * 5 + 1] = get_max_sub_group_size ();\n"
+      "  out[i * 5 + 2] = get_num_sub_groups ();\n"
+      "  out[i * 5 + 3] = get_sub_group_id ();\n"
+      "  out[i * 5 + 4] = get_sub_group_local_id ();\n"
+      "}\n"
+      "kernel void native_size (global uint *out)\n"
+      "{\n"
+      "  record (out);\n"
+      "}\n"
+      "kernel __attribute__ ((intel_reqd_sub_group_size (3)))\n"
+      "void reqd_size (global uint *out)\n"
+      "{\n"
+      "  record (out);\n"
+      "}\n";
+
+/* Runs KERNEL with the local size LX x LY, and checks the sub-group size
+   SG_SIZE of it against the host queries and the kernel-side functions.
+   Returns the number of errors. */
+static int
+check_sub_groups (cl_context context, cl_device_id device,
+                  cl_command_queue queue, cl_kernel kernel,
+                  const char *name, size_t lx, size_t ly, size_t sg_size)
+{
+  size_t local[2] = { lx, ly };
+  size_t global[2] = { lx * NUM_GROUPS, ly };
+  size_t items = global[0] * global[1];
+  size_t per_row = (lx + sg_size - 1) / sg_size;
+  size_t num_sub_groups = per_row * ly;
+  size_t max_size = 0, count = 0;
+  int errors = 0;
+  cl_int err;
+
+  CHECK_CL_ERROR (clGetKernelSubGroupInfo (
+      kernel, device, CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE,
+      sizeof (local), local, sizeof (max_size), &max_size, NULL));
+  CHECK_CL_ERROR (clGetKernelSubGroupInfo (
+      kernel, device, CL_KERNEL_SUB_GROUP_COUNT_FOR_NDRANGE, sizeof (local),
+      local, sizeof (count), &count, NULL));
+  if (max_size != sg_size || count != num_sub_groups)
+    {
+      printf ("FAIL: %s %zux%zu: the query gives %zu sub-groups of %zu, "
+              "expected %zu of %zu\n",
+              name, lx, ly, count, max_size, num_sub_groups, sg_size);
+      ++errors;
+    }
+
+  cl_mem buf = clCreateBuffer (context, CL_MEM_WRITE_ONLY,
+                               sizeof (cl_uint) * items * FIELDS, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &buf));
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, kernel, 2, NULL, global,
+                                          local, 0, NULL, NULL));
+  cl_uint *out = (cl_uint *)malloc (sizeof (cl_uint) * items * FIELDS);
+  TEST_ASSERT (out != NULL);
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, buf, CL_TRUE, 0,
+                                       sizeof (cl_uint) * items * FIELDS, out,
+                                       0, NULL, NULL));
+
+  for (size_t y = 0; y < global[1]; ++y)
+    for (size_t x = 0; x < global[0]; ++x)
+      {
+        size_t local_x = x % lx, local_y = y % ly;
+        size_t first_x = local_x / sg_size * sg_size;
+        cl_uint expected[FIELDS];
+        expected[0] = (cl_uint)(lx - first_x < sg_size ? lx - first_x
+                                                       : sg_size);
+        expected[1] = (cl_uint)sg_size;
+        expected[2] = (cl_uint)num_sub_groups;
+        expected[3] = (cl_uint)(local_y * per_row + local_x / sg_size);
+        expected[4] = (cl_uint)(local_x % sg_size);
+        const cl_uint *got = &out[(y * global[0] + x) * FIELDS];
+        if (memcmp (got, expected, sizeof (expected)) != 0 && errors++ < 10)
+          printf ("FAIL: %s %zux%zu, work-item (%zu, %zu): size %u, "
+                  "max size %u, %u sub-groups, id %u, local id %u; "
+                  "expected %u, %u, %u, %u, %u\n",
+                  name, lx, ly, x, y, got[0], got[1], got[2], got[3],
+                  got[4], expected[0], expected[1], expected[2],
+                  expected[3], expected[4]);
+      }
+
+  free (out);
+  CHECK_CL_ERROR (clReleaseMemObject (buf));
+  return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  cl_context context = NULL;
+  cl_device_id device = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel native = NULL, reqd = NULL;
+  int errors = 0;
+  cl_int err;
+
+  setenv ("POCL_CPU_SUB_GROUP_SIZE", "4", 1);
+
+  CHECK_CL_ERROR (poclu_get_any_device (&context, &device, &queue));
+
+  cl_uint max_sub_groups = 0;
+  CHECK_CL_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_NUM_SUB_GROUPS,
+                                   sizeof (max_sub_groups), &max_sub_groups,
+                                   NULL));
+  char extensions[4096];
+  CHECK_CL_ERROR (clGetDeviceInfo (device, CL_DEVICE_EXTENSIONS,
+                                   sizeof (extensions), extensions, NULL));
+  if (max_sub_groups == 0 || strstr (extensions, "cl_khr_subgroups") == NULL
+      || strstr (extensions, "cl_intel_required_subgroup_size") == NULL)
+    {
+      printf ("The device has no sub-groups of a settable size, skipping\n");
+      return 77;
+    }
+
+  const char *src = source;
+  program = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  err = clBuildProgram (program, 0, NULL, NULL, NULL, NULL);
+  if (err == CL_BUILD_PROGRAM_FAILURE)
+    poclu_show_program_build_log (program);
+  CHECK_OPENCL_ERROR_IN ("clBuildProgram");
+  native = clCreateKernel (program, "native_size", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  reqd = clCreateKernel (program, "reqd_size", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  /* the native size where it divides the local x size, else the whole
+     x dimension */
+  errors += check_sub_groups (context, device, queue, native, "native", 16,
+                              1, NATIVE_SIZE);
+  errors += check_sub_groups (context, device, queue, native, "native", 8, 2,
+                              NATIVE_SIZE);
+  errors += check_sub_groups (context, device, queue, native, "native", 6, 2,
+                              6);
+  errors += check_sub_groups (context, device, queue, native, "native", 7, 1,
+                              7);
+
+  /* the required size, with a partial last sub-group in each row where it
+     does not divide the local x size */
+  errors += check_sub_groups (context, device, queue, reqd, "reqd", 6, 2,
+                              REQD_SIZE);
+  errors += check_sub_groups (context, device, queue, reqd, "reqd", 8, 2,
+                              REQD_SIZE);
+  errors += check_sub_groups (context, device, queue, reqd, "reqd", 7, 1,
+                              REQD_SIZE);
+
+  CHECK_CL_ERROR (clReleaseKernel (native));
+  CHECK_CL_ERROR (clReleaseKernel (reqd));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
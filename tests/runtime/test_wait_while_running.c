@@ -0,0 +1,225 @@
+/*
+  Copyright (c) 2023 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+  deal in the Software without restriction, including without limitation the
+  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+  sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+
+/* Waits for a short kernel while a long one runs in the same out-of-order
+   queue. The long kernel is not a dependency of the short one, so a host
+   thread waiting for the short kernel must not help with the long one
+   (POCL_HOST_THREADS_HELP), and must return before the long kernel has
+   finished. Also checks the results of both kernels. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "poclu.h"
+
+#define LONG_ITEMS (1 << 16)
+/* several work-groups, so it is not run inline at enqueue */
+#define SHORT_ITEMS 4096
+#define SHORT_LOCAL_SIZE 16
+
+static const char source[]
+    = "kernel void lcg (global uint *buf, uint iterations)\n"
+      "{\n"
+      "  size_t i = get_global_id (0);\n"
+      "  uint x = (uint)i;\n"
+      "  for (uint j = 0; j < iterations; ++j)\n"
+      "    x = x * 1664525u + 1013904223u;\n"
+      "  buf[i] = x;\n"
+      "}\n";
+
+static double
+now_s ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static cl_uint
+lcg (cl_uint x, cl_uint iterations)
+{
+  cl_uint j;
+  for (j = 0; j < iterations; ++j)
+    x = x * 1664525u + 1013904223u;
+  return x;
+}
+
+static int
+check (const char *name, const cl_uint *result, size_t items,
+       cl_uint iterations)
+{
+  size_t i;
+  int errors = 0;
+  /* the long kernel is checked on a sample of the items */
+  size_t step = items > 4096 ? items / 4096 : 1;
+  for (i = 0; i < items; i += step)
+    {
+      cl_uint expected = lcg ((cl_uint)i, iterations);
+      if (result[i] != expected)
+        {
+          if (errors < 10)
+            printf ("%s: item %zu is %u, expected %u\n", name, i, result[i],
+                    expected);
+          ++errors;
+        }
+    }
+  return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  cl_context context = NULL;
+  cl_device_id device = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel long_kernel = NULL, short_kernel = NULL;
+  cl_mem long_buf = NULL, short_buf = NULL;
+  cl_event long_event = NULL, short_event = NULL;
+  cl_command_queue_properties props;
+  size_t long_items = LONG_ITEMS, short_items = SHORT_ITEMS;
+  size_t short_local_size = SHORT_LOCAL_SIZE;
+  cl_uint long_iterations = 256, short_iterations = 16;
+  cl_uint *result = NULL;
+  cl_int status;
+  int err, errors = 0;
+
+  err = poclu_get_any_device (&context, &device, &queue);
+  CHECK_OPENCL_ERROR_IN ("poclu_get_any_device");
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+
+  CHECK_CL_ERROR (clGetDeviceInfo (device, CL_DEVICE_QUEUE_PROPERTIES,
+                                   sizeof (props), &props, NULL));
+  if (!(props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+    {
+      printf ("SKIP: no out-of-order queues\n");
+      CHECK_CL_ERROR (clReleaseContext (context));
+      return 77;
+    }
+  queue = clCreateCommandQueue (context, device,
+                                CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateCommandQueue");
+
+  const char *src = source;
+  program = clCreateProgramWithSource (context, 1, &src, NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateProgramWithSource");
+  CHECK_CL_ERROR (clBuildProgram (program, 1, &device, NULL, NULL, NULL));
+  long_kernel = clCreateKernel (program, "lcg", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+  short_kernel = clCreateKernel (program, "lcg", &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateKernel");
+
+  long_buf = clCreateBuffer (context, CL_MEM_READ_WRITE,
+                             LONG_ITEMS * sizeof (cl_uint), NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  short_buf = clCreateBuffer (context, CL_MEM_READ_WRITE,
+                              SHORT_ITEMS * sizeof (cl_uint), NULL, &err);
+  CHECK_OPENCL_ERROR_IN ("clCreateBuffer");
+  CHECK_CL_ERROR (clSetKernelArg (long_kernel, 0, sizeof (cl_mem), &long_buf));
+  CHECK_CL_ERROR (
+      clSetKernelArg (short_kernel, 0, sizeof (cl_mem), &short_buf));
+  CHECK_CL_ERROR (clSetKernelArg (short_kernel, 1, sizeof (cl_uint),
+                                  &short_iterations));
+
+  /* Build the WG functions, and scale the long kernel up until it takes
+     at least half a second. */
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, short_kernel, 1, NULL,
+                                          &short_items, &short_local_size, 0,
+                                          NULL, NULL));
+  while (1)
+    {
+      CHECK_CL_ERROR (clSetKernelArg (long_kernel, 1, sizeof (cl_uint),
+                                      &long_iterations));
+      double start = now_s ();
+      CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, long_kernel, 1, NULL,
+                                              &long_items, NULL, 0, NULL,
+                                              NULL));
+      CHECK_CL_ERROR (clFinish (queue));
+      if (now_s () - start >= 0.5 || long_iterations >= (1u << 28))
+        break;
+      long_iterations *= 4;
+    }
+
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, long_kernel, 1, NULL,
+                                          &long_items, NULL, 0, NULL,
+                                          &long_event));
+  CHECK_CL_ERROR (clGetEventInfo (long_event,
+                                  CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                  sizeof (status), &status, NULL));
+  if (status == CL_COMPLETE)
+    {
+      /* the driver runs the commands at enqueue time */
+      printf ("SKIP: the kernel finished at enqueue\n");
+      CHECK_CL_ERROR (clFinish (queue));
+      return 77;
+    }
+  CHECK_CL_ERROR (clEnqueueNDRangeKernel (queue, short_kernel, 1, NULL,
+                                          &short_items, &short_local_size, 0,
+                                          NULL, &short_event));
+  CHECK_CL_ERROR (clFlush (queue));
+  CHECK_CL_ERROR (clWaitForEvents (1, &short_event));
+
+  CHECK_CL_ERROR (clGetEventInfo (long_event,
+                                  CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                  sizeof (status), &status, NULL));
+  if (status == CL_COMPLETE)
+    {
+      printf ("the wait for the short kernel returned only after the long "
+              "kernel had finished\n");
+      ++errors;
+    }
+
+  CHECK_CL_ERROR (clWaitForEvents (1, &long_event));
+
+  result = (cl_uint *)malloc (LONG_ITEMS * sizeof (cl_uint));
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, short_buf, CL_TRUE, 0,
+                                       SHORT_ITEMS * sizeof (cl_uint), result,
+                                       0, NULL, NULL));
+  errors += check ("short kernel", result, SHORT_ITEMS, short_iterations);
+  CHECK_CL_ERROR (clEnqueueReadBuffer (queue, long_buf, CL_TRUE, 0,
+                                       LONG_ITEMS * sizeof (cl_uint), result,
+                                       0, NULL, NULL));
+  errors += check ("long kernel", result, LONG_ITEMS, long_iterations);
+  free (result);
+
+  CHECK_CL_ERROR (clReleaseEvent (long_event));
+  CHECK_CL_ERROR (clReleaseEvent (short_event));
+  CHECK_CL_ERROR (clReleaseMemObject (long_buf));
+  CHECK_CL_ERROR (clReleaseMemObject (short_buf));
+  CHECK_CL_ERROR (clReleaseKernel (long_kernel));
+  CHECK_CL_ERROR (clReleaseKernel (short_kernel));
+  CHECK_CL_ERROR (clReleaseProgram (program));
+  CHECK_CL_ERROR (clReleaseCommandQueue (queue));
+  CHECK_CL_ERROR (clReleaseContext (context));
+  CHECK_CL_ERROR (clUnloadCompiler ());
+
+  if (errors)
+    {
+      printf ("FAIL: %d errors\n", errors);
+      return EXIT_FAILURE;
+    }
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}